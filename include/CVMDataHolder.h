@@ -4,6 +4,7 @@
 #include <Eigen/Dense>
 #include <list>
 #include <memory>
+#include <random>
 #include <vector>
 
 #include "clus_str.h"
@@ -86,7 +87,11 @@ class CVMOptimizerDataHolder {
 				      const Array<Arrayint> &labellookup);
 
   VectorXd GetDisorderedCorrelation() const;
+  // correlations of a random configuration (a fresh, nondeterministic draw at
+  // each call);
   VectorXd GetSampleCorrelation() const;
+  // same, drawing the random configuration from rng (reproducible);
+  VectorXd GetSampleCorrelation(std::mt19937 &rng) const;
   double GetConvFactor(const UnitType type) const;
 
   void saveClusterInformation(const string &clusterfname = "clusters.out",
@@ -0,0 +1,90 @@
+#ifndef __CVM_IPOPT_HPP__
+#define __CVM_IPOPT_HPP__
+
+#include <IpIpoptApplication.hpp>
+#include <IpTNLP.hpp>
+#include <ifopt/problem.h>
+
+#include <string>
+#include <vector>
+
+#include "CVMModel.h"
+
+namespace ifopt {
+
+// Ipopt::TNLP over a CVM problem (correlations, rho constraints, norm
+// constraint and free energy). It does what ifopt's IpoptAdapter does, but
+// also gives IPOPT the Hessian of the Lagrangian, obj_factor times the free
+// energy Hessian plus the multiplier of the norm constraint times its
+// Hessian, on the lower triangle of the sparsity pattern of V^T V (plus its
+// diagonal). norm_row is the row of the norm constraint among all
+// constraints, or -1 if there is none;
+class CVMIpoptAdapter : public Ipopt::TNLP {
+ public:
+  typedef Ipopt::Index Index;
+  typedef Ipopt::Number Number;
+
+  CVMIpoptAdapter(Problem &nlp, const CVMFreeEnergy &cost,
+		  const CVMNormConstraints *norm, int norm_row);
+
+  bool get_nlp_info(Index &n, Index &m, Index &nnz_jac_g, Index &nnz_h_lag,
+		    IndexStyleEnum &index_style) override;
+  bool get_bounds_info(Index n, Number *x_l, Number *x_u, Index m,
+		       Number *g_l, Number *g_u) override;
+  bool get_starting_point(Index n, bool init_x, Number *x, bool init_z,
+			  Number *z_L, Number *z_U, Index m, bool init_lambda,
+			  Number *lambda) override;
+  bool eval_f(Index n, const Number *x, bool new_x,
+	      Number &obj_value) override;
+  bool eval_grad_f(Index n, const Number *x, bool new_x,
+		   Number *grad_f) override;
+  bool eval_g(Index n, const Number *x, bool new_x, Index m,
+	      Number *g) override;
+  bool eval_jac_g(Index n, const Number *x, bool new_x, Index m,
+		  Index nele_jac, Index *iRow, Index *jCol,
+		  Number *values) override;
+  bool eval_h(Index n, const Number *x, bool new_x, Number obj_factor,
+	      Index m, const Number *lambda, bool new_lambda, Index nele_hess,
+	      Index *iRow, Index *jCol, Number *values) override;
+  bool intermediate_callback(Ipopt::AlgorithmMode mode, Index iter,
+			     Number obj_value, Number inf_pr, Number inf_du,
+			     Number mu, Number d_norm,
+			     Number regularization_size, Number alpha_du,
+			     Number alpha_pr, Index ls_trials,
+			     const Ipopt::IpoptData *ip_data,
+			     Ipopt::IpoptCalculatedQuantities *ip_cq) override;
+  void finalize_solution(Ipopt::SolverReturn status, Index n,
+			 const Number *x, const Number *z_L,
+			 const Number *z_U, Index m, const Number *g,
+			 const Number *lambda, Number obj_value,
+			 const Ipopt::IpoptData *ip_data,
+			 Ipopt::IpoptCalculatedQuantities *ip_cq) override;
+
+ private:
+  Problem *nlp_;
+  const CVMFreeEnergy *cost_;
+  const CVMNormConstraints *norm_;
+  int norm_row_;
+  // (row, column) of the lower triangle entries of the Hessian;
+  std::vector<int> hess_row_;
+  std::vector<int> hess_col_;
+};
+
+// Same interface as ifopt's IpoptSolver, for problems solved through a
+// CVMIpoptAdapter; hessian_approximation defaults to exact;
+class CVMIpoptSolver {
+ public:
+  CVMIpoptSolver();
+  void SetOption(const std::string &name, const std::string &value);
+  void SetOption(const std::string &name, int value);
+  void SetOption(const std::string &name, double value);
+  void Solve(Problem &nlp, const CVMFreeEnergy &cost,
+	     const CVMNormConstraints *norm, int norm_row);
+
+ private:
+  Ipopt::SmartPtr<Ipopt::IpoptApplication> ipopt_app_;
+};
+
+}  // namespace ifopt
+
+#endif	// __CVM_IPOPT_HPP__
@@ -5,6 +5,7 @@
 #include <ifopt/cost_term.h>
 #include <ifopt/variable_set.h>
 
+#include <Eigen/Sparse>
 #include <vector>
 
 #include "CVMDataHolder.h"
@@ -37,6 +38,10 @@ class CVMCorrelations : public VariableSet {
   int num_point_clusters_;
 };
 
+// Keeps the correlations within half the distance between the ordered and
+// disordered states of the disordered state, written as
+// (|ordered-disordered|/2)^2 - |corrs-disordered|^2 >= 0 so that it is smooth
+// at the disordered state and its Hessian is simply -2 I;
 class CVMNormConstraints : public ConstraintSet {
  public:
   CVMNormConstraints(const std::string &name, const VectorXd &disordered_corr,
@@ -45,6 +50,8 @@ class CVMNormConstraints : public ConstraintSet {
   VecBound GetBounds() const override;
   void FillJacobianBlock(std::string var_set,
 			 Jacobian &jac_block) const override;
+  typedef Jacobian Hessian;
+  void FillHessian(const VectorXd &corrs, Hessian &hess) const;
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
  private:
@@ -65,6 +72,7 @@ class CVMRhoConstraints : public ConstraintSet {
 
  private:
   MatrixXd vmatrix_;
+  Jacobian sparse_vmatrix_;
   int num_point_configs_;
 };
 
@@ -94,7 +102,8 @@ class CVMFreeEnergy : public CostTerm {
       : CostTerm(name),
 	mult_eci_(mult_eci),
 	multconfig_kb_(multconfig_kb),
-	vmatrix_(vmatrix) {
+	vmatrix_(vmatrix),
+	sparse_vmatrix_(vmatrix.sparseView()) {
     T = 0;
   }
 
@@ -102,6 +111,12 @@ class CVMFreeEnergy : public CostTerm {
   double GetCost(const VectorXd &corrs) const;
   void FillJacobianBlock(std::string var_set,
 			 Jacobian &jac_block) const override;
+  // Hessian of the free energy with respect to the correlations,
+  // T kB V^T diag(multconfig_kb/rho) V (same sparsity as V^T V), given to
+  // IPOPT by CVMIpoptAdapter (see CVMIpopt.h);
+  typedef Jacobian Hessian;
+  void FillHessian(Hessian &hess) const;
+  void FillHessian(const VectorXd &corrs, Hessian &hess) const;
 
   double getT() const { return T; }
   void setT(const double T_) { T = T_; }
@@ -111,8 +126,15 @@ class CVMFreeEnergy : public CostTerm {
   VectorXd mult_eci_;
   VectorXd multconfig_kb_;
   MatrixXd vmatrix_;
+  Eigen::SparseMatrix<double> sparse_vmatrix_;
   static constexpr double kB = 8.61733326e-05;
   double T;
+
+  // cluster probabilities rho=V*corrs, kept from the last call since IPOPT
+  // evaluates the cost and its gradient at the same point;
+  const VectorXd &GetRho(const VectorXd &corrs) const;
+  mutable VectorXd cached_corrs_;
+  mutable VectorXd cached_rho_;
 };
 
 }  // namespace ifopt
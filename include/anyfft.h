@@ -1,4 +1,44 @@
+#ifndef __ANYFFT_H__
+#define __ANYFFT_H__
+
 #include "misc.h"
 #include <complex>
 
+// In-place transform of an ndim-dimensional array whose first index varies
+// fastest (dims[0]): isign=1 gives sum_j data(j) exp(2 pi i j.k/dims), isign=-1
+// the inverse transform (with the opposite sign and divided by the number of
+// points).
 void fftnd(Complex *data, int ndim, int *dims, int isign);
+// Same as fftnd, for data whose imaginary parts are zero (they are ignored);
+// about twice as fast when dims[0] is even;
+void fftnd_real(Complex *data, int ndim, int *dims, int isign);
+// Replaces data by the real part of fftnd(data) (imaginary parts are set to
+// 0); about twice as fast when dims[0] is even;
+void fftnd_real_part(Complex *data, int ndim, int *dims, int isign);
+// Number of threads used by the built-in backend on large arrays (default 1);
+void set_fft_nb_threads(int nb_threads);
+
+// Unnormalized in-place transform for one array shape (see fftnd). Plans are
+// created once per shape and cached; transform() may be called from several
+// threads at once.
+class FFTPlan {
+public:
+  virtual ~FFTPlan(void) {}
+  virtual void transform(Complex *data, int isign) = 0;
+};
+
+// A source of FFT plans. The built-in backend handles lengths whose prime
+// factors are 2, 3 and 5 (others go through the original fftn code); an FFTW
+// backend is used instead when ATAT is built with USE_FFTW.
+class FFTBackend {
+public:
+  virtual ~FFTBackend(void) {}
+  // returns NULL if the backend cannot handle that shape;
+  virtual FFTPlan *make_plan(int ndim, const int *dims) = 0;
+};
+
+// Selects the backend used by all later calls (which then owns the plans it
+// makes); pass NULL to restore the default one;
+void set_fft_backend(FFTBackend *backend);
+
+#endif
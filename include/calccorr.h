@@ -3,6 +3,7 @@
 
 #include "findsym.h"
 #include "gceutil.h"
+#include <vector>
 
 void find_equivalent_clusters(Array<ArrayrVector3d> *pclusters,
                               const Array<rVector3d> &cluster,
@@ -61,10 +62,97 @@ Real calc_correlation(const Structure &str, const MultiCluster &cluster,
                       const rMatrix3d &cell, const Array<rMatrix3d> &point_op,
                       const Array<rVector3d> &trans,
                       const Array<Array<Array<Real>>> &corrfunc);
-Real calc_correlation_fast(Tensor<int> *ptab_str, const Structure &str,
-                           const Array<MultiCluster> &clusters,
-                           const Structure &lat,
-                           const Array<Array<Array<Real>>> &corrfunc);
+
+// Locates the atoms of a structure by lattice site, for any supercell of a
+// lattice. The supercell matrix m (in lattice coordinates) is brought to Smith
+// normal form u*m*v=d, so that lattice translation t maps to the cell
+// (u*t) mod d, stored in row-major order with the last index fastest. Site
+// (basis atom b, cell g) is atom get_atom(b, g) of the structure.
+class SupercellSiteTable {
+  rMatrix3d cell;
+  rMatrix3d inv_cell;
+  iMatrix3d u;
+  iVector3d d;
+  int nb_cell;
+  Array<rVector3d> basis;
+  Array<int> site_atom;
+
+public:
+  SupercellSiteTable(void) : basis(), site_atom() { nb_cell = 0; }
+  // returns 0 if str is not a supercell of lattice cell (e.g. missing atoms);
+  int init(const Structure &str, const rMatrix3d &_cell);
+  int get_nb_cell(void) const { return nb_cell; }
+  int get_nb_basis(void) const { return basis.get_size(); }
+  const iVector3d &get_cell_grid(void) const { return d; }
+  int get_atom(int b, int g) const { return site_atom(b * nb_cell + g); }
+  // finds the basis atom b and the shift w (in cell grid coordinates) such
+  // that site pos+t is site b in cell (u*t+w) mod d; returns 0 if pos is not
+  // a lattice site;
+  int find_site(int *pb, iVector3d *pw, const rVector3d &pos) const;
+};
+
+// Species on each site of str, in the order of the table (site (b, g) is
+// element b*nb_cell+g);
+void get_site_types(Array<int> *psite_type, const Structure &str,
+                    const SupercellSiteTable &tab);
+Real calc_correlation(const Array<int> &site_type,
+                      const Array<MultiCluster> &clusters,
+                      const SupercellSiteTable &tab,
+                      const Array<Array<Array<Real>>> &corrfunc);
+Real calc_correlation(const Structure &str, const Array<MultiCluster> &clusters,
+                      const SupercellSiteTable &tab,
+                      const Array<Array<Array<Real>>> &corrfunc);
+// Binary (spin 2*type-1) version; same as calc_correlation(str, clusters, cell)
+// when tab was initialized from str and cell;
+Real calc_correlation(const Array<int> &site_type,
+                      const Array<ArrayrVector3d> &clusters,
+                      const SupercellSiteTable &tab);
+
+// Evaluates the correlations of a fixed list of orbits (each an array of
+// equivalent clusters) for structures sharing one SupercellSiteTable. init()
+// locates every cluster point once; set_structure() stores, for each
+// (site type, function) pair in use, the function value on every site
+// contiguously, so that each cluster point then costs one shifted elementwise
+// product over all cells. Results are bitwise identical to
+// calc_correlation(site_type, orbit, tab, corrfunc).
+class CorrelationKernel {
+  const SupercellSiteTable *ptab;
+  std::vector<int> orbit_begin;   // first cluster of each orbit (plus end);
+  std::vector<int> cluster_begin; // first point of each cluster (plus end);
+  std::vector<int> point_func;    // (site type, function) pair of each point;
+  std::vector<int> point_site;    // first site of the point's basis atom;
+  std::vector<iVector3d> point_shift;
+  std::vector<int> func_site_type;
+  std::vector<int> func_func;
+  Array<Real> value;        // value(f*nb_site+site);
+  Array<Real> sigma;
+
+public:
+  CorrelationKernel(void);
+  // starts an empty list of orbits, to be located in tab;
+  void init(const SupercellSiteTable &tab);
+  // appends an orbit (the next index); returns 0 if one of its points is not
+  // a site of tab;
+  int add_orbit(const Array<MultiCluster> &orbit);
+  // init() and add_orbit() for each orbit; returns 0 if one fails;
+  int init(const SupercellSiteTable &tab,
+           const LinkedList<Array<MultiCluster>> &orbits);
+  int init(const SupercellSiteTable &tab,
+           const Array<Array<MultiCluster>> &orbits);
+  int get_nb_orbits(void) const { return (int)orbit_begin.size() - 1; }
+  // site_type as returned by get_site_types();
+  void set_structure(const Array<int> &site_type,
+                     const Array<Array<Array<Real>>> &corrfunc);
+  Real get_correlation(int orbit);
+  void get_correlations(Array<Real> *pcorr);
+};
+
+// Correlations of all orbits of str (using a CorrelationKernel when str is a
+// supercell of cell);
+void calc_correlations(Array<Real> *pcorr, const Structure &str,
+                       const Array<Array<MultiCluster>> &orbits,
+                       const rMatrix3d &cell,
+                       const Array<Array<Array<Real>>> &corrfunc);
 
 void find_clusters_overlapping_site(
     Array<MultiCluster> *o_cluster, Array<int> *o_which, const rVector3d &site,
@@ -6,6 +6,9 @@
 #include "stringo.h"
 //#include <fstream>
 #include "mpiinterf.h"
+#include <numeric>
+#include <unordered_map>
+#include <unordered_set>
 
 extern Real complexity_exp;
 
@@ -69,6 +72,28 @@ public:
   LinkedList<MultiCluster> &get_cluster_list(void) { return cluster_list; }
 };
 
+// A decoration of the sites of a supercell as a hashable key;
+inline std::string decoration_key(const Array<int> &deco) {
+  std::string key(deco.get_size(), 0);
+  for (int i = 0; i < deco.get_size(); i++) {
+    key[i] = (char)deco(i);
+  }
+  return key;
+}
+
+// Lists, in enumeration order, the configurations of the sites of supercell
+// that contain no pure translation and are not equivalent to a lexicographic
+// successor, i.e. the candidates examined by StructureBank::find_new_structure;
+void list_candidate_configs(Array<Arrayint> *pconfig, const rMatrix3d &supercell,
+                            const Structure &lattice,
+                            const SpaceGroup &spacegroup);
+// Same for supercells(begin..end-1), stored in (*pconfig)(begin..end-1), using
+// nb_threads threads;
+void list_candidate_configs(Array<Array<Arrayint>> *pconfig,
+                            const Array<rMatrix3d> &supercells, int begin,
+                            int end, const Structure &lattice,
+                            const SpaceGroup &spacegroup, int nb_threads);
+
 // The best algorithm is invoked by not specifying any -D... in the makefile;
 // If you want to use MPI, use -DSLOWENUMALGO ;
 // For debugging, you can use the slowest algorithm with -DSLOWENUMALGO
@@ -92,12 +117,122 @@ template <class T> class StructureBank {
   Structure blank_superstructure;
   SpaceGroup subgroup;
   int useradded;
+  // canonical decorations (see min_equivalent_decoration) of the structures of
+  // the bank that fit in the current supercell;
+  std::unordered_set<std::string> known_config;
+  // structures of the bank, by fingerprint (only structures with the same
+  // fingerprint need to be compared in add_structure); only built once
+  // add_structure is first called;
+  std::unordered_multimap<std::string, T *> by_fingerprint;
+  int fingerprinted;
+  // with nb_threads>1, the candidates of the supercells of the current volume
+  // are listed in parallel, nb_threads supercells at a time (volume_listed),
+  // and are then examined in the same order as in the serial enumeration;
+  int nb_threads;
+  int volume_listed;
+  int listed_upto;
+  Array<Array<Arrayint>> volume_config;
+  int curnew_index;
+  int config_left(void) {
+    if (volume_listed) {
+      return (curnew_supercell < volume_config.get_size() &&
+              curnew_index < volume_config(curnew_supercell).get_size());
+    }
+    return (curnew_config ? 1 : 0);
+  }
+  // vectors from each site of the lattice to its first and second neighbors;
+  Array<Array<rVector3d>> nbr_vec;
+  Array<Array<int>> nbr_shell;
+
+  // Number of atoms of each type and of pairs of each type in each neighbor
+  // shell, divided by their greatest common divisor: the same for any two
+  // structures that are equivalent by symmetry (even if one is a repetition
+  // of the other);
+  std::string fingerprint(const Structure &str) const {
+    int nb_type = max(basic_structure.atom_type);
+    Array<int> cnt(nb_type * (1 + 2 * nb_type));
+    zero_array(&cnt);
+    rMatrix3d inv_cell = !str.cell;
+    rMatrix3d inv_lat = !basic_structure.cell;
+    for (int i = 0; i < str.atom_pos.get_size(); i++) {
+      int ti = str.atom_type(i);
+      cnt(ti)++;
+      int b = which_atom(basic_structure.atom_pos, str.atom_pos(i), inv_lat);
+      if (b == -1)
+        continue;
+      for (int n = 0; n < nbr_vec(b).get_size(); n++) {
+        int j = which_atom(str.atom_pos, str.atom_pos(i) + nbr_vec(b)(n),
+                           inv_cell);
+        if (j == -1)
+          continue;
+        cnt(nb_type * (1 + nb_type * nbr_shell(b)(n) + ti) + str.atom_type(j))++;
+      }
+    }
+    int g = 0;
+    for (int k = 0; k < cnt.get_size(); k++) {
+      g = std::gcd(g, cnt(k));
+    }
+    std::ostringstream key;
+    for (int k = 0; k < cnt.get_size(); k++) {
+      key << cnt(k) / MAX(g, 1) << ",";
+    }
+    return key.str();
+  }
+  void add_to_list(T *p_str, LinkedListIterator<T> &insert_at) {
+    structure_list.add(p_str, insert_at);
+    if (fingerprinted) {
+      by_fingerprint.insert(std::make_pair(fingerprint(*p_str), p_str));
+    }
+  }
+  void add_known_config(const Structure &str) {
+    Structure mapped;
+    if (map_onto_supercell(&mapped.atom_type, str, blank_superstructure,
+                           equivalent_by_symmetry)) {
+      mapped.cell = blank_superstructure.cell;
+      mapped.atom_pos = blank_superstructure.atom_pos;
+      Array<int> deco;
+      min_equivalent_decoration(&deco, mapped, basic_structure.cell,
+                                subgroup.point_op, subgroup.trans);
+      known_config.insert(decoration_key(deco));
+    }
+  }
 
   void init(void) {
     current_volume = 0;
     current_index = 0;
     curnew_supercell = 0;
     useradded = 0;
+    fingerprinted = 0;
+    volume_listed = 0;
+    listed_upto = 0;
+    curnew_index = 0;
+
+    nbr_vec.resize(basic_structure.atom_pos.get_size());
+    nbr_shell.resize(basic_structure.atom_pos.get_size());
+    for (int b = 0; b < basic_structure.atom_pos.get_size(); b++) {
+      LinkedList<rVector3d> vec;
+      LinkedList<int> shell;
+      AtomPairIterator pair(basic_structure.cell, basic_structure.atom_pos(b),
+                            basic_structure.atom_pos);
+      int s = -1;
+      Real dist = 0.;
+      while (1) {
+        rVector3d v = pair(1) - pair(0);
+        if (norm(v) > zero_tolerance) {
+          if (norm(v) > dist + zero_tolerance) {
+            s++;
+            dist = norm(v);
+          }
+          if (s >= 2)
+            break;
+          vec << new rVector3d(v);
+          shell << new int(s);
+        }
+        pair++;
+      }
+      LinkedList_to_Array(&nbr_vec(b), vec);
+      LinkedList_to_Array(&nbr_shell(b), shell);
+    }
 
     // special case to put pure structures first;
     LinkedListIterator<T> insert_at(structure_list);
@@ -117,7 +252,7 @@ template <class T> class StructureBank {
           break;
       }
       if (!i) {
-        structure_list.add(new T(blank_superstructure), insert_at);
+        add_to_list(new T(blank_superstructure), insert_at);
         insert_at++;
       }
     }
@@ -128,19 +263,23 @@ template <class T> class StructureBank {
 public:
   StructureBank(const Structure &_basic_structure,
                 const SpaceGroup &_equivalent_by_symmetry, int _do2D = 0)
-      : structure_list(), current_structure(),
-        equivalent_by_symmetry(_equivalent_by_symmetry),
-        basic_structure(_basic_structure), do2D(_do2D), supercells(),
-        curnew_config(), beginning_of_cell(), subgroup() {
+      : equivalent_by_symmetry(_equivalent_by_symmetry),
+        basic_structure(_basic_structure), structure_list(),
+        current_structure(), do2D(_do2D), curnew_config(), supercells(),
+        beginning_of_cell(), subgroup(), known_config(), by_fingerprint(),
+        volume_config(), nbr_vec(), nbr_shell() {
+    nb_threads = 1;
     init();
   }
   StructureBank(const Structure &_basic_structure,
                 const Array<Arrayint> &site_type_list,
                 const SpaceGroup &_equivalent_by_symmetry, int _do2D = 0)
-      : structure_list(), current_structure(),
-        equivalent_by_symmetry(_equivalent_by_symmetry),
-        basic_structure(_basic_structure), do2D(_do2D), supercells(),
-        curnew_config(), beginning_of_cell(), subgroup() {
+      : equivalent_by_symmetry(_equivalent_by_symmetry),
+        basic_structure(_basic_structure), structure_list(),
+        current_structure(), do2D(_do2D), curnew_config(), supercells(),
+        beginning_of_cell(), subgroup(), known_config(), by_fingerprint(),
+        volume_config(), nbr_vec(), nbr_shell() {
+    nb_threads = 1;
     for (int i = 0; i < basic_structure.atom_type.get_size(); i++) {
       basic_structure.atom_type(i) =
           site_type_list(basic_structure.atom_type(i)).get_size();
@@ -148,6 +287,8 @@ public:
     init();
   }
   void set_2D_mode(int _do2D) { do2D = _do2D; }
+  // takes effect when the next volume is started;
+  void set_nb_threads(int _nb_threads) { nb_threads = _nb_threads; }
   void reset(void) {
     current_index = 0;
     current_structure.init(structure_list);
@@ -184,27 +325,33 @@ public:
     return 0;
   }
   int add_structure(const Structure &str, T **pp_str = NULL) {
-    LinkedListIterator<T> i(structure_list);
-    for (; i; i++) {
-      if (equivalent_by_symmetry(*i, str))
-        break;
+    if (!fingerprinted) {
+      for (LinkedListIterator<T> i(structure_list); i; i++) {
+        by_fingerprint.insert(std::make_pair(fingerprint(*i), (T *)i));
+      }
+      fingerprinted = 1;
     }
-    if (!i) {
-      LinkedListIterator<T> insert_at(structure_list);
-      while (insert_at &&
-             insert_at->atom_pos.get_size() < str.atom_pos.get_size() + 1)
-        insert_at++;
-      T *p_str = new T(str);
-      structure_list.add(p_str, insert_at);
-      useradded = 1;
-      if (pp_str)
-        *pp_str = p_str;
-      return 1;
-    } else {
-      if (pp_str)
-        *pp_str = i;
-      return 0;
+    auto range = by_fingerprint.equal_range(fingerprint(str));
+    for (auto i = range.first; i != range.second; i++) {
+      if (equivalent_by_symmetry(*(i->second), str)) {
+        if (pp_str)
+          *pp_str = i->second;
+        return 0;
+      }
+    }
+    LinkedListIterator<T> insert_at(structure_list);
+    while (insert_at &&
+           insert_at->atom_pos.get_size() < str.atom_pos.get_size() + 1)
+      insert_at++;
+    T *p_str = new T(str);
+    add_to_list(p_str, insert_at);
+    useradded = 1;
+    if (supercells.get_size() > 0) {
+      add_known_config(str);
     }
+    if (pp_str)
+      *pp_str = p_str;
+    return 1;
   }
 };
 
@@ -212,7 +359,7 @@ public:
 
 template <class T> int StructureBank<T>::find_new_structure(void) {
   while (1) {
-    if (!curnew_config) {
+    if (!config_left()) {
       curnew_supercell++;
       if (curnew_supercell >= supercells.get_size()) {
         current_volume = current_volume + 1;
@@ -240,10 +387,24 @@ template <class T> int StructureBank<T>::find_new_structure(void) {
           beginning_of_cell++;
         }
         // cerr << "begincell ]\n";
+#ifdef ENUMFLIPTRICK
+        volume_listed = (nb_threads > 1);
+        volume_config.resize(volume_listed ? supercells.get_size() : 0);
+        listed_upto = 0;
+#endif
       }
       if (!useradded && current_volume > 1) {
         beginning_of_cell = current_structure;
       }
+#ifdef ENUMFLIPTRICK
+      if (volume_listed && curnew_supercell >= listed_upto) {
+        int end = MIN(curnew_supercell + nb_threads, supercells.get_size());
+        list_candidate_configs(&volume_config, supercells, curnew_supercell,
+                               end, basic_structure, equivalent_by_symmetry,
+                               nb_threads);
+        listed_upto = end;
+      }
+#endif
       // cerr << "findsymcell [\n";
       supercells(curnew_supercell) =
           find_symmetric_cell(supercells(curnew_supercell));
@@ -259,6 +420,11 @@ template <class T> int StructureBank<T>::find_new_structure(void) {
           equivalent_by_symmetry.point_op, equivalent_by_symmetry.trans);
       //      cerr << "point = " << subgroup.point_op << endl;
       //      cerr << "trans = " << subgroup.trans << endl;
+      known_config.clear();
+      for (LinkedListIterator<T> i = beginning_of_cell; i; i++) {
+        add_known_config(*i);
+      }
+      curnew_index = 0;
     }
 
     int need_to_gen = 0;
@@ -272,6 +438,19 @@ template <class T> int StructureBank<T>::find_new_structure(void) {
     if (!need_to_gen)
       return 0;
 
+#ifdef ENUMFLIPTRICK
+    if (volume_listed) {
+      blank_superstructure.atom_type =
+          volume_config(curnew_supercell)(curnew_index++);
+      if ((!useradded && current_volume > 1) ||
+          known_config.find(decoration_key(blank_superstructure.atom_type)) ==
+              known_config.end()) {
+        add_to_list(new T(blank_superstructure), current_structure);
+        break; // exit routine;
+      }
+      continue;
+    }
+#endif
     for (int s = 0; s < ((Arrayint)curnew_config).get_size(); s++) {
       blank_superstructure.atom_type(s) = ((Arrayint)curnew_config)(s);
     }
@@ -281,32 +460,25 @@ template <class T> int StructureBank<T>::find_new_structure(void) {
                                     basic_structure.cell)) {
       if (!equiv_to_lexico_successor(blank_superstructure, basic_structure.cell,
                                      subgroup.point_op, subgroup.trans)) {
-        if (!useradded && current_volume > 1) {
-          structure_list.add(new T(blank_superstructure), current_structure);
+        // the configuration is its own canonical decoration: it is new unless
+        // a structure of the bank maps onto it;
+        if ((!useradded && current_volume > 1) ||
+            known_config.find(decoration_key(blank_superstructure.atom_type)) ==
+                known_config.end()) {
+          add_to_list(new T(blank_superstructure), current_structure);
           break; // exit routine;
-        } else {
-          LinkedListIterator<T> i = beginning_of_cell;
-          for (; i; i++) {
-            if (equivalent_by_symmetry(*i, blank_superstructure))
-              break;
-          }
-          if (!i) {
-            structure_list.add(new T(blank_superstructure), current_structure);
-            break; // exit routine;
-          }
         }
       }
     }
 #else
     if (!contains_pure_translations_or_lexico_successor(blank_superstructure,
                                                         basic_structure.cell)) {
-      LinkedListIterator<T> i = beginning_of_cell;
-      for (; i; i++) {
-        if (equivalent_by_symmetry(*i, blank_superstructure))
-          break;
-      }
-      if (!i) {
-        structure_list.add(new T(blank_superstructure), current_structure);
+      Array<int> deco;
+      min_equivalent_decoration(&deco, blank_superstructure,
+                                basic_structure.cell, subgroup.point_op,
+                                subgroup.trans);
+      if (known_config.insert(decoration_key(deco)).second) {
+        add_to_list(new T(blank_superstructure), current_structure);
         break; // exit routine;
       }
     }
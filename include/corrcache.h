@@ -0,0 +1,90 @@
+#ifndef __CORRCACHE_H__
+#define __CORRCACHE_H__
+
+#include "xtalutil.h"
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Content hashes used as keys of the correlation cache. Coordinates are
+// rounded to zero_tolerance, so that a structure or cluster read back from a
+// file maps to the same key. hash_structure ignores the order of the atoms and
+// lattice translations of their positions; the key of a cluster should include
+// (through context) everything else the correlation depends on: lattice,
+// correlation functions, etc.
+uint64_t hash_combine(uint64_t h, uint64_t v);
+uint64_t hash_structure(const Structure &str);
+uint64_t hash_cluster(const Array<rVector3d> &clus, uint64_t context);
+uint64_t hash_cluster(const MultiCluster &clus, uint64_t context);
+uint64_t hash_corrfunc(const Array<Array<Array<Real>>> &corrfunc);
+
+// The keys shared by all codes using the cache (maps, mmaps, corrdump,
+// mcsqs). Clusters are keyed as MultiClusters (binary clusters having site
+// type and function 0) with the context below: the lattice, as read by
+// parse_lattice_file, and the correlation functions (for maps, the binary
+// spins 2*type-1, which are the trigo functions of 2 components).
+// Structures are keyed with their sites that host a single species left out
+// and atom types given as indices in the list of species of each site (as
+// after fix_atom_type);
+uint64_t corrcache_context(const Structure &lattice,
+                           const Array<Array<Array<Real>>> &corrfunc);
+uint64_t corrcache_structure_key(const Structure &str,
+                                 const Structure &lattice,
+                                 const Array<Array<int>> &site_type_list);
+
+class CorrelationCacheEntry {
+public:
+  uint64_t str_key;
+  uint64_t clus_key;
+  Real corr;
+};
+
+// Correlations saved on disk (usually as corrcache.bin, next to clusters.out)
+// so that they need not be recomputed when a code is restarted. The file is a
+// header followed by fixed-size entries; it is memory-mapped and indexed when
+// opened, and new entries are appended to it by flush(), so that several codes
+// running in the same directory can share it. Codes running concurrently may
+// append the same entries; open() rewrites the file with one copy of each
+// entry when more than a quarter of its entries are duplicates. Otherwise the
+// file only grows with the number of distinct correlations computed (16 bytes
+// each) and may be deleted at any time.
+// find() may be called from several threads at once, and so may add(), but
+// entries added are only visible to find() after flush();
+class CorrelationCache {
+  struct KeyHash {
+    size_t operator()(const std::pair<uint64_t, uint64_t> &k) const {
+      return (size_t)hash_combine(k.first, k.second);
+    }
+  };
+  std::string filename;
+  int writable;
+  std::unordered_map<std::pair<uint64_t, uint64_t>, Real, KeyHash> table;
+  std::vector<CorrelationCacheEntry> pending;
+  std::mutex pending_lock;
+  void insert(const CorrelationCacheEntry &e);
+  // rewrites the file with the entries of table; entries appended by another
+  // code meanwhile are lost (they will only be computed again);
+  void compact(void);
+
+public:
+  CorrelationCache(void) : filename(), table(), pending() { writable = 0; }
+  ~CorrelationCache(void) { flush(); }
+  // reads the file, if it exists; entries added later are appended to it
+  // unless writable is 0; returns the number of entries read;
+  int open(const char *_filename, int _writable = 1);
+  int is_open(void) const { return filename.length() > 0; }
+  int find(Real *pcorr, uint64_t str_key, uint64_t clus_key) const;
+  void add(uint64_t str_key, uint64_t clus_key, Real corr);
+  void flush(void);
+  // access to all entries, e.g. to send them to other processes (entries
+  // added through add_entries are not written to the file);
+  void get_entries(Array<CorrelationCacheEntry> *pentry) const;
+  void add_entries(const Array<CorrelationCacheEntry> &entry);
+};
+
+// Name of the cache file to use with a given cluster file;
+std::string corrcache_filename(const char *clusterfilename);
+
+#endif
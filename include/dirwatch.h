@@ -0,0 +1,44 @@
+#ifndef __DIRWATCH_H__
+#define __DIRWATCH_H__
+
+#include "linklist.h"
+#include <map>
+#include <set>
+#include <string>
+
+// Reports which subdirectories of a directory have had files created, written,
+// renamed or deleted, so that a structure bank on disk can be updated without
+// rescanning every directory. Uses inotify on Linux; elsewhere (or if the
+// watches cannot be set up) is_active() is 0 and the caller should poll.
+// Note that changes made on other machines through a network filesystem are
+// usually not reported.
+class DirWatcher {
+  int fd;
+  int lost;
+  std::string top;
+  std::map<int, std::string> wd_label; // watch descriptor -> subdirectory;
+  std::set<std::string> touched;
+  int add_subdir(const std::string &label);
+  int read_events(void);
+  void close_all(void);
+
+public:
+  DirWatcher(void) : top(), wd_label(), touched() {
+    fd = -1;
+    lost = 0;
+  }
+  ~DirWatcher(void) { close_all(); }
+  // watches dir and all its current (and future) subdirectories;
+  // returns 0 if that is not possible;
+  int init(const char *dir = ".");
+  int is_active(void) const { return fd >= 0; }
+  // blocks until something changes in the watched directories or timeout
+  // (in ms) expires; returns 0 on timeout;
+  int wait(int timeout);
+  // appends to *plabel the subdirectories touched since the last call (each
+  // listed once); returns 0 if events were lost, in which case a full rescan
+  // is needed;
+  int fetch(LinkedList<std::string> *plabel);
+};
+
+#endif
@@ -147,6 +147,21 @@ int contains_pure_translations_or_lexico_successor(const Structure &str,
 int equiv_to_lexico_successor(const Structure &str, const rMatrix3d &unitcell,
                               const Array<rMatrix3d> &point_op,
                               const Array<rVector3d> &trans);
+// Smallest decoration (in the order used by equiv_to_lexico_successor, last
+// site most significant) among the images of str.atom_type under the operations
+// (point_op,trans) mapping str.cell onto itself, combined with the
+// translations of unitcell. Equivalent decorations of a supercell give the
+// same result; a decoration accepted by equiv_to_lexico_successor is its own.
+void min_equivalent_decoration(Array<int> *pdeco, const Structure &str,
+                               const rMatrix3d &unitcell,
+                               const Array<rMatrix3d> &point_op,
+                               const Array<rVector3d> &trans);
+// Decoration of the sites of supercell (whose atom_type is ignored) that is
+// equivalent to str, or of which str is a repetition, under one of the
+// operations of spacegroup; returns 0 if there is none.
+int map_onto_supercell(Array<int> *pdeco, const Structure &str,
+                       const Structure &supercell,
+                       const SpaceGroup &spacegroup);
 
 void generate_space_group(SpaceGroup *p_fullgroup, const SpaceGroup &generator);
 void generate_point_group(Array<rMatrix3d> *p_fullgroup,
@@ -20,6 +20,40 @@ void predict_ols(Array<Real> *p_yhat, const Array2d<Real> &x,
                  const Array<Real> &y, const Array<Real> &weight = empty_rArray,
                  int nonredundant = 0);
 
+// Least-squares fits and leave-one-out CV scores for a sequence of design
+// matrices that mostly differ by columns added to or removed from the end (as
+// in ClusterExpansion::find_best_cluster_choice). A QR factorization of the
+// (weighted) nonredundant columns is kept, so that a new column costs O(n r)
+// and so does a CV score (from the diagonal of the hat matrix), instead of
+// the O(n r^2 + r^3) of calc_cv and calc_ols. Results are the same as with
+// calc_cv(x,y,weight,1) and calc_ols(&b,x,y,weight,1).
+class IncrementalCV {
+  Array<Real> weight;
+  int nb_row;
+  int nb_col;
+  int nb_basis;
+  Array<Array<Real>> col;   // unweighted columns of the design matrix;
+  Array<int> col_basis;     // basis vector of each column (-1 if redundant);
+  Array<int> basis_col;     // column of each basis vector;
+  Array<Array<Real>> q;     // orthonormal basis vectors;
+  Array<Array<Real>> r;     // r(k)(j): component of column basis_col(k) on q(j);
+  Array<Real> hat;          // diagonal of the hat matrix;
+  void reserve(int n);
+  void truncate(int n);
+  void append(const Array2d<Real> &x, int j);
+
+public:
+  IncrementalCV(void);
+  void init(const Array<Real> &_weight = empty_rArray);
+  // makes x the current design matrix, keeping the factorization of the
+  // leading columns it shares with the previous one;
+  void set_design(const Array2d<Real> &x);
+  int get_nb_basis(void) const { return nb_basis; }
+  Real get_cv(const Array<Real> &y) const;
+  // least-squares coefficients (zero for redundant columns);
+  void get_fit(Array<Real> *pb, const Array<Real> &y) const;
+};
+
 void calc_ols_var(Array2d<Real> *pvar, const Array2d<Real> &x,
                   const Array<Real> &y);
 void calc_gls_var(Array2d<Real> *pvar, const Array2d<Real> &x,
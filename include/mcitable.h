@@ -0,0 +1,78 @@
+#ifndef __MCITABLE_H__
+#define __MCITABLE_H__
+
+#include "clus_str.h"
+#include <cstdint>
+#include <vector>
+
+// The clusters containing each site of a lattice, in the form MonteCarlo and
+// MultiMonteCarlo need to compute the energy change of a flip. Finding them
+// through the space group is what makes setting up a simulation slow with
+// large cluster sets; a table does not depend on the supercell and is never
+// modified once built, so one table can be passed to several simulations
+// (possibly running on different threads) or saved and read back by later
+// runs.
+class MCInteractionTable {
+public:
+  // hash of the lattice, space group and clusters the table was built from;
+  uint64_t key;
+  int nb_site;
+  int total_clusters;
+  int which_is_empty;
+  Real max_clus_len;
+  // number of sites and number per lattice site of the clusters of each type;
+  std::vector<int> type_size;
+  std::vector<Real> mult_per_atom;
+  // Cluster ic around site s is of type which_cluster[s][ic] and has
+  // cluster_size[s][ic] members, stored from index first_member[s][ic] on in
+  // the member_ arrays of site s, site s itself coming first. Each member is
+  // given by its site in the unit cell and its cell (in lattice vectors,
+  // relative to the cell of site s);
+  std::vector<std::vector<int>> which_cluster;
+  std::vector<std::vector<int>> cluster_size;
+  std::vector<std::vector<int>> first_member;
+  std::vector<std::vector<int>> member_site;
+  std::vector<std::vector<iVector3d>> member_cell;
+  // site type and correlation function of each member (0 for clusters of a
+  // binary lattice);
+  std::vector<std::vector<int>> member_type;
+  std::vector<std::vector<int>> member_func;
+
+  MCInteractionTable(void);
+  MCInteractionTable(const Structure &lattice, const SpaceGroup &space_group,
+                     const LinkedList<Cluster> &cluster_list);
+  MCInteractionTable(const Structure &lattice, const SpaceGroup &space_group,
+                     const LinkedList<MultiCluster> &cluster_list);
+  void init(const Structure &lattice, const SpaceGroup &space_group,
+            const LinkedList<Cluster> &cluster_list);
+  void init(const Structure &lattice, const SpaceGroup &space_group,
+            const LinkedList<MultiCluster> &cluster_list);
+  int get_nb_clusters(int s) const { return which_cluster[s].size(); }
+  // returns 0 (leaving the table unchanged) if the file cannot be read, is
+  // not a consistent table or was not built from the input with the given
+  // key;
+  int read(const char *filename, uint64_t expected_key);
+  int write(const char *filename) const;
+};
+
+uint64_t calc_interaction_table_key(const Structure &lattice,
+                                    const SpaceGroup &space_group,
+                                    const LinkedList<Cluster> &cluster_list);
+uint64_t calc_interaction_table_key(const Structure &lattice,
+                                    const SpaceGroup &space_group,
+                                    const LinkedList<MultiCluster> &cluster_list);
+
+// Makes *ptable hold the table of the given input: leaves it alone if it
+// already does (e.g. when several phases share their lattice and clusters),
+// otherwise reads it from filename (when not empty and the file matches) or
+// builds it and then saves it there;
+void get_interaction_table(MCInteractionTable *ptable, const Structure &lattice,
+                           const SpaceGroup &space_group,
+                           const LinkedList<Cluster> &cluster_list,
+                           const char *filename = "");
+void get_interaction_table(MCInteractionTable *ptable, const Structure &lattice,
+                           const SpaceGroup &space_group,
+                           const LinkedList<MultiCluster> &cluster_list,
+                           const char *filename = "");
+
+#endif
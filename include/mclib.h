@@ -4,11 +4,33 @@
 #include "clus_str.h"
 #include "keci.h"
 #include "linalg.h"
+#include "mcitable.h"
+#include "replexch.h"
+#include "rndstream.h"
+#include "sumtree.h"
 #include <fstream>
 #include <time.h>
 
 #define SPIN_TYPE signed char
 
+// a box of cells updated serially by one thread during a parallel sweep;
+class MCBlock {
+public:
+  int lo[3];
+  int width[3];
+  int index;
+};
+
+// changes accumulated by one block, reduced once its color is done;
+class MCBlockAccum {
+public:
+  Real denergy;
+  Real dconc;
+  Real ddisorder;
+  Array<Real> drho;
+  MCBlockAccum(void) : drho() {}
+};
+
 class MonteCarlo {
 protected:
   Structure lattice;
@@ -25,6 +47,10 @@ protected:
   int **cluster_size;
   Real *rcluster_mult_per_atom;
   int ***site_offset;
+  int **site_offset_flat;
+  int *nbr_row_len;
+  int *nbr_table;
+  int *nbr_row_start;
   Real **eci;
   int **which_cluster;
   Real E_ref;
@@ -38,23 +64,63 @@ protected:
   Real T;
   Real mu;
 
+  int nb_threads;
+  iVector3d reach;
+  iVector3d nb_block;
+  RandomStream master_rng;
+  Array<RandomStream> block_rng;
+  Array<MCBlockAccum> block_accum;
+
+  SumTree flip_rate;
+  int flip_rate_valid;
+  Real flip_wait;
+  int *flip_stamp;
+  int cur_stamp;
+  MCBlockAccum flip_accum;
+
 public:
   void calc_from_scratch(void);
   void spin_flip(void);
   void spin_double_flip(void);
   MonteCarlo(const Structure &_lattice, const iVector3d &_supercell,
              const SpaceGroup &space_group,
-             const LinkedList<Cluster> &cluster_list);
-  ~MonteCarlo(void);
+             const LinkedList<Cluster> &cluster_list,
+             int use_index_table = 0);
+  // same, with the clusters around each site taken from a table built for
+  // _lattice (which may be shared by several MonteCarlo objects);
+  MonteCarlo(const Structure &_lattice, const iVector3d &_supercell,
+             const MCInteractionTable &table, int use_index_table = 0);
+  virtual ~MonteCarlo(void);
   void set_eci(const Array<Real> &eci);
+  // same as set_eci, but the energy is obtained from the current correlations
+  // instead of a scan of all spins (not for k-space ECI, whose energy is kept
+  // separately);
+  void change_eci(const Array<Real> &eci);
   void init_random(Real concentration = 0.);
   void init_structure(const Structure &str);
   void set_concentration(Real concentration);
   void init_run(Real _T, Real _mu);
-  void run(int mc_passes, int mode = 1); // 1: grand-canonical, 2: canonical;
+  void run(int mc_passes,
+           int mode = 1); // 1: grand-canonical, 2: canonical,
+                          // 3: grand-canonical rejection-free;
+  // same as run(,1) or run(,2), but drawing random numbers from *rng only,
+  // so that distinct MonteCarlo objects can run concurrently;
+  void run(int mc_passes, int mode, RandomStream *rng);
+  void set_nb_threads(int _nb_threads);
+  int get_nb_threads(void) const { return nb_threads; }
+  // the stream all moves are drawn from (seeded from rand() on construction);
+  // threaded sweeps use substreams split from it, which are split anew when
+  // it is replaced (e.g. from a saved state, to continue a run);
+  void set_random_stream(const RandomStream &rng);
+  const RandomStream &get_random_stream(void) const { return master_rng; }
   void view(const Array<Arrayint> &labellookup,
             const Array<std::string> &atom_label, ofstream &file,
             const rMatrix3d &axes);
+  // species index (in the list of species allowed on the site) of every site
+  // of the supercell, in the order view() lists them;
+  void get_species(Array<int> *pspecies) const;
+  const Structure &get_lattice(void) const { return lattice; }
+  const iVector3d &get_supercell(void) const { return supercell; }
 
   const Array<Real> &get_cur_corr(void) const { return cur_rho; }
   Real get_cur_energy(void) {
@@ -71,8 +137,32 @@ public:
   }
   Real get_T(void) const { return T; }
   Real get_mu(void) const { return mu; }
+  Real get_nb_sites(void) const { return rspin_size; }
 
 protected:
+  // offsets (relative to the flipped site) of the other sites of all clusters
+  // containing it, stored cluster after cluster;
+  int *first_site_offset(int offset, int incell) {
+    return (nbr_table ? nbr_table + nbr_row_start[offset]
+                      : site_offset_flat[incell]);
+  }
+  void copy_eci(const Array<Real> &new_eci);
+  int can_run_parallel(void);
+  void split_block_rng(void);
+  void plan_sweep(Array<Array<MCBlock> > *color_blocks);
+  void parallel_run(int mc_passes, int mode);
+  void sweep_block(const MCBlock &block, int mode, RandomStream *rng,
+                   MCBlockAccum *acc);
+  Real site_flip_energy(int offset, int incell);
+  void flip_spin_images(const int *cell, int incell);
+  void commit_spin_flip(const int *cell, int incell, int offset,
+                        MCBlockAccum *acc);
+  int site_from_offset(int moffset, int *cell, int *incell);
+  void update_flip_rate(int site);
+  void init_flip_rates(void);
+  void rejection_free_run(int mc_passes);
+
+  virtual int extension_is_active(void) { return 0; }
   virtual void extension_calc_from_scratch(void) {}
   virtual void extension_update_spin_flip(int *cell, int incell, int newspin,
                                           Real d_recip_energy) {}
@@ -105,10 +195,31 @@ void run_mc(MonteCarlo *pmc, int mode, int n_step, Accumulator *eq);
 void run_mc(MCOutputData *pmcdata, MonteCarlo *pmc, int mode, int n_step,
             Real prec, int which_elem = 1);
 
+// Parallel tempering for emc2 (see replexch.h); each replica draws from its own
+// random stream, split from that of the exchange.
+class ReplicaExchange : public ReplicaExchangeBase<MonteCarlo> {
+  Array<RandomStream> rng;
+  Array<Real> mu;
+  Array<Array<Real>> eci;
+  Array<Accumulator> *paccum;
+  void run_replica(int r, int nb_pass);
+  void sample_slot(int s);
+  Real calc_enthalpy(int r, int slot);
+  void set_conditions(int r, int slot);
+
+public:
+  ReplicaExchange(const Array<MonteCarlo *> &_replica);
+  void init_run(const Array<Real> &_T, const Array<Real> &_mu,
+                const Array<Array<Real>> &_eci);
+  void run(Array<MCOutputData> *pmcdata, int n_equil, int n_step,
+           int swap_interval, int mode);
+};
+
 extern Array<Real> mclibdummyarray;
 
 class GenericAccumulator {
 public:
+  virtual ~GenericAccumulator(void) {}
   virtual int new_data(const Array<Real> &data) { return 0; }
   virtual const Array<Real> &get_mean(void) { return mclibdummyarray; }
   virtual const Array<Real> &get_var(void) { return mclibdummyarray; }
@@ -171,6 +282,7 @@ public:
 
 class FlippedSpin {
 public:
+  FlippedSpin(void) {}
   FlippedSpin(int *_cell, int _incell, SPIN_TYPE _newspin,
               Real _d_recip_energy) {
     for (int i = 0; i < 3; i++) {
@@ -200,7 +312,14 @@ protected:
   Complex **ft_eci;
   Complex **dir_eci;
   Complex **convol;
-  LinkedList<FlippedSpin> flipped_spins;
+  Real **rs_eci; // real part of dir_eci, the only part used after FFT;
+  // flips not yet included in convol, oldest first, kept in a circular buffer
+  // allocated once;
+  Array<FlippedSpin> flip_ring;
+  int flip_first;
+  int nb_flip;
+  int nb_flip_since_fft;
+  int real_space_update;
   KSpaceECI *p_kspace_eci;
   Real cur_recip_E;
   clock_t fft_time;
@@ -213,10 +332,22 @@ public:
                    const SpaceGroup &space_group,
                    const LinkedList<Cluster> &cluster_list,
                    KSpaceECI *_p_kspace_eci);
+  KSpaceMonteCarlo(const Structure &_lattice, const iVector3d &_supercell,
+                   const MCInteractionTable &table, KSpaceECI *_p_kspace_eci);
   ~KSpaceMonteCarlo();
+  // if on, each flip is added to convol (in real space) as soon as it can no
+  // longer be undone, instead of recomputing convol by FFT once enough flips
+  // have accumulated; this avoids the FFTs (except when the concentration
+  // drifts) at the cost of O(number of sites) operations per accepted flip;
+  void set_real_space_update(int on) { real_space_update = on; }
 
 protected:
   void set_k_space_eci(void);
+  FlippedSpin &get_flip(int i) {
+    return flip_ring((flip_first + i) % flip_ring.get_size());
+  }
+  void fold_oldest_flip(void);
+  int extension_is_active(void) { return 1; }
   void extension_calc_from_scratch(void);
   void extension_update_spin_flip(int *cell, int incell, int newspin,
                                   Real d_recip_energy);
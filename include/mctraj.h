@@ -0,0 +1,73 @@
+#ifndef __MCTRAJ_H__
+#define __MCTRAJ_H__
+
+#include "xtalutil.h"
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Binary trajectory of Monte Carlo snapshots (emc2/memc2 -otr). The header
+// holds everything needed to write a snapshot as a structure file (lattice,
+// axes, atom labels and supercell). Each frame then gives the conditions of
+// the snapshot (T, mu...) and, for each site of the supercell (in the order
+// MonteCarlo::view() lists them), the index of its species in the list of
+// species allowed on that site, packed in as few bits as the longest such
+// list requires. When ATAT is built with USE_ZSTD, frames can also be
+// compressed, one zstd block per frame.
+class TrajectoryWriter {
+  ofstream file;
+  int nb_sites;
+  int nb_bits;
+  int compression;
+  std::vector<unsigned char> packed;
+  std::vector<unsigned char> buffer;
+
+public:
+  TrajectoryWriter(void);
+  // compression is the zstd level (0: frames are only bit-packed); returns 0
+  // if the file cannot be created;
+  int open(const char *filename, const Structure &lattice,
+           const Array<Arrayint> &labellookup,
+           const Array<std::string> &atom_label, const rMatrix3d &axes,
+           const iVector3d &supercell, int compression = 0);
+  int is_open(void) const { return file.is_open(); }
+  void write_frame(const Array<int> &species, const Array<Real> &conditions);
+  void close(void);
+};
+
+// Reads a trajectory one frame at a time, so that files of any length can be
+// processed.
+class TrajectoryReader {
+  ifstream file;
+  int nb_sites;
+  int nb_bits;
+  std::vector<unsigned char> packed;
+  std::vector<unsigned char> buffer;
+
+public:
+  // lattice (in cartesian coordinates), as given to the simulation;
+  Structure lattice;
+  Array<Arrayint> labellookup;
+  Array<std::string> atom_label;
+  rMatrix3d axes;
+  iVector3d supercell;
+
+  TrajectoryReader(void);
+  // returns 0 if the file cannot be opened or is not a trajectory;
+  int open(const char *filename);
+  int get_nb_sites(void) const { return nb_sites; }
+  // label of site s of the supercell when it hosts species index sp;
+  const std::string &get_label(int s, int sp) const {
+    return atom_label(
+        labellookup(lattice.atom_type(s % lattice.atom_pos.get_size()))(sp));
+  }
+  // reads the next frame; returns 0 at the end of the file;
+  int read_frame(Array<int> *pspecies, Array<Real> *pconditions);
+  // reads only the conditions of the next frame, skipping its spins; returns
+  // 0 at the end of the file;
+  int skip_frame(Array<Real> *pconditions);
+  // writes a frame in the format of MonteCarlo::view() (that of str.out);
+  void write_structure(ostream &s, const Array<int> &species) const;
+};
+
+#endif
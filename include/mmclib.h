@@ -5,6 +5,10 @@
 #include "equil.h"
 #include "kmeci.h"
 #include "linalg.h"
+#include "mcitable.h"
+#include "replexch.h"
+#include "rndstream.h"
+#include "sumtree.h"
 #include <fstream>
 #include <time.h>
 
@@ -45,6 +49,8 @@ protected:
   int site_in_cell;
   int active_site_in_cell;
   int *which_site;
+  // 1 for sites listed in frozensite.in, which never flip;
+  int *is_frozen;
   int *nb_spin_val;
   int total_clusters;
   int *nb_clusters;
@@ -52,9 +58,20 @@ protected:
   int **cluster_size;
   Real *rcluster_mult_per_atom;
   int ***site_offset;
+  int **site_offset_flat;
+  int *nbr_row_len;
+  int *nbr_table;
+  int *nbr_row_start;
   Real ****spin_val_clus;
   Real **eci;
   int **which_cluster;
+  // distinct orbits containing each site (the only entries of new_rho a flip
+  // of that site can change) and the point terms (indices into
+  // which_is_point) among them;
+  int *nb_touched;
+  int **touched;
+  int *nb_touched_point;
+  int **touched_point;
   Real E_ref;
   int which_is_empty;
   int nb_point;
@@ -73,15 +90,48 @@ protected:
 
   Array<Array<Array<Real>>> corrfunc;
 
+  RandomStream rng;
+
   Array<Array<int>> allowed_flip_site;
   Array<Array<int>> allowed_flip_before;
   Array<Array<Array<int>>> allowed_flip_after;
   iVector3d flip_span;
 
+  SumTree flip_rate;
+  int flip_rate_valid;
+  Real flip_wait;
+  int *flip_stamp;
+  int cur_stamp;
+
 protected:
+  // offsets (relative to the flipped site) of all sites of all clusters
+  // containing it, stored cluster after cluster;
+  int *first_site_offset(int offset, int incell) {
+    return (nbr_table ? nbr_table + nbr_row_start[offset]
+                      : site_offset_flat[incell]);
+  }
   void calc_delta_point_corr(Array<Real> *pcorr, int site, int type);
   void calc_delta_point_corr(Array<Real> *pcorr, const Array<int> &sites,
                              const Array<int> &types);
+  Real site_flip_energy(int offset, int incell, int newspin);
+  void add_flip_to_corr(int incell);
+  void spin_flip(int with_extension);
+  // writes a new spin in all periodic images of a site and updates the
+  // disorder parameter and extension (energy and correlations are left to the
+  // caller);
+  void set_spin(int *cell, int incell, int oldspin, int newspin);
+  // draws the species of one random site from its exact conditional
+  // distribution given its neighbors (scratch space in neighbor_prod,
+  // species_energy and species_weight);
+  void heat_bath_flip(void);
+  Array<Real> neighbor_prod;
+  Array<Real> species_energy;
+  Array<Real> species_weight;
+  int site_from_offset(int moffset, int *cell, int *incell);
+  void update_flip_rate(int site);
+  void init_flip_rates(void);
+  void rejection_free_run(int mc_passes);
+  void copy_eci(const Array<Real> &new_eci);
 
 public:
   void find_all_allowed_flips(const Array2d<Real> &corr_constraints,
@@ -96,14 +146,28 @@ public:
 public:
   void calc_from_scratch(void);
   void spin_flip(void);
-  void run(int mc_passes, int mode);
+  void run(int mc_passes,
+           int mode); // 0: constrained multiple flips, 1: single flips,
+                      // 3: rejection-free single flips, 4: heat-bath single
+                      // flips;
   MultiMonteCarlo(const Structure &_lattice,
                   const Array<Array<int>> &_site_type_list,
                   const iVector3d &_supercell, const SpaceGroup &space_group,
                   const LinkedList<MultiCluster> &cluster_list,
-                  const Array<Array<Array<Real>>> &_corrfunc);
-  ~MultiMonteCarlo(void);
+                  const Array<Array<Array<Real>>> &_corrfunc,
+                  int use_index_table = 0);
+  // same, with the clusters around each site taken from a table built for
+  // _lattice (which may be shared by several MultiMonteCarlo objects);
+  MultiMonteCarlo(const Structure &_lattice,
+                  const Array<Array<int>> &_site_type_list,
+                  const iVector3d &_supercell, const MCInteractionTable &table,
+                  const Array<Array<Array<Real>>> &_corrfunc,
+                  int use_index_table = 0);
+  virtual ~MultiMonteCarlo(void);
   void set_eci(const Array<Real> &eci);
+  // same as set_eci, but the energy is obtained from the current correlations
+  // instead of a scan of all spins (not for k-space ECI);
+  void change_eci(const Array<Real> &eci);
   void init_random(const Array<Array<Real>> &conc);
   void init_structure(const Structure &str);
   //  void set_concentration(Real concentration);
@@ -111,6 +175,11 @@ public:
   void view(const Array<Arrayint> &labellookup,
             const Array<std::string> &atom_label, ofstream &file,
             const rMatrix3d &axes);
+  // species index (in the list of species allowed on the site) of every site
+  // of the supercell, in the order view() lists them;
+  void get_species(Array<int> *pspecies) const;
+  const Structure &get_lattice(void) const { return lattice; }
+  const iVector3d &get_supercell(void) const { return supercell; }
 
   const Array<Real> &get_cur_corr(void) const { return cur_rho; }
   Real get_cur_energy(void) {
@@ -127,10 +196,15 @@ public:
   }
   Real get_T(void) const { return T; }
   const Array<Real> &get_mu(void) const { return mu; }
+  Real get_nb_sites(void) const { return rspin_size; }
   const iVector3d &get_cell_size() const { return supercell; }
   void get_thermo_data(Array<Real> *pdata);
+  // the stream all moves are drawn from (seeded from rand() on construction);
+  void set_random_stream(const RandomStream &_rng) { rng = _rng; }
+  RandomStream &get_random_stream(void) { return rng; }
 
 protected:
+  virtual int extension_is_active(void) { return 0; }
   virtual void extension_calc_from_scratch(void) {}
   virtual void extension_save_state(void) {}
   virtual void extension_forget_state(void) {}
@@ -142,6 +216,27 @@ protected:
 
 void run_mc(GenericAccumulator *accum, MultiMonteCarlo *pmc, int mode);
 
+// Parallel tempering for memc2 (see replexch.h); each replica is given its
+// own random stream, split from that of the exchange.
+class MultiReplicaExchange : public ReplicaExchangeBase<MultiMonteCarlo> {
+  Array<Array<Real>> mu;
+  Array<Array<Real>> eci;
+  Array<Accumulator> accum;
+  void run_replica(int r, int nb_pass);
+  void sample_slot(int s);
+  Real calc_enthalpy(int r, int slot);
+  void set_conditions(int r, int slot);
+
+public:
+  MultiReplicaExchange(const Array<MultiMonteCarlo *> &_replica);
+  void init_run(const Array<Real> &_T, const Array<Array<Real>> &_mu,
+                const Array<Array<Real>> &_eci);
+  // averages and variances of MultiMonteCarlo::get_thermo_data() at each slot
+  // (one per point of the scan);
+  void run(Array<Array<Real>> *pmean, Array<Array<Real>> *pvar, int n_equil,
+           int n_step, int swap_interval, int mode);
+};
+
 class FlippedSpin {
 public:
   FlippedSpin(int *_cell, int _incell, const Array<Real> &_dspin) {
@@ -184,10 +279,17 @@ public:
                         const LinkedList<MultiCluster> &cluster_list,
                         const Array<Array<Array<Real>>> &_corrfunc,
                         KSpaceECI *_p_kspace_eci);
+  KSpaceMultiMonteCarlo(const Structure &_lattice,
+                        const Array<Array<int>> &_site_type_list,
+                        const iVector3d &_supercell,
+                        const MCInteractionTable &table,
+                        const Array<Array<Array<Real>>> &_corrfunc,
+                        KSpaceECI *_p_kspace_eci);
   ~KSpaceMultiMonteCarlo();
 
 protected:
   void set_k_space_eci(void);
+  int extension_is_active(void) { return 1; }
   void extension_calc_from_scratch(void);
   void extension_save_state(void);
   void extension_forget_state(void);
@@ -3,8 +3,12 @@
 
 #include "arraylist.h"
 #include "binstream.h"
+#include "xtalutil.h"
+#include <cstring>
 #include <fstream>
 #include <sstream>
+#include <type_traits>
+#include <vector>
 
 #define MYSTR str
 
@@ -115,13 +119,86 @@ inline int MyMPI_BcastStream(T *pbuf, int root = 0,
   return retcode;
 }
 
-template <class T> class MPISynchronizer {
+// Typed transport: trivially copyable objects (int, Real, rVector3d, rMatrix3d,
+// ...) and Arrays of them are broadcast straight from their own storage, in
+// one message, instead of going through a stringstream; other objects fall
+// back on MyMPI_BcastStream. Like bin_ostream, this assumes all processes
+// share the same binary representation;
+template <class T>
+inline int MyMPI_Bcast(T *pbuf, int root = 0, MPI_Comm comm = MPI_COMM_WORLD) {
+  if constexpr (std::is_trivially_copyable<T>::value) {
+    return MPI_Bcast((void *)pbuf, sizeof(T), MPI_BYTE, root, comm);
+  } else {
+    return MyMPI_BcastStream(pbuf, root, comm);
+  }
+}
+
+template <class T>
+  requires std::is_trivially_copyable<T>::value
+inline int MyMPI_Bcast(Array<T> *pbuf, int root = 0,
+                       MPI_Comm comm = MPI_COMM_WORLD) {
+  int len = pbuf->get_size();
+  MPI_Bcast(&len, 1, MPI_INT, root, comm);
+  if (MyMPIobj.id != root) {
+    pbuf->resize(len);
+  }
+  if (len == 0) {
+    return MPI_SUCCESS;
+  }
+  return MPI_Bcast((void *)pbuf->get_buf(), len * sizeof(T), MPI_BYTE, root,
+                   comm);
+}
+
+inline int MyMPI_Bcast(Structure *pbuf, int root = 0,
+                       MPI_Comm comm = MPI_COMM_WORLD) {
+  MyMPI_Bcast(&(pbuf->cell), root, comm);
+  MyMPI_Bcast(&(pbuf->atom_pos), root, comm);
+  return MyMPI_Bcast(&(pbuf->atom_type), root, comm);
+}
+
+// Object k of pobj has been computed by process k % numproc; sends it to all
+// other processes, using a single collective for all n objects;
+template <class T>
+int MyMPI_AllgatherCyclic(T **pobj, int n, MPI_Comm comm = MPI_COMM_WORLD) {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "MyMPI_AllgatherCyclic needs trivially copyable objects");
+  int np = MyMPIobj.numproc;
+  Array<int> count(np), displ(np);
+  int total = 0;
+  for (int r = 0; r < np; r++) {
+    count(r) = (r < n ? (n - r + np - 1) / np : 0) * sizeof(T);
+    displ(r) = total;
+    total += count(r);
+  }
+  Array<char> sendbuf(MAX(count(MyMPIobj.id), 1)), recvbuf(MAX(total, 1));
+  char *p = sendbuf.get_buf();
+  for (int k = MyMPIobj.id; k < n; k += np, p += sizeof(T)) {
+    memcpy(p, pobj[k], sizeof(T));
+  }
+  int retcode = MPI_Allgatherv(
+      (void *)sendbuf.get_buf(), count(MyMPIobj.id), MPI_BYTE,
+      (void *)recvbuf.get_buf(), count.get_buf(), displ.get_buf(), MPI_BYTE,
+      comm);
+  for (int k = 0; k < n; k++) {
+    memcpy(pobj[k], recvbuf.get_buf() + displ(k % np) + (k / np) * sizeof(T),
+           sizeof(T));
+  }
+  return retcode;
+}
+
+// Distributes the computation of a sequence of objects (round robin) and
+// makes the results available to all processes once the synchronizer is
+// destroyed (or flush() is called). Trivially copyable objects are all sent in
+// a single collective; other objects are broadcast (see MyMPI_Bcast) as soon
+// as each process has computed one;
+template <class T, bool raw = std::is_trivially_copyable<T>::value>
+class MPISynchronizer {
   int index;
   Array<T *> to_update_list;
   void finish(void) {
     int windex = index % MyMPIobj.numproc;
     for (int i = 0; i <= windex; i++) {
-      MyMPI_BcastStream(to_update_list(i), i);
+      MyMPI_Bcast(to_update_list(i), i);
     }
   }
 
@@ -144,6 +221,24 @@ public:
   }
 };
 
+template <class T> class MPISynchronizer<T, true> {
+  std::vector<T *> to_update_list;
+
+public:
+  MPISynchronizer(void) : to_update_list() {}
+  int is_my_job(void) {
+    return (to_update_list.size() % MyMPIobj.numproc == MyMPIobj.id);
+  }
+  void sync(T *pobject) { to_update_list.push_back(pobject); }
+  void flush(void) {
+    if (to_update_list.size() > 0) {
+      MyMPI_AllgatherCyclic(to_update_list.data(), to_update_list.size());
+      to_update_list.clear();
+    }
+  }
+  ~MPISynchronizer() { flush(); }
+};
+
 /*
 template<class T>
 class MPISynchronizer {
@@ -252,11 +347,14 @@ template <class T> inline int MyMPI_BcastStream(T *pbuf, int root = 0) {
   return 1;
 }
 
+template <class T> inline int MyMPI_Bcast(T *pbuf, int root = 0) { return 1; }
+
 template <class T> class MPISynchronizer {
 public:
   MPISynchronizer(void) {}
   int is_my_job(void) { return (1); }
   void sync(T *pobject) {}
+  void flush(void) {}
 };
 
 template <class T>
@@ -3,6 +3,7 @@
 
 #include "chull.h"
 #include "clus_str.h"
+#include "corrcache.h"
 #include "linalg.h"
 #include "lstsqr.h"
 #include "plugin.h"
@@ -129,6 +130,8 @@ protected:
   int cur_label;
   const char *predictor_labels;
   Real high_energy;
+  CorrelationCache *pcache; // where correlations are looked up first (if any);
+  uint64_t cache_context;
 
 public:
   int max_multiplet; // maximum number of points in cluster (can be increased
@@ -201,6 +204,9 @@ public:
     user_max_vol = _user_max_vol;
   };
   void set_max_weight(Real _max_weight) { giveup_weight = _max_weight; }
+  // look up (and save) correlations in a cache (NULL: no cache); should be
+  // called before correlations are computed;
+  void set_correlation_cache(CorrelationCache *_pcache);
 
   // the following 4 routines can be overridden in derived class to enable new
   // fitting algorithms;
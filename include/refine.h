@@ -2,6 +2,7 @@
 #define _RAFFINE_H_
 
 #include "clus_str.h"
+#include "corrcache.h"
 #include "gstate.h"
 #include "linalg.h"
 #include "lstsqr.h"
@@ -11,6 +12,7 @@ typedef LinkedList<Real> LinkedListReal;
 
 class StructureInfo;
 class ClusterExpansion;
+class MissingCorrelations;
 
 class EnergyPredictor {
 public:
@@ -113,6 +115,13 @@ protected:
   LinkedListIterator<int> i_label_list;
   int cur_label;
   const char *predictor_labels;
+  int nb_threads; // used to compute correlations of many structures at once;
+  CorrelationCache *pcache; // where correlations are looked up first (if any);
+  uint64_t cache_context;
+  // sets the label, cost and predictors of a structure, if needed, and appends
+  // (uncomputed) entries for its missing correlations, listed in *pmissing;
+  void list_missing_correlations(MissingCorrelations *pmissing,
+                                 StructureInfo *str);
 
 public:
   int max_multiplet; // maximum number of points in cluster (can be increased
@@ -180,6 +189,10 @@ public:
     user_max_vol = _user_max_vol;
   };
   void set_max_weight(Real _max_weight) { giveup_weight = _max_weight; }
+  void set_nb_threads(int _nb_threads) { nb_threads = MAX(_nb_threads, 1); }
+  // look up (and save) correlations in a cache (NULL: no cache); should be
+  // called before correlations are computed;
+  void set_correlation_cache(CorrelationCache *_pcache);
 
   // the following 4 routines can be overridden in derived class to enable new
   // fitting algorithms;
@@ -0,0 +1,152 @@
+#ifndef _REPLEXCH_H_
+#define _REPLEXCH_H_
+
+#include "array.h"
+#include "rndstream.h"
+#include <barrier>
+#include <thread>
+#include <vector>
+
+// Parallel tempering, shared by emc2 (MonteCarlo) and memc2
+// (MultiMonteCarlo): slot i holds the conditions (T, mu, ECI) of point i of a
+// scan and is occupied by one of the replicas. Every swap_interval passes,
+// replicas in neighboring slots exchange conditions (not spins) with the usual
+// Metropolis acceptance. Replicas are run by at most set_nb_threads() worker
+// threads, created once per call to run_schedule() and synchronized at each swap.
+// Derived classes say how a replica is run, sampled and given new conditions.
+template <class MC> class ReplicaExchangeBase {
+protected:
+  Array<MC *> replica;
+  Array<int> slot_replica;
+  Array<Real> T;
+  RandomStream master_rng;
+  Array<int> nb_swap_try;
+  Array<int> nb_swap_accept;
+  int mode_cur;
+  int nb_threads;
+
+  // runs replica r for nb_pass passes (called concurrently, for distinct r);
+  virtual void run_replica(int r, int nb_pass) = 0;
+  // adds the current state of the replica in slot s to the averages of slot s;
+  virtual void sample_slot(int s) = 0;
+  // enthalpy per site of the configuration of replica r under the conditions
+  // of slot s, obtained from its correlations;
+  virtual Real calc_enthalpy(int r, int s) = 0;
+  // gives replica r the conditions of slot s, without rescanning its spins;
+  virtual void set_conditions(int r, int s) = 0;
+
+  void set_nb_replicas(int nb) {
+    slot_replica.resize(nb);
+    for (int i = 0; i < nb; i++) {
+      slot_replica(i) = i;
+    }
+    nb_swap_try.resize(MAX(nb - 1, 0));
+    nb_swap_accept.resize(MAX(nb - 1, 0));
+    zero_array(&nb_swap_try);
+    zero_array(&nb_swap_accept);
+  }
+
+  // attempts to exchange the replicas of slots (i,i+1) for all i of the given
+  // parity;
+  void try_swaps(int parity) {
+    Real N = replica(0)->get_nb_sites();
+    for (int i = parity; i < replica.get_size() - 1; i += 2) {
+      int a = slot_replica(i);
+      int b = slot_replica(i + 1);
+      Real darg = N * ((calc_enthalpy(b, i) - calc_enthalpy(a, i)) / T(i) +
+                       (calc_enthalpy(a, i + 1) - calc_enthalpy(b, i + 1)) /
+                           T(i + 1));
+      nb_swap_try(i)++;
+      if (darg < 0 || master_rng.uniform01() < exp(-darg)) {
+        nb_swap_accept(i)++;
+        slot_replica(i) = b;
+        slot_replica(i + 1) = a;
+        set_conditions(b, i);
+        set_conditions(a, i + 1);
+      }
+    }
+  }
+
+  // n_equil passes, then n_step passes during which sample_slot() is called
+  // after each pass (or once, if n_step is 0), swapping every swap_interval
+  // passes;
+  void run_schedule(int n_equil, int n_step, int swap_interval) {
+    if (swap_interval < 1) swap_interval = 1;
+    // each interval: number of passes, whether to sample, whether to swap;
+    std::vector<int> interval_pass, interval_sample, interval_swap;
+    for (int n = 0; n < n_equil; n += swap_interval) {
+      interval_pass.push_back(MIN(swap_interval, n_equil - n));
+      interval_sample.push_back(0);
+      interval_swap.push_back(1);
+    }
+    for (int n = 0; n < n_step; n += swap_interval) {
+      interval_pass.push_back(MIN(swap_interval, n_step - n));
+      interval_sample.push_back(1);
+      interval_swap.push_back(1);
+    }
+    if (n_step == 0) {
+      interval_pass.push_back(0);
+      interval_sample.push_back(1);
+      interval_swap.push_back(0);
+    }
+    int nb_slot = replica.get_size();
+    int nb_thread = MAX(1, MIN(nb_slot, nb_threads));
+    size_t cur = 0;
+    int parity = 0;
+    // the swaps are made by the last worker to reach the barrier, while the
+    // others wait;
+    std::barrier sync(nb_thread, [&]() noexcept {
+      if (interval_swap[cur]) {
+        try_swaps(parity);
+        parity = 1 - parity;
+      }
+      cur++;
+    });
+    auto worker = [&](int t) {
+      for (size_t k = 0; k < interval_pass.size(); k++) {
+        for (int s = t; s < nb_slot; s += nb_thread) {
+          int r = slot_replica(s);
+          if (!interval_sample[k]) {
+            run_replica(r, interval_pass[k]);
+            continue;
+          }
+          for (int n = 0; n < MAX(interval_pass[k], 1); n++) {
+            if (interval_pass[k] > 0) run_replica(r, 1);
+            sample_slot(s);
+          }
+        }
+        sync.arrive_and_wait();
+      }
+    };
+    std::vector<std::thread> threads;
+    for (int t = 1; t < nb_thread; t++) {
+      threads.push_back(std::thread(worker, t));
+    }
+    worker(0);
+    for (auto &th : threads) {
+      th.join();
+    }
+  }
+
+public:
+  ReplicaExchangeBase(const Array<MC *> &_replica)
+      : replica(_replica), slot_replica(), T(), master_rng(), nb_swap_try(),
+        nb_swap_accept() {
+    master_rng.set_seed(new_stream_seed());
+    set_nb_replicas(replica.get_size());
+    mode_cur = 1;
+    nb_threads = 1;
+  }
+  virtual ~ReplicaExchangeBase(void) {}
+  int get_nb_replicas(void) const { return replica.get_size(); }
+  void set_nb_threads(int _nb_threads) { nb_threads = MAX(_nb_threads, 1); }
+  MC *get_replica_at(int slot) { return replica(slot_replica(slot)); }
+  // fraction of accepted swaps between slots slot and slot+1;
+  Real get_swap_rate(int slot) const {
+    return (nb_swap_try(slot) == 0
+                ? 0.
+                : (Real)nb_swap_accept(slot) / (Real)nb_swap_try(slot));
+  }
+};
+
+#endif
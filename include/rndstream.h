@@ -0,0 +1,113 @@
+#ifndef __RNDSTREAM_H__
+#define __RNDSTREAM_H__
+
+#include "misc.h"
+#include <stdint.h>
+
+// Independent pseudo-random stream (xoshiro256**), usable from one thread
+// without touching the global libc generator used by random()/uniform01().
+class RandomStream {
+  uint64_t s[4];
+
+  static uint64_t rotl(const uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+  }
+
+public:
+  RandomStream(uint64_t seed = 0) { set_seed(seed); }
+  void set_seed(uint64_t seed) {
+    // expand the seed with splitmix64 so that nearby seeds give unrelated
+    // states (and the state is never all zero);
+    for (int i = 0; i < 4; i++) {
+      uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+      s[i] = z ^ (z >> 31);
+    }
+  }
+  uint64_t next(void) {
+    const uint64_t result = rotl(s[1] * 5, 7) * 9;
+    const uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return result;
+  }
+  // advance by 2^128 steps: successive jumps give non-overlapping substreams;
+  void jump(void) {
+    static const uint64_t JUMP[] = {0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+                                    0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL};
+    uint64_t t[4] = {0, 0, 0, 0};
+    for (int i = 0; i < 4; i++) {
+      for (int b = 0; b < 64; b++) {
+        if (JUMP[i] & ((uint64_t)1 << b)) {
+          for (int j = 0; j < 4; j++) {
+            t[j] ^= s[j];
+          }
+        }
+        next();
+      }
+    }
+    for (int j = 0; j < 4; j++) {
+      s[j] = t[j];
+    }
+  }
+  // returns a stream positioned here and moves this one 2^128 steps ahead, so
+  // that the two never overlap (e.g. one per thread or per replica);
+  RandomStream split(void) {
+    RandomStream child(*this);
+    jump();
+    return child;
+  }
+  int random(int max) { return (int)(((next() >> 32) * (uint64_t)max) >> 32); }
+  Real uniform01(void) { return (Real)(next() >> 11) * (1. / 9007199254740992.); }
+  // same sequences as n calls to random(max) or uniform01();
+  void fill_random(int *buf, int n, int max) {
+    for (int i = 0; i < n; i++) {
+      buf[i] = (int)(((next() >> 32) * (uint64_t)max) >> 32);
+    }
+  }
+  void fill_uniform01(Real *buf, int n) {
+    for (int i = 0; i < n; i++) {
+      buf[i] = (Real)(next() >> 11) * (1. / 9007199254740992.);
+    }
+  }
+  // the state as four integers, for restarts (see operator<< and >>);
+  void get_state(uint64_t *state) const {
+    for (int i = 0; i < 4; i++) {
+      state[i] = s[i];
+    }
+  }
+  void set_state(const uint64_t *state) {
+    for (int i = 0; i < 4; i++) {
+      s[i] = state[i];
+    }
+  }
+};
+
+inline ostream &operator<<(ostream &file, const RandomStream &rng) {
+  uint64_t state[4];
+  rng.get_state(state);
+  file << state[0] << " " << state[1] << " " << state[2] << " " << state[3];
+  return file;
+}
+
+inline istream &operator>>(istream &file, RandomStream &rng) {
+  uint64_t state[4];
+  file >> state[0] >> state[1] >> state[2] >> state[3];
+  if (file) {
+    rng.set_state(state);
+  }
+  return file;
+}
+
+// Seed for a new stream owned by an object, drawn from the global generator so
+// that rndseed() still makes runs reproducible;
+inline uint64_t new_stream_seed(void) {
+  return ((uint64_t)rand() << 31) ^ (uint64_t)rand();
+}
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef __SUMTREE_H__
+#define __SUMTREE_H__
+
+#include "array.h"
+
+// Binary tree of partial sums over nonnegative weights: changing one weight and
+// drawing an index with probability proportional to its weight both take
+// O(log n). Parents are recomputed from their children (rather than updated by
+// differences) so that roundoff does not accumulate.
+class SumTree {
+  int nb_leaf;
+  Array<Real> node; // node(1) is the root, leaves start at node(nb_leaf);
+
+public:
+  SumTree(void) : node() { nb_leaf = 0; }
+  void init(int n) {
+    nb_leaf = 1;
+    while (nb_leaf < n) {
+      nb_leaf *= 2;
+    }
+    node.resize(2 * nb_leaf);
+    zero_array(&node);
+  }
+  int get_size(void) const { return nb_leaf; }
+  Real get_total(void) const { return node(1); }
+  Real operator()(int i) const { return node(nb_leaf + i); }
+  void set(int i, Real w) {
+    int j = nb_leaf + i;
+    node(j) = w;
+    for (j /= 2; j >= 1; j /= 2) {
+      node(j) = node(2 * j) + node(2 * j + 1);
+    }
+  }
+  // returns the leaf i such that the sum of the weights before it is <= r and
+  // the sum including it is > r (for 0 <= r < get_total());
+  int find(Real r) const {
+    int j = 1;
+    while (j < nb_leaf) {
+      j *= 2;
+      if (node(j + 1) > 0. && (r >= node(j) || node(j) == 0.)) {
+        r -= node(j);
+        j++;
+      }
+    }
+    return j - nb_leaf;
+  }
+};
+
+#endif
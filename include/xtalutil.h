@@ -293,6 +293,12 @@ void find_common_simple_supercell(iVector3d *psimple_supercell,
                                   const rMatrix3d &unitcell,
                                   const rMatrix3d &supercell);
 
+// Smith normal form: finds unimodular u and v such that d=u*m*v is diagonal,
+// with d(0,0) dividing d(1,1) dividing d(2,2) and all diagonal elements
+// nonnegative (positive if m is nonsingular);
+void smith_normal_form(iMatrix3d *pd, iMatrix3d *pu, iMatrix3d *pv,
+                       const iMatrix3d &m);
+
 void strain_str(Structure *pstr, const Structure &str, const rMatrix3d &strain);
 
 void apply_symmetry(Array<rVector3d> *b, const rMatrix3d &point_op,
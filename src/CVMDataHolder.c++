@@ -542,12 +542,20 @@ void CVMOptimizerDataHolder::get_structure_from_file(
 }
 
 VectorXd CVMOptimizerDataHolder::GetSampleCorrelation() const {
+  std::mt19937 rng(std::random_device{}());
+  return GetSampleCorrelation(rng);
+}
+
+VectorXd CVMOptimizerDataHolder::GetSampleCorrelation(std::mt19937 &rng) const {
   Structure mystructure = str;
   VectorXd corrs = VectorXd::Zero(get_num_clusters());
   int ieci = 0;
 
+  for (int i = mystructure.atom_pos.get_size() - 1; i > 0; i--) {
+    int j = std::uniform_int_distribution<int>(0, i)(rng);
+    swap(&mystructure.atom_pos(i), &mystructure.atom_pos(j));
+  }
   LinkedListIterator<Array<MultiCluster>> icluster(equivcluslist);
-  mystructure.atom_pos.shuffle();
   for (; icluster; icluster++, ieci++) {
     double rho =
 	calc_correlation(mystructure, *icluster, spacegroup.cell, *pcorrfunc);
@@ -0,0 +1,175 @@
+#include "CVMIpopt.h"
+
+using namespace ifopt;
+
+CVMIpoptAdapter::CVMIpoptAdapter(Problem &nlp, const CVMFreeEnergy &cost,
+				 const CVMNormConstraints *norm, int norm_row)
+    : nlp_(&nlp), cost_(&cost), norm_(norm), norm_row_(norm_row) {
+  // the structure of V^T diag(w) V does not depend on w, so any point gives
+  // the sparsity pattern; the diagonal is added for the norm constraint;
+  CVMFreeEnergy::Hessian hess;
+  cost_->FillHessian(nlp_->GetVariableValues(), hess);
+  int n = nlp_->GetNumberOfOptimizationVariables();
+  for (int i = 0; i < n; i++) {
+    for (CVMFreeEnergy::Hessian::InnerIterator it(hess, i); it; ++it) {
+      if (it.col() < i) {
+	hess_row_.push_back(i);
+	hess_col_.push_back(it.col());
+      }
+    }
+    hess_row_.push_back(i);
+    hess_col_.push_back(i);
+  }
+}
+
+bool CVMIpoptAdapter::get_nlp_info(Index &n, Index &m, Index &nnz_jac_g,
+				   Index &nnz_h_lag,
+				   IndexStyleEnum &index_style) {
+  n = nlp_->GetNumberOfOptimizationVariables();
+  m = nlp_->GetNumberOfConstraints();
+  nnz_jac_g = nlp_->GetJacobianOfConstraints().nonZeros();
+  nnz_h_lag = hess_row_.size();
+  index_style = C_STYLE;
+  return true;
+}
+
+bool CVMIpoptAdapter::get_bounds_info(Index n, Number *x_l, Number *x_u,
+				      Index m, Number *g_l, Number *g_u) {
+  Problem::VecBound x_bounds = nlp_->GetBoundsOnOptimizationVariables();
+  for (int i = 0; i < n; i++) {
+    x_l[i] = x_bounds.at(i).lower_;
+    x_u[i] = x_bounds.at(i).upper_;
+  }
+  Problem::VecBound g_bounds = nlp_->GetBoundsOnConstraints();
+  for (int i = 0; i < m; i++) {
+    g_l[i] = g_bounds.at(i).lower_;
+    g_u[i] = g_bounds.at(i).upper_;
+  }
+  return true;
+}
+
+bool CVMIpoptAdapter::get_starting_point(Index n, bool init_x, Number *x,
+					 bool init_z, Number *z_L,
+					 Number *z_U, Index m,
+					 bool init_lambda, Number *lambda) {
+  if (!init_x || init_z || init_lambda) return false;
+  Eigen::Map<VectorXd>(x, n) = nlp_->GetVariableValues();
+  return true;
+}
+
+bool CVMIpoptAdapter::eval_f(Index n, const Number *x, bool new_x,
+			     Number &obj_value) {
+  obj_value = nlp_->EvaluateCostFunction(x);
+  return true;
+}
+
+bool CVMIpoptAdapter::eval_grad_f(Index n, const Number *x, bool new_x,
+				  Number *grad_f) {
+  Eigen::Map<VectorXd>(grad_f, n) = nlp_->EvaluateCostFunctionGradient(x);
+  return true;
+}
+
+bool CVMIpoptAdapter::eval_g(Index n, const Number *x, bool new_x, Index m,
+			     Number *g) {
+  Eigen::Map<VectorXd>(g, m) = nlp_->EvaluateConstraints(x);
+  return true;
+}
+
+bool CVMIpoptAdapter::eval_jac_g(Index n, const Number *x, bool new_x,
+				 Index m, Index nele_jac, Index *iRow,
+				 Index *jCol, Number *values) {
+  if (values == NULL) {
+    Problem::Jacobian jac = nlp_->GetJacobianOfConstraints();
+    int nele = 0;
+    for (int k = 0; k < jac.outerSize(); k++) {
+      for (Problem::Jacobian::InnerIterator it(jac, k); it; ++it) {
+	iRow[nele] = it.row();
+	jCol[nele] = it.col();
+	nele++;
+      }
+    }
+    return nele == nele_jac;
+  }
+  nlp_->SetVariables(x);
+  Problem::Jacobian jac = nlp_->GetJacobianOfConstraints();
+  if (jac.nonZeros() != nele_jac) return false;
+  std::copy(jac.valuePtr(), jac.valuePtr() + nele_jac, values);
+  return true;
+}
+
+bool CVMIpoptAdapter::eval_h(Index n, const Number *x, bool new_x,
+			     Number obj_factor, Index m, const Number *lambda,
+			     bool new_lambda, Index nele_hess, Index *iRow,
+			     Index *jCol, Number *values) {
+  if (values == NULL) {
+    std::copy(hess_row_.begin(), hess_row_.end(), iRow);
+    std::copy(hess_col_.begin(), hess_col_.end(), jCol);
+    return true;
+  }
+  Eigen::Map<const VectorXd> corrs(x, n);
+  CVMFreeEnergy::Hessian hess;
+  cost_->FillHessian(corrs, hess);
+  hess *= obj_factor;
+  if (norm_ && norm_row_ >= 0) {
+    CVMNormConstraints::Hessian norm_hess;
+    norm_->FillHessian(corrs, norm_hess);
+    hess += lambda[norm_row_] * norm_hess;
+  }
+  for (int k = 0; k < nele_hess; k++) {
+    values[k] = hess.coeff(hess_row_[k], hess_col_[k]);
+  }
+  return true;
+}
+
+bool CVMIpoptAdapter::intermediate_callback(
+    Ipopt::AlgorithmMode mode, Index iter, Number obj_value, Number inf_pr,
+    Number inf_du, Number mu, Number d_norm, Number regularization_size,
+    Number alpha_du, Number alpha_pr, Index ls_trials,
+    const Ipopt::IpoptData *ip_data, Ipopt::IpoptCalculatedQuantities *ip_cq) {
+  nlp_->SaveCurrent();
+  return true;
+}
+
+void CVMIpoptAdapter::finalize_solution(
+    Ipopt::SolverReturn status, Index n, const Number *x, const Number *z_L,
+    const Number *z_U, Index m, const Number *g, const Number *lambda,
+    Number obj_value, const Ipopt::IpoptData *ip_data,
+    Ipopt::IpoptCalculatedQuantities *ip_cq) {
+  nlp_->SetVariables(x);
+  nlp_->SaveCurrent();
+}
+
+CVMIpoptSolver::CVMIpoptSolver() {
+  ipopt_app_ = IpoptApplicationFactory();
+  // same defaults as ifopt's IpoptSolver, except for the Hessian;
+  SetOption("linear_solver", "mumps");
+  SetOption("jacobian_approximation", "exact");
+  SetOption("hessian_approximation", "exact");
+  SetOption("max_cpu_time", 40.0);
+  SetOption("tol", 0.001);
+  SetOption("print_timing_statistics", "no");
+  SetOption("print_user_options", "no");
+  SetOption("print_level", 4);
+}
+
+void CVMIpoptSolver::SetOption(const std::string &name,
+			       const std::string &value) {
+  ipopt_app_->Options()->SetStringValue(name, value);
+}
+
+void CVMIpoptSolver::SetOption(const std::string &name, int value) {
+  ipopt_app_->Options()->SetIntegerValue(name, value);
+}
+
+void CVMIpoptSolver::SetOption(const std::string &name, double value) {
+  ipopt_app_->Options()->SetNumericValue(name, value);
+}
+
+void CVMIpoptSolver::Solve(Problem &nlp, const CVMFreeEnergy &cost,
+			   const CVMNormConstraints *norm, int norm_row) {
+  if (ipopt_app_->Initialize() != Ipopt::Solve_Succeeded)
+    ERRORQUIT("Unable to initialize IPOPT");
+  Ipopt::SmartPtr<Ipopt::TNLP> tnlp =
+      new CVMIpoptAdapter(nlp, cost, norm, norm_row);
+  ipopt_app_->OptimizeTNLP(tnlp);
+}
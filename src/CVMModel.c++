@@ -31,6 +31,7 @@ CVMRhoConstraints::CVMRhoConstraints(const std::string &name,
 				     const MatrixXd &vmatrix)
     : ConstraintSet(num_config, name) {
   vmatrix_ = vmatrix;
+  sparse_vmatrix_ = vmatrix.sparseView();
   num_point_configs_ = num_point_configs;
 }
 
@@ -48,8 +49,8 @@ CVMNormConstraints::VectorXd CVMNormConstraints::GetValues() const {
   VectorXd g(GetRows());
   VectorXd correlations =
       GetVariables()->GetComponent(DEFAULT_CORRELATIONS_SET_NAME)->GetValues();
-  g(0) = (disordered_corr_ - ordered_corr_).norm() / 2 -
-	 (correlations - disordered_corr_).norm();
+  g(0) = (disordered_corr_ - ordered_corr_).squaredNorm() / 4 -
+	 (correlations - disordered_corr_).squaredNorm();
   return g;
 }
 
@@ -58,14 +59,18 @@ void CVMNormConstraints::FillJacobianBlock(std::string var_set,
   VectorXd corrs =
       GetVariables()->GetComponent(DEFAULT_CORRELATIONS_SET_NAME)->GetValues();
 
-  // VectorXd t0 = corrs - ordered_corr_;
-  VectorXd t1 = corrs - disordered_corr_;
-
-  VectorXd jac = -1 / t1.norm() * t1;
+  VectorXd jac = -2 * (corrs - disordered_corr_);
   for (int i = 0; i < ordered_corr_.size(); i++)
     jac_block.coeffRef(0, i) = jac[i];
 }
 
+void CVMNormConstraints::FillHessian(const VectorXd &corrs,
+				     Hessian &hess) const {
+  hess.resize(corrs.size(), corrs.size());
+  hess.setIdentity();
+  hess *= -2.;
+}
+
 CVMNormConstraints::CVMNormConstraints(const std::string &name,
 				       const VectorXd &disordered_corr,
 				       const VectorXd &ordered_corr)
@@ -85,13 +90,13 @@ CVMNormConstraints::VecBound CVMNormConstraints::GetBounds() const {
 void CVMRhoConstraints::FillJacobianBlock(std::string var_set,
 					  Jacobian &jac_block) const {
   if (var_set == DEFAULT_CORRELATIONS_SET_NAME)
-    jac_block = vmatrix_.sparseView();
+    jac_block = sparse_vmatrix_;
 }
 
 VectorXd CVMRhoConstraints::GetValues() const {
   VectorXd correlations =
       GetVariables()->GetComponent(DEFAULT_CORRELATIONS_SET_NAME)->GetValues();
-  return vmatrix_ * correlations;
+  return sparse_vmatrix_ * correlations;
 }
 
 double CVMEnergy::GetCost() const {
@@ -111,12 +116,20 @@ double CVMFreeEnergy::GetCost() const {
   return GetCost(corrs);
 }
 
+const VectorXd &CVMFreeEnergy::GetRho(const VectorXd &corrs) const {
+  if (cached_corrs_.size() != corrs.size() || cached_corrs_ != corrs) {
+    cached_rho_ = sparse_vmatrix_ * corrs;
+    cached_corrs_ = corrs;
+  }
+  return cached_rho_;
+}
+
 double CVMFreeEnergy::GetCost(const VectorXd &corrs) const {
   auto rhologrho = [](double x) {
     return x * std::log(std::abs(x) + std::numeric_limits<double>::epsilon());
   };
   return mult_eci_.dot(corrs) +
-	 T * kB * multconfig_kb_.dot((vmatrix_ * corrs).unaryExpr(rhologrho));
+	 T * kB * multconfig_kb_.dot(GetRho(corrs).unaryExpr(rhologrho));
 };
 
 void CVMEnergy::FillJacobianBlock(std::string var_set,
@@ -129,21 +142,31 @@ void CVMEnergy::FillJacobianBlock(std::string var_set,
 
 void CVMFreeEnergy::FillJacobianBlock(std::string var_set,
 				      Jacobian &jac_block) const {
+  if (var_set != DEFAULT_CORRELATIONS_SET_NAME) return;
   VectorXd corrs =
       GetVariables()->GetComponent(DEFAULT_CORRELATIONS_SET_NAME)->GetValues();
   auto onepluslog = [](double x) {
     return 1 + std::log(std::abs(x) + std::numeric_limits<double>::epsilon());
   };
-  auto mult_T_kB = [T_ = getT()](double x) { return T_ * kB * x; };
-  auto cwiseMult = [](double x, double y) { return x * y; };
 
   VectorXd jac =
-      mult_eci_ + (vmatrix_.transpose() *
-		   multconfig_kb_.binaryExpr(
-		       (vmatrix_ * corrs).unaryExpr(onepluslog), cwiseMult))
-		      .unaryExpr(mult_T_kB);
-  if (var_set == DEFAULT_CORRELATIONS_SET_NAME) {
-    for (int i = 0; i < mult_eci_.size(); i++)
-      jac_block.coeffRef(0, i) = jac[i];
-  }
+      mult_eci_ + T * kB * (sparse_vmatrix_.transpose() *
+			    multconfig_kb_.cwiseProduct(
+				GetRho(corrs).unaryExpr(onepluslog)));
+  for (int i = 0; i < mult_eci_.size(); i++) jac_block.coeffRef(0, i) = jac[i];
+}
+
+void CVMFreeEnergy::FillHessian(Hessian &hess) const {
+  FillHessian(
+      GetVariables()->GetComponent(DEFAULT_CORRELATIONS_SET_NAME)->GetValues(),
+      hess);
+}
+
+void CVMFreeEnergy::FillHessian(const VectorXd &corrs, Hessian &hess) const {
+  auto inverse = [](double x) {
+    return 1. / (std::abs(x) + std::numeric_limits<double>::epsilon());
+  };
+  VectorXd weight =
+      T * kB * multconfig_kb_.cwiseProduct(GetRho(corrs).unaryExpr(inverse));
+  hess = sparse_vmatrix_.transpose() * weight.asDiagonal() * sparse_vmatrix_;
 }
@@ -1,7 +1,512 @@
 #include "anyfft.h"
 #include "fftn.h"
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <numbers>
+#include <thread>
+#include <vector>
+#ifdef USE_FFTW
+#include <fftw3.h>
+#endif
 
-void fftnd(Complex *data, int ndim, int *dims, int isign ) {
-  fftn(ndim,dims,(Real *)data,((Real *)data)+1,isign*2,(isign==1 ? 1.0 : -1.0));
-  fft_free();
+static int fft_nb_threads = 1;
+// below that many points per thread, starting threads costs more than it saves;
+#define FFT_MIN_POINTS_PER_THREAD 16384
+#define FFT_LINE_BLOCK 16
+
+// complex product without the checks for infinities std::complex does;
+static inline Complex cmul(const Complex &a, const Complex &b) {
+  return Complex(real(a) * real(b) - imag(a) * imag(b),
+                 real(a) * imag(b) + imag(a) * real(b));
+}
+
+// 1D mixed-radix (2, 3, 4, 5) decimation-in-time transform with precomputed
+// twiddle factors, applied to a batch of nb lines at once: element j of line b
+// is at [j*nb+b], so that each butterfly is applied to nb contiguous values;
+class FFTPlan1d {
+  int n;
+  std::vector<int> factor; // (radix, remaining length) pairs;
+  std::vector<Complex> twiddle[2]; // exp(+-2 pi i k/n), k<n;
+  void work(Complex *out, const Complex *in, int fstride, const int *pfactor,
+            int isign, int nb) const;
+
+public:
+  FFTPlan1d(void) : factor() { n = 0; }
+  // returns 0 if n has prime factors other than 2, 3 and 5;
+  int init(int _n);
+  // out must not overlap in;
+  void transform(Complex *out, const Complex *in, int isign, int nb) const;
+};
+
+int FFTPlan1d::init(int _n) {
+  n = _n;
+  factor.clear();
+  int p = 4;
+  int m = n;
+  while (m > 1) {
+    while (m % p) {
+      switch (p) {
+      case 4:
+        p = 2;
+        break;
+      case 2:
+        p = 3;
+        break;
+      default:
+        p += 2;
+      }
+      if (p > 5) {
+        return 0;
+      }
+    }
+    m /= p;
+    factor.push_back(p);
+    factor.push_back(m);
+  }
+  for (int s = 0; s < 2; s++) {
+    twiddle[s].resize(n);
+    Real sgn = (s == 0 ? 1. : -1.);
+    for (int k = 0; k < n; k++) {
+      twiddle[s][k] = std::polar(1., sgn * 2. * std::numbers::pi * (Real)k / (Real)n);
+    }
+  }
+  return 1;
+}
+
+void FFTPlan1d::work(Complex *out, const Complex *in, int fstride,
+                     const int *pfactor, int isign, int nb) const {
+  int p = pfactor[0];
+  int m = pfactor[1];
+  if (m == 1) {
+    for (int q = 0; q < p; q++) {
+      std::copy(in + q * fstride * nb, in + (q * fstride + 1) * nb,
+                out + q * nb);
+    }
+  } else {
+    for (int q = 0; q < p; q++) {
+      work(out + q * m * nb, in + q * fstride * nb, fstride * p, pfactor + 2,
+           isign, nb);
+    }
+  }
+  const Complex *tw = twiddle[isign > 0 ? 0 : 1].data();
+  int mnb = m * nb;
+  switch (p) {
+  case 2:
+    for (int k = 0; k < m; k++) {
+      Complex w1 = tw[k * fstride];
+      Complex *o = out + k * nb;
+      for (int b = 0; b < nb; b++) {
+        Complex t = cmul(o[b + mnb], w1);
+        o[b + mnb] = o[b] - t;
+        o[b] += t;
+      }
+    }
+    break;
+  case 3: {
+    Real sin3 = imag(tw[fstride * m]); // +-sqrt(3)/2;
+    for (int k = 0; k < m; k++) {
+      Complex w1 = tw[k * fstride];
+      Complex w2 = tw[2 * k * fstride];
+      Complex *o = out + k * nb;
+      for (int b = 0; b < nb; b++) {
+        Complex s1 = cmul(o[b + mnb], w1);
+        Complex s2 = cmul(o[b + 2 * mnb], w2);
+        Complex s3 = s1 + s2;
+        Complex s0 = (s1 - s2) * sin3;
+        Complex mid = o[b] - s3 * 0.5;
+        o[b] += s3;
+        o[b + mnb] = Complex(real(mid) - imag(s0), imag(mid) + real(s0));
+        o[b + 2 * mnb] = Complex(real(mid) + imag(s0), imag(mid) - real(s0));
+      }
+    }
+  } break;
+  case 4: {
+    Real sgn = (isign > 0 ? 1. : -1.);
+    for (int k = 0; k < m; k++) {
+      Complex w1 = tw[k * fstride];
+      Complex w2 = tw[2 * k * fstride];
+      Complex w3 = tw[3 * k * fstride];
+      Complex *o = out + k * nb;
+      for (int b = 0; b < nb; b++) {
+        Complex s0 = cmul(o[b + mnb], w1);
+        Complex s1 = cmul(o[b + 2 * mnb], w2);
+        Complex s2 = cmul(o[b + 3 * mnb], w3);
+        Complex s5 = o[b] - s1;
+        Complex s6 = o[b] + s1;
+        Complex s3 = s0 + s2;
+        Complex s4 = s0 - s2;
+        Complex js4(-sgn * imag(s4), sgn * real(s4)); // i*s4 or -i*s4;
+        o[b] = s6 + s3;
+        o[b + mnb] = s5 + js4;
+        o[b + 2 * mnb] = s6 - s3;
+        o[b + 3 * mnb] = s5 - js4;
+      }
+    }
+  } break;
+  case 5: {
+    Complex ya = tw[fstride * m];
+    Complex yb = tw[2 * fstride * m];
+    for (int k = 0; k < m; k++) {
+      Complex w1 = tw[k * fstride];
+      Complex w2 = tw[2 * k * fstride];
+      Complex w3 = tw[3 * k * fstride];
+      Complex w4 = tw[4 * k * fstride];
+      Complex *o = out + k * nb;
+      for (int b = 0; b < nb; b++) {
+        Complex s0 = o[b];
+        Complex s1 = cmul(o[b + mnb], w1);
+        Complex s2 = cmul(o[b + 2 * mnb], w2);
+        Complex s3 = cmul(o[b + 3 * mnb], w3);
+        Complex s4 = cmul(o[b + 4 * mnb], w4);
+        Complex s7 = s1 + s4;
+        Complex s10 = s1 - s4;
+        Complex s8 = s2 + s3;
+        Complex s9 = s2 - s3;
+        o[b] = s0 + s7 + s8;
+        Complex s5 = s0 + s7 * real(ya) + s8 * real(yb);
+        Complex s6(imag(s10) * imag(ya) + imag(s9) * imag(yb),
+                   -real(s10) * imag(ya) - real(s9) * imag(yb));
+        o[b + mnb] = s5 - s6;
+        o[b + 4 * mnb] = s5 + s6;
+        Complex s11 = s0 + s7 * real(yb) + s8 * real(ya);
+        Complex s12(-imag(s10) * imag(yb) + imag(s9) * imag(ya),
+                    real(s10) * imag(yb) - real(s9) * imag(ya));
+        o[b + 2 * mnb] = s11 + s12;
+        o[b + 3 * mnb] = s11 - s12;
+      }
+    }
+  } break;
+  }
+}
+
+void FFTPlan1d::transform(Complex *out, const Complex *in, int isign,
+                          int nb) const {
+  if (n == 1) {
+    std::copy(in, in + nb, out);
+  } else {
+    work(out, in, 1, factor.data(), isign, nb);
+  }
+}
+
+// Multidimensional transform done one axis at a time, the lines along an axis
+// being split among threads;
+class BuiltinFFTPlan : public FFTPlan {
+  std::vector<int> dims;
+  std::vector<FFTPlan1d> axis_plan;
+  int size;
+
+public:
+  BuiltinFFTPlan(void) : dims(), axis_plan() { size = 0; }
+  int init(int ndim, const int *_dims);
+  void transform(Complex *data, int isign);
+};
+
+int BuiltinFFTPlan::init(int ndim, const int *_dims) {
+  dims.assign(_dims, _dims + ndim);
+  axis_plan.resize(ndim);
+  size = 1;
+  for (int a = 0; a < ndim; a++) {
+    if (!axis_plan[a].init(dims[a])) {
+      return 0;
+    }
+    size *= dims[a];
+  }
+  return 1;
+}
+
+void BuiltinFFTPlan::transform(Complex *data, int isign) {
+  int stride = 1;
+  for (int a = 0; a < (int)dims.size(); a++) {
+    int n = dims[a];
+    if (n > 1) {
+      const FFTPlan1d &plan = axis_plan[a];
+      // lines are handled by blocks of (up to) FFT_LINE_BLOCK ones that are
+      // adjacent in memory (or, along the first axis, consecutive), so that
+      // the butterflies are applied to the whole block at once;
+      int nb_line = size / n;
+      int block, nb_block_per_row, jstride, bstride;
+      if (stride == 1) {
+        block = MIN(nb_line, FFT_LINE_BLOCK);
+        nb_block_per_row = 1;
+        jstride = 1;
+        bstride = n;
+      } else {
+        block = MIN(stride, FFT_LINE_BLOCK);
+        nb_block_per_row = (stride + block - 1) / block;
+        jstride = stride;
+        bstride = 1;
+      }
+      int nb_block = (stride == 1 ? (nb_line + block - 1) / block
+                                  : (nb_line / stride) * nb_block_per_row);
+      auto do_blocks = [&](int begin, int end) {
+        std::vector<Complex> in(n * block), out(n * block);
+        for (int ib = begin; ib < end; ib++) {
+          Complex *first;
+          int nb;
+          if (stride == 1) {
+            first = data + ib * block * n;
+            nb = MIN(block, nb_line - ib * block);
+          } else {
+            int lo = (ib % nb_block_per_row) * block;
+            first = data + (ib / nb_block_per_row) * stride * n + lo;
+            nb = MIN(block, stride - lo);
+          }
+          for (int j = 0; j < n; j++) {
+            for (int b = 0; b < nb; b++) {
+              in[j * nb + b] = first[j * jstride + b * bstride];
+            }
+          }
+          plan.transform(out.data(), in.data(), isign, nb);
+          for (int j = 0; j < n; j++) {
+            for (int b = 0; b < nb; b++) {
+              first[j * jstride + b * bstride] = out[j * nb + b];
+            }
+          }
+        }
+      };
+      int nb_threads = MIN(fft_nb_threads, size / FFT_MIN_POINTS_PER_THREAD);
+      if (nb_threads <= 1) {
+        do_blocks(0, nb_block);
+      } else {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < nb_threads; t++) {
+          threads.emplace_back(do_blocks, nb_block * t / nb_threads,
+                               nb_block * (t + 1) / nb_threads);
+        }
+        for (auto &th : threads) {
+          th.join();
+        }
+      }
+    }
+    stride *= n;
+  }
+}
+
+class BuiltinFFTBackend : public FFTBackend {
+public:
+  FFTPlan *make_plan(int ndim, const int *dims) {
+    BuiltinFFTPlan *pplan = new BuiltinFFTPlan;
+    if (!pplan->init(ndim, dims)) {
+      delete pplan;
+      return NULL;
+    }
+    return pplan;
+  }
+};
+
+// The original fftn code, for shapes no backend can handle;
+class SingletonFFTPlan : public FFTPlan {
+  std::vector<int> dims;
+
+public:
+  SingletonFFTPlan(int ndim, const int *_dims) : dims(_dims, _dims + ndim) {}
+  void transform(Complex *data, int isign) {
+    // fftn keeps its work space in static variables;
+    static std::mutex lock;
+    std::lock_guard<std::mutex> guard(lock);
+    fftn(dims.size(), dims.data(), (Real *)data, ((Real *)data) + 1,
+         isign * 2, 1.0);
+    fft_free();
+  }
+};
+
+#ifdef USE_FFTW
+class FFTWPlan : public FFTPlan {
+  fftw_plan plan[2]; // isign=1, isign=-1;
+
+public:
+  FFTWPlan(int ndim, const int *dims) {
+    // FFTW expects the last index to vary fastest;
+    std::vector<int> n(dims, dims + ndim);
+    int size = 1;
+    for (int a = 0; a < ndim; a++) {
+      n[a] = dims[ndim - 1 - a];
+      size *= dims[a];
+    }
+    fftw_complex *tmp = fftw_alloc_complex(size);
+    plan[0] = fftw_plan_dft(ndim, n.data(), tmp, tmp, FFTW_BACKWARD,
+                            FFTW_ESTIMATE | FFTW_UNALIGNED);
+    plan[1] = fftw_plan_dft(ndim, n.data(), tmp, tmp, FFTW_FORWARD,
+                            FFTW_ESTIMATE | FFTW_UNALIGNED);
+    fftw_free(tmp);
+  }
+  ~FFTWPlan(void) {
+    fftw_destroy_plan(plan[0]);
+    fftw_destroy_plan(plan[1]);
+  }
+  void transform(Complex *data, int isign) {
+    fftw_execute_dft(plan[isign > 0 ? 0 : 1], (fftw_complex *)data,
+                     (fftw_complex *)data);
+  }
+};
+
+class FFTWBackend : public FFTBackend {
+public:
+  FFTPlan *make_plan(int ndim, const int *dims) {
+    return new FFTWPlan(ndim, dims);
+  }
+};
+
+static FFTWBackend default_fft_backend;
+#else
+static BuiltinFFTBackend default_fft_backend;
+#endif
+
+static std::mutex fft_plan_lock;
+static FFTBackend *fft_backend = &default_fft_backend;
+static std::map<std::vector<int>, FFTPlan *> fft_plan_cache;
+
+static FFTPlan *get_fft_plan(int ndim, const int *dims) {
+  std::vector<int> key(dims, dims + ndim);
+  std::lock_guard<std::mutex> guard(fft_plan_lock);
+  FFTPlan *&pplan = fft_plan_cache[key];
+  if (!pplan) {
+    pplan = fft_backend->make_plan(ndim, dims);
+    if (!pplan) {
+      pplan = new SingletonFFTPlan(ndim, dims);
+    }
+  }
+  return pplan;
+}
+
+void set_fft_backend(FFTBackend *backend) {
+  std::lock_guard<std::mutex> guard(fft_plan_lock);
+  for (auto &i : fft_plan_cache) {
+    delete i.second;
+  }
+  fft_plan_cache.clear();
+  fft_backend = (backend ? backend : &default_fft_backend);
+}
+
+void set_fft_nb_threads(int nb_threads) { fft_nb_threads = MAX(nb_threads, 1); }
+
+static int fft_size(int ndim, const int *dims) {
+  int size = 1;
+  for (int a = 0; a < ndim; a++) {
+    size *= dims[a];
+  }
+  return size;
+}
+
+static void fft_normalize(Complex *data, int size, int isign) {
+  if (isign < 0) {
+    Real scale = 1. / (Real)size;
+    for (int i = 0; i < size; i++) {
+      data[i] *= scale;
+    }
+  }
+}
+
+// index of -k for each combination k of the indices other than the first;
+static void list_negated_index(std::vector<int> *pneg, int ndim,
+                               const int *dims) {
+  pneg->assign(1, 0);
+  for (int a = 1; a < ndim; a++) {
+    int nb = pneg->size();
+    pneg->resize(nb * dims[a]);
+    for (int k = 1; k < dims[a]; k++) {
+      for (int r = 0; r < nb; r++) {
+        (*pneg)[k * nb + r] = (dims[a] - k) * nb + (*pneg)[r];
+      }
+    }
+  }
+}
+
+void fftnd(Complex *data, int ndim, int *dims, int isign) {
+  get_fft_plan(ndim, dims)->transform(data, isign);
+  fft_normalize(data, fft_size(ndim, dims), isign);
+}
+
+// The even and odd points along the first axis are packed into one complex
+// array of half the size, whose transform gives those of both.
+void fftnd_real(Complex *data, int ndim, int *dims, int isign) {
+  int size = fft_size(ndim, dims);
+  if (ndim < 1 || (dims[0] % 2) != 0) {
+    for (int i = 0; i < size; i++) {
+      data[i] = real(data[i]);
+    }
+    fftnd(data, ndim, dims, isign);
+    return;
+  }
+  int n0 = dims[0];
+  int h = n0 / 2;
+  int nb_rest = size / n0;
+  std::vector<int> half_dims(dims, dims + ndim);
+  half_dims[0] = h;
+  std::vector<Complex> z(size / 2);
+  for (int r = 0; r < nb_rest; r++) {
+    for (int j = 0; j < h; j++) {
+      z[r * h + j] =
+          Complex(real(data[r * n0 + 2 * j]), real(data[r * n0 + 2 * j + 1]));
+    }
+  }
+  get_fft_plan(ndim, half_dims.data())->transform(z.data(), isign);
+  std::vector<int> neg;
+  list_negated_index(&neg, ndim, dims);
+  std::vector<Complex> w(h + 1);
+  for (int k = 0; k <= h; k++) {
+    w[k] = std::polar(1., (isign > 0 ? 1. : -1.) * std::numbers::pi * (Real)k / (Real)h);
+  }
+  for (int r = 0; r < nb_rest; r++) {
+    for (int k = 0; k <= h; k++) {
+      Complex zk = z[r * h + (k % h)];
+      Complex zmk = conj(z[neg[r] * h + ((h - k) % h)]);
+      Complex even = (zk + zmk) * 0.5;
+      Complex diff = zk - zmk;
+      Complex odd(0.5 * imag(diff), -0.5 * real(diff)); // (zk-zmk)/(2i);
+      data[r * n0 + k] = even + cmul(w[k], odd);
+    }
+  }
+  for (int r = 0; r < nb_rest; r++) {
+    for (int k = 1; k < h; k++) {
+      data[r * n0 + n0 - k] = conj(data[neg[r] * n0 + k]);
+    }
+  }
+  fft_normalize(data, size, isign);
+}
+
+// Only the hermitian part of data, (X(k)+conj(X(-k)))/2, contributes to the
+// real part of the transform, which is computed as in fftnd_real, in reverse.
+void fftnd_real_part(Complex *data, int ndim, int *dims, int isign) {
+  int size = fft_size(ndim, dims);
+  if (ndim < 1 || (dims[0] % 2) != 0) {
+    fftnd(data, ndim, dims, isign);
+    for (int i = 0; i < size; i++) {
+      data[i] = real(data[i]);
+    }
+    return;
+  }
+  int n0 = dims[0];
+  int h = n0 / 2;
+  int nb_rest = size / n0;
+  std::vector<int> half_dims(dims, dims + ndim);
+  half_dims[0] = h;
+  std::vector<int> neg;
+  list_negated_index(&neg, ndim, dims);
+  auto herm = [&](int r, int k) {
+    return (data[r * n0 + k] + conj(data[neg[r] * n0 + (n0 - k) % n0])) * 0.5;
+  };
+  std::vector<Complex> w(h);
+  for (int k = 0; k < h; k++) {
+    w[k] = std::polar(1., (isign > 0 ? 1. : -1.) * std::numbers::pi * (Real)k / (Real)h);
+  }
+  std::vector<Complex> z(size / 2);
+  for (int r = 0; r < nb_rest; r++) {
+    for (int k = 0; k < h; k++) {
+      Complex hk = herm(r, k);
+      Complex hkh = herm(r, k + h);
+      Complex odd = cmul(hk - hkh, w[k]);
+      z[r * h + k] = (hk + hkh) + Complex(-imag(odd), real(odd));
+    }
+  }
+  get_fft_plan(ndim, half_dims.data())->transform(z.data(), isign);
+  for (int r = 0; r < nb_rest; r++) {
+    for (int j = 0; j < h; j++) {
+      data[r * n0 + 2 * j] = real(z[r * h + j]);
+      data[r * n0 + 2 * j + 1] = imag(z[r * h + j]);
+    }
+  }
+  fft_normalize(data, size, isign);
 }
@@ -218,6 +218,26 @@ int calc_multiplicity(const MultiCluster &cluster, const rMatrix3d &cell,
 Real calc_correlation(const Structure &str, const Array<MultiCluster> &clusters,
                       const rMatrix3d &cell,
                       const Array<Array<Array<Real>>> &corrfunc) {
+  // use the table-driven version whenever str is a supercell of cell and all
+  // cluster points are sites of it;
+  SupercellSiteTable tab;
+  if (clusters.get_size() > 0 && tab.init(str, cell)) {
+    int c = 0;
+    for (; c < clusters.get_size(); c++) {
+      int at = 0;
+      for (; at < clusters(c).clus.get_size(); at++) {
+        int b;
+        iVector3d w;
+        if (!tab.find_site(&b, &w, clusters(c).clus(at)))
+          break;
+      }
+      if (at < clusters(c).clus.get_size())
+        break;
+    }
+    if (c == clusters.get_size()) {
+      return calc_correlation(str, clusters, tab, corrfunc);
+    }
+  }
   Real accum = 0.;
   int count = 0;
   rMatrix3d inv_strcell = !str.cell;
@@ -254,82 +274,332 @@ int neg_mod(int x, int m) {
   return (x % m);
 }
 
-Real calc_correlation_fast(Tensor<int> *ptab_str, const Structure &str,
-                           const Array<MultiCluster> &clusters,
-                           const Structure &lat,
-                           const Array<Array<Array<Real>>> &corrfunc) {
-  rMatrix3d inv_cell = !lat.cell;
-  if (ptab_str->get_size().get_size() == 0) {
-    Array<int> supcel(4);
-    rMatrix3d supscale = (!lat.cell) * str.cell;
-    for (int i = 0; i < 3; i++) {
-      for (int j = 0; j < 3; j++) {
-        if (i != j) {
-          if (!near_zero(supscale(i, j))) {
-            ERRORQUIT("Fast algorithm needs a simple supercell");
-          }
-        } else {
-          supcel(i) = iround(supscale(i, j));
-        }
+int SupercellSiteTable::init(const Structure &str, const rMatrix3d &_cell) {
+  cell = _cell;
+  inv_cell = !cell;
+  nb_cell = 0;
+  rMatrix3d supscale = inv_cell * str.cell;
+  if (!is_int(supscale)) {
+    return 0;
+  }
+  iMatrix3d dmat, v;
+  smith_normal_form(&dmat, &u, &v, to_int(supscale));
+  for (int i = 0; i < 3; i++) {
+    d(i) = dmat(i, i);
+    if (d(i) == 0) {
+      return 0;
+    }
+  }
+  int n = d(0) * d(1) * d(2);
+  // basis atoms are the positions that are distinct modulo the lattice;
+  LinkedList<rVector3d> basis_list;
+  Array<int> atom_basis(str.atom_pos.get_size());
+  Array<int> atom_cell(str.atom_pos.get_size());
+  for (int at = 0; at < str.atom_pos.get_size(); at++) {
+    int b = 0;
+    LinkedListIterator<rVector3d> ib(basis_list);
+    for (; ib; ib++, b++) {
+      if (is_int(inv_cell * (str.atom_pos(at) - *ib)))
+        break;
+    }
+    iVector3d t(0, 0, 0);
+    if (ib) {
+      t = u * to_int(inv_cell * (str.atom_pos(at) - *ib));
+    } else {
+      basis_list << new rVector3d(str.atom_pos(at));
+    }
+    atom_basis(at) = b;
+    atom_cell(at) =
+        (neg_mod(t(0), d(0)) * d(1) + neg_mod(t(1), d(1))) * d(2) +
+        neg_mod(t(2), d(2));
+  }
+  LinkedList_to_Array(&basis, basis_list);
+  if (basis.get_size() * n != str.atom_pos.get_size()) {
+    return 0;
+  }
+  site_atom.resize(str.atom_pos.get_size());
+  for (int i = 0; i < site_atom.get_size(); i++) {
+    site_atom(i) = -1;
+  }
+  for (int at = 0; at < str.atom_pos.get_size(); at++) {
+    int &s = site_atom(atom_basis(at) * n + atom_cell(at));
+    if (s != -1) {
+      return 0;
+    }
+    s = at;
+  }
+  nb_cell = n;
+  return 1;
+}
+
+int SupercellSiteTable::find_site(int *pb, iVector3d *pw,
+                                  const rVector3d &pos) const {
+  for (int b = 0; b < basis.get_size(); b++) {
+    rVector3d f = inv_cell * (pos - basis(b));
+    if (is_int(f)) {
+      iVector3d t = u * to_int(f);
+      *pb = b;
+      for (int i = 0; i < 3; i++) {
+        (*pw)(i) = neg_mod(t(i), d(i));
       }
+      return 1;
     }
-    supcel(3) = lat.atom_pos.get_size();
-    ptab_str->resize(supcel);
-    for (int at = 0; at < str.atom_pos.get_size(); at++) {
-      int atl = which_atom(lat.atom_pos, str.atom_pos(at), inv_cell);
-      if (atl == -1) {
-        ERRORQUIT("Lattice/structure mismatch");
+  }
+  return 0;
+}
+
+void get_site_types(Array<int> *psite_type, const Structure &str,
+                    const SupercellSiteTable &tab) {
+  int nb_cell = tab.get_nb_cell();
+  psite_type->resize(tab.get_nb_basis() * nb_cell);
+  for (int b = 0; b < tab.get_nb_basis(); b++) {
+    for (int g = 0; g < nb_cell; g++) {
+      (*psite_type)(b * nb_cell + g) = str.atom_type(tab.get_atom(b, g));
+    }
+  }
+}
+
+// multiplies the product accumulated in each cell (s) by the function f of
+// the species on the site at pos (relative to the cell); the last grid index
+// being fastest, each row of cells is two contiguous gathers (before and after
+// wrapping around);
+static void multiply_by_site_function(Real *s, const SupercellSiteTable &tab,
+                                      const Array<int> &site_type,
+                                      const rVector3d &pos, const Real *f) {
+  int nb_cell = tab.get_nb_cell();
+  const iVector3d &d = tab.get_cell_grid();
+  int b;
+  iVector3d w;
+  if (!tab.find_site(&b, &w, pos)) {
+    ERRORQUIT("Lattice/cluster mismatch");
+  }
+  const int *spin = site_type.get_buf_c() + b * nb_cell;
+  int split = d(2) - w(2);
+  for (int g0 = 0; g0 < d(0); g0++) {
+    int h0 = (g0 + w(0)) % d(0);
+    for (int g1 = 0; g1 < d(1); g1++) {
+      int h1 = (g1 + w(1)) % d(1);
+      Real *srow = s + (g0 * d(1) + g1) * d(2);
+      const int *prow = spin + (h0 * d(1) + h1) * d(2);
+      for (int k = 0; k < split; k++) {
+        srow[k] *= f[prow[k + w(2)]];
       }
-      iVector3d t = to_int(inv_cell * (str.atom_pos(at) - lat.atom_pos(atl)));
-      Array<int> cellat(4);
-      for (int i = 0; i < 3; i++) {
-        cellat(i) = neg_mod(t(i), supcel(i));
+      for (int k = split; k < d(2); k++) {
+        srow[k] *= f[prow[k - split]];
       }
-      cellat(3) = atl;
-      (*ptab_str)(cellat) = str.atom_type(at);
     }
   }
-  Array<Array<Array<int>>> clus_int(clusters.get_size());
+}
+
+Real calc_correlation(const Array<int> &site_type,
+                      const Array<MultiCluster> &clusters,
+                      const SupercellSiteTable &tab,
+                      const Array<Array<Array<Real>>> &corrfunc) {
+  int nb_cell = tab.get_nb_cell();
+  // the product over the points of each cluster is accumulated for all
+  // cells at once;
+  Array<Real> sigma(nb_cell);
+  Real accum = 0.;
+  for (int c = 0; c < clusters.get_size(); c++) {
+    Real *s = sigma.get_buf();
+    for (int g = 0; g < nb_cell; g++) {
+      s[g] = 1.;
+    }
+    for (int at = 0; at < clusters(c).clus.get_size(); at++) {
+      multiply_by_site_function(
+          s, tab, site_type, clusters(c).clus(at),
+          corrfunc(clusters(c).site_type(at))(clusters(c).func(at))
+              .get_buf_c());
+    }
+    for (int g = 0; g < nb_cell; g++) {
+      accum += s[g];
+    }
+  }
+  return accum / (Real)(nb_cell * clusters.get_size());
+}
+
+Real calc_correlation(const Structure &str, const Array<MultiCluster> &clusters,
+                      const SupercellSiteTable &tab,
+                      const Array<Array<Array<Real>>> &corrfunc) {
+  Array<int> site_type;
+  get_site_types(&site_type, str, tab);
+  return calc_correlation(site_type, clusters, tab, corrfunc);
+}
+
+Real calc_correlation(const Array<int> &site_type,
+                      const Array<ArrayrVector3d> &clusters,
+                      const SupercellSiteTable &tab) {
+  int nb_cell = tab.get_nb_cell();
+  // spin of each species, as in the binary calc_correlation above;
+  int max_type = 0;
+  for (int i = 0; i < site_type.get_size(); i++) {
+    max_type = MAX(max_type, site_type(i));
+  }
+  Array<Real> spin(max_type + 1);
+  for (int t = 0; t <= max_type; t++) {
+    spin(t) = (Real)(2 * t - 1);
+  }
+  Array<Real> sigma(nb_cell);
+  Real accum = 0.;
   for (int c = 0; c < clusters.get_size(); c++) {
-    clus_int(c).resize(clusters(c).clus.get_size());
-    for (int p = 0; p < clusters(c).clus.get_size(); p++) {
-      int atl = which_atom(lat.atom_pos, clusters(c).clus(p), inv_cell);
-      if (atl == -1) {
-        ERRORQUIT("Lattice/cluster mismatch");
+    Real *s = sigma.get_buf();
+    for (int g = 0; g < nb_cell; g++) {
+      s[g] = 1.;
+    }
+    for (int at = 0; at < clusters(c).get_size(); at++) {
+      multiply_by_site_function(s, tab, site_type, clusters(c)(at),
+                                spin.get_buf_c());
+    }
+    for (int g = 0; g < nb_cell; g++) {
+      accum += s[g];
+    }
+  }
+  return accum / (Real)(nb_cell * clusters.get_size());
+}
+
+CorrelationKernel::CorrelationKernel(void) : value(), sigma() {
+  ptab = NULL;
+}
+
+void CorrelationKernel::init(const SupercellSiteTable &tab) {
+  ptab = &tab;
+  orbit_begin.assign(1, 0);
+  cluster_begin.assign(1, 0);
+  point_func.clear();
+  point_site.clear();
+  point_shift.clear();
+  func_site_type.clear();
+  func_func.clear();
+}
+
+int CorrelationKernel::add_orbit(const Array<MultiCluster> &orbit) {
+  int nb_cell = ptab->get_nb_cell();
+  for (int c = 0; c < orbit.get_size(); c++) {
+    for (int at = 0; at < orbit(c).clus.get_size(); at++) {
+      int b;
+      iVector3d w;
+      if (!ptab->find_site(&b, &w, orbit(c).clus(at))) {
+        return 0;
       }
-      iVector3d t =
-          to_int(inv_cell * (clusters(c).clus(p) - lat.atom_pos(atl)));
-      clus_int(c)(p).resize(4);
-      for (int i = 0; i < 3; i++) {
-        clus_int(c)(p)(i) = t(i);
+      int f = 0;
+      for (; f < (int)func_func.size(); f++) {
+        if (func_site_type[f] == orbit(c).site_type(at) &&
+            func_func[f] == orbit(c).func(at))
+          break;
       }
-      clus_int(c)(p)(3) = atl;
+      if (f == (int)func_func.size()) {
+        func_site_type.push_back(orbit(c).site_type(at));
+        func_func.push_back(orbit(c).func(at));
+      }
+      point_func.push_back(f);
+      point_site.push_back(b * nb_cell);
+      point_shift.push_back(w);
+    }
+    cluster_begin.push_back(point_func.size());
+  }
+  orbit_begin.push_back(cluster_begin.size() - 1);
+  return 1;
+}
+
+int CorrelationKernel::init(const SupercellSiteTable &tab,
+                            const LinkedList<Array<MultiCluster>> &orbits) {
+  init(tab);
+  LinkedListIterator<Array<MultiCluster>> i(orbits);
+  for (; i; i++) {
+    if (!add_orbit(*i))
+      return 0;
+  }
+  return 1;
+}
+
+int CorrelationKernel::init(const SupercellSiteTable &tab,
+                            const Array<Array<MultiCluster>> &orbits) {
+  init(tab);
+  for (int o = 0; o < orbits.get_size(); o++) {
+    if (!add_orbit(orbits(o)))
+      return 0;
+  }
+  return 1;
+}
+
+void CorrelationKernel::set_structure(
+    const Array<int> &site_type, const Array<Array<Array<Real>>> &corrfunc) {
+  int nb_site = site_type.get_size();
+  value.resize(func_func.size() * nb_site);
+  for (int f = 0; f < (int)func_func.size(); f++) {
+    const Real *pf = corrfunc(func_site_type[f])(func_func[f]).get_buf_c();
+    Real *pv = value.get_buf() + f * nb_site;
+    for (int i = 0; i < nb_site; i++) {
+      pv[i] = pf[site_type(i)];
     }
   }
+}
+
+Real CorrelationKernel::get_correlation(int orbit) {
+  int nb_cell = ptab->get_nb_cell();
+  int nb_site = nb_cell * ptab->get_nb_basis();
+  const iVector3d &d = ptab->get_cell_grid();
+  sigma.resize(nb_cell);
+  Real *s = sigma.get_buf();
   Real accum = 0.;
-  int count = 0;
-  Array<int> supcel = ptab_str->get_size();
-  iVector3d supcelt(supcel(0), supcel(1), supcel(2));
-  MultiDimIterator<iVector3d> cell(supcelt);
-  for (; cell; cell++) {
-    for (int c = 0; c < clusters.get_size(); c++) {
-      Real sigma = 1.;
-      for (int at = 0; at < clusters(c).clus.get_size(); at++) {
-        Array<int> cellat(4);
-        for (int i = 0; i < 3; i++) {
-          cellat(i) =
-              neg_mod(((iVector3d &)cell)(i) + clus_int(c)(at)(i), supcel(i));
+  for (int c = orbit_begin[orbit]; c < orbit_begin[orbit + 1]; c++) {
+    for (int g = 0; g < nb_cell; g++) {
+      s[g] = 1.;
+    }
+    // same row-wise gathers as multiply_by_site_function(), reading values
+    // instead of looking them up by species;
+    for (int p = cluster_begin[c]; p < cluster_begin[c + 1]; p++) {
+      const Real *v =
+          value.get_buf_c() + point_func[p] * nb_site + point_site[p];
+      const iVector3d &w = point_shift[p];
+      int split = d(2) - w(2);
+      for (int g0 = 0; g0 < d(0); g0++) {
+        int h0 = (g0 + w(0)) % d(0);
+        for (int g1 = 0; g1 < d(1); g1++) {
+          int h1 = (g1 + w(1)) % d(1);
+          Real *srow = s + (g0 * d(1) + g1) * d(2);
+          const Real *vrow = v + (h0 * d(1) + h1) * d(2);
+          for (int k = 0; k < split; k++) {
+            srow[k] *= vrow[k + w(2)];
+          }
+          for (int k = split; k < d(2); k++) {
+            srow[k] *= vrow[k - split];
+          }
         }
-        cellat(3) = clus_int(c)(at)(3);
-        Real spin = corrfunc(clusters(c).site_type(at))(clusters(c).func(at))(
-            (*ptab_str)(cellat));
-        sigma = sigma * spin;
       }
-      accum += sigma;
-      count++;
+    }
+    for (int g = 0; g < nb_cell; g++) {
+      accum += s[g];
+    }
+  }
+  return accum /
+         (Real)(nb_cell * (orbit_begin[orbit + 1] - orbit_begin[orbit]));
+}
+
+void CorrelationKernel::get_correlations(Array<Real> *pcorr) {
+  pcorr->resize(get_nb_orbits());
+  for (int o = 0; o < get_nb_orbits(); o++) {
+    (*pcorr)(o) = get_correlation(o);
+  }
+}
+
+void calc_correlations(Array<Real> *pcorr, const Structure &str,
+                       const Array<Array<MultiCluster>> &orbits,
+                       const rMatrix3d &cell,
+                       const Array<Array<Array<Real>>> &corrfunc) {
+  SupercellSiteTable tab;
+  CorrelationKernel kernel;
+  if (tab.init(str, cell) && kernel.init(tab, orbits)) {
+    Array<int> site_type;
+    get_site_types(&site_type, str, tab);
+    kernel.set_structure(site_type, corrfunc);
+    kernel.get_correlations(pcorr);
+  } else {
+    pcorr->resize(orbits.get_size());
+    for (int o = 0; o < orbits.get_size(); o++) {
+      (*pcorr)(o) = calc_correlation(str, orbits(o), cell, corrfunc);
     }
   }
-  return accum / (Real)count;
 }
 
 void find_clusters_overlapping_site(
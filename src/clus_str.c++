@@ -1,5 +1,8 @@
 #include "clus_str.h"
 #include "arraylist.h"
+#include <atomic>
+#include <thread>
+#include <vector>
 
 ClusterBank::ClusterBank(const rMatrix3d &cell,
                          const Array<rVector3d> &atom_pos, int ntuple,
@@ -125,3 +128,49 @@ Real get_length_slow(const Array<rVector3d> &c) {
   }
   return maxd;
 }
+
+void list_candidate_configs(Array<Arrayint> *pconfig, const rMatrix3d &supercell,
+                            const Structure &lattice,
+                            const SpaceGroup &spacegroup) {
+  Structure blank;
+  blank.cell = find_symmetric_cell(supercell);
+  find_all_atom_in_supercell(&blank.atom_pos, &blank.atom_type,
+                             lattice.atom_pos, lattice.atom_type, lattice.cell,
+                             blank.cell);
+  SpaceGroup subgroup;
+  subfactorgroup_from_supercell_and_spacegroup(
+      &subgroup.point_op, &subgroup.trans, blank.cell, spacegroup.point_op,
+      spacegroup.trans);
+  LinkedList<Arrayint> list;
+  MultiDimIterator<Arrayint> config(blank.atom_type);
+  for (; config; config++) {
+    blank.atom_type = (Arrayint)config;
+    if (!contains_pure_translations(blank, lattice.cell) &&
+        !equiv_to_lexico_successor(blank, lattice.cell, subgroup.point_op,
+                                   subgroup.trans)) {
+      list << new Arrayint(blank.atom_type);
+    }
+  }
+  LinkedList_to_Array(pconfig, list);
+}
+
+void list_candidate_configs(Array<Array<Arrayint>> *pconfig,
+                            const Array<rMatrix3d> &supercells, int begin,
+                            int end, const Structure &lattice,
+                            const SpaceGroup &spacegroup, int nb_threads) {
+  // supercells are handed out one at a time, since their cost varies a lot;
+  std::atomic<int> next(begin);
+  std::vector<std::thread> worker;
+  for (int t = 0; t < MIN(nb_threads, end - begin); t++) {
+    worker.push_back(std::thread([&]() {
+      int c;
+      while ((c = next++) < end) {
+        list_candidate_configs(&(*pconfig)(c), supercells(c), lattice,
+                               spacegroup);
+      }
+    }));
+  }
+  for (size_t t = 0; t < worker.size(); t++) {
+    worker[t].join();
+  }
+}
@@ -0,0 +1,302 @@
+#include "corrcache.h"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define CORRCACHE_MMAP
+#endif
+
+#define CORRCACHE_MAGIC "ATATCC01"
+#define CORRCACHE_MAGIC_LEN 8
+
+static uint64_t mix64(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+uint64_t hash_combine(uint64_t h, uint64_t v) {
+  return mix64(h ^ (v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2)));
+}
+
+static uint64_t hash_real(Real x) {
+  return (uint64_t)llround(x / zero_tolerance);
+}
+
+uint64_t hash_structure(const Structure &str) {
+  uint64_t h = mix64(str.atom_pos.get_size());
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      h = hash_combine(h, hash_real(str.cell(i, j)));
+    }
+  }
+  // atoms are combined by a sum, which does not depend on their order;
+  rMatrix3d inv_cell = !str.cell;
+  long long grid = MAX(llround(1. / zero_tolerance), 1);
+  uint64_t sum = 0;
+  for (int at = 0; at < str.atom_pos.get_size(); at++) {
+    rVector3d frac = inv_cell * str.atom_pos(at);
+    uint64_t a = mix64(str.atom_type(at) + 1);
+    for (int i = 0; i < 3; i++) {
+      long long q = llround(frac(i) * grid) % grid;
+      a = hash_combine(a, (uint64_t)(q < 0 ? q + grid : q));
+    }
+    sum += a;
+  }
+  return hash_combine(h, sum);
+}
+
+uint64_t hash_cluster(const Array<rVector3d> &clus, uint64_t context) {
+  uint64_t h = hash_combine(context, clus.get_size());
+  for (int at = 0; at < clus.get_size(); at++) {
+    for (int i = 0; i < 3; i++) {
+      h = hash_combine(h, hash_real(clus(at)(i)));
+    }
+  }
+  return h;
+}
+
+uint64_t hash_cluster(const MultiCluster &clus, uint64_t context) {
+  uint64_t h = hash_cluster(clus.clus, context);
+  for (int at = 0; at < clus.clus.get_size(); at++) {
+    h = hash_combine(h, clus.site_type(at));
+    h = hash_combine(h, clus.func(at));
+  }
+  return h;
+}
+
+uint64_t hash_corrfunc(const Array<Array<Array<Real>>> &corrfunc) {
+  uint64_t h = mix64(corrfunc.get_size());
+  for (int st = 0; st < corrfunc.get_size(); st++) {
+    for (int f = 0; f < corrfunc(st).get_size(); f++) {
+      for (int t = 0; t < corrfunc(st)(f).get_size(); t++) {
+        uint64_t bits;
+        Real x = corrfunc(st)(f)(t);
+        memcpy(&bits, &x, sizeof(bits));
+        h = hash_combine(h, bits);
+      }
+      h = hash_combine(h, corrfunc(st)(f).get_size());
+    }
+  }
+  return h;
+}
+
+uint64_t corrcache_context(const Structure &lattice,
+                           const Array<Array<Array<Real>>> &corrfunc) {
+  return hash_combine(hash_structure(lattice), hash_corrfunc(corrfunc));
+}
+
+uint64_t corrcache_structure_key(const Structure &str,
+                                 const Structure &lattice,
+                                 const Array<Array<int>> &site_type_list) {
+  rMatrix3d inv_cell = !lattice.cell;
+  LinkedList<rVector3d> pos_list;
+  LinkedList<int> type_list;
+  for (int at = 0; at < str.atom_pos.get_size(); at++) {
+    int site = which_atom(lattice.atom_pos, str.atom_pos(at), inv_cell);
+    if (site == -1 || site_type_list(lattice.atom_type(site)).get_size() > 1) {
+      pos_list << new rVector3d(str.atom_pos(at));
+      type_list << new int(str.atom_type(at));
+    }
+  }
+  Structure active;
+  active.cell = str.cell;
+  LinkedList_to_Array(&active.atom_pos, pos_list);
+  LinkedList_to_Array(&active.atom_type, type_list);
+  return hash_structure(active);
+}
+
+void CorrelationCache::insert(const CorrelationCacheEntry &e) {
+  table[std::make_pair(e.str_key, e.clus_key)] = e.corr;
+}
+
+int CorrelationCache::open(const char *_filename, int _writable) {
+  flush();
+  filename = _filename;
+  writable = _writable;
+  table.clear();
+  const char *buf = NULL;
+  size_t len = 0;
+#ifdef CORRCACHE_MMAP
+  void *map = MAP_FAILED;
+  int fd = ::open(_filename, O_RDONLY);
+  if (fd >= 0) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      len = st.st_size;
+      map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    ::close(fd);
+  }
+  if (map != MAP_FAILED) {
+    buf = (const char *)map;
+  } else {
+    len = 0;
+  }
+#else
+  std::string contents;
+  {
+    ifstream file(_filename, ios::binary);
+    if (file) {
+      ostringstream tmp;
+      tmp << file.rdbuf();
+      contents = tmp.str();
+    }
+  }
+  buf = contents.data();
+  len = contents.size();
+#endif
+  int nb = 0;
+  if (len >= CORRCACHE_MAGIC_LEN &&
+      strncmp(buf, CORRCACHE_MAGIC, CORRCACHE_MAGIC_LEN) == 0) {
+    // a partial entry at the end (being written by another code) is skipped;
+    nb = (len - CORRCACHE_MAGIC_LEN) / sizeof(CorrelationCacheEntry);
+    table.reserve(nb);
+    for (int i = 0; i < nb; i++) {
+      CorrelationCacheEntry e;
+      memcpy(&e, buf + CORRCACHE_MAGIC_LEN + i * sizeof(CorrelationCacheEntry),
+             sizeof(CorrelationCacheEntry));
+      insert(e);
+    }
+  } else if (len > 0) {
+    cerr << "Ignoring invalid correlation cache " << _filename << endl;
+    writable = 0;
+  }
+#ifdef CORRCACHE_MMAP
+  if (len > 0) {
+    munmap(map, len);
+  }
+#endif
+  if (writable && nb - (int)table.size() > nb / 4) {
+    compact();
+  }
+  return nb;
+}
+
+void CorrelationCache::compact(void) {
+  Array<CorrelationCacheEntry> entry;
+  get_entries(&entry);
+  // written under a name unique to this process, then renamed over the
+  // file, so that other codes never read a partial cache;
+  std::string tmpname = filename + ".";
+#ifdef CORRCACHE_MMAP
+  tmpname += std::to_string(getpid());
+#endif
+  tmpname += ".tmp";
+  {
+    ofstream file(tmpname.c_str(), ios::binary);
+    file.write(CORRCACHE_MAGIC, CORRCACHE_MAGIC_LEN);
+    file.write((const char *)entry.get_buf(),
+               entry.get_size() * sizeof(CorrelationCacheEntry));
+    if (!file) {
+      cerr << "Unable to write correlation cache " << filename << endl;
+      std::remove(tmpname.c_str());
+      return;
+    }
+  }
+  if (std::rename(tmpname.c_str(), filename.c_str()) != 0) {
+    std::remove(tmpname.c_str());
+  }
+}
+
+int CorrelationCache::find(Real *pcorr, uint64_t str_key,
+                           uint64_t clus_key) const {
+  auto i = table.find(std::make_pair(str_key, clus_key));
+  if (i == table.end()) {
+    return 0;
+  }
+  *pcorr = i->second;
+  return 1;
+}
+
+void CorrelationCache::add(uint64_t str_key, uint64_t clus_key, Real corr) {
+  CorrelationCacheEntry e;
+  e.str_key = str_key;
+  e.clus_key = clus_key;
+  e.corr = corr;
+  std::lock_guard<std::mutex> guard(pending_lock);
+  pending.push_back(e);
+}
+
+void CorrelationCache::flush(void) {
+  std::vector<CorrelationCacheEntry> to_write;
+  {
+    std::lock_guard<std::mutex> guard(pending_lock);
+    for (size_t i = 0; i < pending.size(); i++) {
+      if (table.count(std::make_pair(pending[i].str_key, pending[i].clus_key)) ==
+          0) {
+        insert(pending[i]);
+        to_write.push_back(pending[i]);
+      }
+    }
+    pending.clear();
+  }
+  if (!is_open() || !writable || to_write.size() == 0) {
+    return;
+  }
+  size_t len = to_write.size() * sizeof(CorrelationCacheEntry);
+#ifdef CORRCACHE_MMAP
+  // the header is written by whoever creates the file; the entries are then
+  // appended in a single write, so that codes sharing the file do not
+  // interleave them;
+  int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+  if (fd >= 0) {
+    if (write(fd, CORRCACHE_MAGIC, CORRCACHE_MAGIC_LEN) !=
+        CORRCACHE_MAGIC_LEN) {
+      cerr << "Unable to write correlation cache " << filename << endl;
+    }
+    ::close(fd);
+  }
+  fd = ::open(filename.c_str(), O_WRONLY | O_APPEND);
+  if (fd < 0 || write(fd, to_write.data(), len) != (ssize_t)len) {
+    cerr << "Unable to write correlation cache " << filename << endl;
+  }
+  if (fd >= 0) {
+    ::close(fd);
+  }
+#else
+  {
+    ifstream test(filename.c_str());
+    if (!test) {
+      ofstream file(filename.c_str(), ios::binary);
+      file.write(CORRCACHE_MAGIC, CORRCACHE_MAGIC_LEN);
+    }
+  }
+  ofstream file(filename.c_str(), ios::binary | ios::app);
+  file.write((const char *)to_write.data(), len);
+#endif
+}
+
+void CorrelationCache::get_entries(Array<CorrelationCacheEntry> *pentry) const {
+  pentry->resize(table.size());
+  int i = 0;
+  for (auto e = table.begin(); e != table.end(); e++, i++) {
+    (*pentry)(i).str_key = e->first.first;
+    (*pentry)(i).clus_key = e->first.second;
+    (*pentry)(i).corr = e->second;
+  }
+}
+
+void CorrelationCache::add_entries(const Array<CorrelationCacheEntry> &entry) {
+  for (int i = 0; i < entry.get_size(); i++) {
+    insert(entry(i));
+  }
+}
+
+std::string corrcache_filename(const char *clusterfilename) {
+  std::string name(clusterfilename);
+  size_t slash = name.rfind('/');
+  if (slash == std::string::npos) {
+    return std::string("corrcache.bin");
+  }
+  return name.substr(0, slash + 1) + "corrcache.bin";
+}
@@ -5,6 +5,11 @@
 #include "ctype.h"
 #include "version.h"
 #include "plugin.h"
+#include "corrcache.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 #define MAXMULTIPLET 6
 
@@ -38,6 +43,10 @@ int main(int argc, char *argv[]) {
 	int multincl=0;
 	const char *corrfunc_label="trigo";
 	int printnum=0;
+	const char *batchfilename="";
+	int batchdir=0;
+	int nb_threads=1;
+	int usecache=0;
 	AskStruct options[]={
 		{"","CORRelation DUMPer " MAPS_VERSION ", by Axel van de Walle",TITLEVAL,NULL},
 		{"-h","Display more help",BOOLVAL,&dohelp},
@@ -48,9 +57,12 @@ int main(int argc, char *argv[]) {
 		{"-6","Maximum distance between two points within a sextuplet",REALVAL,&maxd(6)},
 		{"-l","Input file defining the lattice   (default: lat.in)",STRINGVAL,&latticefilename},
 		{"-s","Input file defining the structure (default: str.out)",STRINGVAL,&strfilename},
+		{"-sl","Batch mode: file listing the structure files to process",STRINGVAL,&batchfilename},
+		{"-bd","Batch mode: process the structure file (-s) of every subdirectory",BOOLVAL,&batchdir},
+		{"-nt","Number of threads used in batch mode (default: 1)",INTVAL,&nb_threads},
 		{"-pc","Print composition only",BOOLVAL,&doconc},
 		{"-pcm","Print composition matrix only",BOOLVAL,&doconcmat},
-		{"-fast","Use fast algo to calculate correlations of 'simple' supercells",BOOLVAL,&fastalgo},
+		{"-fast","Require the structure to be an exact supercell of the lattice (stop with an error otherwise); the fast algorithm is used whenever it is, with or without this option",BOOLVAL,&fastalgo},
 		{"-skipr","Skip algorithm robust to relaxations",BOOLVAL,&skiprel},
 		{"-sym","Just find space group",BOOLVAL,&dosym},
 		{"-clus","Just find clusters",BOOLVAL,&doclus},
@@ -69,6 +81,7 @@ int main(int argc, char *argv[]) {
 		//    {"-dil","Input file defining the dilute sites",STRINGVAL,&dilutefilename},
 		{"-crf","Select correlation functions (default: trigo)",STRINGVAL,&corrfunc_label},
 		{"-nb","Print structure number",BOOLVAL,&printnum},
+		{"-cc","Look up correlations in, and save them to, the correlation cache shared with maps/mmaps/mcsqs (corrcache.bin, next to the cluster file)",BOOLVAL,&usecache},
 		{"-ro","Read lattice file containing occupation variables (this code does not make use of them)",BOOLVAL,&readocc}
 	};
 	if (!get_values(argc,argv,countof(options),options)) {
@@ -304,19 +317,24 @@ int main(int argc, char *argv[]) {
 		exit(0);
 	}
 
+	// with -cc, correlations are looked up in (and saved to) the cache, keyed by the ideal structure;
+	CorrelationCache corrcache;
+	Array<uint64_t> clus_key;
+	if (usecache) {
+		corrcache.open(corrcache_filename(clusterfilename).c_str());
+		uint64_t context=corrcache_context(lattice,*pcorrfunc);
+		clus_key.resize(clusterlist.get_size());
+		LinkedListIterator<MultiCluster> icluster(clusterlist);
+		for (int c=0; icluster; icluster++, c++) {
+			clus_key(c)=hash_cluster(*icluster,context);
+		}
+	}
 
-	Structure str;
-	ifstream strfile(strfilename);
-	if (!strfile) ERRORQUIT("Unable to open structure file");
-	int strnum=1;
-	while (!strfile.eof()) {
-		parse_structure_file(&str.cell,&str.atom_pos,&str.atom_type,label,strfile);
-		skip_to_next_structure(strfile);
+	// computes the output row of one structure (as read from a structure file);
+	// returns an error message (NULL on success) if the structure does not fit
+	// the lattice;
+	auto dump_structure=[&](ostream &out, ostream &logfile, Structure &str, int strnum) -> const char * {
 		wrap_inside_cell(&str.atom_pos,str.atom_pos,str.cell);
-
-		ofstream logfile("corrdump.log");
-		logfile.setf(ios::fixed);
-		logfile.precision(sigdig);
 		rMatrix3d supercell=(!lattice.cell)*str.cell;
 		rMatrix3d rounded_supercell=to_real(to_int(supercell));
 		rMatrix3d transfo=lattice.cell*rounded_supercell*(!str.cell);
@@ -371,7 +389,7 @@ int main(int argc, char *argv[]) {
 			}
 			for (int k=0; k<ideal_str.atom_pos.get_size(); k++) {
 				if (ideal_str.atom_type(k)!=-1) {
-					if (!is_in_array(labellookup(ideal_str.atom_type(k)),vac)) ERRORQUIT("Unexpected vacancy");
+					if (!is_in_array(labellookup(ideal_str.atom_type(k)),vac)) return "Unexpected vacancy";
 					spin(k)=index_in_array(labellookup(ideal_str.atom_type(k)),vac);
 					logfile << "Vacancy at " << ((!axes)*(ideal_str.atom_pos(k))) << endl;
 				}
@@ -405,18 +423,14 @@ int main(int argc, char *argv[]) {
 			write_structure(full_ideal_str, lattice, labellookup, label, axes, file);
 		}
 
-		cout.setf(ios::fixed);
-		//    cout.setf(ios::showpos);
-		cout.precision(sigdig);
-		if (printnum) cout << strnum << delim;
-		strnum++;
+		if (printnum) out << strnum << delim;
 		Real pred=0.;
 		if (doconc) {
 			Array<Real> conc;
 			Structure cstr(ideal_str);
 			calc_concentration(&conc,lattice,labellookup,cstr);
 			for (int i=0; i<conc.get_size(); i++) {
-				cout << conc(i) << " ";
+				out << conc(i) << " ";
 			}
 		}
 		if (rndcorr) {
@@ -453,34 +467,173 @@ int main(int argc, char *argv[]) {
 					pred+=eci(ieci)*(multincl ? 1 : ieqcluster->get_size())*rho;
 				}
 				else {
-					if (!doconc) {cout << rho << delim;}
+					if (!doconc) {out << rho << delim;}
 				}
 			}
 		}
 		else {
 			int ieci=0;
 			LinkedListIterator<Array<MultiCluster> > icluster(eq_clusterlist);
-			Tensor<int> tab_str;
+			SupercellSiteTable tab_str;
+			// all orbits are evaluated by one kernel, set up on the first cache miss;
+			CorrelationKernel kernel;
+			int kernel_state=0; // 0: not set up, 1: ready, -1: not a supercell;
+			uint64_t str_key=(!usecache ? 0 : corrcache_structure_key(ideal_str,lattice,labellookup));
 			for ( ; icluster; icluster++, ieci++) {
 				Real rho;
-				if (fastalgo) {
-					rho=calc_correlation_fast(&tab_str, ideal_str,*icluster,lattice,*pcorrfunc);
-				}
-				else {
-					rho=calc_correlation(ideal_str, *icluster, spacegroup.cell, *pcorrfunc);
+				if (!usecache || !corrcache.find(&rho,str_key,clus_key(ieci))) {
+					if (kernel_state==0) {
+						kernel_state=-1;
+						if (tab_str.init(ideal_str,lattice.cell) && kernel.init(tab_str,eq_clusterlist)) {
+							Array<int> site_type;
+							get_site_types(&site_type,ideal_str,tab_str);
+							kernel.set_structure(site_type,*pcorrfunc);
+							kernel_state=1;
+						}
+						else if (fastalgo) {
+							return "Lattice/structure mismatch";
+						}
+					}
+					if (kernel_state==1) {
+						rho=kernel.get_correlation(ieci);
+					}
+					else {
+						rho=calc_correlation(ideal_str, *icluster, spacegroup.cell, *pcorrfunc);
+					}
+					if (usecache) corrcache.add(str_key,clus_key(ieci),rho);
 				}
 				if (strlen(ecifile)>0) {
 					pred+=eci(ieci)*(multincl ? 1 : icluster->get_size())*rho;
 				}
 				else {
-					if (!doconc) {cout << rho << delim;}
+					if (!doconc) {out << rho << delim;}
 				}
 			}
 		}
 		if (strlen(ecifile)>0) {
-			cout << pred;
+			out << pred;
+		}
+		out << endl;
+		return NULL;
+	};
+
+	if (strlen(batchfilename)>0 || batchdir) {
+		if (strlen(writeunrel)>0) ERRORQUIT("The -wu option cannot be used in batch mode.");
+		// list the structure files;
+		LinkedList<std::string> strfile_list;
+		if (batchdir) {
+			ostringstream cmd;
+			cmd << "ls */" << strfilename << " 2> /dev/null" << '\0';
+			FILE *pipe=popen(cmd.str().c_str(),"r");
+			if (!pipe) ERRORQUIT("Unable to list directories.");
+			char buf[MAX_LINE_LEN];
+			while (fgets(buf,MAX_LINE_LEN,pipe)) {
+				std::string name(buf);
+				while (name.length()>0 && isspace(name[name.length()-1])) name.erase(name.length()-1);
+				if (name.length()>0) strfile_list << new std::string(name);
+			}
+			pclose(pipe);
+		}
+		else {
+			ifstream listfile(batchfilename);
+			if (!listfile) ERRORQUIT("Unable to open list of structure files.");
+			std::string name;
+			while (getline(listfile,name)) {
+				while (name.length()>0 && isspace(name[name.length()-1])) name.erase(name.length()-1);
+				while (name.length()>0 && isspace(name[0])) name.erase(0,1);
+				if (name.length()>0) strfile_list << new std::string(name);
+			}
+		}
+		Array<std::string> strfile_name;
+		LinkedList_to_Array(&strfile_name,strfile_list);
+		// workers take the files in turn; rows are printed in the order of the
+		// list as soon as all the preceding ones are done;
+		Array<std::string> row(strfile_name.get_size());
+		Array<int> row_done(strfile_name.get_size());
+		zero_array(&row_done);
+		std::atomic<int> next_file(0);
+		std::mutex row_lock;
+		std::condition_variable row_ready;
+		auto worker=[&](void) {
+			while (1) {
+				int f=next_file++;
+				if (f>=strfile_name.get_size()) break;
+				ostringstream out;
+				out.setf(ios::fixed);
+				out.precision(sigdig);
+				ostringstream logfile; // the details of the mapping onto the lattice are not kept;
+				ifstream strfile(strfile_name(f).c_str());
+				int readable=(strfile ? 1 : 0);
+				Structure str;
+				int strnum=1;
+				while (readable && !strfile.eof()) {
+					// a structure that cannot be processed is reported and skipped
+					// (after an unknown label, the rest of the file cannot be
+					// parsed reliably and is skipped too);
+					const char *err="Unknown atom label";
+					ostringstream str_row;
+					str_row.setf(ios::fixed);
+					str_row.precision(sigdig);
+					int parsed;
+					{
+						// parse_structure_file reports unknown labels on cerr;
+						std::lock_guard<std::mutex> guard(row_lock);
+						parsed=parse_structure_file(&str.cell,&str.atom_pos,&str.atom_type,label,strfile);
+					}
+					if (parsed) {
+						str_row << strfile_name(f) << delim;
+						err=dump_structure(str_row,logfile,str,strnum);
+						skip_to_next_structure(strfile);
+					}
+					if (err) {
+						std::lock_guard<std::mutex> guard(row_lock);
+						cerr << strfile_name(f) << " (structure " << strnum << "): " << err << (parsed ? "; skipped" : "; rest of file skipped") << endl;
+					}
+					else {
+						out << str_row.str();
+					}
+					if (!parsed) break;
+					strnum++;
+				}
+				std::lock_guard<std::mutex> guard(row_lock);
+				if (!readable) cerr << "Unable to open " << strfile_name(f) << endl;
+				row(f)=out.str();
+				row_done(f)=1;
+				row_ready.notify_one();
+			}
+		};
+		std::vector<std::thread> threads;
+		for (int t=0; t<MAX(nb_threads,1); t++) {
+			threads.push_back(std::thread(worker));
 		}
-		cout << endl;
+		for (int f=0; f<strfile_name.get_size(); f++) {
+			std::unique_lock<std::mutex> lock(row_lock);
+			row_ready.wait(lock,[&]{return row_done(f)!=0;});
+			cout << row(f) << flush;
+			row(f)=std::string();
+		}
+		for (auto &t : threads) {
+			t.join();
+		}
+		return 0;
+	}
+
+	Structure str;
+	ifstream strfile(strfilename);
+	if (!strfile) ERRORQUIT("Unable to open structure file");
+	cout.setf(ios::fixed);
+	//    cout.setf(ios::showpos);
+	cout.precision(sigdig);
+	int strnum=1;
+	while (!strfile.eof()) {
+		parse_structure_file(&str.cell,&str.atom_pos,&str.atom_type,label,strfile);
+		skip_to_next_structure(strfile);
+		ofstream logfile("corrdump.log");
+		logfile.setf(ios::fixed);
+		logfile.precision(sigdig);
+		const char *err=dump_structure(cout,logfile,str,strnum);
+		if (err) ERRORQUIT(err);
+		strnum++;
 	}
 }
 
@@ -25,6 +25,20 @@ const char *helpstring=""
 "7) It writes the files corrdump.log containting the list of all adjustements\n"
 "   needed to map the (possibly relaxed) structure onto the ideal lattice.\n"
 "\n"
+"->Batch mode\n"
+"\n"
+"Steps 5) and 6) can be repeated for many structures in a single run, so that\n"
+"the lattice, its symmetry and the clusters are only set up once:\n"
+"  -sl=[file] processes the structure files listed in [file] (one per line);\n"
+"  -bd processes the structure file (named by -s, default str.out) of every\n"
+"      subdirectory of the current directory, as maps does.\n"
+"Structures are processed in parallel by -nt=[n] threads, but one line per\n"
+"structure is still printed, in the order of the list, each starting\n"
+"with the name of the structure file. Files that cannot be read, and\n"
+"structures that do not fit the lattice (unknown atom labels, unexpected\n"
+"vacancies...), are reported on stderr and skipped. corrdump.log is not\n"
+"written in batch mode and the -wu option is not available.\n"
+"\n"
 "->File formats\n"
 "\n"
 "Lattice and structure files\n"
@@ -11,12 +11,16 @@
 #endif
 
 #include <algorithm>
+#include <atomic>
 #include <fstream>
 #include <memory>
+#include <mutex>
 #include <ostream>
 #include <random>
+#include <thread>
 #include <vector>
 
+#include "CVMIpopt.h"
 #include "CVMLogger.h"
 #include "CVMModel.h"
 #include "getvalue.h"
@@ -36,6 +40,92 @@ typedef std::vector<std::pair<VectorXd, double>> IterMapType;
 namespace py = pybind11;
 #endif
 
+// One minimizer of the free energy at fixed T, with its own copy of the
+// variables and constraints so that several can run concurrently; if the
+// linear solver is not thread-safe, the searches share a psolve_lock that
+// lets only one IPOPT solve run at a time;
+class CVMLocalSearch {
+  CVMModel model;
+  std::shared_ptr<CVMCorrelations> correlationSet;
+  std::shared_ptr<CVMFreeEnergy> FreeEnergyCost;
+  std::shared_ptr<CVMNormConstraints> normConstraint;
+  int norm_row;
+  CVMIpoptSolver solver;
+  std::mutex *psolve_lock;
+
+ public:
+  CVMLocalSearch(const CVMOptimizerDataHolder &cvmdata,
+		 const VectorXd &disordered_correlation,
+		 const VectorXd &orderedcorr, int verbosity,
+		 int derivative_test, const char *linear_solver,
+		 std::mutex *_psolve_lock = NULL) {
+    psolve_lock = _psolve_lock;
+    correlationSet = std::make_shared<CVMCorrelations>(
+	"cvm-correlations", cvmdata.get_num_clusters(),
+	cvmdata.get_num_point_clusters());
+    correlationSet->SetVariables(disordered_correlation);
+    FreeEnergyCost = std::make_shared<CVMFreeEnergy>(
+	"free-energy", cvmdata.get_mults_eci(), cvmdata.get_multconfig_kb(),
+	cvmdata.get_vmatrix());
+    model.AddVariableSet(correlationSet);
+    model.AddConstraintSet(std::make_shared<CVMRhoConstraints>(
+	"constraint-rho", cvmdata.get_num_configs(),
+	cvmdata.get_num_point_clusters() + 1, cvmdata.get_vmatrix()));
+    model.AddCostSet(FreeEnergyCost);
+    normConstraint = std::make_shared<CVMNormConstraints>(
+	"constraint-norm", disordered_correlation, orderedcorr);
+    model.AddConstraintSet(normConstraint);
+    norm_row = model.GetNumberOfConstraints() - 1;
+
+    solver.SetOption("linear_solver", linear_solver);
+    solver.SetOption("jacobian_approximation", "exact");
+    solver.SetOption("hessian_approximation", "exact");
+    if (derivative_test) solver.SetOption("derivative_test", "second-order");
+    solver.SetOption("print_level", verbosity);
+  }
+  // minimizes from start at temperature T, stores the optimum in *popt and
+  // returns its free energy;
+  double Solve(VectorXd *popt, const VectorXd &start, double T) {
+    FreeEnergyCost->setT(T);
+    correlationSet->SetVariables(start);
+    {
+      std::unique_lock<std::mutex> lock;
+      if (psolve_lock) lock = std::unique_lock<std::mutex>(*psolve_lock);
+      solver.Solve(model, *FreeEnergyCost, normConstraint.get(), norm_row);
+    }
+    *popt = model.GetOptVariables()->GetValues();
+    return FreeEnergyCost->GetCost(*popt);
+  }
+};
+
+// Runs one local search from each starting point, spread over the given
+// searches (one thread each), and returns the lowest free energy found (ties
+// go to the earliest starting point, so the result does not depend on
+// scheduling);
+static double best_local_search(VectorXd *pbest,
+				const std::vector<VectorXd> &start, double T,
+				const std::vector<CVMLocalSearch *> &search) {
+  std::vector<VectorXd> opt(start.size());
+  std::vector<double> fe(start.size());
+  std::atomic<int> next(0);
+  auto worker = [&](CVMLocalSearch *psearch) {
+    int i;
+    while ((i = next++) < (int)start.size()) {
+      fe[i] = psearch->Solve(&opt[i], start[i], T);
+    }
+  };
+  if (search.size() == 1) {
+    worker(search[0]);
+  } else {
+    std::vector<std::thread> threads;
+    for (auto psearch : search) threads.emplace_back(worker, psearch);
+    for (auto &t : threads) t.join();
+  }
+  int best = std::min_element(fe.begin(), fe.end()) - fe.begin();
+  *pbest = opt[best];
+  return fe[best];
+}
+
 double mygaussian(double x, double a, double b, double c) {
   const double z = (x - b) / c;
   return a * std::exp(-0.5 * z * z);
@@ -52,7 +142,13 @@ int main(int argc, char *argv[]) {
   double Tmax = 3000.0;
   double Tinc = 100.0;
   int nlocal = 10;
+  int nlocal_warm = -1;
+  int nb_threads = 1;
+  int par_T = 0;
+  int seed = 0;
   int verbosity = 5;
+  int derivative_test = 0;
+  const char *linear_solver = "mumps";
 
   AskStruct options[] = {
       {"",
@@ -68,13 +164,34 @@ int main(int argc, char *argv[]) {
        &sigdig},
       {"-crf", "Select correlation functions (default: trigo)", STRINGVAL,
        &corrfunc_label},
-      {"-Tmin", "Starting Temperature (default 100 K)", INTVAL, &Tmin},
-      {"-Tmax", "Starting Temperature (default 3000 K)", INTVAL, &Tmax},
-      {"-Tinc", "Starting Temperature (default 300 K)", INTVAL, &Tinc},
+      {"-Tmin", "Starting Temperature (default 100 K)", REALVAL, &Tmin},
+      {"-Tmax", "Starting Temperature (default 3000 K)", REALVAL, &Tmax},
+      {"-Tinc", "Starting Temperature (default 300 K)", REALVAL, &Tinc},
       {"-nlocal", "No. of local searches for global minima search (default 20)",
        INTVAL, &nlocal},
+      {"-nlw",
+       "No. of local searches at temperatures warm-started from the previous "
+       "optimum (default: same as -nlocal)",
+       INTVAL, &nlocal_warm},
+      {"-nt",
+       "Number of threads running local searches (default 1; the IPOPT "
+       "solves themselves only overlap with a thread-safe linear solver, see "
+       "-ls)",
+       INTVAL, &nb_threads},
+      {"-ls",
+       "Linear solver used by IPOPT (default: mumps, which is not "
+       "thread-safe; e.g. ma27, ma57 or ma97 if IPOPT was built with HSL)",
+       STRINGVAL, &linear_solver},
+      {"-pT",
+       "Distribute blocks of temperatures among threads instead of local "
+       "searches",
+       BOOLVAL, &par_T},
+      {"-sd", "Seed for random number generator (default: randomize)", INTVAL,
+       &seed},
       {"-v", "verbosity level of IPOPT solver 1--20 (default 5)", INTVAL,
        &verbosity},
+      {"-dt", "Check analytic derivatives in every IPOPT solve (slow)", BOOLVAL,
+       &derivative_test},
       {"-d", "Use all default values", BOOLVAL, &dummy}};
   if (!get_values(argc, argv, countof(options), options)) {
     display_help(countof(options), options);
@@ -115,57 +232,103 @@ int main(int argc, char *argv[]) {
   OrderedStateModel.AddConstraintSet(rhoConstraintSet);
   OrderedStateModel.AddCostSet(EnergyCost);
 
-  IpoptSolver ipopt_ordered, ipopt_opt;
+  IpoptSolver ipopt_ordered;
 
-  ipopt_ordered.SetOption("linear_solver", "mumps");
+  ipopt_ordered.SetOption("linear_solver", linear_solver);
   ipopt_ordered.SetOption("jacobian_approximation", "exact");
   ipopt_ordered.SetOption("print_level", verbosity);
-  ipopt_ordered.SetOption("derivative_test", "first-order");
+  if (derivative_test)
+    ipopt_ordered.SetOption("derivative_test", "first-order");
   ipopt_ordered.Solve(OrderedStateModel);
 
   VectorXd orderedcorr = OrderedStateModel.GetOptVariables()->GetValues();
 
-  // Solve for optimised state
-  CVMModel OptimisedModel;
-  OptimisedModel.AddVariableSet(correlationSet);
-  OptimisedModel.AddConstraintSet(rhoConstraintSet);
-  OptimisedModel.AddCostSet(FreeEnergyCost);
-
-  auto normConstraintSet = std::make_shared<CVMNormConstraints>(
-      "constraint-norm", disordered_correlation, orderedcorr);
-  OptimisedModel.AddConstraintSet(normConstraintSet);
-
-  ipopt_opt.SetOption("linear_solver", "mumps");
-  ipopt_opt.SetOption("jacobian_approximation", "exact");
-  ipopt_opt.SetOption("derivative_test", "first-order");
-  ipopt_opt.SetOption("print_level", verbosity);
+  if (nlocal < 1) nlocal = 1;
+  if (nlocal_warm < 0) nlocal_warm = nlocal;
+  if (nlocal_warm < 1) nlocal_warm = 1;
+  if (nb_threads < 1) nb_threads = 1;
 
   cvmdata->cvminfo.ordered_correlation = orderedcorr;
   cvmdata->cvminfo.disordered_correlation = disordered_correlation;
   CVMResultsLogger energyresults("cvmresult.csv", sigdig, cvmdata);
   CVMCorrelationsLogger corrresults("cvmsteps.out", sigdig, cvmdata);
 
-  for (int T = Tmin; T <= Tmax; T += Tinc) {
-    FreeEnergyCost->setT(static_cast<double>(T));
-    IterMapType mymap;
-
-    for (int i = 0; i < nlocal; i++) {
-      correlationSet->SetVariables(cvmdata->GetSampleCorrelation());
-      ipopt_opt.Solve(OptimisedModel);
+  std::vector<double> temperatures;
+  for (int iT = 0; Tmin + iT * Tinc <= Tmax + 1e-6 * fabs(Tinc); iT++) {
+    temperatures.push_back(Tmin + iT * Tinc);
+    if (Tinc <= 0.) break;
+  }
+  int nT = temperatures.size();
+  if (par_T && nb_threads > nT) nb_threads = MAX(nT, 1);
 
-      VectorXd opttemp = OptimisedModel.GetOptVariables()->GetValues();
-      double fetemp = FreeEnergyCost->GetCost(opttemp);
-      mymap.push_back(std::make_pair(std::move(opttemp), fetemp));
+  // each temperature starts from random configurations, except that the first
+  // start of a temperature following another one in the same chain (all of
+  // them, unless -pT) is the optimum found at that previous temperature;
+  std::vector<int> chain_begin;
+  for (int t = 0; t <= (par_T ? nb_threads : 1); t++) {
+    chain_begin.push_back(((long)nT * t) / (par_T ? nb_threads : 1));
+  }
+  std::mt19937 rng(seed ? seed : time(NULL));
+  std::vector<std::vector<VectorXd>> start(nT);
+  for (int iT = 0; iT < nT; iT++) {
+    int warm = (std::find(chain_begin.begin(), chain_begin.end(), iT) ==
+		chain_begin.end());
+    start[iT].resize(warm ? nlocal_warm : nlocal);
+    for (int i = warm; i < (int)start[iT].size(); i++) {
+      start[iT][i] = cvmdata->GetSampleCorrelation(rng);
     }
+  }
 
-    auto minresult = std::min_element(
-	mymap.begin(), mymap.end(), [](const auto &first, const auto &second) {
-	  return first.second < second.second;
-	});
-    cvmdata->addInfo(minresult->first, minresult->second,
-		     FreeEnergyCost->GetCost(orderedcorr),
-		     FreeEnergyCost->GetCost(disordered_correlation), T);
+  // MUMPS keeps global state, so concurrent solves must not overlap;
+  std::mutex solve_lock;
+  std::mutex *psolve_lock = NULL;
+  if (nb_threads > 1 && strcmp(linear_solver, "mumps") == 0) {
+    cerr << "Warning: the mumps linear solver is not thread-safe; IPOPT "
+	    "solves will run one at a time (see -ls)."
+	 << endl;
+    psolve_lock = &solve_lock;
+  }
+  std::vector<std::unique_ptr<CVMLocalSearch>> search;
+  for (int t = 0; t < nb_threads; t++) {
+    search.emplace_back(new CVMLocalSearch(*cvmdata, disordered_correlation,
+					   orderedcorr, verbosity,
+					   derivative_test, linear_solver,
+					   psolve_lock));
+  }
+
+  auto record = [&](const VectorXd &optcorr, double optfe, int iT) {
+    FreeEnergyCost->setT(temperatures[iT]);
+    cvmdata->addInfo(optcorr, optfe, FreeEnergyCost->GetCost(orderedcorr),
+		     FreeEnergyCost->GetCost(disordered_correlation),
+		     temperatures[iT]);
     cvmdata->log();
+  };
+
+  if (par_T) {
+    std::vector<VectorXd> optcorr(nT);
+    std::vector<double> optfe(nT);
+    auto chain = [&](int t) {
+      std::vector<CVMLocalSearch *> mysearch(1, search[t].get());
+      for (int iT = chain_begin[t]; iT < chain_begin[t + 1]; iT++) {
+	if (iT > chain_begin[t]) start[iT][0] = optcorr[iT - 1];
+	optfe[iT] = best_local_search(&optcorr[iT], start[iT], temperatures[iT],
+				      mysearch);
+      }
+    };
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nb_threads; t++) threads.emplace_back(chain, t);
+    for (auto &t : threads) t.join();
+    for (int iT = 0; iT < nT; iT++) record(optcorr[iT], optfe[iT], iT);
+  } else {
+    std::vector<CVMLocalSearch *> allsearch;
+    for (auto &psearch : search) allsearch.push_back(psearch.get());
+    VectorXd optcorr;
+    for (int iT = 0; iT < nT; iT++) {
+      if (iT > 0) start[iT][0] = optcorr;
+      double optfe = best_local_search(&optcorr, start[iT], temperatures[iT],
+				       allsearch);
+      record(optcorr, optfe, iT);
+    }
   }
 
   vector<double> correction;
@@ -0,0 +1,155 @@
+#include "dirwatch.h"
+#include <cerrno>
+#include <dirent.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+// what changes the state of a structure: energy/error/str.out being written,
+// created, renamed or deleted;
+#define DIRWATCH_SUB_MASK                                                      \
+  (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM)
+
+int DirWatcher::add_subdir(const std::string &label) {
+#ifdef __linux__
+  int wd = inotify_add_watch(fd, (top + "/" + label).c_str(),
+                             DIRWATCH_SUB_MASK | IN_ONLYDIR);
+  if (wd < 0) {
+    return 0;
+  }
+  wd_label[wd] = label;
+#endif
+  return 1;
+}
+
+void DirWatcher::close_all(void) {
+  if (fd >= 0) {
+    close(fd);
+  }
+  fd = -1;
+  wd_label.clear();
+}
+
+int DirWatcher::init(const char *dir) {
+  close_all();
+  touched.clear();
+  lost = 0;
+  top = dir;
+#ifdef __linux__
+  fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0) {
+    return 0;
+  }
+  // the top directory itself: new structure directories and control files
+  // (ready, refresh, stop);
+  int wd = inotify_add_watch(fd, dir, DIRWATCH_SUB_MASK | IN_ONLYDIR);
+  if (wd < 0) {
+    close_all();
+    return 0;
+  }
+  wd_label[wd] = "";
+  DIR *d = opendir(dir);
+  if (!d) {
+    close_all();
+    return 0;
+  }
+  struct dirent *entry;
+  while ((entry = readdir(d)) != NULL) {
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+    if (entry->d_type != DT_DIR && entry->d_type != DT_UNKNOWN) {
+      continue;
+    }
+    // IN_ONLYDIR makes this fail harmlessly for non-directories of unknown
+    // type; running out of watches (ENOSPC) is a real failure;
+    if (!add_subdir(entry->d_name) && errno == ENOSPC) {
+      closedir(d);
+      close_all();
+      return 0;
+    }
+  }
+  closedir(d);
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+int DirWatcher::read_events(void) {
+  int nb_event = 0;
+#ifdef __linux__
+  char buf[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+  while (1) {
+    ssize_t len = read(fd, buf, sizeof(buf));
+    if (len <= 0) {
+      break;
+    }
+    for (char *p = buf; p < buf + len;) {
+      struct inotify_event *event = (struct inotify_event *)p;
+      p += sizeof(struct inotify_event) + event->len;
+      nb_event++;
+      if (event->mask & IN_Q_OVERFLOW) {
+        lost = 1;
+        continue;
+      }
+      std::map<int, std::string>::iterator i = wd_label.find(event->wd);
+      if (i == wd_label.end()) {
+        continue;
+      }
+      if (event->mask & IN_IGNORED) { // directory removed;
+        wd_label.erase(i);
+        continue;
+      }
+      if (i->second.length() > 0) {
+        touched.insert(i->second);
+      } else if (event->len > 0 && (event->mask & IN_ISDIR)) {
+        // a subdirectory appeared or disappeared in the top directory;
+        std::string label(event->name);
+        if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+          if (!add_subdir(label)) {
+            lost = 1;
+          }
+        }
+        touched.insert(label);
+      }
+    }
+  }
+#endif
+  return nb_event;
+}
+
+int DirWatcher::wait(int timeout) {
+  if (fd < 0) {
+    return 0;
+  }
+  if (read_events() > 0) {
+    return 1;
+  }
+#ifdef __linux__
+  struct pollfd pfd;
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  if (poll(&pfd, 1, timeout) <= 0) {
+    return 0;
+  }
+#endif
+  read_events();
+  return 1;
+}
+
+int DirWatcher::fetch(LinkedList<std::string> *plabel) {
+  if (fd >= 0) {
+    read_events();
+  }
+  for (std::set<std::string>::iterator i = touched.begin(); i != touched.end();
+       i++) {
+    (*plabel) << new std::string(*i);
+  }
+  touched.clear();
+  int ok = !lost && fd >= 0;
+  lost = 0;
+  return ok;
+}
@@ -1,6 +1,7 @@
 #include <fstream>
 #include <sstream>
 #include "mclib.h"
+#include "mctraj.h"
 #include "drawpd.h"
 #include "parse.h"
 #include "getvalue.h"
@@ -8,6 +9,7 @@
 #include "version.h"
 #include "teci.h"
 #include "keci.h"
+#include "anyfft.h"
 #include "plugin.h"
 
 extern const char *helpstring;
@@ -46,7 +48,17 @@ int main(int argc, char *argv[]) {
   int droplast=0;
   int addmux=0;
   const char *my_init_str="";
+  const char *rng_in_file="";
+  const char *rng_out_file="";
   const char *kspace_labels="";
+  int kspace_real_space=0;
+  int nb_threads=1;
+  int index_table=0;
+  int rejection_free=0;
+  int pt_interval=0;
+  const char *itable_file="";
+  const char *traj_file="";
+  int traj_compression=0;
   AskStruct options[]={
     {"","Eazy Monte Carlo Code " MAPS_VERSION ", by Axel van de Walle",TITLEVAL,NULL},
     {"-h","Help",BOOLVAL,&help},
@@ -81,7 +93,17 @@ int main(int argc, char *argv[]) {
     {"-dl","Drop the last data point of each inner loop (after the phase transition occured)",BOOLVAL,&droplast},
     {"-g2c","Convert output to canonical rather than grand-canonical quantities",BOOLVAL,&addmux},
     {"-is","File name containing a user-specified initial configuration (replaces -gs)",STRINGVAL,&my_init_str},
-    {"-ks","Specify how k space ECI are calculated (e.g. -ks=cs).",STRINGVAL,&kspace_labels}
+    {"-irs","File containing a random number generator state saved with -ors (to continue a run; replaces -sd)",STRINGVAL,&rng_in_file},
+    {"-ors","Output random number generator state file, written at the end (default: do not write)",STRINGVAL,&rng_out_file},
+    {"-ks","Specify how k space ECI are calculated (e.g. -ks=cs).",STRINGVAL,&kspace_labels},
+    {"-ksr","Update the k space energy in real space after each accepted flip (instead of periodic FFTs)",BOOLVAL,&kspace_real_space},
+    {"-nt","Number of threads used for checkerboard-decomposed sweeps, k space FFTs and parallel tempering replicas (default: 1, serial)",INTVAL,&nb_threads},
+    {"-it","Store each spin once and find neighbors through precomputed index tables (instead of a padded spin array)",BOOLVAL,&index_table},
+    {"-rf","Use the rejection-free (n-fold way) algorithm in grand-canonical mode (efficient at low temperature)",BOOLVAL,&rejection_free},
+    {"-pt","Parallel tempering: run all points of each inner loop at once, exchanging replicas every [value] passes (default: 0, off)",INTVAL,&pt_interval},
+    {"-itf","Interaction table file: the clusters around each site are read from it if it matches lattice and clusters, otherwise found and saved to it (default: do not use a file)",STRINGVAL,&itable_file},
+    {"-otr","Output a binary trajectory file with one snapshot per point (default: do not write)",STRINGVAL,&traj_file},
+    {"-trz","zstd compression level of the trajectory snapshots (default: 0, off)",INTVAL,&traj_compression}
   };
   if (!get_values(argc,argv,countof(options),options)) {
     display_help(countof(options),options);
@@ -100,6 +122,15 @@ int main(int argc, char *argv[]) {
     mu_l[1]=0.;
     do_abs=1;
     cerr << "Running in canonical mode: limited features available" << endl;
+    if (rejection_free) ERRORQUIT("The -rf option is only available in grand-canonical mode.");
+  }
+  if (rejection_free && strlen(kspace_labels)>0) ERRORQUIT("The -rf and -ks options cannot be combined.");
+  int gc_mode=(rejection_free ? 3 : 1);
+  if (pt_interval>0) {
+    if (can_mode) ERRORQUIT("The -pt option is only available in grand-canonical mode.");
+    if (x_prec>0.) ERRORQUIT("The -pt option requires -eq and -n (not -dx).");
+    if (strlen(kspace_labels)>0) ERRORQUIT("The -pt and -ks options cannot be combined.");
+    if (rejection_free) ERRORQUIT("The -pt and -rf options cannot be combined.");
   }
   if (strlen(my_init_str)>0) {
     init_gs=-1;
@@ -286,6 +317,9 @@ int main(int argc, char *argv[]) {
     }
   }
   if (!quiet) cout << "Supercell size: " << simple_supercell << endl;
+  // found once, for the main simulation and all parallel tempering replicas;
+  MCInteractionTable itable;
+  get_interaction_table(&itable,lattice_only,spacegroup,clusterlist,itable_file);
   MonteCarlo *pmc;
   MultiKSpaceECI multi_kspace_eci;
   if (strlen(kspace_labels)>0) {
@@ -298,10 +332,22 @@ int main(int argc, char *argv[]) {
     for (; i; i++) {
       i->static_init(lattice_only);
     }
-    pmc=new KSpaceMonteCarlo(lattice_only,simple_supercell,spacegroup,clusterlist,&multi_kspace_eci);
+    KSpaceMonteCarlo *pkmc=new KSpaceMonteCarlo(lattice_only,simple_supercell,itable,&multi_kspace_eci);
+    pkmc->set_real_space_update(kspace_real_space);
+    pmc=pkmc;
   }
   else {
-    pmc=new MonteCarlo(lattice_only,simple_supercell,spacegroup,clusterlist);
+    pmc=new MonteCarlo(lattice_only,simple_supercell,itable,index_table);
+  }
+  if (nb_threads>1) {
+    pmc->set_nb_threads(nb_threads);
+    set_fft_nb_threads(nb_threads);
+  }
+  if (strlen(rng_in_file)>0) {
+    ifstream rngfile(rng_in_file);
+    RandomStream rng;
+    if (!(rngfile >> rng)) ERRORQUIT("Unable to read random number generator state file");
+    pmc->set_random_stream(rng);
   }
 
   ofstream mcfile(outfile);
@@ -310,6 +356,11 @@ int main(int argc, char *argv[]) {
   cout.setf(ios::fixed);
   cout.precision(sigdig);
 
+  TrajectoryWriter traj;
+  if (strlen(traj_file)>0) {
+    if (!traj.open(traj_file,pmc->get_lattice(),labellookup,label,axes,pmc->get_supercell(),traj_compression)) ERRORQUIT("Unable to open trajectory file");
+  }
+
   if (can_mode) {
     Real T=T_l[0];
     Real phi=(phi0==MAXFLOAT ? (init_gs==-1 ? 0 : gs_energy(init_gs)) : phi0);
@@ -349,6 +400,13 @@ int main(int argc, char *argv[]) {
               ++snapshotnum;
           }
       }
+      if (traj.is_open()) {
+	Array<int> species;
+	pmc->get_species(&species);
+	Array<Real> cond(1);
+	cond(0)=T;
+	traj.write_frame(species,cond);
+      }
 
       if (init_gs==-1) mcdata.lro=0.;
       
@@ -425,6 +483,10 @@ int main(int argc, char *argv[]) {
     Real old_E,old_x,very_old_E,very_old_x,very_old_phi;
     LinkedList<Real> order_list;
     LinkedList<Real> outer_order_list;
+    Array<MonteCarlo *> pt_replica;
+    ReplicaExchange *ppt=NULL;
+    Array<MCOutputData> pt_data;
+    int pt_point=0;
     while (1) {
       if (new_scan) {
 	pmc->init_structure(*my_p_init_str);
@@ -438,12 +500,70 @@ int main(int argc, char *argv[]) {
       pmc->set_eci(eci);
       pmc->init_run(T,mu);
 
-      if (new_scan) {
-	if (x_prec==0.) pmc->run(n_equil,1);
+      if (new_scan && pt_interval>0) {
+	// all points of this inner loop are run at once, one replica each;
+	LinkedList<Real> T_list,mu_list;
+	Real pt_T=T;
+	Real pt_mu=mu;
+	while (1) {
+	  T_list << new Real(pt_T);
+	  mu_list << new Real(pt_mu);
+	  if (innerT) {
+	    if (dodb) {
+	      pt_T=1./((1./pt_T)+db);
+	    }
+	    else {
+	      pt_T+=dT;
+	    }
+	    if (!is_between(pt_T,T_l[0],T_l[1])) break;
+	  }
+	  else {
+	    pt_mu+=dmu;
+	    if (!is_between(pt_mu,mu_l[0],mu_l[1])) break;
+	  }
+	}
+	Array<Real> pt_T_list,pt_mu_list;
+	LinkedList_to_Array(&pt_T_list,T_list);
+	LinkedList_to_Array(&pt_mu_list,mu_list);
+	Array<Array<Real> > pt_eci(pt_T_list.get_size());
+	for (int i=0; i<pt_T_list.get_size(); i++) {
+	  teci.interpol(&pt_eci(i),pt_T_list(i));
+	}
+	if (!ppt) {
+	  pt_replica.resize(pt_T_list.get_size());
+	  for (int i=0; i<pt_replica.get_size(); i++) {
+	    pt_replica(i)=new MonteCarlo(lattice_only,simple_supercell,itable,index_table);
+	  }
+	  ppt=new ReplicaExchange(pt_replica);
+	  ppt->set_nb_threads(nb_threads);
+	}
+	for (int i=0; i<pt_replica.get_size(); i++) {
+	  pt_replica(i)->init_structure(*my_p_init_str);
+	  if (init_conc!=MAXFLOAT) pt_replica(i)->set_concentration(init_conc);
+	}
+	ppt->init_run(pt_T_list,pt_mu_list,pt_eci);
+	ppt->run(&pt_data,n_equil,n_step,pt_interval,1);
+	if (!quiet) {
+	  cerr << "Replica exchange acceptance:";
+	  for (int i=0; i<pt_replica.get_size()-1; i++) {cerr << " " << ppt->get_swap_rate(i);}
+	  cerr << endl;
+	}
+	pt_point=0;
+      }
+      else if (new_scan) {
+	if (x_prec==0.) pmc->run(n_equil,gc_mode);
       }
       
       MCOutputData mcdata;
-      run_mc(&mcdata,pmc,1,n_step,x_prec,which_col);
+      MonteCarlo *pcur_mc=pmc;
+      if (ppt) {
+	mcdata=pt_data(pt_point);
+	pcur_mc=ppt->get_replica_at(pt_point);
+	pt_point++;
+      }
+      else {
+	run_mc(&mcdata,pmc,gc_mode,n_step,x_prec,which_col);
+      }
 
       if (strlen(snapshotnumfile)>0) {
 
@@ -459,10 +579,18 @@ int main(int argc, char *argv[]) {
         std::ofstream file(filename);
         file << std::fixed << std::setprecision(sigdig);
 
-        pmc->view(labellookup, label, file, axes);
+        pcur_mc->view(labellookup, label, file, axes);
         ++snapshotnum;
     }
       }
+      if (traj.is_open()) {
+	Array<int> species;
+	pcur_mc->get_species(&species);
+	Array<Real> cond(2);
+	cond(0)=T;
+	cond(1)=mu;
+	traj.write_frame(species,cond);
+      }
 
       if (init_gs==-1) mcdata.lro=0.;
       
@@ -597,6 +725,10 @@ int main(int argc, char *argv[]) {
 	}
       }
     }
+    if (ppt) {
+      delete ppt;
+      for (int i=0; i<pt_replica.get_size(); i++) {delete pt_replica(i);}
+    }
   }
   {
     ofstream file(snapshotfile);
@@ -604,6 +736,10 @@ int main(int argc, char *argv[]) {
     file.precision(sigdig);
     pmc->view(labellookup,label,file,axes);
   }
+  if (strlen(rng_out_file)>0) {
+    ofstream file(rng_out_file);
+    file << pmc->get_random_stream() << endl;
+  }
   delete pmc;
 }
 
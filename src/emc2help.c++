@@ -93,6 +93,62 @@ const char *helpstring=""
 "\n"
 "-o:       Name of the output file (default: mc.out).\n"
 "\n"
+"-it: halo-free storage. By default, spins are stored in an array padded\n"
+"     by the range of the clusters so that neighbors are reached by a fixed\n"
+"     offset, but every flip must then update all periodic images.  With -it,\n"
+"     each spin is stored once and the neighbors of every site are read from\n"
+"     a precomputed index table (one int per cluster site per lattice site).\n"
+"     This is faster for small supercells or long-range clusters, at the\n"
+"     cost of the memory taken by the table.\n"
+"\n"
+"-itf: interaction table file. Setting up a simulation requires finding all\n"
+"     the clusters that contain each site of the lattice, which can take a\n"
+"     while with many or large clusters.  With -itf=file, the result is saved\n"
+"     to that (binary) file and read back by later runs, provided the lattice,\n"
+"     its symmetry and clusters.out are unchanged (otherwise the file is\n"
+"     simply rebuilt).  The table does not depend on the supercell size.\n"
+"\n"
+"-otr: binary trajectory file. Writes the configuration reached at every point\n"
+"     of the scan (where -opss writes one structure file) to a single file\n"
+"     holding the lattice, labels and supercell once, followed by the species\n"
+"     of each site packed in as few bits as needed, along with T and mu.\n"
+"     This is much smaller and faster than -opss for large supercells.\n"
+"     The trajstr utility lists the snapshots of such a file and converts\n"
+"     them to the str.out format (the same output as -opss).\n"
+"     -trz=level further compresses each snapshot with zstd (requires ATAT\n"
+"     to be built with the cmake option USEZSTD).\n"
+"\n"
+"-nt: number of threads. When larger than 1, each Monte Carlo pass is a\n"
+"     checkerboard sweep: the supercell is cut into blocks at least as wide\n"
+"     as the range of the clusters, blocks of the same color are updated\n"
+"     concurrently (each with its own random number stream) and the colors\n"
+"     are visited in random order. Runs are reproducible for a given seed\n"
+"     and number of threads, but differ (statistically) from the serial run.\n"
+"     Ignored with -ks or when the supercell is too small to be split.\n"
+"\n"
+"-rf: rejection-free (n-fold way) algorithm. The flip rate of every site is\n"
+"     kept up to date and each step flips a site chosen with probability\n"
+"     proportional to its rate, while the clock advances by a random waiting\n"
+"     time distributed like the run of rejected attempts that Metropolis\n"
+"     sampling would have gone through before that flip.\n"
+"     Averages are identical (statistically) to the default algorithm and\n"
+"     are still taken once per pass. Each flip is more costly, so this only\n"
+"     pays off at low temperature, where most Metropolis flips are\n"
+"     rejected. Grand-canonical mode only; cannot be combined with -ks;\n"
+"     the -nt option is ignored.\n"
+"\n"
+"-pt: parallel tempering (replica exchange). All the points of an inner\n"
+"     loop (over mu, or over T with -innerT) are simulated at once, each by\n"
+"     its own replica; replicas are run on as many threads as there are\n"
+"     cores. Every [value] passes, replicas at neighboring points try to\n"
+"     exchange their conditions (T, mu and ECI; the spins themselves are not\n"
+"     copied) with the usual Metropolis acceptance probability. This helps a\n"
+"     scan cross first-order transitions without hysteresis. Each replica\n"
+"     performs -eq equilibration passes and -n averaging passes; the output\n"
+"     format is unchanged and the exchange acceptance rates are printed to\n"
+"     stderr.\n"
+"     Grand-canonical mode only; cannot be combined with -dx, -ks or -rf.\n"
+"\n"
 "Tricks:\n"
 "\n"
 "   To read parameters from a file, use:\n"
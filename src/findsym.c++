@@ -948,6 +948,76 @@ int equiv_to_lexico_successor(const Structure &str, const rMatrix3d &unitcell,
   return 0;
 }
 
+void min_equivalent_decoration(Array<int> *pdeco, const Structure &str,
+                               const rMatrix3d &unitcell,
+                               const Array<rMatrix3d> &point_op,
+                               const Array<rVector3d> &trans) {
+  int n = str.atom_pos.get_size();
+  rMatrix3d isupcel = !(str.cell);
+  *pdeco = str.atom_type;
+  Array<int> image(n);
+  LatticePointInCellIterator l(unitcell, str.cell);
+  for (; l; l++) {
+    for (int op = 0; op < point_op.get_size(); op++) {
+      for (int i = 0; i < n; i++) {
+        int j = which_atom(
+            str.atom_pos,
+            point_op(op) * str.atom_pos(i) + trans(op) + (rVector3d)l, isupcel);
+        image(i) = str.atom_type(j);
+      }
+      int i;
+      for (i = n - 1; i >= 0; i--) {
+        if (image(i) != (*pdeco)(i))
+          break;
+      }
+      if (i >= 0 && image(i) < (*pdeco)(i)) {
+        *pdeco = image;
+      }
+    }
+  }
+}
+
+int map_onto_supercell(Array<int> *pdeco, const Structure &str,
+                       const Structure &supercell,
+                       const SpaceGroup &spacegroup) {
+  int n = supercell.atom_pos.get_size();
+  if (n == 0 || str.atom_pos.get_size() % n != 0)
+    return 0;
+  Real nb_rep = (Real)(str.atom_pos.get_size() / n);
+  rMatrix3d isupcel = !(supercell.cell);
+  pdeco->resize(n);
+  for (int op = 0; op < spacegroup.point_op.get_size(); op++) {
+    rMatrix3d m = isupcel * (spacegroup.point_op(op) * str.cell);
+    if (!is_int(m) || !near_zero(fabs(det(m)) - nb_rep))
+      continue;
+    Array<rVector3d> pos;
+    apply_symmetry(&pos, spacegroup.point_op(op), spacegroup.trans(op),
+                   str.atom_pos);
+    fill_array(pdeco, -1);
+    int at;
+    for (at = 0; at < pos.get_size(); at++) {
+      int s = which_atom(supercell.atom_pos, pos(at), isupcel);
+      if (s == -1)
+        break;
+      if ((*pdeco)(s) == -1) {
+        (*pdeco)(s) = str.atom_type(at);
+      } else if ((*pdeco)(s) != str.atom_type(at)) {
+        break;
+      }
+    }
+    if (at == pos.get_size()) {
+      int s;
+      for (s = 0; s < n; s++) {
+        if ((*pdeco)(s) == -1)
+          break;
+      }
+      if (s == n)
+        return 1;
+    }
+  }
+  return 0;
+}
+
 int contains_pure_translations_or_lexico_successor(const Structure &str,
                                                    const rMatrix3d &unitcell) {
   rMatrix3d isupcel = !(str.cell);
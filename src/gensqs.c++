@@ -180,14 +180,26 @@ int main(int argc, char *argv[]) {
       find_equivalent_clusters(&eqclus(t), *ic, lat.cell, spacegroup.point_op,
                                spacegroup.trans);
     }
+    // the site positions are the same for all configurations;
+    SupercellSiteTable tab;
+    CorrelationKernel kernel;
+    int usekernel = tab.init(blank_superstructure, lat.cell) &&
+                    kernel.init(tab, eqclus);
+    Array<int> site_type;
     MultiDimIterator<Arrayint> config(blank_superstructure.atom_type);
     for (; config; config++) {
       blank_superstructure.atom_type = config;
+      if (usekernel) {
+        get_site_types(&site_type, blank_superstructure, tab);
+        kernel.set_structure(site_type, *pcorrfunc);
+      }
       int t;
       for (t = 0; t < corrarray.get_size(); t++) {
-        if (fabs(corrarray(t) - calc_correlation(blank_superstructure,
+        Real rho = (usekernel ? kernel.get_correlation(t)
+                              : calc_correlation(blank_superstructure,
                                                  eqclus(t), lat.cell,
-                                                 *pcorrfunc)) > mysqstol)
+                                                 *pcorrfunc));
+        if (fabs(corrarray(t) - rho) > mysqstol)
           break;
       }
       if (t == corrarray.get_size()) {
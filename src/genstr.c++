@@ -11,11 +11,13 @@ int main(int argc, char *argv[]) {
   const char *latticefilename="lat.in";
   int sigdig=6;
   int do2D=0;
+  int nb_threads=1;
   AskStruct options[]={
     {"","GENerate STRuctures " MAPS_VERSION ", by Axel van de Walle",TITLEVAL,NULL},
     {"-n","maximum nb of atom/unit cell",INTVAL,&maxvol},
     {"-sig","Number of significant digits to print in output files",INTVAL,&sigdig},
     {"-2d","Find supercells along a and b axes only",BOOLVAL,&do2D},
+    {"-nt","Number of threads used to enumerate the configurations of each supercell (default: 1)",INTVAL,&nb_threads},
     {"-l","Input file defining the lattice (default: lat.in)",STRINGVAL,&latticefilename}
   };
   if (!get_values(argc,argv,countof(options),options)) {
@@ -75,6 +77,7 @@ int main(int argc, char *argv[]) {
     spacegroup.cell=lat.cell;
     find_spacegroup(&spacegroup.point_op,&spacegroup.trans,lat.cell,lat.atom_pos,lat.atom_type);
     StructureBank<Structure> str_bank(lat, site_type_list, spacegroup,do2D);
+    str_bank.set_nb_threads(nb_threads);
     while (1) {
 #ifndef SLOWENUMALGO
 	if (str_bank.get_current_structure().atom_pos.get_size()>maxvol) break;
@@ -173,6 +173,171 @@ Real calc_cv(const Array2d<Real> &x, const Array<Real> &y,
   return calc_cv(*px, *py);
 }
 
+IncrementalCV::IncrementalCV(void)
+    : weight(), col(), col_basis(), basis_col(), q(), r(), hat() {
+  nb_row = 0;
+  nb_col = 0;
+  nb_basis = 0;
+}
+
+void IncrementalCV::init(const Array<Real> &_weight) {
+  weight = _weight;
+  nb_row = 0;
+  nb_col = 0;
+  nb_basis = 0;
+}
+
+void IncrementalCV::reserve(int n) {
+  if (n <= col.get_size()) {
+    return;
+  }
+  int size = MAX(n, 2 * col.get_size());
+  Array<Array<Real>> newcol(size), newq(size), newr(size);
+  Array<int> newcol_basis(size), newbasis_col(size);
+  for (int j = 0; j < nb_col; j++) {
+    newcol(j) = std::move(col(j));
+    newcol_basis(j) = col_basis(j);
+  }
+  for (int k = 0; k < nb_basis; k++) {
+    newq(k) = std::move(q(k));
+    newr(k) = std::move(r(k));
+    newbasis_col(k) = basis_col(k);
+  }
+  col = std::move(newcol);
+  q = std::move(newq);
+  r = std::move(newr);
+  col_basis = std::move(newcol_basis);
+  basis_col = std::move(newbasis_col);
+}
+
+void IncrementalCV::truncate(int n) {
+  nb_col = n;
+  while (nb_basis > 0 && basis_col(nb_basis - 1) >= n) {
+    nb_basis--;
+  }
+  // recomputed rather than downdated, so that roundoff does not accumulate;
+  zero_array(&hat);
+  for (int k = 0; k < nb_basis; k++) {
+    for (int i = 0; i < nb_row; i++) {
+      hat(i) += sqr(q(k)(i));
+    }
+  }
+}
+
+void IncrementalCV::append(const Array2d<Real> &x, int j) {
+  Array<Real> &c = col(nb_col);
+  c.resize(nb_row);
+  Array<Real> v(nb_row);
+  for (int i = 0; i < nb_row; i++) {
+    c(i) = x(i, j);
+    v(i) = (weight.get_size() == 0 ? 1. : weight(i)) * c(i);
+  }
+  // modified Gram-Schmidt, done twice to keep q orthonormal to working
+  // precision;
+  Array<Real> coef(nb_basis + 1);
+  zero_array(&coef);
+  for (int pass = 0; pass < 2; pass++) {
+    for (int k = 0; k < nb_basis; k++) {
+      Real p = inner_product(q(k), v);
+      coef(k) += p;
+      for (int i = 0; i < nb_row; i++) {
+        v(i) -= p * q(k)(i);
+      }
+    }
+  }
+  Real len2 = 0.;
+  for (int i = 0; i < nb_row; i++) {
+    len2 += sqr(v(i));
+  }
+  // same criterion as in build_basis (used by list_nonredundant_columns);
+  if (sqrt(len2 / max(1.0, (Real)nb_row)) < zero_tolerance) {
+    col_basis(nb_col) = -1;
+  } else {
+    Real len = sqrt(len2);
+    for (int i = 0; i < nb_row; i++) {
+      v(i) /= len;
+      hat(i) += sqr(v(i));
+    }
+    coef(nb_basis) = len;
+    q(nb_basis) = std::move(v);
+    r(nb_basis) = std::move(coef);
+    basis_col(nb_basis) = nb_col;
+    col_basis(nb_col) = nb_basis;
+    nb_basis++;
+  }
+  nb_col++;
+}
+
+void IncrementalCV::set_design(const Array2d<Real> &x) {
+  if (x.get_size()(0) != nb_row) {
+    nb_row = x.get_size()(0);
+    nb_col = 0;
+    nb_basis = 0;
+    hat.resize(nb_row);
+    zero_array(&hat);
+  }
+  int keep = 0;
+  for (; keep < MIN(nb_col, x.get_size()(1)); keep++) {
+    int i = 0;
+    while (i < nb_row && x(i, keep) == col(keep)(i)) {
+      i++;
+    }
+    if (i < nb_row) {
+      break;
+    }
+  }
+  if (keep < nb_col) {
+    truncate(keep);
+  }
+  reserve(x.get_size()(1));
+  for (int j = keep; j < x.get_size()(1); j++) {
+    append(x, j);
+  }
+}
+
+Real IncrementalCV::get_cv(const Array<Real> &y) const {
+  Array<Real> e(nb_row);
+  for (int i = 0; i < nb_row; i++) {
+    e(i) = (weight.get_size() == 0 ? 1. : weight(i)) * y(i);
+  }
+  for (int k = 0; k < nb_basis; k++) {
+    Real p = inner_product(q(k), e);
+    for (int i = 0; i < nb_row; i++) {
+      e(i) -= p * q(k)(i);
+    }
+  }
+  Real cv = 0.;
+  for (int i = 0; i < nb_row; i++) {
+    Real den = 1. - hat(i);
+    if (den < zero_tolerance) {
+      return MAXFLOAT;
+    }
+    cv += sqr(e(i) / den);
+  }
+  return sqrt(cv / (Real)nb_row);
+}
+
+void IncrementalCV::get_fit(Array<Real> *pb, const Array<Real> &y) const {
+  Array<Real> wy(nb_row);
+  for (int i = 0; i < nb_row; i++) {
+    wy(i) = (weight.get_size() == 0 ? 1. : weight(i)) * y(i);
+  }
+  // solve r*beta=q^T*wy by back-substitution;
+  Array<Real> beta(nb_basis);
+  for (int k = nb_basis - 1; k >= 0; k--) {
+    Real b = inner_product(q(k), wy);
+    for (int l = k + 1; l < nb_basis; l++) {
+      b -= r(l)(k) * beta(l);
+    }
+    beta(k) = b / r(k)(k);
+  }
+  pb->resize(nb_col);
+  zero_array(pb);
+  for (int k = 0; k < nb_basis; k++) {
+    (*pb)(basis_col(k)) = beta(k);
+  }
+}
+
 void predict_ols(Array<Real> *p_yhat, const Array2d<Real> &x,
                  const Array<Real> &y, const Array<Real> &weight,
                  int nonredundant) {
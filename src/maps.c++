@@ -7,6 +7,7 @@
 #include <iomanip>
 #include <sstream>
 
+#include "dirwatch.h"
 #include "getvalue.h"
 #include "parse.h"
 #include "refine.h"
@@ -36,6 +37,7 @@ void write_structure_file(const StructureInfo &str, const Structure &lat,
         std::filesystem::perm_options::replace
     );
   if (std::filesystem::exists(str.label.c_str())) {
+    std::filesystem::current_path(str.label);
     ofstream file("str.out");
     file.setf(ios::fixed);
     file.precision(sigdig);
@@ -175,6 +177,53 @@ int update_structure(StructureInfo *pstr, Real atom_factor) {
   return changed;
 }
 
+// Reads the structure in directory label and adds it to the bank (if it is
+// new or was unknown); returns 1 if the bank has changed.
+int load_structure(StructureBank<StructureInfo> *pstr_bank,
+		   const std::string &label, const Structure &lattice,
+		   const Array<Arrayint> &site_type_list,
+		   const Array<std::string> &atom_label) {
+  int changed = 0;
+  if (!std::filesystem::is_directory(label)) {
+    cerr << "Unable to cd to " << label << endl;
+    return 0;
+  }
+  std::filesystem::current_path(label);
+  StructureInfo str;
+  ifstream strfile("str.out");
+  if (strfile) {
+    if (parse_structure_file(&str.cell, &str.atom_pos, &str.atom_type,
+			     atom_label, strfile)) {
+      if (str.atom_pos.get_size() == 0) {
+	cerr << "Problem reading structure " << label << endl;
+	ERRORQUIT("Aborting.");
+      }
+      if (fix_atom_type(&str, lattice, site_type_list, 0)) {
+	StructureInfo *pstr;
+	if (pstr_bank->add_structure(str, &pstr)) {
+	  pstr->label = label;
+	  if (update_structure(pstr, lattice.atom_pos.get_size())) changed = 1;
+	} else {
+	  if (pstr->status & StructureInfo::unknown) {
+	    pstr->label = label;
+	    if (update_structure(pstr, lattice.atom_pos.get_size())) changed = 1;
+	  } else {
+	    cerr << "Structure " << label
+		 << " not loaded since it is the same as structure " << pstr->label
+		 << endl;
+	  }
+	}
+      } else {
+	cerr << "Error while reading structure " << label << endl;
+      }
+    } else {
+      cerr << "Error while reading structure " << label << endl;
+    }
+  }
+  std::filesystem::current_path("..");
+  return changed;
+}
+
 int update_all_structures(StructureBank<StructureInfo> *pstr_bank,
 			  const Structure &lattice,
 			  const Array<Arrayint> &site_type_list,
@@ -205,10 +254,11 @@ int update_all_structures(StructureBank<StructureInfo> *pstr_bank,
 	i->status = StructureInfo::unknown;
 	changed = 1;
       } else {
-	if (std::filesystem::exists(i->label.c_str())) {
+	if (std::filesystem::is_directory(i->label)) {
+	  std::filesystem::current_path(i->label);
 	  if (update_structure(&(*i), lattice.atom_pos.get_size())) changed = 1;
 	  delete label_on_disk.detach(i_disk);
-      std::filesystem::current_path("..");
+	  std::filesystem::current_path("..");
 	}
       }
     }
@@ -216,46 +266,42 @@ int update_all_structures(StructureBank<StructureInfo> *pstr_bank,
 
   LinkedListIterator<std::string> i_disk(label_on_disk);
   for (; i_disk; i_disk++) {
-    if (std::filesystem::exists(*i_disk)) {
-      StructureInfo str;
-      ifstream strfile("str.out");
-      if (strfile) {
-	if (parse_structure_file(&str.cell, &str.atom_pos, &str.atom_type,
-				 atom_label, strfile)) {
-	  if (str.atom_pos.get_size() == 0) {
-	    cerr << "Problem reading structure " << *i_disk << endl;
-	    ERRORQUIT("Aborting.");
-	  }
-	  if (fix_atom_type(&str, lattice, site_type_list, 0)) {
-	    StructureInfo *pstr;
-	    if (pstr_bank->add_structure(str, &pstr)) {
-	      pstr->label = *i_disk;
-	      if (update_structure(pstr, lattice.atom_pos.get_size()))
-		changed = 1;
-	    } else {
-	      if (pstr->status & StructureInfo::unknown) {
-		pstr->label = *i_disk;
-		if (update_structure(pstr, lattice.atom_pos.get_size()))
-		  changed = 1;
-	      } else {
-		cerr << "Structure " << *i_disk
-		     << " not loaded since it is the same as structure "
-		     << pstr->label << endl;
-	      }
-	    }
-	  } else {
-	    cerr << "Error while reading structure " << *i_disk << endl;
-	  }
-	} else {
-	  cerr << "Error while reading structure " << *i_disk << endl;
-	}
+    if (load_structure(pstr_bank, *i_disk, lattice, site_type_list,
+		       atom_label))
+      changed = 1;
+  }
+  unlink("strlist.out");  // cleanup structure list file;
+  return changed;
+}
+
+// Same as update_all_structures, but only looks at the directories listed.
+int update_structures(StructureBank<StructureInfo> *pstr_bank,
+		      const LinkedList<std::string> &label_list,
+		      const Structure &lattice,
+		      const Array<Arrayint> &site_type_list,
+		      const Array<std::string> &atom_label) {
+  int changed = 0;
+  LinkedListIterator<std::string> l(label_list);
+  for (; l; l++) {
+    int on_disk = file_exists((*l + "/str.out").c_str());
+    LinkedListIterator<StructureInfo> i(pstr_bank->get_structure_list());
+    for (; i; i++) {
+      if (!(i->status & StructureInfo::unknown) && i->label == *l) break;
+    }
+    if (i) {
+      if (!on_disk) {
+	i->status = StructureInfo::unknown;
+	changed = 1;
+      } else {
+	std::filesystem::current_path(*l);
+	if (update_structure(&(*i), lattice.atom_pos.get_size())) changed = 1;
+	std::filesystem::current_path("..");
       }
-      std::filesystem::current_path("..");
-    } else {
-      cerr << "Unable to cd to " << *i_disk << endl;
+    } else if (on_disk) {
+      if (load_structure(pstr_bank, *l, lattice, site_type_list, atom_label))
+	changed = 1;
     }
   }
-  unlink("strlist.out");  // cleanup structure list file;
   return changed;
 }
 
@@ -266,6 +312,8 @@ int main(int argc, char *argv[]) {
   int dohelp = 0;
   const char *latticefilename = "lat.in";
   int polltime = 10;
+  int rescantime = 600;
+  int nowatch = 0;
   int max_multiplet = 4;
   int dummy = 0;
   int quiet = 0;
@@ -273,6 +321,8 @@ int main(int argc, char *argv[]) {
   Real minc_gs_ok = 0.;
   Real maxc_gs_ok = 1.;
   int do2D = 0;
+  int nb_threads = 1;
+  int nocache = 0;
   Real complexity_exp = 3.;
   int user_max_vol = 32000;
   Real max_weight = 16.;
@@ -292,6 +342,18 @@ int main(int argc, char *argv[]) {
        &complexity_exp},
       {"-t", "Time between disk reads in sec (default: 10 sec)", INTVAL,
        &polltime},
+      {"-tr",
+       "Time between full rescans of all directories in sec when watching "
+       "them for changes (default: 600 sec)",
+       INTVAL, &rescantime},
+      {"-nw", "Do not watch directories for changes, just poll them (see -t)",
+       BOOLVAL, &nowatch},
+      {"-nt",
+       "Number of threads used to enumerate new structures and compute their "
+       "correlations (default: 1)",
+       INTVAL, &nb_threads},
+      {"-ncc", "Do not read or update the correlation cache (corrcache.bin)",
+       BOOLVAL, &nocache},
       {"-m", "Maximum number of points in cluster (default 4)", INTVAL,
        &max_multiplet},
       {"-g",
@@ -392,6 +454,13 @@ int main(int argc, char *argv[]) {
   pce->set_max_weight(max_weight);
   pce->set_predictor_labels(predictor_labels);
   pce->access_structure_bank().set_2D_mode(do2D);
+  pce->access_structure_bank().set_nb_threads(nb_threads);
+  pce->set_nb_threads(nb_threads);
+  CorrelationCache corrcache;
+  if (!nocache) {
+    corrcache.open("corrcache.bin");
+    pce->set_correlation_cache(&corrcache);
+  }
 
   if (gsnbatom) {
     if (!quiet)
@@ -412,12 +481,29 @@ int main(int argc, char *argv[]) {
   fitinfo.status = CEFitInfo::fit_impossible;
   write_fit_info(fitinfo, lat, site_type_list, atom_label, axes);
 
+  // watch the structure directories, so that only those that changed need to
+  // be reread; otherwise (or periodically, see -tr) reread all of them;
+  DirWatcher watcher;
+  if (!nowatch && !watcher.init(".") && !quiet) {
+    cerr << "Unable to watch directories for changes, polling instead." << endl;
+  }
+  time_t last_rescan = 0;
+  auto update_bank = [&](void) {
+    LinkedList<std::string> touched;
+    if (!watcher.fetch(&touched) || file_exists("refresh") ||
+	time(NULL) - last_rescan >= rescantime) {
+      last_rescan = time(NULL);
+      return update_all_structures(&(pce->access_structure_bank()), lat,
+				   site_type_list, atom_label);
+    }
+    return update_structures(&(pce->access_structure_bank()), touched, lat,
+			     site_type_list, atom_label);
+  };
+
   // main loop: wait for "events";
   while (1) {
     // look for updated structure status/energy;
-    while (update_all_structures(&(pce->access_structure_bank()), lat,
-				 site_type_list, atom_label) ||
-	   file_exists("refresh")) {
+    while (update_bank() || file_exists("refresh")) {
       while (file_exists("refresh")) unlink("refresh");
       // if there are changes, fit a new CE;
       CEFitInfo fitinfo;
@@ -447,9 +533,13 @@ int main(int argc, char *argv[]) {
       pstr->status = StructureInfo::busy;	     // mark structure as busy;
       if (!quiet) cerr << "done!" << endl;
     }
-    for (int t = 0; t < polltime; t++) {
-      if (file_exists("refresh")) break;
-      std::this_thread::sleep_for(std::chrono::seconds(1));
+    if (watcher.is_active()) {
+      watcher.wait(polltime * 1000);
+    } else {
+      for (int t = 0; t < polltime; t++) {
+	if (file_exists("refresh")) break;
+	std::this_thread::sleep_for(std::chrono::seconds(1));
+      }
     }
   }
   unlink("stop");
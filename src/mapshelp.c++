@@ -206,6 +206,13 @@ const char *helpstring =
     "-maps continuously scans all the subdirectories 'n' for 'n/energy' or "
     "'n/error'\n"
     " files and updates the cluster expansion accordingly.\n"
+    " On Linux, maps is notified of changes in the subdirectories (inotify) "
+    "and only\n"
+    " rereads those that changed (plus a full rescan every -tr seconds).\n"
+    " Changes made on another machine through a network filesystem may not "
+    "be\n"
+    " noticed until then: use -nw to poll all subdirectories every -t "
+    "seconds instead.\n"
     "-maps updates the cluster expansion whenever a file called 'refresh' is "
     "created\n"
     " (maps then deletes it).\n"
@@ -0,0 +1,333 @@
+#include "mcitable.h"
+#include "calccorr.h"
+#include "corrcache.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+
+#define MCITABLE_MAGIC "ATATIT01"
+#define MCITABLE_MAGIC_LEN 8
+
+static const Array<rVector3d> &sites_of(const Cluster &c) { return c; }
+static const Array<rVector3d> &sites_of(const MultiCluster &c) {
+  return c.clus;
+}
+static int type_of(const Cluster &c, int i) { return 0; }
+static int type_of(const MultiCluster &c, int i) { return c.site_type(i); }
+static int func_of(const Cluster &c, int i) { return 0; }
+static int func_of(const MultiCluster &c, int i) { return c.func(i); }
+
+MCInteractionTable::MCInteractionTable(void)
+    : type_size(), mult_per_atom(), which_cluster(), cluster_size(), first_member(),
+      member_site(), member_cell(), member_type(), member_func() {
+  key = 0;
+  nb_site = 0;
+  total_clusters = 0;
+  which_is_empty = -1;
+  max_clus_len = 0.;
+}
+
+MCInteractionTable::MCInteractionTable(const Structure &lattice,
+                                       const SpaceGroup &space_group,
+                                       const LinkedList<Cluster> &cluster_list)
+    : MCInteractionTable() {
+  init(lattice, space_group, cluster_list);
+}
+
+MCInteractionTable::MCInteractionTable(
+    const Structure &lattice, const SpaceGroup &space_group,
+    const LinkedList<MultiCluster> &cluster_list)
+    : MCInteractionTable() {
+  init(lattice, space_group, cluster_list);
+}
+
+static void add_member(MCInteractionTable *pt, int s, const Structure &lattice,
+                       const rMatrix3d &inv_cell, const rVector3d &pos,
+                       int type, int func) {
+  int offset_in_cell = which_atom(lattice.atom_pos, pos, inv_cell);
+  pt->member_site[s].push_back(offset_in_cell);
+  pt->member_cell[s].push_back(
+      to_int(inv_cell * (pos - lattice.atom_pos(offset_in_cell))));
+  pt->member_type[s].push_back(type);
+  pt->member_func[s].push_back(func);
+}
+
+template <class C>
+static void build_table(MCInteractionTable *pt, const Structure &lattice,
+                        const SpaceGroup &space_group,
+                        const LinkedList<C> &cluster_list) {
+  pt->nb_site = lattice.atom_pos.get_size();
+  pt->total_clusters = cluster_list.get_size();
+  pt->which_is_empty = -1;
+  pt->max_clus_len = 0.;
+  pt->type_size.resize(pt->total_clusters);
+  pt->mult_per_atom.resize(pt->total_clusters);
+  // the clusters equivalent to each one are found once, for all sites;
+  Array<Array<C>> equiv(pt->total_clusters);
+  LinkedListIterator<C> c(cluster_list);
+  for (int i = 0; c; c++, i++) {
+    Real l = get_cluster_length(sites_of(*c));
+    if (l > pt->max_clus_len) pt->max_clus_len = l;
+    pt->type_size[i] = sites_of(*c).get_size();
+    pt->mult_per_atom[i] =
+        calc_multiplicity(*c, lattice.cell, space_group.point_op,
+                          space_group.trans) /
+        (Real)pt->nb_site;
+    if (sites_of(*c).get_size() == 0) {
+      pt->which_is_empty = i;
+    } else {
+      find_equivalent_clusters(&equiv(i), *c, space_group.cell,
+                               space_group.point_op, space_group.trans);
+    }
+  }
+
+  pt->which_cluster.assign(pt->nb_site, std::vector<int>());
+  pt->cluster_size.assign(pt->nb_site, std::vector<int>());
+  pt->first_member.assign(pt->nb_site, std::vector<int>());
+  pt->member_site.assign(pt->nb_site, std::vector<int>());
+  pt->member_cell.assign(pt->nb_site, std::vector<iVector3d>());
+  pt->member_type.assign(pt->nb_site, std::vector<int>());
+  pt->member_func.assign(pt->nb_site, std::vector<int>());
+  rMatrix3d inv_cell = !lattice.cell;
+  for (int s = 0; s < pt->nb_site; s++) {
+    for (int i = 0; i < pt->total_clusters; i++) {
+      for (int ec = 0; ec < equiv(i).get_size(); ec++) {
+        const C &e = equiv(i)(ec);
+        const Array<rVector3d> &clus = sites_of(e);
+        for (int center = 0; center < clus.get_size(); center++) {
+          rVector3d lat_shift = lattice.atom_pos(s) - clus(center);
+          if (!is_int(inv_cell * lat_shift)) continue;
+          pt->which_cluster[s].push_back(i);
+          pt->cluster_size[s].push_back(clus.get_size());
+          pt->first_member[s].push_back(pt->member_site[s].size());
+          add_member(pt, s, lattice, inv_cell, clus(center) + lat_shift,
+                     type_of(e, center), func_of(e, center));
+          for (int j = 0; j < clus.get_size(); j++) {
+            if (j != center) {
+              add_member(pt, s, lattice, inv_cell, clus(j) + lat_shift,
+                         type_of(e, j), func_of(e, j));
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+void MCInteractionTable::init(const Structure &lattice,
+                              const SpaceGroup &space_group,
+                              const LinkedList<Cluster> &cluster_list) {
+  build_table(this, lattice, space_group, cluster_list);
+  key = calc_interaction_table_key(lattice, space_group, cluster_list);
+}
+
+void MCInteractionTable::init(const Structure &lattice,
+                              const SpaceGroup &space_group,
+                              const LinkedList<MultiCluster> &cluster_list) {
+  build_table(this, lattice, space_group, cluster_list);
+  key = calc_interaction_table_key(lattice, space_group, cluster_list);
+}
+
+static uint64_t hash_matrix(const rMatrix3d &m, uint64_t h) {
+  Array<rVector3d> rows(3);
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      rows(i)(j) = m(i, j);
+    }
+  }
+  return hash_cluster(rows, h);
+}
+
+// kind tells binary (1) and multicomponent (2) clusters apart;
+template <class C>
+static uint64_t calc_key(const Structure &lattice,
+                         const SpaceGroup &space_group,
+                         const LinkedList<C> &cluster_list, uint64_t kind) {
+  uint64_t h = hash_combine(kind, lattice.atom_pos.get_size());
+  h = hash_matrix(lattice.cell, h);
+  h = hash_cluster(lattice.atom_pos, h);
+  for (int at = 0; at < lattice.atom_type.get_size(); at++) {
+    h = hash_combine(h, lattice.atom_type(at));
+  }
+  h = hash_matrix(space_group.cell, h);
+  for (int op = 0; op < space_group.point_op.get_size(); op++) {
+    h = hash_matrix(space_group.point_op(op), h);
+  }
+  h = hash_cluster(space_group.trans, h);
+  h = hash_combine(h, cluster_list.get_size());
+  LinkedListIterator<C> c(cluster_list);
+  for (; c; c++) {
+    h = hash_cluster(*c, h);
+  }
+  return h;
+}
+
+uint64_t calc_interaction_table_key(const Structure &lattice,
+                                    const SpaceGroup &space_group,
+                                    const LinkedList<Cluster> &cluster_list) {
+  return calc_key(lattice, space_group, cluster_list, 1);
+}
+
+uint64_t
+calc_interaction_table_key(const Structure &lattice,
+                           const SpaceGroup &space_group,
+                           const LinkedList<MultiCluster> &cluster_list) {
+  return calc_key(lattice, space_group, cluster_list, 2);
+}
+
+template <class T>
+static void write_vector(ostream &file, const std::vector<T> &v) {
+  int n = v.size();
+  file.write((const char *)&n, sizeof(n));
+  file.write((const char *)v.data(), n * sizeof(T));
+}
+
+template <class T> static int read_vector(istream &file, std::vector<T> *pv) {
+  int n = -1;
+  if (!file.read((char *)&n, sizeof(n)) || n < 0) return 0;
+  pv->resize(n);
+  return !file.read((char *)pv->data(), n * sizeof(T)).fail();
+}
+
+int MCInteractionTable::write(const char *filename) const {
+  // written under another name first (unique to this process, since runs
+  // started together may all be building the table), so that a run started
+  // meanwhile never reads a partial table;
+  std::string tmpname =
+      std::string(filename) + "." + std::to_string(getpid()) + ".tmp";
+  {
+    ofstream file(tmpname.c_str(), ios::binary);
+    if (!file) return 0;
+    file.write(MCITABLE_MAGIC, MCITABLE_MAGIC_LEN);
+    file.write((const char *)&key, sizeof(key));
+    file.write((const char *)&nb_site, sizeof(nb_site));
+    file.write((const char *)&total_clusters, sizeof(total_clusters));
+    file.write((const char *)&which_is_empty, sizeof(which_is_empty));
+    file.write((const char *)&max_clus_len, sizeof(max_clus_len));
+    write_vector(file, type_size);
+    write_vector(file, mult_per_atom);
+    for (int s = 0; s < nb_site; s++) {
+      write_vector(file, which_cluster[s]);
+      write_vector(file, cluster_size[s]);
+      write_vector(file, first_member[s]);
+      write_vector(file, member_site[s]);
+      std::vector<int> cell(3 * member_cell[s].size());
+      for (size_t k = 0; k < member_cell[s].size(); k++) {
+        for (int i = 0; i < 3; i++) {
+          cell[3 * k + i] = member_cell[s][k](i);
+        }
+      }
+      write_vector(file, cell);
+      write_vector(file, member_type[s]);
+      write_vector(file, member_func[s]);
+    }
+    if (!file) return 0;
+  }
+  return std::rename(tmpname.c_str(), filename) == 0;
+}
+
+// checks that the clusters around site s, as read from a file (with
+// nb_cell_coord cell coordinates), are consistent and only refer to existing
+// sites and cluster types, so that a corrupted table is rebuilt instead of
+// being used;
+static int is_valid_site(const MCInteractionTable &t, int s,
+                         size_t nb_cell_coord) {
+  size_t nb_clus = t.which_cluster[s].size();
+  size_t nb_member = t.member_site[s].size();
+  if (t.cluster_size[s].size() != nb_clus ||
+      t.first_member[s].size() != nb_clus ||
+      t.member_type[s].size() != nb_member ||
+      t.member_func[s].size() != nb_member || nb_cell_coord != 3 * nb_member)
+    return 0;
+  for (size_t ic = 0; ic < nb_clus; ic++) {
+    int i = t.which_cluster[s][ic];
+    int size = t.cluster_size[s][ic];
+    int first = t.first_member[s][ic];
+    if (i < 0 || i >= t.total_clusters || size < 1 ||
+        size != t.type_size[i] || first < 0 || first > (int)nb_member - size)
+      return 0;
+  }
+  for (size_t m = 0; m < nb_member; m++) {
+    if (t.member_site[s][m] < 0 || t.member_site[s][m] >= t.nb_site) return 0;
+  }
+  return 1;
+}
+
+int MCInteractionTable::read(const char *filename, uint64_t expected_key) {
+  ifstream file(filename, ios::binary);
+  if (!file) return 0;
+  char magic[MCITABLE_MAGIC_LEN];
+  if (!file.read(magic, MCITABLE_MAGIC_LEN) ||
+      strncmp(magic, MCITABLE_MAGIC, MCITABLE_MAGIC_LEN) != 0)
+    return 0;
+  MCInteractionTable t;
+  file.read((char *)&t.key, sizeof(t.key));
+  if (!file || t.key != expected_key) return 0;
+  file.read((char *)&t.nb_site, sizeof(t.nb_site));
+  file.read((char *)&t.total_clusters, sizeof(t.total_clusters));
+  file.read((char *)&t.which_is_empty, sizeof(t.which_is_empty));
+  file.read((char *)&t.max_clus_len, sizeof(t.max_clus_len));
+  if (!file || t.nb_site < 0 || t.total_clusters < 0 ||
+      t.which_is_empty < -1 || t.which_is_empty >= t.total_clusters ||
+      !read_vector(file, &t.type_size) ||
+      !read_vector(file, &t.mult_per_atom) ||
+      (int)t.type_size.size() != t.total_clusters ||
+      (int)t.mult_per_atom.size() != t.total_clusters)
+    return 0;
+  t.which_cluster.resize(t.nb_site);
+  t.cluster_size.resize(t.nb_site);
+  t.first_member.resize(t.nb_site);
+  t.member_site.resize(t.nb_site);
+  t.member_cell.resize(t.nb_site);
+  t.member_type.resize(t.nb_site);
+  t.member_func.resize(t.nb_site);
+  for (int s = 0; s < t.nb_site; s++) {
+    std::vector<int> cell;
+    if (!read_vector(file, &t.which_cluster[s]) ||
+        !read_vector(file, &t.cluster_size[s]) ||
+        !read_vector(file, &t.first_member[s]) ||
+        !read_vector(file, &t.member_site[s]) || !read_vector(file, &cell) ||
+        !read_vector(file, &t.member_type[s]) ||
+        !read_vector(file, &t.member_func[s]))
+      return 0;
+    if (!is_valid_site(t, s, cell.size())) return 0;
+    t.member_cell[s].resize(cell.size() / 3);
+    for (size_t k = 0; k < t.member_cell[s].size(); k++) {
+      for (int i = 0; i < 3; i++) {
+        t.member_cell[s][k](i) = cell[3 * k + i];
+      }
+    }
+  }
+  *this = t;
+  return 1;
+}
+
+template <class C>
+static void get_table(MCInteractionTable *ptable, const Structure &lattice,
+                      const SpaceGroup &space_group,
+                      const LinkedList<C> &cluster_list,
+                      const char *filename) {
+  uint64_t key = calc_interaction_table_key(lattice, space_group, cluster_list);
+  if (ptable->nb_site > 0 && ptable->key == key) return;
+  if (strlen(filename) > 0 && ptable->read(filename, key)) return;
+  ptable->init(lattice, space_group, cluster_list);
+  if (strlen(filename) > 0 && !ptable->write(filename)) {
+    cerr << "Unable to write interaction table " << filename << endl;
+  }
+}
+
+void get_interaction_table(MCInteractionTable *ptable, const Structure &lattice,
+                           const SpaceGroup &space_group,
+                           const LinkedList<Cluster> &cluster_list,
+                           const char *filename) {
+  get_table(ptable, lattice, space_group, cluster_list, filename);
+}
+
+void get_interaction_table(MCInteractionTable *ptable, const Structure &lattice,
+                           const SpaceGroup &space_group,
+                           const LinkedList<MultiCluster> &cluster_list,
+                           const char *filename) {
+  get_table(ptable, lattice, space_group, cluster_list, filename);
+}
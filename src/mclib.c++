@@ -1,4 +1,7 @@
 #include "mclib.h"
+#include <barrier>
+#include <thread>
+#include <vector>
 
 typedef int *pint;
 typedef int **ppint;
@@ -6,17 +9,20 @@ typedef Real *pReal;
 typedef Complex *pComplex;
 
 MonteCarlo::MonteCarlo(const Structure &_lattice, const iVector3d &_supercell, const SpaceGroup &space_group,
-             const LinkedList<Cluster> &cluster_list):
-               lattice(_lattice), supercell(_supercell), cur_rho() {
-    Real max_clus_len=0.;
-    {
-      LinkedListIterator<Cluster> c(cluster_list);
-      for ( ; c; c++) {
-        Real l=get_cluster_length(*c);
-        if (l>max_clus_len) max_clus_len=l;
-      }
-    }
-    margin=find_sphere_bounding_box(lattice.cell,max_clus_len);
+             const LinkedList<Cluster> &cluster_list, int use_index_table):
+  MonteCarlo(_lattice,_supercell,MCInteractionTable(_lattice,space_group,cluster_list),use_index_table) {}
+
+MonteCarlo::MonteCarlo(const Structure &_lattice, const iVector3d &_supercell, const MCInteractionTable &table,
+             int use_index_table):
+               lattice(_lattice), supercell(_supercell), cur_rho(), reach(0,0,0), nb_block(1,1,1), master_rng(), block_rng(), block_accum(), flip_rate(), flip_accum() {
+    nb_threads=1;
+    master_rng.set_seed(new_stream_seed());
+    flip_rate_valid=0;
+    flip_wait=0.;
+    flip_stamp=NULL;
+    cur_stamp=0;
+    if (table.nb_site!=lattice.atom_pos.get_size()) ERRORQUIT("Interaction table does not match the lattice.");
+    margin=find_sphere_bounding_box(lattice.cell,table.max_clus_len);
     iVector3d supercell_orig=supercell;
     for (int mult=1; 1 ; mult++) {
       supercell=mult*supercell_orig;
@@ -26,6 +32,8 @@ MonteCarlo::MonteCarlo(const Structure &_lattice, const iVector3d &_supercell, c
       }
       if (i==3) break;
     }
+    // without padding, every spin is stored once and neighbors are found through nbr_table;
+    if (use_index_table) {margin=iVector3d(0,0,0);}
     total_box=supercell+2*margin;
     int spin_total_size=total_box(0)*total_box(1)*total_box(2)*lattice.atom_pos.get_size();
     spin=new SPIN_TYPE[spin_total_size];
@@ -48,70 +56,82 @@ MonteCarlo::MonteCarlo(const Structure &_lattice, const iVector3d &_supercell, c
     nb_x_clusters=new int[site_in_cell];
     cluster_size=new pint[site_in_cell];
     site_offset=new ppint[site_in_cell];
+    site_offset_flat=new pint[site_in_cell];
+    nbr_row_len=new int[site_in_cell];
     eci=new pReal[site_in_cell];
     which_cluster=new pint[site_in_cell];
-    total_clusters=cluster_list.get_size();
+    total_clusters=table.total_clusters;
     cur_rho.resize(total_clusters);
     zero_array(&cur_rho);
     pcur_rho=cur_rho.get_buf();
     rcluster_mult_per_atom=new Real[total_clusters];
-    {
-      LinkedListIterator<Cluster> c(cluster_list);
-      for (int i=0; c; c++,i++) {
-	rcluster_mult_per_atom[i]=calc_multiplicity(*c,lattice.cell,space_group.point_op,space_group.trans)/(Real)lattice.atom_pos.get_size();
-      }
+    for (int i=0; i<total_clusters; i++) {
+      rcluster_mult_per_atom[i]=table.mult_per_atom[i];
     }
 
     E_ref=0.;
-    which_is_empty=-1;
-    rMatrix3d inv_cell=!lattice.cell;
-    for (int s=0; s<lattice.atom_pos.get_size(); s++) {
-      LinkedList<Cluster> long_cluster_list;
-      LinkedList<int> long_cluster_i_list;
-      LinkedListIterator<Cluster> c(cluster_list);
-      int cluster_index=0;
-      
-      for ( ; c; c++,cluster_index++) {
-	if (c->get_size()==0) {which_is_empty=cluster_index;}
-        else {
-            Array<Cluster> clusters;
-            find_equivalent_clusters(&clusters, *c,space_group.cell,space_group.point_op,space_group.trans);
-            for (int ec=0; ec<clusters.get_size(); ec++) {
-	      for (int center_atom=0; center_atom<clusters(ec).get_size(); center_atom++) {
-		rVector3d lat_shift=lattice.atom_pos(s)-clusters(ec)(center_atom);
-		if (is_int(inv_cell*lat_shift)) {
-                  Cluster *to_add=new Cluster(clusters(ec).get_size()-1);
-                  int j=0;
-                  for (int i=0; i<clusters(ec).get_size(); i++) {
-                    if (i!=center_atom) {
-                      (*to_add)(j)=clusters(ec)(i)+lat_shift;
-                      j=j+1;
-                    }
-                  }
-                  long_cluster_list << to_add;
-                  long_cluster_i_list << new int(cluster_index);
-                }
-              }
-            }
-        }
-      }
-      nb_x_clusters[s]=long_cluster_list.get_size();
+    which_is_empty=table.which_is_empty;
+    Array<Array<iVector3d> > shift_cell(site_in_cell);
+    Array<Array<int> > shift_site(site_in_cell);
+    for (int s=0; s<site_in_cell; s++) {
+      nb_x_clusters[s]=table.get_nb_clusters(s);
+      nb_clusters[s]=nb_x_clusters[s];
       cluster_size[s]=new int[nb_x_clusters[s]];
       eci[s]=new Real[nb_x_clusters[s]];
       which_cluster[s]=new int[nb_x_clusters[s]];
       site_offset[s]=new pint[nb_x_clusters[s]];
-      c.init(long_cluster_list);
-      LinkedListIterator<int> c_i(long_cluster_i_list);
-      for (int ic=0; ic<nb_x_clusters[s]; ic++, c++, c_i++) {
-        cluster_size[s][ic]=c->get_size();
-	nb_clusters[s]=ic+1;
+      // the table lists site s itself first in each cluster; it is left out here;
+      nbr_row_len[s]=0;
+      for (int ic=0; ic<nb_x_clusters[s]; ic++) {
+        nbr_row_len[s]+=table.cluster_size[s][ic]-1;
+      }
+      // the offsets of all clusters around site s are stored back to back,
+      // so that the flip loops can walk them with a single pointer;
+      site_offset_flat[s]=new int[nbr_row_len[s]];
+      shift_cell(s).resize(nbr_row_len[s]);
+      shift_site(s).resize(nbr_row_len[s]);
+      int k=0;
+      for (int ic=0; ic<nb_x_clusters[s]; ic++) {
+        cluster_size[s][ic]=table.cluster_size[s][ic]-1;
 	eci[s][ic]=0.;
-        which_cluster[s][ic]=*c_i;
-        site_offset[s][ic]=new int[c->get_size()];
-        for (int j=0; j<c->get_size(); j++) {
-          int offset_in_cell=which_atom(lattice.atom_pos,(*c)(j),inv_cell);
-          iVector3d offset_cell=to_int(inv_cell*((*c)(j)-lattice.atom_pos(offset_in_cell)));
+        which_cluster[s][ic]=table.which_cluster[s][ic];
+        site_offset[s][ic]=site_offset_flat[s]+k;
+        for (int j=0; j<cluster_size[s][ic]; j++, k++) {
+          int m=table.first_member[s][ic]+1+j;
+          int offset_in_cell=table.member_site[s][m];
+          const iVector3d &offset_cell=table.member_cell[s][m];
           site_offset[s][ic][j]=((offset_cell(0)*total_box(1) + offset_cell(1))*total_box(2) + offset_cell(2))*site_in_cell + offset_in_cell - s;
+          shift_cell(s)(k)=offset_cell;
+          shift_site(s)(k)=offset_in_cell;
+          for (int i=0; i<3; i++) {
+            reach(i)=MAX(reach(i),abs(offset_cell(i)));
+          }
+        }
+      }
+    }
+    nbr_table=NULL;
+    nbr_row_start=NULL;
+    if (use_index_table) {
+      nbr_row_start=new int[spin_size];
+      int table_size=0;
+      for (int s=0; s<site_in_cell; s++) {
+        table_size+=nbr_row_len[s];
+      }
+      nbr_table=new int[table_size*supercell(0)*supercell(1)*supercell(2)];
+      int k=0;
+      MultiDimIterator<iVector3d> cur_cell(supercell);
+      for ( ; cur_cell; cur_cell++) {
+        iVector3d &cell=(iVector3d &)cur_cell;
+        for (int s=0; s<site_in_cell; s++) {
+          int offset=((cell(0)*supercell(1) + cell(1))*supercell(2) + cell(2))*site_in_cell + s;
+          nbr_row_start[offset]=k;
+          for (int j=0; j<nbr_row_len[s]; j++, k++) {
+            iVector3d n;
+            for (int i=0; i<3; i++) {
+              n(i)=((cell(i)+shift_cell(s)(j)(i)) % supercell(i) + supercell(i)) % supercell(i);
+            }
+            nbr_table[k]=((n(0)*supercell(1) + n(1))*supercell(2) + n(2))*site_in_cell + shift_site(s)(j) - offset;
+          }
         }
       }
     }
@@ -122,7 +142,7 @@ MonteCarlo::~MonteCarlo(void) {
   //to write: delete all dynamically allocated arrays;
 }
 
-void MonteCarlo::set_eci(const Array<Real> &new_eci) {
+void MonteCarlo::copy_eci(const Array<Real> &new_eci) {
   if (which_is_empty>=0) {
     E_ref=new_eci(which_is_empty)/lattice.atom_pos.get_size();
   } else {
@@ -133,18 +153,35 @@ void MonteCarlo::set_eci(const Array<Real> &new_eci) {
       eci[s][c]=new_eci(which_cluster[s][c]);
     }
   }
+}
+
+void MonteCarlo::set_eci(const Array<Real> &new_eci) {
+  copy_eci(new_eci);
   calc_from_scratch();
 }
 
+void MonteCarlo::change_eci(const Array<Real> &new_eci) {
+  copy_eci(new_eci);
+  // each cluster of type i contributes rho/mult_i to cur_rho(i) and rho*eci_i
+  // to the energy (the empty cluster is accounted for by E_ref);
+  cur_energy=-mu*cur_conc;
+  for (int i=0; i<total_clusters; i++) {
+    if (i!=which_is_empty) cur_energy+=new_eci(i)*rcluster_mult_per_atom[i]*cur_rho(i);
+  }
+  flip_rate_valid=0;
+}
+
 void MonteCarlo::init_random(Real concentration) {
     Real c=(1+concentration)/2.0;
     iMatrix3d msupercell;
     msupercell.diag(supercell);
     BoundingBox<int,3> bb(iVector3d(0,0,0),total_box-iVector3d(1,1,1));
     MultiDimIterator<iVector3d> cell(supercell);
+    Array<Real> r(site_in_cell);
     for ( ; cell; cell++) {
+      master_rng.fill_uniform01(r.get_buf(),site_in_cell);
       for (int offset_in_cell=0; offset_in_cell<site_in_cell; offset_in_cell++) {
-        int the_spin=( uniform01()<c ? +1 : -1 );
+        int the_spin=( r(offset_in_cell)<c ? +1 : -1 );
         MultiDimIterator<iVector3d> image(iVector3d(-1,-1,-1),iVector3d(1,1,1));
         for ( ; image; image++) {
           iVector3d image_offset_cell=(iVector3d &)cell+msupercell*(iVector3d &)image+margin;
@@ -206,10 +243,10 @@ void MonteCarlo::set_concentration(Real concentration) {
     for (int s=0; s<nbspin; s++) {
       do {
 	for (int i=0; i<3; i++) {
-	  cell[i]=random(supercell(i));
+	  cell[i]=master_rng.random(supercell(i));
 	  mcell[i]=cell[i]+margin(i);
 	}
-	incell=random(site_in_cell);
+	incell=master_rng.random(site_in_cell);
 	offset=((mcell[0]*total_box(1) + mcell[1])*total_box(2) + mcell[2])*site_in_cell + incell;
       } while (spin[offset]!=toflip);
       for (int i=0; i<3; i++) {
@@ -243,10 +280,11 @@ void MonteCarlo::calc_from_scratch(void) {
         iVector3d cell=cur_cell;
         int offset=((cell(0)*supercell(1) + cell(1))*supercell(2) + cell(2))*site_in_cell + s;
         cur_disorder_param+=(Real)spin_changed[offset];
+        int *poffset=first_site_offset(moffset,s);
         for (int c=0; c<nb_clusters[s]; c++) {
           int rho=spin[moffset];
-          for (int i=0; i<cluster_size[s][c]; i++) {
-            rho*=spin[moffset+site_offset[s][c][i]];
+          for (int i=0; i<cluster_size[s][c]; i++, poffset++) {
+            rho*=spin[moffset+(*poffset)];
           }
 	  Real rrho=(Real)rho/(Real)(cluster_size[s][c]+1);
           cur_energy+=rrho*eci[s][c];
@@ -260,12 +298,14 @@ void MonteCarlo::calc_from_scratch(void) {
     product(&cur_rho,cur_rho,1./rspin_size);
     if (which_is_empty>=0) {cur_rho(which_is_empty)=1.;}
     cur_energy-=mu*cur_conc;
+    flip_rate_valid=0;
   }
 
 void MonteCarlo::init_run(Real _T, Real _mu) {
     T=_T;
     cur_energy-=(_mu-mu)*cur_conc;
     mu=_mu;
+    flip_rate_valid=0;
 }
 
 void MonteCarlo::spin_flip(void) {
@@ -273,22 +313,21 @@ void MonteCarlo::spin_flip(void) {
     int cell[3],mcell[3],mcellscan[3],incell,offset;
     Real denergy,d_recip_energy,dconc;
     int cluster_count,site_count;
-    int **pcluster;
     int *pwhich_cluster;
     int *poffset,*psize;
     Real *peci;
     int rho;
     int accept;
     for (i=0; i<3; i++) {
-      cell[i]=random(supercell(i));
+      cell[i]=master_rng.random(supercell(i));
       mcell[i]=cell[i]+margin(i);
     }
-    incell=random(site_in_cell);
+    incell=master_rng.random(site_in_cell);
     offset=((mcell[0]*total_box(1) + mcell[1])*total_box(2) + mcell[2])*site_in_cell + incell;
     denergy=0.;
-    for (cluster_count=nb_clusters[incell], pcluster=site_offset[incell], psize=cluster_size[incell], peci=eci[incell]; cluster_count>0; cluster_count--, pcluster++, psize++, peci++) {
+    for (cluster_count=nb_clusters[incell], poffset=first_site_offset(offset,incell), psize=cluster_size[incell], peci=eci[incell]; cluster_count>0; cluster_count--, psize++, peci++) {
       rho=spin[offset];
-      for (site_count=*psize, poffset=*pcluster; site_count>0; site_count--, poffset++) {
+      for (site_count=*psize; site_count>0; site_count--, poffset++) {
         rho*=spin[offset+(*poffset)];
       }
       denergy+=-2.*(*peci)*(Real)rho;
@@ -301,15 +340,15 @@ void MonteCarlo::spin_flip(void) {
       accept=1;
     }
     else {
-      if (uniform01()<exp(-(denergy+d_recip_energy)/T)) accept=1;
+      if (master_rng.uniform01()<exp(-(denergy+d_recip_energy)/T)) accept=1;
     }
     if (accept) {
       cur_energy+=denergy/rspin_size;
       cur_conc+=dconc/rspin_size;
 
-      for (cluster_count=nb_clusters[incell], pcluster=site_offset[incell], psize=cluster_size[incell], pwhich_cluster=which_cluster[incell]; cluster_count>0; cluster_count--, pcluster++, psize++, pwhich_cluster++) {
+      for (cluster_count=nb_clusters[incell], poffset=first_site_offset(offset,incell), psize=cluster_size[incell], pwhich_cluster=which_cluster[incell]; cluster_count>0; cluster_count--, psize++, pwhich_cluster++) {
 	rho=spin[offset];
-	for (site_count=*psize, poffset=*pcluster; site_count>0; site_count--, poffset++) {
+	for (site_count=*psize; site_count>0; site_count--, poffset++) {
 	  rho*=spin[offset+(*poffset)];
 	}
 	pcur_rho[*pwhich_cluster]+=-2.*(Real)rho/rcluster_mult_per_atom[*pwhich_cluster]/rspin_size;
@@ -342,7 +381,6 @@ void MonteCarlo::spin_double_flip(void) {
     Real denergy,d_total_energy;
     Real d_recip_energy[2];
     int cluster_count,site_count;
-    int **pcluster;
     int *pwhich_cluster;
     int *poffset,*psize;
     Real *peci;
@@ -353,10 +391,10 @@ void MonteCarlo::spin_double_flip(void) {
     for (f=0; f<2; f++) {
       do {
         for (i=0; i<3; i++) {
-          cell[f][i]=random(supercell(i));
+          cell[f][i]=master_rng.random(supercell(i));
           mcell[f][i]=cell[f][i]+margin(i);
         }
-        incell[f]=random(site_in_cell);
+        incell[f]=master_rng.random(site_in_cell);
         offset[f]=((mcell[f][0]*total_box(1) + mcell[f][1])*total_box(2) + mcell[f][2])*site_in_cell + incell[f];
       } while (f==1 && spin[offset[0]]==spin[offset[1]]);
       for (i=0; i<3; i++) {
@@ -367,9 +405,9 @@ void MonteCarlo::spin_double_flip(void) {
 
     denergy=0.;
     for (f=0; f<2; f++) {
-      for (cluster_count=nb_clusters[incell[f]], pcluster=site_offset[incell[f]], psize=cluster_size[incell[f]], peci=eci[incell[f]]; cluster_count>0; cluster_count--, pcluster++, psize++, peci++) {
+      for (cluster_count=nb_clusters[incell[f]], poffset=first_site_offset(offset[f],incell[f]), psize=cluster_size[incell[f]], peci=eci[incell[f]]; cluster_count>0; cluster_count--, psize++, peci++) {
         rho=spin[offset[f]];
-        for (site_count=*psize, poffset=*pcluster; site_count>0; site_count--, poffset++) {
+        for (site_count=*psize; site_count>0; site_count--, poffset++) {
           rho*=spin[offset[f]+(*poffset)];
         }
         denergy+=-2.*(*peci)*(Real)rho;
@@ -393,7 +431,7 @@ void MonteCarlo::spin_double_flip(void) {
       accept=1;
     }
     else {
-      if (uniform01()<exp(-d_total_energy/T)) accept=1;
+      if (master_rng.uniform01()<exp(-d_total_energy/T)) accept=1;
     }
  
     if (accept) {
@@ -407,9 +445,9 @@ void MonteCarlo::spin_double_flip(void) {
             }
           }
         }
-        for (cluster_count=nb_clusters[incell[f]], pcluster=site_offset[incell[f]], psize=cluster_size[incell[f]], pwhich_cluster=which_cluster[incell[f]]; cluster_count>0; cluster_count--, pcluster++, psize++, pwhich_cluster++) {
+        for (cluster_count=nb_clusters[incell[f]], poffset=first_site_offset(offset[f],incell[f]), psize=cluster_size[incell[f]], pwhich_cluster=which_cluster[incell[f]]; cluster_count>0; cluster_count--, psize++, pwhich_cluster++) {
           rho=-spin[offset[f]];
-          for (site_count=*psize, poffset=*pcluster; site_count>0; site_count--, poffset++) {
+          for (site_count=*psize; site_count>0; site_count--, poffset++) {
 	      rho*=spin[offset[f]+(*poffset)];
           }
 	    pcur_rho[*pwhich_cluster]+=-2.*(Real)rho/rcluster_mult_per_atom[*pwhich_cluster]/rspin_size;
@@ -434,6 +472,15 @@ void MonteCarlo::spin_double_flip(void) {
 }
 
 void MonteCarlo::run(int mc_passes, int mode) {
+  if (mode==3) {
+    rejection_free_run(mc_passes);
+    return;
+  }
+  flip_rate_valid=0;
+  if (nb_threads>1 && can_run_parallel()) {
+    parallel_run(mc_passes,mode);
+    return;
+  }
   int maxn=mc_passes*supercell(0)*supercell(1)*supercell(2)*site_in_cell;
   if (mode==1) {
     for (int n=0; n<maxn; n++) {
@@ -447,6 +494,390 @@ void MonteCarlo::run(int mc_passes, int mode) {
   }
 }
 
+void MonteCarlo::run(int mc_passes, int mode, RandomStream *rng) {
+  if (extension_is_active()) ERRORQUIT("Cannot run with a private random stream when k-space ECI are used");
+  if (mode!=1 && mode!=2) ERRORQUIT("Only modes 1 and 2 can run with a private random stream");
+  flip_rate_valid=0;
+  MCBlock block;
+  for (int i=0; i<3; i++) {
+    block.lo[i]=0;
+    block.width[i]=supercell(i);
+  }
+  block.index=0;
+  MCBlockAccum acc;
+  acc.drho.resize(total_clusters);
+  for (int n=0; n<mc_passes; n++) {
+    sweep_block(block,mode,rng,&acc);
+    cur_energy+=acc.denergy/rspin_size;
+    cur_conc+=acc.dconc/rspin_size;
+    cur_disorder_param+=acc.ddisorder/rspin_size;
+    for (int i=0; i<total_clusters; i++) {
+      pcur_rho[i]+=acc.drho(i)/rspin_size;
+    }
+  }
+}
+
+void MonteCarlo::set_nb_threads(int _nb_threads) {
+  nb_threads=MAX(_nb_threads,1);
+  // blocks must be at least as wide as the cluster reach so that two blocks of
+  // the same color (same parity along every split direction) never share a cluster;
+  // the number of blocks along a direction is kept even so parity survives wrapping.
+  // Blocks are kept as large as the number of threads allows, since canonical
+  // exchanges only occur within a block.
+  iVector3d max_nb_block;
+  for (int i=0; i<3; i++) {
+    max_nb_block(i)=2*(supercell(i)/(2*MAX(reach(i),1)));
+    nb_block(i)=1;
+  }
+  while (1) {
+    int per_color=1;
+    for (int i=0; i<3; i++) {
+      if (nb_block(i)>1) per_color*=nb_block(i)/2;
+    }
+    if (per_color>=nb_threads) break;
+    int best=-1;
+    for (int pass=0; pass<2 && best==-1; pass++) {
+      for (int i=0; i<3; i++) {
+        if ((nb_block(i)>1)!=(pass==0)) continue;
+        int next=(nb_block(i)==1 ? 2 : nb_block(i)+2);
+        if (next<=max_nb_block(i) && (best==-1 || supercell(i)/nb_block(i)>supercell(best)/nb_block(best))) best=i;
+      }
+    }
+    if (best==-1) break;
+    nb_block(best)=(nb_block(best)==1 ? 2 : nb_block(best)+2);
+  }
+  int nb=nb_block(0)*nb_block(1)*nb_block(2);
+  split_block_rng();
+  block_accum.resize(nb);
+  for (int b=0; b<nb; b++) {
+    block_accum(b).drho.resize(total_clusters);
+  }
+}
+
+void MonteCarlo::split_block_rng(void) {
+  block_rng.resize(nb_block(0)*nb_block(1)*nb_block(2));
+  for (int b=0; b<block_rng.get_size(); b++) {
+    block_rng(b)=master_rng.split();
+  }
+}
+
+void MonteCarlo::set_random_stream(const RandomStream &rng) {
+  master_rng=rng;
+  split_block_rng();
+}
+
+int MonteCarlo::can_run_parallel(void) {
+  if (extension_is_active()) return 0;
+  return (nb_block(0)*nb_block(1)*nb_block(2)>1);
+}
+
+Real MonteCarlo::site_flip_energy(int offset, int incell) {
+  Real denergy=0.;
+  int cluster_count,site_count;
+  int *poffset,*psize;
+  Real *peci;
+  int rho;
+  for (cluster_count=nb_clusters[incell], poffset=first_site_offset(offset,incell), psize=cluster_size[incell], peci=eci[incell]; cluster_count>0; cluster_count--, psize++, peci++) {
+    rho=spin[offset];
+    for (site_count=*psize; site_count>0; site_count--, poffset++) {
+      rho*=spin[offset+(*poffset)];
+    }
+    denergy+=-2.*(*peci)*(Real)rho;
+  }
+  return denergy;
+}
+
+void MonteCarlo::flip_spin_images(const int *cell, int incell) {
+  int mcell[3],mcellscan[3];
+  for (int i=0; i<3; i++) {
+    mcell[i]=cell[i]+margin(i);
+    if (mcell[i]>=supercell(i)) {mcell[i]-=supercell(i);}
+  }
+  for (mcellscan[0]=mcell[0]; mcellscan[0]<total_box(0); mcellscan[0]+=supercell(0)) {
+    for (mcellscan[1]=mcell[1]; mcellscan[1]<total_box(1); mcellscan[1]+=supercell(1)) {
+      for (mcellscan[2]=mcell[2]; mcellscan[2]<total_box(2); mcellscan[2]+=supercell(2)) {
+        spin[((mcellscan[0]*total_box(1) + mcellscan[1])*total_box(2) + mcellscan[2])*site_in_cell + incell]*=-1;
+      }
+    }
+  }
+}
+
+void MonteCarlo::commit_spin_flip(const int *cell, int incell, int offset, MCBlockAccum *acc) {
+  int cluster_count,site_count;
+  int *pwhich_cluster;
+  int *poffset,*psize;
+  int rho;
+  Real *pdrho=acc->drho.get_buf();
+  for (cluster_count=nb_clusters[incell], poffset=first_site_offset(offset,incell), psize=cluster_size[incell], pwhich_cluster=which_cluster[incell]; cluster_count>0; cluster_count--, psize++, pwhich_cluster++) {
+    rho=spin[offset];
+    for (site_count=*psize; site_count>0; site_count--, poffset++) {
+      rho*=spin[offset+(*poffset)];
+    }
+    pdrho[*pwhich_cluster]+=-2.*(Real)rho/rcluster_mult_per_atom[*pwhich_cluster];
+  }
+  flip_spin_images(cell,incell);
+  int nomoffset=((cell[0]*supercell(1) + cell[1])*supercell(2) + cell[2])*site_in_cell + incell;
+  acc->ddisorder+=(Real)(1-2*spin_changed[nomoffset]);
+  spin_changed[nomoffset]^=1;
+}
+
+void MonteCarlo::sweep_block(const MCBlock &block, int mode, RandomStream *rng, MCBlockAccum *acc) {
+  acc->denergy=0.;
+  acc->dconc=0.;
+  acc->ddisorder=0.;
+  zero_array(&(acc->drho));
+  int nb_try=block.width[0]*block.width[1]*block.width[2]*site_in_cell;
+  int cell[2][3],incell[2],offset[2];
+  int nb_site=(mode==1 ? 1 : 2);
+  for (int n=0; n<nb_try; n++) {
+    for (int f=0; f<nb_site; f++) {
+      for (int i=0; i<3; i++) {
+        cell[f][i]=(block.lo[i]+rng->random(block.width[i])) % supercell(i);
+      }
+      incell[f]=rng->random(site_in_cell);
+      offset[f]=(((cell[f][0]+margin(0))*total_box(1) + cell[f][1]+margin(1))*total_box(2) + cell[f][2]+margin(2))*site_in_cell + incell[f];
+    }
+    Real denergy;
+    if (mode==1) {
+      Real dconc=-(Real)(2*spin[offset[0]]);
+      denergy=site_flip_energy(offset[0],incell[0])-mu*dconc;
+      if (denergy<0 || rng->uniform01()<exp(-denergy/T)) {
+        acc->denergy+=denergy;
+        acc->dconc+=dconc;
+        commit_spin_flip(cell[0],incell[0],offset[0],acc);
+      }
+    }
+    else {
+      // a pair with equal spins is a rejected (null) move: the proposal stays symmetric;
+      if (spin[offset[0]]==spin[offset[1]]) continue;
+      denergy=site_flip_energy(offset[0],incell[0]);
+      flip_spin_images(cell[0],incell[0]);
+      denergy+=site_flip_energy(offset[1],incell[1]);
+      flip_spin_images(cell[0],incell[0]);
+      if (denergy<0 || rng->uniform01()<exp(-denergy/T)) {
+        acc->denergy+=denergy;
+        commit_spin_flip(cell[0],incell[0],offset[0],acc);
+        commit_spin_flip(cell[1],incell[1],offset[1],acc);
+      }
+    }
+  }
+}
+
+void MonteCarlo::plan_sweep(Array<Array<MCBlock> > *color_blocks) {
+  // a random origin shift moves the block boundaries at every sweep, so that
+  // canonical exchanges are not confined to a fixed block;
+  int shift[3];
+  for (int i=0; i<3; i++) {
+    shift[i]=master_rng.random(supercell(i));
+  }
+  int nb_color=8;
+  Array<LinkedList<MCBlock> > color_list(nb_color);
+  MultiDimIterator<iVector3d> b(nb_block);
+  for (; b; b++) {
+    iVector3d &vb=(iVector3d &)b;
+    MCBlock *pblock=new MCBlock;
+    int color=0;
+    for (int i=0; i<3; i++) {
+      int lo=vb(i)*supercell(i)/nb_block(i);
+      int hi=(vb(i)+1)*supercell(i)/nb_block(i);
+      pblock->lo[i]=lo+shift[i];
+      pblock->width[i]=hi-lo;
+      if (nb_block(i)>1) {color+=(vb(i)%2)<<i;}
+    }
+    pblock->index=(vb(0)*nb_block(1)+vb(1))*nb_block(2)+vb(2);
+    color_list(color) << pblock;
+  }
+  // visiting colors in random order keeps the composite update reversible;
+  Array<int> color_order(nb_color);
+  for (int c=0; c<nb_color; c++) {color_order(c)=c;}
+  for (int c=nb_color-1; c>0; c--) {
+    swap(&color_order(c),&color_order(master_rng.random(c+1)));
+  }
+  LinkedList<Array<MCBlock> > nonempty;
+  for (int ci=0; ci<nb_color; ci++) {
+    if (color_list(color_order(ci)).get_size()==0) continue;
+    Array<MCBlock> *pblocks=new Array<MCBlock>;
+    LinkedList_to_Array(pblocks,color_list(color_order(ci)));
+    nonempty << pblocks;
+  }
+  LinkedList_to_Array(color_blocks,nonempty);
+}
+
+void MonteCarlo::parallel_run(int mc_passes, int mode) {
+  if (mc_passes<=0) return;
+  // every non-empty color holds the same number of blocks;
+  int per_color=1;
+  for (int i=0; i<3; i++) {
+    if (nb_block(i)>1) per_color*=nb_block(i)/2;
+  }
+  int nt=MIN(nb_threads,per_color);
+  Array<Array<MCBlock> > color_blocks;
+  plan_sweep(&color_blocks);
+  int pass=0;
+  int ci=0;
+  // the workers are created once for all passes; the last one to reach the
+  // barrier adds the changes of the color just swept, in block order so the
+  // result does not depend on the thread count, and moves on to the next
+  // color (planning the next sweep when needed) while the others wait;
+  auto reduce=[&]() noexcept {
+    const Array<MCBlock> &blocks=color_blocks(ci);
+    for (int j=0; j<blocks.get_size(); j++) {
+      MCBlockAccum &acc=block_accum(blocks(j).index);
+      cur_energy+=acc.denergy/rspin_size;
+      cur_conc+=acc.dconc/rspin_size;
+      cur_disorder_param+=acc.ddisorder/rspin_size;
+      for (int i=0; i<total_clusters; i++) {
+        pcur_rho[i]+=acc.drho(i)/rspin_size;
+      }
+    }
+    ci++;
+    if (ci==color_blocks.get_size()) {
+      ci=0;
+      pass++;
+      if (pass<mc_passes) plan_sweep(&color_blocks);
+    }
+  };
+  std::barrier sync(nt,reduce);
+  auto worker=[&](int t) {
+    while (pass<mc_passes) {
+      const Array<MCBlock> &blocks=color_blocks(ci);
+      for (int j=t; j<blocks.get_size(); j+=nt) {
+        sweep_block(blocks(j),mode,&block_rng(blocks(j).index),&block_accum(blocks(j).index));
+      }
+      sync.arrive_and_wait();
+    }
+  };
+  std::vector<std::thread> threads;
+  for (int t=1; t<nt; t++) {
+    threads.push_back(std::thread(worker,t));
+  }
+  worker(0);
+  for (int t=0; t<nt-1; t++) {
+    threads[t].join();
+  }
+}
+
+int MonteCarlo::site_from_offset(int moffset, int *cell, int *incell) {
+  int mcell[3];
+  *incell=moffset % site_in_cell;
+  moffset/=site_in_cell;
+  for (int i=2; i>=0; i--) {
+    mcell[i]=moffset % total_box(i);
+    moffset/=total_box(i);
+  }
+  for (int i=0; i<3; i++) {
+    cell[i]=((mcell[i]-margin(i)) % supercell(i) + supercell(i)) % supercell(i);
+  }
+  return ((cell[0]*supercell(1) + cell[1])*supercell(2) + cell[2])*site_in_cell + *incell;
+}
+
+void MonteCarlo::update_flip_rate(int site) {
+  int incell=site % site_in_cell;
+  int c=site/site_in_cell;
+  int mcell[3];
+  for (int i=2; i>=0; i--) {
+    mcell[i]=c % supercell(i) + margin(i);
+    c/=supercell(i);
+  }
+  int offset=((mcell[0]*total_box(1) + mcell[1])*total_box(2) + mcell[2])*site_in_cell + incell;
+  Real denergy=site_flip_energy(offset,incell)+mu*(Real)(2*spin[offset]);
+  flip_rate.set(site,(denergy<0 ? 1. : exp(-denergy/T)));
+}
+
+void MonteCarlo::init_flip_rates(void) {
+  int spin_size=(int)rspin_size;
+  flip_rate.init(spin_size);
+  for (int i=0; i<spin_size; i++) {
+    update_flip_rate(i);
+  }
+  if (!flip_stamp) {
+    flip_stamp=new int[spin_size];
+  }
+  for (int i=0; i<spin_size; i++) {
+    flip_stamp[i]=0;
+  }
+  cur_stamp=0;
+  flip_accum.drho.resize(total_clusters);
+  flip_wait=-1.;
+  flip_rate_valid=1;
+}
+
+// n-fold way: each site flips at the Metropolis rate min(1,exp(-dE/T)) per
+// pass, so that the event sequence and the time spent in each state are those
+// of run(,1) without the rejected attempts.  The state is sampled at whole
+// passes, which weighs each configuration by its residence time;
+void MonteCarlo::rejection_free_run(int mc_passes) {
+  if (extension_is_active()) ERRORQUIT("Rejection-free mode is not available with k-space ECI");
+  if (!flip_rate_valid) init_flip_rates();
+  flip_accum.denergy=0.;
+  flip_accum.dconc=0.;
+  flip_accum.ddisorder=0.;
+  zero_array(&flip_accum.drho);
+  Real time_left=(Real)mc_passes;
+  while (1) {
+    if (flip_wait<0.) {
+      Real total=flip_rate.get_total();
+      Real r;
+      do {r=master_rng.uniform01();} while (r==0.);
+      flip_wait=(total>0. ? -log(r)/total : MAXFLOAT);
+    }
+    if (flip_wait>time_left) break;
+    time_left-=flip_wait;
+    flip_wait=-1.;
+    int site=flip_rate.find(master_rng.uniform01()*flip_rate.get_total());
+    int cell[3],mcell[3],incell;
+    int c=site/site_in_cell;
+    incell=site % site_in_cell;
+    for (int i=2; i>=0; i--) {
+      cell[i]=c % supercell(i);
+      mcell[i]=cell[i]+margin(i);
+      c/=supercell(i);
+    }
+    int offset=((mcell[0]*total_box(1) + mcell[1])*total_box(2) + mcell[2])*site_in_cell + incell;
+    Real dconc=-(Real)(2*spin[offset]);
+    flip_accum.denergy+=site_flip_energy(offset,incell)-mu*dconc;
+    flip_accum.dconc+=dconc;
+    commit_spin_flip(cell,incell,offset,&flip_accum);
+    // the rates of the flipped site and of every site sharing a cluster with it have changed;
+    if (cur_stamp==MAXINT) {
+      for (int i=0; i<(int)rspin_size; i++) {flip_stamp[i]=0;}
+      cur_stamp=0;
+    }
+    cur_stamp++;
+    update_flip_rate(site);
+    flip_stamp[site]=cur_stamp;
+    int *poffset=first_site_offset(offset,incell);
+    for (int j=0; j<nbr_row_len[incell]; j++, poffset++) {
+      int ncell[3],nincell;
+      int nsite=site_from_offset(offset+(*poffset),ncell,&nincell);
+      if (flip_stamp[nsite]!=cur_stamp) {
+        flip_stamp[nsite]=cur_stamp;
+        update_flip_rate(nsite);
+      }
+    }
+  }
+  flip_wait-=time_left;
+  cur_energy+=flip_accum.denergy/rspin_size;
+  cur_conc+=flip_accum.dconc/rspin_size;
+  cur_disorder_param+=flip_accum.ddisorder/rspin_size;
+  for (int i=0; i<total_clusters; i++) {
+    pcur_rho[i]+=flip_accum.drho(i)/rspin_size;
+  }
+}
+
+void MonteCarlo::get_species(Array<int> *pspecies) const {
+  pspecies->resize(supercell(0)*supercell(1)*supercell(2)*site_in_cell);
+  int k=0;
+  MultiDimIterator<iVector3d> cur_cell(supercell);
+  for ( ; cur_cell; cur_cell++) {
+    iVector3d m_cur_cell=(iVector3d &)cur_cell+margin;
+    for (int s=0; s<site_in_cell; s++, k++) {
+      int moffset=((m_cur_cell(0)*total_box(1) + m_cur_cell(1))*total_box(2) + m_cur_cell(2))*site_in_cell + s;
+      (*pspecies)(k)=(1+spin[moffset])/2;
+    }
+  }
+}
+
 void MonteCarlo::view(const Array<Arrayint> &labellookup, const Array<std::string> &atom_label, ofstream &file, const rMatrix3d &axes) {
   for (int i=0; i<3; i++) {
     file << axes.get_column(i) << endl;
@@ -532,6 +963,87 @@ void run_mc(MCOutputData *pmcdata, MonteCarlo *pmc, int mode, int n_step, Real p
   pmc->get_cluster_mult(&(pmcdata->mult));
 }
 
+ReplicaExchange::ReplicaExchange(const Array<MonteCarlo *> &_replica): ReplicaExchangeBase<MonteCarlo>(_replica), rng(), mu(), eci() {
+  rng.resize(replica.get_size());
+  for (int i=0; i<replica.get_size(); i++) {
+    rng(i)=master_rng.split();
+  }
+  paccum=NULL;
+}
+
+void ReplicaExchange::init_run(const Array<Real> &_T, const Array<Real> &_mu, const Array<Array<Real> > &_eci) {
+  if (_T.get_size()!=replica.get_size()) ERRORQUIT("ReplicaExchange: need one replica per temperature");
+  T=_T;
+  mu=_mu;
+  eci=_eci;
+  for (int s=0; s<replica.get_size(); s++) {
+    MonteCarlo *pmc=replica(slot_replica(s));
+    pmc->set_eci(eci(s));
+    pmc->init_run(T(s),mu(s));
+  }
+}
+
+void ReplicaExchange::run_replica(int r, int nb_pass) {
+  replica(r)->run(nb_pass,mode_cur,&rng(r));
+}
+
+void ReplicaExchange::sample_slot(int s) {
+  MonteCarlo *pmc=get_replica_at(s);
+  Array<Real> data(nb_value_accum+pmc->get_total_clusters());
+  data(0)=pmc->get_cur_energy();
+  data(1)=pmc->get_cur_concentration();
+  data(2)=1.-pmc->get_cur_disorder_param();
+  const Array<Real> &cur_corr=pmc->get_cur_corr();
+  for (int i=0; i<cur_corr.get_size(); i++) {data(nb_value_accum+i)=cur_corr(i);}
+  (*paccum)(s).new_data(data);
+}
+
+// energy per site of the configuration of replica r under the ECI and
+// chemical potential of slot s;
+Real ReplicaExchange::calc_enthalpy(int r, int s) {
+  const Array<Real> &corr=replica(r)->get_cur_corr();
+  Array<Real> mult;
+  replica(r)->get_cluster_mult(&mult);
+  Real E=0.;
+  for (int i=0; i<corr.get_size(); i++) {
+    E+=eci(s)(i)*mult(i)*corr(i);
+  }
+  return E-mu(s)*replica(r)->get_cur_concentration();
+}
+
+void ReplicaExchange::set_conditions(int r, int s) {
+  replica(r)->change_eci(eci(s));
+  replica(r)->init_run(T(s),mu(s));
+}
+
+void ReplicaExchange::run(Array<MCOutputData> *pmcdata, int n_equil, int n_step, int swap_interval, int mode) {
+  mode_cur=mode;
+  Array<Accumulator> accum(replica.get_size());
+  paccum=&accum;
+  run_schedule(n_equil,n_step,swap_interval);
+  paccum=NULL;
+  pmcdata->resize(replica.get_size());
+  for (int s=0; s<replica.get_size(); s++) {
+    MCOutputData &mcdata=(*pmcdata)(s);
+    mcdata.T=T(s);
+    mcdata.mu=mu(s);
+    const Array<Real> &mean=accum(s).get_mean();
+    const Array<Real> &var=accum(s).get_var();
+    mcdata.E=mean(0);
+    mcdata.x=mean(1);
+    mcdata.lro=mean(2);
+    mcdata.heatcap=var(0);
+    mcdata.suscept=var(1);
+    mcdata.corr.resize(replica(0)->get_total_clusters());
+    for (int i=0; i<mcdata.corr.get_size(); i++) {
+      mcdata.corr(i)=mean(nb_value_accum+i);
+    }
+    replica(0)->get_cluster_mult(&(mcdata.mult));
+    mcdata.n_equil=n_equil;
+    mcdata.n_step=n_step;
+  }
+}
+
 Equilibrator::Equilibrator(void): cur_sum(), cur_sum2(), bin_sum(), bin_sum2(), good_val(), buf_val() {}
 
 Equilibrator::Equilibrator(Real _prec, int data_size, int _which_elem, int init_granularity, int nb_bin):
@@ -681,7 +1193,11 @@ void Accumulator::accum(void) {
 
 KSpaceMonteCarlo::KSpaceMonteCarlo(const Structure &_lattice, const iVector3d &_supercell, const SpaceGroup &space_group,
 				   const LinkedList<Cluster> &cluster_list, KSpaceECI *_p_kspace_eci):
-  MonteCarlo(_lattice,_supercell,space_group,cluster_list),flipped_spins() {
+  KSpaceMonteCarlo(_lattice,_supercell,MCInteractionTable(_lattice,space_group,cluster_list),_p_kspace_eci) {}
+
+KSpaceMonteCarlo::KSpaceMonteCarlo(const Structure &_lattice, const iVector3d &_supercell, const MCInteractionTable &table,
+				   KSpaceECI *_p_kspace_eci):
+  MonteCarlo(_lattice,_supercell,table),flip_ring() {
   p_kspace_eci=_p_kspace_eci;
   nsite=_lattice.atom_pos.get_size();
   size=supercell(0)*supercell(1)*supercell(2);
@@ -690,6 +1206,7 @@ KSpaceMonteCarlo::KSpaceMonteCarlo(const Structure &_lattice, const iVector3d &_
   convol=new pComplex[nsite];
   ft_eci=new pComplex[nsite*(nsite+1)/2];
   dir_eci=new pComplex[nsite*(nsite+1)/2];
+  rs_eci=new pReal[nsite*(nsite+1)/2];
   for (int s=0; s<nsite; s++) {
     ft_spin[s]=new Complex[size];
     convol[s]=new Complex[size];
@@ -698,8 +1215,15 @@ KSpaceMonteCarlo::KSpaceMonteCarlo(const Structure &_lattice, const iVector3d &_
     for (int t=0; t<=s; t++) {
       ft_eci[unrollsym(s,t)]=new Complex[size];
       dir_eci[unrollsym(s,t)]=new Complex[size];
+      rs_eci[unrollsym(s,t)]=new Real[size];
     }
   }
+  // beyond that many flips, an FFT is cheaper anyway (must be even, see below);
+  flip_ring.resize(2*MAX(nsite*size,32));
+  flip_first=0;
+  nb_flip=0;
+  nb_flip_since_fft=0;
+  real_space_update=0;
   fft_time=0;
   flip_time=0;
   ref_x=MAXFLOAT;
@@ -759,7 +1283,11 @@ void KSpaceMonteCarlo::set_k_space_eci(void) {
 #endif
   for (int s=0; s<nsite; s++) {
     for (int t=0; t<=s; t++) {
-      fftnd(dir_eci[unrollsym(s,t)],3,supercell.get_buf(),-1);
+      int st=unrollsym(s,t);
+      fftnd_real_part(dir_eci[st],3,supercell.get_buf(),-1);
+      for (int i=0; i<size; i++) {
+	rs_eci[st][i]=real(dir_eci[st][i]);
+      }
     }
   }
 #ifdef DEBUG
@@ -773,7 +1301,9 @@ void KSpaceMonteCarlo::extension_calc_from_scratch(void) {
     set_k_space_eci();
   }
   fft_time=clock();
-  flipped_spins.delete_all();
+  flip_first=0;
+  nb_flip=0;
+  nb_flip_since_fft=0;
   flip_time=0;
   SPIN_TYPE *spin_corner=spin+((margin(0)*total_box(1) + margin(1))*total_box(2) + margin(2))*nsite;
   MultiDimIterator<iVector3d> cell(supercell);
@@ -786,7 +1316,7 @@ void KSpaceMonteCarlo::extension_calc_from_scratch(void) {
     }
   }
   for (int s=0; s<nsite; s++) {
-    fftnd(ft_spin[s],3,supercell.get_buf(),1);
+    fftnd_real(ft_spin[s],3,supercell.get_buf(),1);
   }
   cur_recip_E=0.;
 //rMatrix3d id;
@@ -806,23 +1336,35 @@ void KSpaceMonteCarlo::extension_calc_from_scratch(void) {
     }
   }
   for (int s=0; s<nsite; s++) {
-    fftnd(convol[s],3,supercell.get_buf(),-1);
+    fftnd_real_part(convol[s],3,supercell.get_buf(),-1);
   }
   cur_recip_E/=(rsize*rspin_size);
 //  cerr << "a_total=" << E_ref+cur_energy+cur_recip_E+mu*cur_conc << endl;
   fft_time=clock()-fft_time;
 }
 
+// The scratch recalculation is only done after an even number of flips, so
+// that the tentative first flip of a canonical exchange (which may be undone)
+// is never lost.
 void KSpaceMonteCarlo::extension_update_spin_flip(int *cell, int incell, int newspin, Real d_recip_energy) {
-  flipped_spins.push_front(new FlippedSpin(cell,incell,newspin,d_recip_energy));
+  get_flip(nb_flip)=FlippedSpin(cell,incell,newspin,d_recip_energy);
+  nb_flip++;
+  nb_flip_since_fft++;
   cur_recip_E+=d_recip_energy/rspin_size;
-  int nbflip=flipped_spins.get_size();
-  if (fabs(get_cur_concentration()-ref_x)>threshold_dx && (nbflip % 2)==0) {
+  int even=((nb_flip_since_fft % 2)==0);
+  if (fabs(get_cur_concentration()-ref_x)>threshold_dx && even) {
+    extension_calc_from_scratch();
+  }
+  else if (real_space_update) {
+    // keep only the last flip, which may still be undone;
+    while (nb_flip>1) fold_oldest_flip();
+  }
+  else if (nb_flip==flip_ring.get_size()) {
     extension_calc_from_scratch();
   } else {
     if (flip_time>0) {
-//cerr << "time: " << nbflip << " " << flip_time << " " << 2*fft_time/flip_time << endl;
-      if (nbflip > 2*fft_time/flip_time && (nbflip % 2)==0) {
+//cerr << "time: " << nb_flip << " " << flip_time << " " << 2*fft_time/flip_time << endl;
+      if (nb_flip > 2*fft_time/flip_time && even) {
 	extension_calc_from_scratch();
       }
     }
@@ -830,31 +1372,60 @@ void KSpaceMonteCarlo::extension_update_spin_flip(int *cell, int incell, int new
 }
 
 void KSpaceMonteCarlo::extension_undo_spin_flip(void) {
-  LinkedListIterator<FlippedSpin> last_flip(flipped_spins);
-  cur_recip_E-=(last_flip->d_recip_energy)/rspin_size;
-  delete flipped_spins.detach(last_flip);
+  nb_flip--;
+  nb_flip_since_fft--;
+  cur_recip_E-=(get_flip(nb_flip).d_recip_energy)/rspin_size;
+}
+
+// Adds the effect of the oldest pending flip to convol, i.e.
+// convol[s](r) += rs_eci[flip site,s](flip cell - r) * spin change.
+void KSpaceMonteCarlo::fold_oldest_flip(void) {
+  FlippedSpin &flip=get_flip(0);
+  int *psupercell=supercell.get_buf();
+  Real spinchange=2.*(Real)(flip.newspin);
+  for (int s=0; s<nsite; s++) {
+    Real *pkernel=rs_eci[unrollsym(flip.incell,s)];
+    Complex *pconvol=convol[s];
+    for (int z=0; z<psupercell[2]; z++) {
+      int dz=(flip.cell[2]-z+psupercell[2]) % psupercell[2];
+      for (int y=0; y<psupercell[1]; y++) {
+	int dy=(flip.cell[1]-y+psupercell[1]) % psupercell[1];
+	Complex *prow=pconvol+(z*psupercell[1] + y)*psupercell[0];
+	Real *pkrow=pkernel+(dz*psupercell[1] + dy)*psupercell[0];
+	int x=0;
+	for (; x<=flip.cell[0]; x++) {
+	  prow[x]+=pkrow[flip.cell[0]-x]*spinchange;
+	}
+	for (; x<psupercell[0]; x++) {
+	  prow[x]+=pkrow[flip.cell[0]-x+psupercell[0]]*spinchange;
+	}
+      }
+    }
+  }
+  flip_first=(flip_first+1) % flip_ring.get_size();
+  nb_flip--;
 }
 
 Real KSpaceMonteCarlo::extension_spin_flip_energy(int *cell, int incell, int newspin) {
 //  cerr << "f_total=" << E_ref+cur_energy+cur_recip_E+mu*cur_conc << endl;
-  flip_time=clock();
+  if (!real_space_update) flip_time=clock();
   int dr[3];
   int *psupercell=supercell.get_buf();
   Real rspinchange=2.*(Real)newspin;
   //int offset=((cell[0]*psupercell[1] + cell[1])*psupercell[2] + cell[2]); //permbug
   int offset=((cell[2]*psupercell[1] + cell[1])*psupercell[0] + cell[0]);
-  Real dE=4.*real(dir_eci[unrollsym(incell,incell)][0]);
-  dE+=2.*real(convol[incell][offset]*rspinchange);
-  LinkedListIterator<FlippedSpin> i(flipped_spins);
-  for (; i; i++) {
+  Real dE=4.*rs_eci[unrollsym(incell,incell)][0];
+  dE+=2.*real(convol[incell][offset])*rspinchange;
+  for (int f=nb_flip-1; f>=0; f--) {
+    const FlippedSpin &flip=get_flip(f);
     for (int j=0; j<3; j++) {
-      dr[j]=(i->cell[j]-cell[j]+psupercell[j]) % psupercell[j];
+      dr[j]=(flip.cell[j]-cell[j]+psupercell[j]) % psupercell[j];
     }
     //int offsetdr=((dr[0]*psupercell[1] + dr[1])*psupercell[2] + dr[2]); //permbug
     int offsetdr=((dr[2]*psupercell[1] + dr[1])*psupercell[0] + dr[0]);
-    dE+=2.*real(dir_eci[unrollsym(i->incell,incell)][offsetdr])*2.*(i->newspin)*rspinchange;
+    dE+=2.*rs_eci[unrollsym(flip.incell,incell)][offsetdr]*2.*(flip.newspin)*rspinchange;
   }
-  flip_time=clock()-flip_time;
+  if (!real_space_update) flip_time=clock()-flip_time;
   return dE;
 }
 
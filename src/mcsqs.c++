@@ -1,20 +1,25 @@
 #include "calccorr.h"
 #include "clus_str.h"
+#include "corrcache.h"
 #include "getvalue.h"
 #include "parse.h"
+#include "rndstream.h"
 #include "version.h"
+#include <atomic>
 #include <fstream>
+#include <mutex>
+#include <thread>
 
 extern const char *helpstring;
 
-void generate_permutation(Array<int> *pperm, int n) {
+void generate_permutation(Array<int> *pperm, int n, RandomStream *rng) {
   pperm->resize(n);
   for (int i = 0; i < n; i++) {
     (*pperm)(i) = -1;
   }
   for (int d = 0; d < n; d++) {
     int i = 0;
-    int r = random(n - d);
+    int r = rng->random(n - d);
     while (1) {
       while ((*pperm)(i) != -1) {
         i++;
@@ -32,10 +37,7 @@ void calc_all_corr(Array<Real> *pcorr, const Structure &str,
                    const Array<Array<MultiCluster>> &eqclus,
                    const rMatrix3d unitcell,
                    const Array<Array<Array<Real>>> &corrfunc) {
-  pcorr->resize(eqclus.get_size());
-  for (int t = 0; t < eqclus.get_size(); t++) {
-    (*pcorr)(t) = calc_correlation(str, eqclus(t), unitcell, corrfunc);
-  }
+  calc_correlations(pcorr, str, eqclus, unitcell, corrfunc);
 }
 
 /*
@@ -145,6 +147,485 @@ public:
   }
 };
 
+// All cluster instances of one supercell, indexed by the atoms they contain,
+// so that the correlations can be updated after swapping two atoms by
+// visiting only the clusters that contain them.
+class CorrelationDelta {
+  Array<int> inst_type;  // cluster type (index in eqclus) of each instance;
+  Array<int> inst_begin; // first site of each instance in inst_atom;
+  Array<int> inst_atom;
+  Array<int> inst_func; // index in func_table, one per entry of inst_atom;
+  Array<const Real *> func_table;
+  Array<Array<int>> site_inst; // instances containing each atom;
+  Array<Real> count;
+  Array<Real> sum;
+  Array<Real> saved_sum;
+  Array<int> stamp;
+  int cur_stamp;
+  int dirty;
+
+  Real calc_instance(int i, const Array<int> &atom_type) const {
+    Real sigma = 1.;
+    for (int j = inst_begin(i); j < inst_begin(i + 1); j++) {
+      sigma *= func_table(inst_func(j))[atom_type(inst_atom(j))];
+    }
+    return sigma;
+  }
+
+public:
+  CorrelationDelta(void)
+      : inst_type(), inst_begin(), inst_atom(), inst_func(), func_table(),
+        site_inst(), count(), sum(), saved_sum(), stamp() {
+    cur_stamp = 0;
+    dirty = 0;
+  }
+  void init(const Structure &str, const Array<Array<MultiCluster>> &eqclus,
+            const rMatrix3d &unitcell,
+            const Array<Array<Array<Real>>> &corrfunc) {
+    // one entry of func_table per (site type, function) pair actually used;
+    Array<Array<int>> func_index(corrfunc.get_size());
+    for (int st = 0; st < corrfunc.get_size(); st++) {
+      func_index(st).resize(corrfunc(st).get_size());
+      for (int f = 0; f < func_index(st).get_size(); f++) {
+        func_index(st)(f) = -1;
+      }
+    }
+    LinkedList<const Real *> func_list_table;
+    int nb_func = 0;
+    LinkedList<int> type_list, atom_list, func_list, begin_list;
+    count.resize(eqclus.get_size());
+    zero_array(&count);
+    rMatrix3d inv_strcell = !str.cell;
+    int nb_inst = 0;
+    int nb_entry = 0;
+    LatticePointInCellIterator t(unitcell, str.cell);
+    for (; t; t++) {
+      for (int ct = 0; ct < eqclus.get_size(); ct++) {
+        for (int c = 0; c < eqclus(ct).get_size(); c++) {
+          const MultiCluster &clus = eqclus(ct)(c);
+          type_list << new int(ct);
+          begin_list << new int(nb_entry);
+          for (int at = 0; at < clus.clus.get_size(); at++) {
+            int &f = func_index(clus.site_type(at))(clus.func(at));
+            if (f == -1) {
+              f = nb_func++;
+              func_list_table << new const Real *(
+                  corrfunc(clus.site_type(at))(clus.func(at)).get_buf_c());
+            }
+            atom_list << new int(
+                which_atom(str.atom_pos, t + clus.clus(at), inv_strcell));
+            func_list << new int(f);
+            nb_entry++;
+          }
+          count(ct) += 1.;
+          nb_inst++;
+        }
+      }
+    }
+    begin_list << new int(nb_entry);
+    LinkedList_to_Array(&inst_type, type_list);
+    LinkedList_to_Array(&inst_begin, begin_list);
+    LinkedList_to_Array(&inst_atom, atom_list);
+    LinkedList_to_Array(&inst_func, func_list);
+    LinkedList_to_Array(&func_table, func_list_table);
+
+    // the same instance may contain an atom twice in small supercells;
+    // it is then listed only once for that atom;
+    Array<int> nb_site_inst(str.atom_pos.get_size());
+    zero_array(&nb_site_inst);
+    stamp.resize(MAX(nb_inst, str.atom_pos.get_size()));
+    for (int i = 0; i < stamp.get_size(); i++) {
+      stamp(i) = -1;
+    }
+    for (int i = 0; i < nb_inst; i++) {
+      for (int j = inst_begin(i); j < inst_begin(i + 1); j++) {
+        if (stamp(inst_atom(j)) != i) {
+          stamp(inst_atom(j)) = i;
+          nb_site_inst(inst_atom(j))++;
+        }
+      }
+    }
+    site_inst.resize(str.atom_pos.get_size());
+    for (int a = 0; a < site_inst.get_size(); a++) {
+      site_inst(a).resize(nb_site_inst(a));
+      nb_site_inst(a) = 0;
+    }
+    for (int i = 0; i < stamp.get_size(); i++) {
+      stamp(i) = -1;
+    }
+    for (int i = 0; i < nb_inst; i++) {
+      for (int j = inst_begin(i); j < inst_begin(i + 1); j++) {
+        int a = inst_atom(j);
+        if (stamp(a) != i) {
+          stamp(a) = i;
+          site_inst(a)(nb_site_inst(a)++) = i;
+        }
+      }
+    }
+    stamp.resize(nb_inst);
+    for (int i = 0; i < nb_inst; i++) {
+      stamp(i) = 0;
+    }
+    cur_stamp = 0;
+    sum.resize(eqclus.get_size());
+    saved_sum.resize(eqclus.get_size());
+  }
+  void calc_from_scratch(const Array<int> &atom_type) {
+    zero_array(&sum);
+    for (int i = 0; i < inst_type.get_size(); i++) {
+      sum(inst_type(i)) += calc_instance(i, atom_type);
+    }
+    dirty = 0;
+  }
+  // recomputes the sums if they have been updated incrementally since the
+  // last call, so that roundoff errors cannot accumulate;
+  int refresh(const Array<int> &atom_type) {
+    if (!dirty) {
+      return 0;
+    }
+    calc_from_scratch(atom_type);
+    return 1;
+  }
+  void get_corr(Array<Real> *pcorr) const {
+    pcorr->resize(sum.get_size());
+    for (int t = 0; t < sum.get_size(); t++) {
+      (*pcorr)(t) = sum(t) / count(t);
+    }
+  }
+  // exchanges the types of atoms at1 and at2 and updates the correlations;
+  void swap_atoms(Array<int> *patom_type, int at1, int at2) {
+    saved_sum = sum;
+    cur_stamp++;
+    if (cur_stamp == MAXINT) {
+      for (int i = 0; i < stamp.get_size(); i++) {
+        stamp(i) = 0;
+      }
+      cur_stamp = 1;
+    }
+    const Array<int> &list1 = site_inst(at1);
+    const Array<int> &list2 = site_inst(at2);
+    for (int k = 0; k < list1.get_size(); k++) {
+      stamp(list1(k)) = cur_stamp;
+      sum(inst_type(list1(k))) -= calc_instance(list1(k), *patom_type);
+    }
+    for (int k = 0; k < list2.get_size(); k++) {
+      if (stamp(list2(k)) != cur_stamp) {
+        sum(inst_type(list2(k))) -= calc_instance(list2(k), *patom_type);
+      }
+    }
+    ::swap(&((*patom_type)(at1)), &((*patom_type)(at2)));
+    for (int k = 0; k < list1.get_size(); k++) {
+      sum(inst_type(list1(k))) += calc_instance(list1(k), *patom_type);
+    }
+    for (int k = 0; k < list2.get_size(); k++) {
+      if (stamp(list2(k)) != cur_stamp) {
+        sum(inst_type(list2(k))) += calc_instance(list2(k), *patom_type);
+      }
+    }
+    dirty = 1;
+  }
+  // undoes the last swap_atoms exactly;
+  void undo_swap(Array<int> *patom_type, int at1, int at2) {
+    ::swap(&((*patom_type)(at1)), &((*patom_type)(at2)));
+    sum = saved_sum;
+  }
+};
+
+// Objective function, optimization parameters and output shared by all the
+// chains of a search (see SqsChain). The best objective found so far is kept
+// in an atomic, so that a chain only needs to take the lock when it has
+// actually improved on it.
+class SqsSearch {
+public:
+  Array<Real> tcorr;
+  Array<Real> diam;
+  Array<int> nbpt;
+  Real mysqstol;
+  Real weightdist;
+  Real weightnbpt;
+  Real weightdecay;
+  Real T;
+  const char *paramfilename;
+  int maxtic;
+  const Structure *pulat;
+  const Array<Arrayint> *psite_type_list;
+  const Array<std::string> *patom_label;
+  rMatrix3d axes;
+  int ip;
+  int sigdig;
+  ofstream *plogfile;
+  CorrelationCache *pcache; // where the correlations of the best SQS are saved;
+  Array<uint64_t> clus_key;
+  std::atomic<int> param_version;
+  std::atomic<Real> best_obj;
+  std::atomic<int> stop;
+  std::mutex lock;
+
+  SqsSearch(void) : tcorr(), diam(), nbpt(), clus_key() {
+    pcache = NULL;
+    param_version = 0;
+    best_obj = MAXFLOAT;
+    stop = 0;
+  }
+  // writes bestsqs.out and bestcorr.out (call with the lock held);
+  void write_best(const SupercellData &best) {
+    ofstream strfile;
+    open_numbered_file(strfile, "bestsqs", ip, ".out");
+    strfile.setf(ios::fixed);
+    strfile.precision(sigdig);
+    write_structure(best.str, *pulat, *psite_type_list, *patom_label, axes,
+                    strfile);
+    ofstream corrfile;
+    open_numbered_file(corrfile, "bestcorr", ip, ".out");
+    corrfile.setf(ios::fixed);
+    corrfile.precision(sigdig);
+    for (int t = 0; t < best.corr.get_size(); t++) {
+      corrfile << nbpt(t) << "\t" << diam(t) << "\t" << best.corr(t) << "\t"
+               << tcorr(t) << "\t" << (best.corr(t) - tcorr(t)) << endl;
+    }
+    ofstream &logfile = *plogfile;
+    if (best.obj == -MAXFLOAT) {
+      corrfile << "Objective_function= Perfect_match" << endl;
+      logfile << "Objective_function= Perfect_match" << endl << flush;
+    } else {
+      corrfile << "Objective_function= " << best.obj << endl;
+      logfile << "Objective_function= " << best.obj << endl << flush;
+    }
+    logfile << "Correlations_mismatch= ";
+    for (int t = 0; t < best.corr.get_size(); t++) {
+      logfile << "\t" << (best.corr(t) - tcorr(t));
+    }
+    logfile << endl << flush;
+    if (pcache) {
+      // keyed like the structure corrdump maps bestsqs.out onto (sites with
+      // a single species removed);
+      Structure active;
+      active.cell = best.str.cell;
+      LinkedList<rVector3d> pos_list;
+      LinkedList<int> type_list;
+      for (int at = 0; at < best.str.atom_pos.get_size(); at++) {
+        if (best.nbcomp(at) > 1) {
+          pos_list << new rVector3d(best.str.atom_pos(at));
+          type_list << new int(best.str.atom_type(at));
+        }
+      }
+      LinkedList_to_Array(&active.atom_pos, pos_list);
+      LinkedList_to_Array(&active.atom_type, type_list);
+      uint64_t str_key = hash_structure(active);
+      for (int t = 0; t < best.corr.get_size(); t++) {
+        pcache->add(str_key, clus_key(t), best.corr(t));
+      }
+      pcache->flush();
+    }
+    if (best.obj == -MAXFLOAT) {
+      stop = 1;
+    }
+  }
+  // writes out sqs if its objective (evaluated with the parameters of
+  // the given version) beats that of every SQS found so far by any chain;
+  void offer_best(const SupercellData &sqs, int version) {
+    Real cur = best_obj;
+    while (sqs.obj < cur && version == param_version) {
+      if (best_obj.compare_exchange_weak(cur, sqs.obj)) {
+        std::lock_guard<std::mutex> guard(lock);
+        // skip if another chain got better in the meantime;
+        if (best_obj == sqs.obj && version == param_version) {
+          write_best(sqs);
+        }
+        return;
+      }
+    }
+  }
+  // rereads the parameter file and checks for the stopsqs file;
+  void read_param(void) {
+    std::lock_guard<std::mutex> guard(lock);
+    ofstream &logfile = *plogfile;
+    ifstream tempfile(paramfilename);
+    Real newweightdist = 1.;
+    Real newweightnbpt = 1.;
+    Real newweightdecay = 0.;
+    Real newT = MAXFLOAT;
+    if (tempfile) {
+      tempfile >> newweightdist >> newweightnbpt >> newweightdecay >> newT;
+      if (newT == MAXFLOAT) {
+        newT = newweightnbpt;
+        newweightdecay = 0;
+        newweightnbpt = 1;
+      }
+      if (newweightdist != weightdist || newweightnbpt != weightnbpt ||
+          newweightdecay != weightdecay || newT != T) {
+        logfile << "New parameters read in: -wr=" << newweightdist
+                << " -wp=" << newweightnbpt << " -wd=" << newweightdecay
+                << " -T=" << newT << endl;
+      }
+      T = newT;
+      if (newweightdist != weightdist || newweightnbpt != weightnbpt ||
+          newweightdecay != weightdecay) {
+        weightdist = newweightdist;
+        weightnbpt = newweightnbpt;
+        weightdecay = newweightdecay;
+        // objectives obtained with the old weights are not comparable;
+        param_version++;
+        best_obj = MAXFLOAT;
+      }
+    }
+    if (file_exists("stopsqs")) {
+      unlink("stopsqs");
+      logfile << "Stopped" << endl;
+      stop = 1;
+    }
+  }
+};
+
+// One Metropolis chain over all supercells. Several chains can run
+// concurrently on the same SqsSearch (option -nt); each draws its random
+// numbers from its own stream rng.
+class SqsChain {
+public:
+  Array<SupercellData> mc;
+  Array<CorrelationDelta> corrdelta;
+  int cc;
+  Real obj;
+  Real weightdist;
+  Real weightnbpt;
+  Real weightdecay;
+  Real T;
+  int param_version;
+  SqsSearch *psearch;
+  RandomStream rng;
+
+  SqsChain(void) : mc(), corrdelta(), rng() {
+    cc = 0;
+    obj = MAXFLOAT;
+    psearch = NULL;
+  }
+  int random_int(int max) { return rng.random(max); }
+  Real random01(void) { return rng.uniform01(); }
+  Real calc_obj(const Array<Real> &corr) const {
+    return calc_objective_func(corr, psearch->tcorr, psearch->mysqstol,
+                               weightdist, weightnbpt, weightdecay,
+                               psearch->diam, psearch->nbpt);
+  }
+  // fetches the current parameters and, if the weights changed, restarts
+  // from the supercell that is best according to the new weights;
+  void sync_param(void) {
+    {
+      std::lock_guard<std::mutex> guard(psearch->lock);
+      T = psearch->T;
+      if (param_version == psearch->param_version) {
+        return;
+      }
+      weightdist = psearch->weightdist;
+      weightnbpt = psearch->weightnbpt;
+      weightdecay = psearch->weightdecay;
+      param_version = psearch->param_version;
+    }
+    obj = MAXFLOAT;
+    for (int c = 0; c < mc.get_size(); c++) {
+      mc(c).obj = calc_obj(mc(c).corr);
+      if (mc(c).obj < obj) {
+        obj = mc(c).obj;
+        cc = c;
+      }
+    }
+  }
+  // assigns random occupations (with the compositions given by
+  // sym_type_prob) to the supercells in mc, whose atom types must initially
+  // hold the symmetry-distinct site types;
+  void init(SqsSearch *_psearch, const Array<Array<Real>> &sym_type_prob,
+            const RandomStream &_rng) {
+    psearch = _psearch;
+    rng = _rng;
+    weightdist = psearch->weightdist;
+    weightnbpt = psearch->weightnbpt;
+    weightdecay = psearch->weightdecay;
+    T = psearch->T;
+    param_version = psearch->param_version;
+    obj = MAXFLOAT;
+    for (int c = 0; c < mc.get_size(); c++) {
+      Array<int> curtype = mc(c).str.atom_type;
+      for (int at = 0; at < mc(c).str.atom_pos.get_size();) {
+        int nbat = mc(c).typeend(at) - mc(c).typebeg(at);
+        Array<int> perm;
+        generate_permutation(&perm, nbat, &rng);
+        int at2 = 0;
+        for (int t = 0; t < mc(c).nbcomp(at); t++) {
+          Real rnum = (Real)nbat * sym_type_prob(curtype(at))(t);
+          int inum = (int)round(rnum);
+          // cerr << rnum << " " << inum << endl;
+          if (!near_zero((Real)inum - rnum))
+            ERRORQUIT("Impossible to match point correlations due to "
+                      "incompatible supercell size.");
+          for (int i = 0; i < inum; i++) {
+            mc(c).str.atom_type(at + perm(at2)) = t;
+            at2++;
+          }
+        }
+        at = mc(c).typeend(at);
+      }
+      corrdelta(c).calc_from_scratch(mc(c).str.atom_type);
+      corrdelta(c).get_corr(&(mc(c).corr));
+      mc(c).obj = calc_obj(mc(c).corr);
+      if (mc(c).obj < obj) {
+        obj = mc(c).obj;
+        cc = c;
+      }
+    }
+  }
+  // runs until a perfect match is found or the search is stopped;
+  void run(void) {
+    int tic = 0;
+    while (1) {
+      if (obj < psearch->best_obj) {
+        psearch->offer_best(mc(cc), param_version);
+      }
+      if (psearch->stop) {
+        break;
+      }
+      if (tic == 0) {
+        for (int c = 0; c < mc.get_size(); c++) {
+          if (corrdelta(c).refresh(mc(c).str.atom_type)) {
+            corrdelta(c).get_corr(&(mc(c).corr));
+            mc(c).obj = calc_obj(mc(c).corr);
+          }
+        }
+        obj = mc(cc).obj;
+        psearch->read_param();
+        if (psearch->stop) {
+          break;
+        }
+        sync_param();
+        tic = psearch->maxtic;
+      }
+      int newcc = random_int(mc.get_size());
+      int at1, at2;
+      do {
+        at1 = random_int(mc(newcc).nbactive);
+        int nbat = mc(newcc).typeend(at1) - mc(newcc).typebeg(at1);
+        at2 = mc(newcc).typebeg(at1) + ((1 + random_int(nbat - 1)) % nbat);
+      } while (mc(newcc).str.atom_type(at1) == mc(newcc).str.atom_type(at2));
+      corrdelta(newcc).swap_atoms(&(mc(newcc).str.atom_type), at1, at2);
+      Array<Real> newcorr;
+      corrdelta(newcc).get_corr(&newcorr);
+      Real newobj = calc_obj(newcorr);
+      //  cerr << newcc << " " << obj << " " << newobj << " ";
+      //    for (int t=0; t<newcorr.get_size(); t++) {cerr << newcorr(t) << " ";}
+      if (random01() < exp((obj - newobj) / T)) {
+        mc(newcc).corr = newcorr;
+        mc(newcc).obj = newobj;
+        cc = newcc;
+        obj = newobj;
+        //  cerr << "A";
+      } else {
+        corrdelta(newcc).undo_swap(&(mc(newcc).str.atom_type), at1, at2);
+        //  cerr << "r";
+      }
+      //  cerr << endl << flush;
+      tic--;
+    }
+  }
+};
+
 #define MAXMULTIPLET 6
 
 int main(int argc, char *argv[]) {
@@ -167,6 +648,8 @@ int main(int argc, char *argv[]) {
   int maxtic = 10000;
   int do2d = 0;
   int sigdig = 6;
+  int nb_threads = 1;
+  int usecache = 0;
   const char *corrfunc_label = "trigo";
   int dohelp = 0;
   AskStruct options[] = {
@@ -231,6 +714,13 @@ int main(int argc, char *argv[]) {
       {"-sig",
        "Number of significant digits to print in output files (default: 6)",
        INTVAL, &sigdig},
+      {"-nt",
+       "Number of threads, each running an independent chain (default: 1)",
+       INTVAL, &nb_threads},
+      {"-cc",
+       "Save the correlations of the best SQS in the correlation cache shared "
+       "with maps/mmaps/corrdump (corrcache.bin, next to the cluster file)",
+       BOOLVAL, &usecache},
       {"-h", "Display more help", BOOLVAL, &dohelp}};
   if (!get_values(argc, argv, countof(options), options)) {
     display_help(countof(options), options);
@@ -546,10 +1036,38 @@ int main(int argc, char *argv[]) {
 
   rndseed(seed);
 
+  SqsSearch search;
+  search.tcorr = tcorr;
+  search.diam = diam;
+  search.nbpt = nbpt;
+  search.mysqstol = mysqstol;
+  search.weightdist = weightdist;
+  search.weightnbpt = weightnbpt;
+  search.weightdecay = weightdecay;
+  search.T = T;
+  search.paramfilename = paramfilename;
+  search.maxtic = maxtic;
+  search.pulat = &ulat;
+  CorrelationCache corrcache;
+  if (usecache) {
+    corrcache.open(corrcache_filename(clusterfilename).c_str());
+    uint64_t context = corrcache_context(ulat, *pcorrfunc);
+    search.clus_key.resize(clusterlist.get_size());
+    LinkedListIterator<MultiCluster> ic(clusterlist);
+    for (int t = 0; ic; t++, ic++) {
+      search.clus_key(t) = hash_cluster(*ic, context);
+    }
+    search.pcache = &corrcache;
+  }
+  search.psite_type_list = &site_type_list;
+  search.patom_label = &atom_label;
+  search.axes = axes;
+  search.ip = ip;
+  search.sigdig = sigdig;
+  search.plogfile = &logfile;
+
   Array<SupercellData> mc(supercell.get_size());
-  SupercellData best;
-  best.obj = MAXFLOAT;
-  int cc = 0;
+  Array<CorrelationDelta> corrdelta(supercell.get_size());
 
   logfile << "Initializing random supercells..." << endl << flush;
   for (int c = 0; c < supercell.get_size(); c++) {
@@ -557,12 +1075,13 @@ int main(int argc, char *argv[]) {
     find_all_atom_in_supercell_ordered(&(mc(c).str.atom_pos),
                                        &(mc(c).str.atom_type), lat.atom_pos,
                                        lat.atom_type, lat.cell, mc(c).str.cell);
-    Array<int> curtype = mc(c).str.atom_type;
+    const Array<int> &curtype = mc(c).str.atom_type;
     int curbeg = 0;
     int curend = 0;
     mc(c).nbcomp.resize(curtype.get_size());
     mc(c).typebeg.resize(curtype.get_size());
     mc(c).typeend.resize(curtype.get_size());
+    mc(c).nbactive = curtype.get_size();
     for (int at = 0; at < curtype.get_size(); at++) {
       mc(c).nbcomp(at) = site_type_list(sym_to_type(curtype(at))).get_size();
       if (at == curend) {
@@ -575,151 +1094,39 @@ int main(int argc, char *argv[]) {
       }
       mc(c).typebeg(at) = curbeg;
       mc(c).typeend(at) = curend;
-    }
-    mc(c).nbactive = curtype.get_size();
-    for (int at = 0; at < mc(c).str.atom_pos.get_size();) {
-      int nbat = mc(c).typeend(at) - mc(c).typebeg(at);
-      Array<int> perm;
-      generate_permutation(&perm, nbat);
-      if (mc(c).nbcomp(at) == 1) {
-        if (mc(c).nbactive == curtype.get_size()) {
-          mc(c).nbactive = at;
-        }
+      if (mc(c).nbcomp(at) == 1 && mc(c).nbactive == curtype.get_size()) {
+        mc(c).nbactive = curbeg;
       }
-      int at2 = 0;
-      for (int t = 0; t < mc(c).nbcomp(at); t++) {
-        Real rnum = (Real)nbat * sym_type_prob(curtype(at))(t);
-        int inum = (int)round(rnum);
-        // cerr << rnum << " " << inum << endl;
-        if (!near_zero((Real)inum - rnum))
-          ERRORQUIT("Impossible to match point correlations due to "
-                    "incompatible supercell size.");
-        for (int i = 0; i < inum; i++) {
-          mc(c).str.atom_type(at + perm(at2)) = t;
-          at2++;
-        }
-      }
-      at = mc(c).typeend(at);
     }
-    calc_all_corr(&(mc(c).corr), mc(c).str, eqclus, lat.cell, *pcorrfunc);
-    mc(c).obj = calc_objective_func(mc(c).corr, tcorr, mysqstol, weightdist,
-                                    weightnbpt, weightdecay, diam, nbpt);
-    if (mc(c).obj < best.obj) {
-      best = mc(c);
-      cc = c;
+    corrdelta(c).init(mc(c).str, eqclus, lat.cell, *pcorrfunc);
+  }
+
+  // each chain draws from its own substream of -sd;
+  int nb_chain = MAX(nb_threads, 1);
+  Array<SqsChain> chain(nb_chain);
+  RandomStream master_rng(seed);
+  for (int i = nb_chain - 1; i >= 0; i--) {
+    if (i > 0) {
+      chain(i).mc = mc;
+      chain(i).corrdelta = corrdelta;
+    } else {
+      chain(i).mc = std::move(mc);
+      chain(i).corrdelta = std::move(corrdelta);
     }
+    chain(i).init(&search, sym_type_prob, master_rng.split());
   }
   logfile << "Initialization done." << endl;
 
-  int tic = 0;
-  Real obj = best.obj;
-  best.obj = MAXFLOAT;
-  while (1) {
-    if (obj < best.obj) {
-      // cerr << "Best" << endl;
-      best = mc(cc);
-      ofstream strfile;
-      open_numbered_file(strfile, "bestsqs", ip, ".out");
-      strfile.setf(ios::fixed);
-      strfile.precision(sigdig);
-      write_structure(best.str, ulat, site_type_list, atom_label, axes,
-                      strfile);
-      ofstream corrfile;
-      open_numbered_file(corrfile, "bestcorr", ip, ".out");
-      corrfile.setf(ios::fixed);
-      corrfile.precision(sigdig);
-      for (int t = 0; t < best.corr.get_size(); t++) {
-        corrfile << nbpt(t) << "\t" << diam(t) << "\t" << best.corr(t) << "\t"
-                 << tcorr(t) << "\t" << (best.corr(t) - tcorr(t)) << endl;
-      }
-      if (best.obj == -MAXFLOAT) {
-        corrfile << "Objective_function= Perfect_match" << endl;
-        logfile << "Objective_function= Perfect_match" << endl << flush;
-      } else {
-        corrfile << "Objective_function= " << best.obj << endl;
-        logfile << "Objective_function= " << best.obj << endl << flush;
-      }
-      logfile << "Correlations_mismatch= ";
-      for (int t = 0; t < best.corr.get_size(); t++) {
-        logfile << "\t" << (best.corr(t) - tcorr(t));
-      }
-      logfile << endl << flush;
-      if (best.obj == -MAXFLOAT) {
-        break;
-      }
+  if (nb_chain == 1) {
+    chain(0).run();
+  } else {
+    logfile << "Running " << nb_chain << " chains in parallel." << endl;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < nb_chain; i++) {
+      threads.push_back(std::thread(&SqsChain::run, &chain(i)));
     }
-
-    if (tic == 0) {
-      ifstream tempfile(paramfilename);
-      Real newweightdist = 1.;
-      Real newweightnbpt = 1.;
-      Real newweightdecay = 0.;
-      Real newT = MAXFLOAT;
-      if (tempfile) {
-        tempfile >> newweightdist >> newweightnbpt >> newweightdecay >> newT;
-        if (newT == MAXFLOAT) {
-          newT = newweightnbpt;
-          newweightdecay = 0;
-          newweightnbpt = 1;
-        }
-        if (newweightdist != weightdist || newweightnbpt != weightnbpt ||
-            newweightdecay != weightdecay || newT != T) {
-          logfile << "New parameters read in: -wr=" << newweightdist
-                  << " -wp=" << newweightnbpt << " -wd=" << newweightdecay
-                  << " -T=" << newT << endl;
-        }
-        T = newT;
-        if (newweightdist != weightdist || newweightnbpt != weightnbpt ||
-            newweightdecay != weightdecay) {
-          weightdist = newweightdist;
-          weightnbpt = newweightnbpt;
-          weightdecay = newweightdecay;
-          best.obj = MAXFLOAT;
-          for (int c = 0; c < mc.get_size(); c++) {
-            mc(c).obj =
-                calc_objective_func(mc(c).corr, tcorr, mysqstol, weightdist,
-                                    weightnbpt, weightdecay, diam, nbpt);
-            if (mc(c).obj < best.obj) {
-              best = mc(c);
-              cc = c;
-            }
-          }
-          obj = best.obj;
-          best.obj = MAXFLOAT;
-        }
-      }
-      if (file_exists("stopsqs")) {
-        unlink("stopsqs");
-        logfile << "Stopped" << endl;
-        break;
-      }
-      tic = maxtic;
-    }
-    int newcc = random(mc.get_size());
-    int at1, at2;
-    do {
-      at1 = random(mc(newcc).nbactive);
-      int nbat = mc(newcc).typeend(at1) - mc(newcc).typebeg(at1);
-      at2 = mc(newcc).typebeg(at1) + ((1 + random(nbat - 1)) % nbat);
-    } while (mc(newcc).str.atom_type(at1) == mc(newcc).str.atom_type(at2));
-    swap(&(mc(newcc).str.atom_type(at1)), &(mc(newcc).str.atom_type(at2)));
-    Array<Real> newcorr;
-    calc_all_corr(&newcorr, mc(newcc).str, eqclus, lat.cell, *pcorrfunc);
-    Real newobj = calc_objective_func(newcorr, tcorr, mysqstol, weightdist,
-                                      weightnbpt, weightdecay, diam, nbpt);
-    //  cerr << newcc << " " << best.obj << " " << obj << " " << newobj << " ";
-    //    for (int t=0; t<newcorr.get_size(); t++) {cerr << newcorr(t) << " ";}
-    if (uniform01() < exp((obj - newobj) / T)) {
-      mc(newcc).corr = newcorr;
-      mc(newcc).obj = newobj;
-      cc = newcc;
-      obj = newobj;
-      //  cerr << "A";
-    } else {
-      swap(&(mc(newcc).str.atom_type(at1)), &(mc(newcc).str.atom_type(at2)));
-      //  cerr << "r";
+    for (int i = 0; i < nb_chain; i++) {
+      threads[i].join();
     }
-    //  cerr << endl << flush;
-    tic--;
   }
 }
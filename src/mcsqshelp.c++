@@ -89,6 +89,23 @@ const char *helpstring =
     "  [If your are using a version prior to  3.07, these should be entered in "
     "cartesian coordinates.]\n"
     "\n"
+    "-> Parallel operation\n"
+    "\n"
+    "  The -nt=[n] option runs n independent Monte Carlo chains in as many "
+    "threads of a single process.\n"
+    "  Each chain uses its own random number sequence, split from the one "
+    "seeded by -sd,\n"
+    "  so a given -sd value no longer reproduces the sequence of earlier "
+    "versions, even with -nt=1.\n"
+    "  Only an SQS that improves on the best one found by all chains so far "
+    "is written to bestsqs.out and bestcorr.out,\n"
+    "  and all progress goes to a single mcsqs.log.\n"
+    "  The sqsparam.in and stopsqs files act on all chains.\n"
+    "  Alternatively, the -ip option lets you run separate processes (e.g. "
+    "on different machines),\n"
+    "  each writing its own bestsqs[ip].out, bestcorr[ip].out and "
+    "mcsqs[ip].log, and -best collects the best result.\n"
+    "\n"
     "-> Format of the input file defining the lattice (specified by the -l "
     "option)\n"
     "\n"
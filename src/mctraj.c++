@@ -0,0 +1,280 @@
+#include "mctraj.h"
+#include <cstring>
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
+#define MCTRAJ_MAGIC "ATATTR01"
+#define MCTRAJ_MAGIC_LEN 8
+
+// how the packed spins of a frame are stored;
+#define MCTRAJ_RAW 0
+#define MCTRAJ_ZSTD 1
+
+template <class T> static void write_value(ostream &file, const T &x) {
+  file.write((const char *)&x, sizeof(T));
+}
+
+template <class T> static int read_value(istream &file, T *px) {
+  return !file.read((char *)px, sizeof(T)).fail();
+}
+
+static void write_matrix(ostream &file, const rMatrix3d &m) {
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      write_value(file, m(i, j));
+    }
+  }
+}
+
+static int read_matrix(istream &file, rMatrix3d *pm) {
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      if (!read_value(file, &(*pm)(i, j))) return 0;
+    }
+  }
+  return 1;
+}
+
+static void pack_species(std::vector<unsigned char> *ppacked,
+                         const Array<int> &species, int nb_bits) {
+  ppacked->assign((species.get_size() * nb_bits + 7) / 8, 0);
+  int bit = 0;
+  for (int s = 0; s < species.get_size(); s++) {
+    for (int b = 0; b < nb_bits; b++, bit++) {
+      if (species(s) & (1 << b)) (*ppacked)[bit / 8] |= (1 << (bit % 8));
+    }
+  }
+}
+
+static void unpack_species(Array<int> *pspecies,
+                           const std::vector<unsigned char> &packed,
+                           int nb_sites, int nb_bits) {
+  pspecies->resize(nb_sites);
+  int bit = 0;
+  for (int s = 0; s < nb_sites; s++) {
+    int sp = 0;
+    for (int b = 0; b < nb_bits; b++, bit++) {
+      if (packed[bit / 8] & (1 << (bit % 8))) sp |= (1 << b);
+    }
+    (*pspecies)(s) = sp;
+  }
+}
+
+TrajectoryWriter::TrajectoryWriter(void) {
+  nb_sites = 0;
+  nb_bits = 0;
+  compression = 0;
+}
+
+int TrajectoryWriter::open(const char *filename, const Structure &lattice,
+                           const Array<Arrayint> &labellookup,
+                           const Array<std::string> &atom_label,
+                           const rMatrix3d &axes, const iVector3d &supercell,
+                           int _compression) {
+#ifndef USE_ZSTD
+  if (_compression > 0)
+    ERRORQUIT("Compressed trajectories require ATAT to be built with zstd "
+              "(USEZSTD)");
+#endif
+  compression = _compression;
+  file.open(filename, ios::binary);
+  if (!file) return 0;
+  int site_in_cell = lattice.atom_pos.get_size();
+  nb_sites = supercell(0) * supercell(1) * supercell(2) * site_in_cell;
+  int max_species = 1;
+  for (int s = 0; s < site_in_cell; s++) {
+    max_species = MAX(max_species,
+                      labellookup(lattice.atom_type(s)).get_size());
+  }
+  nb_bits = 0;
+  while ((1 << nb_bits) < max_species) nb_bits++;
+
+  file.write(MCTRAJ_MAGIC, MCTRAJ_MAGIC_LEN);
+  write_matrix(file, axes);
+  write_matrix(file, lattice.cell);
+  write_value(file, site_in_cell);
+  for (int s = 0; s < site_in_cell; s++) {
+    for (int i = 0; i < 3; i++) {
+      write_value(file, lattice.atom_pos(s)(i));
+    }
+    write_value(file, lattice.atom_type(s));
+  }
+  write_value(file, labellookup.get_size());
+  for (int t = 0; t < labellookup.get_size(); t++) {
+    write_value(file, labellookup(t).get_size());
+    for (int i = 0; i < labellookup(t).get_size(); i++) {
+      write_value(file, labellookup(t)(i));
+    }
+  }
+  write_value(file, atom_label.get_size());
+  for (int l = 0; l < atom_label.get_size(); l++) {
+    int len = atom_label(l).size();
+    write_value(file, len);
+    file.write(atom_label(l).data(), len);
+  }
+  for (int i = 0; i < 3; i++) {
+    write_value(file, supercell(i));
+  }
+  write_value(file, nb_bits);
+  file.flush();
+  return !file.fail();
+}
+
+void TrajectoryWriter::write_frame(const Array<int> &species,
+                                   const Array<Real> &conditions) {
+  if (species.get_size() != nb_sites)
+    ERRORQUIT("Snapshot does not match the trajectory header");
+  pack_species(&packed, species, nb_bits);
+  int method = MCTRAJ_RAW;
+  const unsigned char *data = packed.data();
+  int size = packed.size();
+#ifdef USE_ZSTD
+  if (compression > 0 && size > 0) {
+    buffer.resize(ZSTD_compressBound(size));
+    size_t csize = ZSTD_compress(buffer.data(), buffer.size(), packed.data(),
+                                 size, compression);
+    // incompressible frames are kept as they are;
+    if (!ZSTD_isError(csize) && csize < (size_t)size) {
+      method = MCTRAJ_ZSTD;
+      data = buffer.data();
+      size = csize;
+    }
+  }
+#endif
+  write_value(file, conditions.get_size());
+  for (int i = 0; i < conditions.get_size(); i++) {
+    write_value(file, conditions(i));
+  }
+  write_value(file, method);
+  write_value(file, size);
+  file.write((const char *)data, size);
+  // so that the trajectory can be read while the simulation runs;
+  file.flush();
+  if (!file) ERRORQUIT("Unable to write trajectory file");
+}
+
+void TrajectoryWriter::close(void) { file.close(); }
+
+TrajectoryReader::TrajectoryReader(void) {
+  nb_sites = 0;
+  nb_bits = 0;
+}
+
+int TrajectoryReader::open(const char *filename) {
+  file.open(filename, ios::binary);
+  if (!file) return 0;
+  char magic[MCTRAJ_MAGIC_LEN];
+  if (!file.read(magic, MCTRAJ_MAGIC_LEN) ||
+      strncmp(magic, MCTRAJ_MAGIC, MCTRAJ_MAGIC_LEN) != 0)
+    return 0;
+  int site_in_cell;
+  if (!read_matrix(file, &axes) || !read_matrix(file, &lattice.cell) ||
+      !read_value(file, &site_in_cell) || site_in_cell < 0)
+    return 0;
+  lattice.atom_pos.resize(site_in_cell);
+  lattice.atom_type.resize(site_in_cell);
+  for (int s = 0; s < site_in_cell; s++) {
+    for (int i = 0; i < 3; i++) {
+      if (!read_value(file, &lattice.atom_pos(s)(i))) return 0;
+    }
+    if (!read_value(file, &lattice.atom_type(s))) return 0;
+  }
+  int nb_types;
+  if (!read_value(file, &nb_types) || nb_types < 0) return 0;
+  labellookup.resize(nb_types);
+  for (int t = 0; t < nb_types; t++) {
+    int n;
+    if (!read_value(file, &n) || n < 0) return 0;
+    labellookup(t).resize(n);
+    for (int i = 0; i < n; i++) {
+      if (!read_value(file, &labellookup(t)(i))) return 0;
+    }
+  }
+  int nb_labels;
+  if (!read_value(file, &nb_labels) || nb_labels < 0) return 0;
+  atom_label.resize(nb_labels);
+  for (int l = 0; l < nb_labels; l++) {
+    int len;
+    if (!read_value(file, &len) || len < 0) return 0;
+    std::string label(len, ' ');
+    if (!file.read(&label[0], len)) return 0;
+    atom_label(l) = label;
+  }
+  for (int i = 0; i < 3; i++) {
+    if (!read_value(file, &supercell(i))) return 0;
+  }
+  if (!read_value(file, &nb_bits)) return 0;
+  nb_sites = supercell(0) * supercell(1) * supercell(2) * site_in_cell;
+  return 1;
+}
+
+int TrajectoryReader::read_frame(Array<int> *pspecies,
+                                 Array<Real> *pconditions) {
+  int nb_cond;
+  if (!read_value(file, &nb_cond)) return 0;
+  pconditions->resize(nb_cond);
+  for (int i = 0; i < nb_cond; i++) {
+    if (!read_value(file, &(*pconditions)(i))) return 0;
+  }
+  int method, size;
+  if (!read_value(file, &method) || !read_value(file, &size)) return 0;
+  int packed_size = (nb_sites * nb_bits + 7) / 8;
+  if (method == MCTRAJ_RAW) {
+    if (size != packed_size) ERRORQUIT("Corrupted trajectory file");
+    packed.resize(size);
+    if (!file.read((char *)packed.data(), size)) return 0;
+  } else if (method == MCTRAJ_ZSTD) {
+#ifdef USE_ZSTD
+    buffer.resize(size);
+    if (!file.read((char *)buffer.data(), size)) return 0;
+    packed.resize(packed_size);
+    size_t dsize =
+        ZSTD_decompress(packed.data(), packed_size, buffer.data(), size);
+    if (ZSTD_isError(dsize) || dsize != (size_t)packed_size)
+      ERRORQUIT("Corrupted trajectory file");
+#else
+    ERRORQUIT("Compressed trajectories require ATAT to be built with zstd "
+              "(USEZSTD)");
+#endif
+  } else {
+    ERRORQUIT("Corrupted trajectory file");
+  }
+  unpack_species(pspecies, packed, nb_sites, nb_bits);
+  return 1;
+}
+
+int TrajectoryReader::skip_frame(Array<Real> *pconditions) {
+  int nb_cond;
+  if (!read_value(file, &nb_cond)) return 0;
+  pconditions->resize(nb_cond);
+  for (int i = 0; i < nb_cond; i++) {
+    if (!read_value(file, &(*pconditions)(i))) return 0;
+  }
+  int method, size;
+  if (!read_value(file, &method) || !read_value(file, &size)) return 0;
+  file.ignore(size);
+  return file.gcount() == size;
+}
+
+void TrajectoryReader::write_structure(ostream &s,
+                                       const Array<int> &species) const {
+  for (int i = 0; i < 3; i++) {
+    s << axes.get_column(i) << endl;
+  }
+  for (int i = 0; i < 3; i++) {
+    s << (!axes) * ((Real)(supercell(i)) * lattice.cell.get_column(i))
+      << endl;
+  }
+  rMatrix3d iaxes = !axes;
+  int site_in_cell = lattice.atom_pos.get_size();
+  int k = 0;
+  MultiDimIterator<iVector3d> cur_cell(supercell);
+  for (; cur_cell; cur_cell++) {
+    for (int s_in = 0; s_in < site_in_cell; s_in++, k++) {
+      s << iaxes * (lattice.cell * to_real(cur_cell) +
+                    lattice.atom_pos(s_in))
+        << " " << get_label(s_in, species(k)) << endl;
+    }
+  }
+}
@@ -1,6 +1,7 @@
 #include <fstream>
 #include <sstream>
 #include "mmclib.h"
+#include "mctraj.h"
 #include "parse.h"
 #include "getvalue.h"
 #include "lstsqr.h"
@@ -133,7 +134,17 @@ int main(int argc, char *argv[]) {
   Real fdT=1e-2;
   Real fdmu=1e-2;
   const char *my_init_str="";
+  const char *rng_in_file="";
+  const char *rng_out_file="";
   const char *kspace_labels="";
+  int index_table=0;
+  int rejection_free=0;
+  int heat_bath=0;
+  const char *itable_file="";
+  const char *traj_file="";
+  int traj_compression=0;
+  int pt_interval=0;
+  int nb_threads=1;
 
   // parse command line;
   AskStruct options[]={
@@ -163,6 +174,8 @@ int main(int argc, char *argv[]) {
     {"-sd","Seed for random number generation (default: use clock)",INTVAL,&seed},
     {"-dl","Drop the last data point of each inner loop (after the phase transition occured)",BOOLVAL,&droplast},
     {"-is","File name containing a user-specified initial configuration (replaces -gs)",STRINGVAL,&my_init_str},
+    {"-irs","File containing a random number generator state saved with -ors (to continue a run; replaces -sd)",STRINGVAL,&rng_in_file},
+    {"-ors","Output random number generator state file, written at the end (default: do not write)",STRINGVAL,&rng_out_file},
     {"-hf","Shift all coordinates by half a grid point in scan (e.g. 2 steps in [0,1] give 0.25,0.75 instead of 0,0.5)",BOOLVAL,&half_shift},
     {"-il","Include last coordinate in scan (e.g. 3 steps in [0,1] gives 0,0.5,1 instead of 0,0.333,0.666)",BOOLVAL,&include_last},
     {"-ts","Triangular scanning. Specify list of composition axes (e.g. -ts=1,2).",STRINGVAL,&conc_axes},
@@ -172,7 +185,15 @@ int main(int argc, char *argv[]) {
     {"-rw","Use random walk algorithm (experimental)",BOOLVAL,&rnd_walk},
     {"-fdT","Temperature step for finite differences",REALVAL,&fdT},
     {"-fdmu","Chemical potential step for finite differences",REALVAL,&fdmu},
-    {"-ks","Specify how k space ECI are calculated (e.g. -ks=cs).",STRINGVAL,&kspace_labels}
+    {"-ks","Specify how k space ECI are calculated (e.g. -ks=cs).",STRINGVAL,&kspace_labels},
+    {"-it","Store each spin once and find neighbors through precomputed index tables (instead of a padded spin array)",BOOLVAL,&index_table},
+    {"-rf","Use the rejection-free (n-fold way) algorithm (efficient at low temperature)",BOOLVAL,&rejection_free},
+    {"-hb","Use heat-bath single flips (the new species of a site is drawn among all species; efficient with many components)",BOOLVAL,&heat_bath},
+    {"-itf","Interaction table file: the clusters around each site are read from it if it matches lattice and clusters, otherwise found and saved to it (default: do not use a file)",STRINGVAL,&itable_file},
+    {"-otr","Output a binary trajectory file with one snapshot per point (default: do not write)",STRINGVAL,&traj_file},
+    {"-trz","zstd compression level of the trajectory snapshots (default: 0, off)",INTVAL,&traj_compression},
+    {"-pt","Parallel tempering: run all points of each inner loop at once, exchanging replicas every [value] passes (default: 0, off)",INTVAL,&pt_interval},
+    {"-nt","Number of threads used to run the parallel tempering replicas (default: 1, serial)",INTVAL,&nb_threads}
   };
   if (!get_values(argc,argv,countof(options),options)) {
     display_help(countof(options),options);
@@ -194,6 +215,12 @@ int main(int argc, char *argv[]) {
   if (! ((n_equil!=-1 && n_step!=-1) || t_prec>0.)) ERRORQUIT("Specify either (-eq and -n) or -tp");
   if (t_prec>0. && n_equil==-1) {n_equil=0;}
   if ( t_prec<0. ) ERRORQUIT("-tp value must be positive");
+  if (pt_interval>0) {
+    if (t_prec>0.) ERRORQUIT("The -pt option requires -eq and -n (not -tp).");
+    if (rnd_walk) ERRORQUIT("The -pt and -rw options cannot be combined.");
+    if (strlen(kspace_labels)>0) ERRORQUIT("The -pt and -ks options cannot be combined.");
+    if (rejection_free) ERRORQUIT("The -pt and -rf options cannot be combined.");
+  }
 
   rndseed(seed);
   int snapshotnum=0;
@@ -357,6 +384,8 @@ int main(int argc, char *argv[]) {
   if (!quiet) cout << "Supercell size: " << simple_supercell << endl;
 
   // create the Monte Carlo object;
+  MCInteractionTable itable;
+  get_interaction_table(&itable,lattice_only,spacegroup,clusterlist,itable_file);
   MultiMonteCarlo *pmc;
   MultiKSpaceECI multi_kspace_eci;
   // if plug-in for k-space method specified, use it;
@@ -369,10 +398,16 @@ int main(int argc, char *argv[]) {
     for (; i; i++) {
       i->init(lattice_only,labellookup,label, simple_supercell, *pcorrfunc);
     }
-    pmc=new KSpaceMultiMonteCarlo(lattice_only,labellookup,simple_supercell,spacegroup,clusterlist,*pcorrfunc,&multi_kspace_eci);
+    pmc=new KSpaceMultiMonteCarlo(lattice_only,labellookup,simple_supercell,itable,*pcorrfunc,&multi_kspace_eci);
   }
   else {
-    pmc=new MultiMonteCarlo(lattice_only,labellookup,simple_supercell,spacegroup,clusterlist,*pcorrfunc);
+    pmc=new MultiMonteCarlo(lattice_only,labellookup,simple_supercell,itable,*pcorrfunc,index_table);
+  }
+  if (strlen(rng_in_file)>0) {
+    ifstream rngfile(rng_in_file);
+    RandomStream rng;
+    if (!(rngfile >> rng)) ERRORQUIT("Unable to read random number generator state file");
+    pmc->set_random_stream(rng);
   }
 
   // find all combinations of spin flips allowed by  constrains;
@@ -387,6 +422,18 @@ int main(int argc, char *argv[]) {
     product(&corr_cons,conc_cons,corr_to_fullconc);
     pmc->find_all_allowed_flips(corr_cons,iVector3d(flip_span,flip_span,flip_span),flip_min_nb);
     flipmode=0;
+    if (pt_interval>0) ERRORQUIT("The -pt option cannot be used with concentration constraints (conccons.in).");
+  }
+  if (rejection_free) {
+    if (flipmode==0) ERRORQUIT("The -rf option cannot be used with concentration constraints (conccons.in).");
+    if (strlen(kspace_labels)>0) ERRORQUIT("The -rf and -ks options cannot be combined.");
+    flipmode=3;
+  }
+  if (heat_bath) {
+    if (flipmode==0) ERRORQUIT("The -hb option cannot be used with concentration constraints (conccons.in).");
+    if (flipmode==3) ERRORQUIT("The -hb and -rf options cannot be combined.");
+    if (strlen(kspace_labels)>0) ERRORQUIT("The -hb and -ks options cannot be combined.");
+    flipmode=4;
   }
 
 
@@ -412,6 +459,10 @@ int main(int argc, char *argv[]) {
   }
 
   ofstream mcfile(outfile);
+  TrajectoryWriter traj;
+  if (strlen(traj_file)>0) {
+    if (!traj.open(traj_file,pmc->get_lattice(),labellookup,label,axes,pmc->get_supercell(),traj_compression)) ERRORQUIT("Unable to open trajectory file");
+  }
 
   if (!rnd_walk) { // do standard grid scan;
     // first setup the grid;
@@ -477,6 +528,10 @@ int main(int argc, char *argv[]) {
     
     Array<LinkedList<Real> > lro_list(maxdiv.get_size());
     Array<Real> phi(maxdiv.get_size());
+    Array<MultiMonteCarlo *> pt_replica;
+    MultiReplicaExchange *ppt=NULL;
+    Array<Array<Real> > pt_mean,pt_var;
+    int pt_point=0;
     
     MultiDimIterator<Array<Real> > curpt(maxdiv);
     while (curpt) {
@@ -569,17 +624,85 @@ int main(int argc, char *argv[]) {
       Array<Real> mc_val(3+conc_to_fullconc_c.get_size());
       pmc->set_eci(eci);
       pmc->set_T_mu(T,mu);
-      
-      GenericAccumulator *paccum;
-      if (do_quick) {
-	paccum=create_accum(0,0.,0);
-      } else {
-	if (((Array<Real> &)curpt)(0)==0) {
-	  pmc->run(n_equil,flipmode);
+
+      if (pt_interval>0 && ((Array<Real> &)curpt)(0)==0) {
+	// all points of this inner loop are run at once, one replica each;
+	LinkedList<Real> T_list;
+	LinkedList<Array<Real> > mu_list,eci_list;
+	Array<Real> pt_curpt=curpt;
+	while (1) {
+	  Real pt_sumc=0.;
+	  for (int a=0; a<conc_axes_a.get_size(); a++) {
+	    pt_sumc+=pt_curpt(conc_axes_a(a))/maxdiv(conc_axes_a(a));
+	  }
+	  if (pt_sumc <= 1.+zero_tolerance) {
+	    Array<Real> pt_control;
+	    product(&pt_control,dcontrol,pt_curpt);
+	    sum(&pt_control,pt_control,control_org);
+	    Array<Real> pt_full_mu,pt_mu,pt_eci;
+	    extract_elements(&pt_full_mu,pt_control,1,pt_control.get_size());
+	    product(&pt_full_mu,pt_full_mu,active2full); //fix
+	    product(&pt_mu,pt_full_mu,corr_to_fullconc);
+	    teci.interpol(&pt_eci,pt_control(0));
+	    T_list << new Real(pt_control(0));
+	    mu_list << new Array<Real>(pt_mu);
+	    eci_list << new Array<Real>(pt_eci);
+	  }
+	  // same test as MultiDimIterator;
+	  if (!(pt_curpt(0)<maxdiv(0)-1)) break;
+	  pt_curpt(0)++;
 	}
-	paccum=create_accum(n_step,t_prec,which_col-1);
+	Array<Real> pt_T_list;
+	Array<Array<Real> > pt_mu_list,pt_eci_list;
+	LinkedList_to_Array(&pt_T_list,T_list);
+	LinkedList_to_Array(&pt_mu_list,mu_list);
+	LinkedList_to_Array(&pt_eci_list,eci_list);
+	if (pt_T_list.get_size()>pt_replica.get_size()) {
+	  Array<MultiMonteCarlo *> old_replica=pt_replica;
+	  pt_replica.resize(pt_T_list.get_size());
+	  for (int i=0; i<pt_replica.get_size(); i++) {
+	    pt_replica(i)=(i<old_replica.get_size() ? old_replica(i) : new MultiMonteCarlo(lattice_only,labellookup,simple_supercell,itable,*pcorrfunc,index_table));
+	  }
+	}
+	Array<MultiMonteCarlo *> loop_replica;
+	extract_elements(&loop_replica,pt_replica,0,pt_T_list.get_size());
+	for (int i=0; i<loop_replica.get_size(); i++) {
+	  loop_replica(i)->init_structure(*my_p_init_str);
+	}
+	delete ppt;
+	ppt=new MultiReplicaExchange(loop_replica);
+	ppt->set_nb_threads(nb_threads);
+	ppt->init_run(pt_T_list,pt_mu_list,pt_eci_list);
+	ppt->run(&pt_mean,&pt_var,n_equil,n_step,pt_interval,flipmode);
+	if (!quiet) {
+	  cerr << "Replica exchange acceptance:";
+	  for (int i=0; i<loop_replica.get_size()-1; i++) {cerr << " " << ppt->get_swap_rate(i);}
+	  cerr << endl;
+	}
+	pt_point=0;
+      }
+
+      MultiMonteCarlo *pcur_mc=pmc;
+      Array<Real> mcdata;
+      if (ppt) {
+	mcdata=pt_mean(pt_point);
+	pcur_mc=ppt->get_replica_at(pt_point);
+	pt_point++;
+      }
+      else {
+	GenericAccumulator *paccum;
+	if (do_quick) {
+	  paccum=create_accum(0,0.,0);
+	} else {
+	  if (((Array<Real> &)curpt)(0)==0) {
+	    pmc->run(n_equil,flipmode);
+	  }
+	  paccum=create_accum(n_step,t_prec,which_col-1);
+	}
+	run_mc(paccum,pmc,flipmode);
+	mcdata=paccum->get_mean();
+	delete paccum;
       }
-      run_mc(paccum,pmc,flipmode);
       if (strlen(snapshotnumfile)>0) {
 
     std::string filename = snapshotnumfile;   // assuming snapshotnumfilec is const char*
@@ -594,12 +717,18 @@ int main(int argc, char *argv[]) {
         std::ofstream file(filename);
         file << std::fixed << std::setprecision(sigdig);
 
-        pmc->view(labellookup, label, file, axes);
+        pcur_mc->view(labellookup, label, file, axes);
         ++snapshotnum;
     }
       }
-      const Array<Real> &mcdata=paccum->get_mean();
-      const Array<Real> &mcdata2=paccum->get_var();
+      if (traj.is_open()) {
+	Array<int> species;
+	pcur_mc->get_species(&species);
+	Array<Real> cond(1+mu.get_size());
+	cond(0)=T;
+	for (int i=0; i<mu.get_size(); i++) {cond(i+1)=mu(i);}
+	traj.write_frame(species,cond);
+      }
       
       mc_val(E_offset)=mcdata(0)-muxc;
       mc_val(lro_offset)=1.-mcdata(1);
@@ -618,8 +747,6 @@ int main(int argc, char *argv[]) {
       sum(&x_mc,x_mc,conc_to_fullconc_c);
       extract_elements(&mc_val, x_offset,x_mc,0,x_mc.get_size());
       
-      delete paccum;
-      
       int looplevel=0;
       while (looplevel<maxdiv.get_size()) {
 	if (((Array<Real> &)curpt)(looplevel)!=0) break;
@@ -702,6 +829,10 @@ int main(int argc, char *argv[]) {
 	curpt++;
       }
     }
+    if (ppt) {
+      delete ppt;
+      for (int i=0; i<pt_replica.get_size(); i++) {delete pt_replica(i);}
+    }
     {
       ofstream file(snapshotfile);
       file.setf(ios::fixed);
@@ -888,13 +1019,17 @@ int main(int argc, char *argv[]) {
 	old_control=cur_control;
       }
       do {
-	cur_control(0)=old_control(0)+dcontrol(0)*(2.*uniform01()-1.);
+	cur_control(0)=old_control(0)+dcontrol(0)*(2.*pmc->get_random_stream().uniform01()-1.);
       } while (cur_control(0)>lim_control(0) || cur_control(0)<0.);
       for (int i=1; i<old_control.get_size(); i++) {
-	cur_control(i)=old_control(i)+dcontrol(i)*(2.*uniform01()-1.);
+	cur_control(i)=old_control(i)+dcontrol(i)*(2.*pmc->get_random_stream().uniform01()-1.);
       }
     }
   }
+  if (strlen(rng_out_file)>0) {
+    ofstream file(rng_out_file);
+    file << pmc->get_random_stream() << endl;
+  }
   delete pcorrfunc;
   delete pmc;
   delete pmf;
@@ -48,6 +48,61 @@ const char *helpstring=""
 "\n"
 "-o:       Name of the output file (default: mc.out).\n"
 "\n"
+"-it: halo-free storage. By default, spins are stored in an array padded\n"
+"     by the range of the clusters so that neighbors are reached by a fixed\n"
+"     offset, but every flip must then update all periodic images.  With -it,\n"
+"     each spin is stored once and the neighbors of every site are read from\n"
+"     a precomputed index table (one int per cluster site per lattice site).\n"
+"     This is faster for small supercells or long-range clusters, at the\n"
+"     cost of the memory taken by the table.\n"
+"\n"
+"-itf: interaction table file. Setting up a simulation requires finding all\n"
+"     the clusters that contain each site of the lattice, which can take a\n"
+"     while with many or large clusters.  With -itf=file, the result is saved\n"
+"     to that (binary) file and read back by later runs, provided the lattice,\n"
+"     its symmetry and clusters.out are unchanged (otherwise the file is\n"
+"     simply rebuilt).  The table does not depend on the supercell size.\n"
+"\n"
+"-otr: binary trajectory file. Writes the configuration reached at every point\n"
+"     of the scan (where -opss writes one structure file) to a single file\n"
+"     holding the lattice, labels and supercell once, followed by the species\n"
+"     of each site packed in as few bits as needed, along with T and mu.\n"
+"     This is much smaller and faster than -opss for large supercells.\n"
+"     The trajstr utility lists the snapshots of such a file and converts\n"
+"     them to the str.out format (the same output as -opss).\n"
+"     -trz=level further compresses each snapshot with zstd (requires ATAT\n"
+"     to be built with the cmake option USEZSTD).\n"
+"\n"
+"-rf: rejection-free (n-fold way) algorithm. The flip rate of every site is\n"
+"     kept up to date and each step flips a site chosen with probability\n"
+"     proportional to its rate, while the clock advances by a random waiting\n"
+"     time distributed like the run of rejected attempts that Metropolis\n"
+"     sampling would have gone through before that flip.\n"
+"     Averages are identical (statistically) to the default algorithm and\n"
+"     are still taken once per pass. Each flip is more costly, so this only\n"
+"     pays off at low temperature, where most Metropolis flips are\n"
+"     rejected. Cannot be combined with -ks or with conccons.in.\n"
+"\n"
+"-hb: heat-bath single flips. Instead of proposing one other species and\n"
+"     accepting it with the Metropolis rule, the new species of the chosen\n"
+"     site is drawn among all allowed species with probability proportional\n"
+"     to exp(-E/kT), the energy of every choice being obtained in a single\n"
+"     pass over the clusters containing the site. Each step costs about twice\n"
+"     a Metropolis step but decorrelates faster, mostly in systems with many\n"
+"     components. Cannot be combined with -rf, -ks or conccons.in.\n"
+"\n"
+"-pt: parallel tempering (replica exchange). All the points of an inner\n"
+"     loop (the first direction of the control file) are simulated at once,\n"
+"     each by its own replica; replicas are run on as many threads as there\n"
+"     are cores. Every [value] passes, replicas at neighboring points try to\n"
+"     exchange their conditions (T, mu and ECI; the spins themselves are not\n"
+"     copied) with the usual Metropolis acceptance probability. This helps a\n"
+"     scan cross first-order transitions without hysteresis. Each replica\n"
+"     starts from the initial configuration and performs -eq equilibration\n"
+"     passes and -n averaging passes; the output format is unchanged and the\n"
+"     exchange acceptance rates are printed to stderr. Cannot be combined\n"
+"     with -tp, -rw, -ks, -rf or conccons.in.\n"
+"\n"
 "-k : Sets boltzman's constant (default k=1). This only affects how\n"
 "     temperatures are converted in energies.  -k=8.617e-5 lets you enter\n"
 "     temperatures in kelvins when energies are in eV.\n"
@@ -226,7 +226,7 @@ int update_structure(StructureInfo *pstr, Real atom_factor, const char *propname
 	file >> new_energy;
       }
     }
-    MyMPI_BcastStream(&new_energy);
+    MyMPI_Bcast(&new_energy);
     if (new_energy!=MAXFLOAT) {
       // if the file energy contains a valid number use it as energy;
       if (atom_factor>0) {
@@ -315,8 +315,8 @@ int update_all_structures(StructureBank<StructureInfo> *pstr_bank, const Structu
       }
       if (!str_is_ok) cerr << "Error while reading structure " << *i_disk << endl;
     }
-    MyMPI_BcastStream(&str_is_ok);
-    MyMPI_BcastStream(&str);
+    MyMPI_Bcast(&str_is_ok);
+    MyMPI_Bcast((Structure *)&str);
 
     if (str_is_ok) {
       if (str.atom_pos.get_size()==0) {
@@ -371,6 +371,7 @@ int main(int argc, char *argv[]) {
   const char *propname="energy";
   int ignore_gs=0;
   int intensive=0;
+  int nocache=0;
   AskStruct options[]={
     {"","MIT Ab initio Phase Stability (MAPS) code " MAPS_VERSION ", by Axel van de Walle",TITLEVAL,NULL},
     {"-h","Display more help",BOOLVAL,&dohelp},
@@ -392,6 +393,7 @@ int main(int argc, char *argv[]) {
     {"-pn","Property to cluster expand (default: energy)",STRINGVAL,&propname},
     {"-ig","Ignore whether cluster expansion predicts correct ground states",BOOLVAL,&ignore_gs},
     {"-pa","Quantity to expand is already per atom",BOOLVAL,&intensive},
+    {"-ncc","Do not read or update the correlation cache (corrcache.bin)",BOOLVAL,&nocache},
     {"-q","Quiet mode (do not print status to stderr)",BOOLVAL,&quiet},
     {"-sig","Number of significant digits to print in output files",INTVAL,&sigdig},
     {"-d","Use all default values",BOOLVAL,&dummy}
@@ -430,10 +432,10 @@ int main(int argc, char *argv[]) {
       }
     }
   }
-  MyMPI_BcastStream(&lat);
+  MyMPI_Bcast(&lat);
   MyMPI_BcastStream(&site_type_list);
   MyMPI_BcastStream(&atom_label);
-  MyMPI_BcastStream(&axes);
+  MyMPI_Bcast(&axes);
 
   // check number of components;
   int maxt=0;
@@ -471,6 +473,20 @@ int main(int argc, char *argv[]) {
   pce->set_highest_energy_allowed(high_energy);
   pce->set_maximum_volume_allowed(user_max_vol);
   pce->set_max_weight(max_weight);
+  CorrelationCache corrcache;
+  if (!nocache) {
+    // only the root process reads and writes the file; the others get a copy;
+    Array<CorrelationCacheEntry> entry;
+    if (MyMPIobj.is_root()) {
+      corrcache.open("corrcache.bin");
+      corrcache.get_entries(&entry);
+    }
+    MyMPI_Bcast(&entry);
+    if (!MyMPIobj.is_root()) {
+      corrcache.add_entries(entry);
+    }
+    pce->set_correlation_cache(&corrcache);
+  }
   LinkedList<LinearInequality> ineq;
   if (strlen(conc_file)>0) {
     ifstream crangefile(conc_file);
@@ -12,17 +12,20 @@ typedef Complex *pComplex;
 
 MultiMonteCarlo::MultiMonteCarlo(const Structure &_lattice, const Array<Array<int> > &_site_type_list, const iVector3d &_supercell, 
 		const SpaceGroup &space_group, const LinkedList<MultiCluster> &cluster_list, 
-		const Array<Array<Array<Real> > > &_corrfunc) :
-               lattice(_lattice), site_type_list(_site_type_list), supercell(_supercell), corrfunc(_corrfunc), cur_rho(), cur_conc(), mu(), allowed_flip_site(),allowed_flip_before(),allowed_flip_after(), flip_span(-1,-1,-1) {
-    Real max_clus_len=0.;
-    {
-      LinkedListIterator<MultiCluster> c(cluster_list);
-      for ( ; c; c++) {
-        Real l=get_cluster_length(c->clus);
-        if (l>max_clus_len) max_clus_len=l;
-      }
-    }
-    margin=find_sphere_bounding_box(lattice.cell,max_clus_len);
+		const Array<Array<Array<Real> > > &_corrfunc, int use_index_table) :
+  MultiMonteCarlo(_lattice,_site_type_list,_supercell,MCInteractionTable(_lattice,space_group,cluster_list),_corrfunc,use_index_table) {}
+
+MultiMonteCarlo::MultiMonteCarlo(const Structure &_lattice, const Array<Array<int> > &_site_type_list, const iVector3d &_supercell, 
+		const MCInteractionTable &table,
+		const Array<Array<Array<Real> > > &_corrfunc, int use_index_table) :
+               lattice(_lattice), site_type_list(_site_type_list), supercell(_supercell), corrfunc(_corrfunc), cur_rho(), cur_conc(), mu(), allowed_flip_site(),allowed_flip_before(),allowed_flip_after(), flip_span(-1,-1,-1), flip_rate() {
+    rng.set_seed(new_stream_seed());
+    flip_rate_valid=0;
+    flip_wait=0.;
+    flip_stamp=NULL;
+    cur_stamp=0;
+    if (table.nb_site!=lattice.atom_pos.get_size()) ERRORQUIT("Interaction table does not match the lattice.");
+    margin=find_sphere_bounding_box(lattice.cell,table.max_clus_len);
     iVector3d supercell_orig=supercell;
     for (int mult=1; 1 ; mult++) {
       supercell=mult*supercell_orig;
@@ -32,6 +35,8 @@ MultiMonteCarlo::MultiMonteCarlo(const Structure &_lattice, const Array<Array<in
       }
       if (i==3) break;
     }
+    // without padding, every spin is stored once and neighbors are found through nbr_table;
+    if (use_index_table) {margin=iVector3d(0,0,0);}
     total_box=supercell+2*margin;
     int spin_total_size=total_box(0)*total_box(1)*total_box(2)*lattice.atom_pos.get_size();
     spin=new SPIN_TYPE[spin_total_size];
@@ -68,6 +73,10 @@ MultiMonteCarlo::MultiMonteCarlo(const Structure &_lattice, const Array<Array<in
 	while (frozen_site(s)==1) {s++;}
 	which_site[i]=s;
       }
+      is_frozen=new int[site_in_cell];
+      for (int i=0; i<site_in_cell; i++) {
+	is_frozen[i]=frozen_site(i);
+      }
     }
     nb_spin_val=new int[site_in_cell];
     for (int i=0; i<site_in_cell; i++) {
@@ -76,110 +85,127 @@ MultiMonteCarlo::MultiMonteCarlo(const Structure &_lattice, const Array<Array<in
     nb_clusters=new int[site_in_cell];
     cluster_size=new pint[site_in_cell];
     site_offset=new ppint[site_in_cell];
+    site_offset_flat=new pint[site_in_cell];
+    nbr_row_len=new int[site_in_cell];
     spin_val_clus=new pppReal[site_in_cell];
     eci=new pReal[site_in_cell];
     which_cluster=new pint[site_in_cell];
-    total_clusters=cluster_list.get_size();
+    total_clusters=table.total_clusters;
     cur_rho.resize(total_clusters);
     zero_array(&cur_rho);
     pcur_rho=cur_rho.get_buf();
     new_rho=new Real[total_clusters];
     rcluster_mult_per_atom=new Real[total_clusters];
-    {
-      LinkedListIterator<MultiCluster> c(cluster_list);
-      for (int i=0; c; c++,i++) {
-	rcluster_mult_per_atom[i]=calc_multiplicity(*c,lattice.cell,space_group.point_op,space_group.trans)/(Real)lattice.atom_pos.get_size();
-      }
+    for (int i=0; i<total_clusters; i++) {
+      rcluster_mult_per_atom[i]=table.mult_per_atom[i];
     }
 
     E_ref=0.;
-    which_is_empty=-1;
+    which_is_empty=table.which_is_empty;
     nb_point=0;
-    {
-      LinkedListIterator<MultiCluster> c(cluster_list);
-      int cluster_index=0;
-      for (; c; c++, cluster_index++) {
-	  if (c->clus.get_size()==0) {which_is_empty=cluster_index;}
-	  if (c->clus.get_size()==1) {nb_point++;}
-	}
-      which_is_point=new int[nb_point];
-      point_mult=new Real[nb_point];
-	c.init(cluster_list);
-      cluster_index=0;
-      int point_index=0;
-      for (; c; c++, cluster_index++) {
-            if (c->clus.get_size()==1) {
-              which_is_point[point_index]=cluster_index;
-              point_mult[point_index]=rcluster_mult_per_atom[cluster_index];
-              point_index++;
-            }
-	}
+    for (int i=0; i<total_clusters; i++) {
+      if (table.type_size[i]==1) {nb_point++;}
+    }
+    which_is_point=new int[nb_point];
+    point_mult=new Real[nb_point];
+    for (int i=0, point_index=0; i<total_clusters; i++) {
+      if (table.type_size[i]==1) {
+        which_is_point[point_index]=i;
+        point_mult[point_index]=rcluster_mult_per_atom[i];
+        point_index++;
+      }
     }
     cur_conc.resize(nb_point);
     mu.resize(nb_point);
     zero_array(&mu);
     pmu=mu.get_buf();
 
-    rMatrix3d inv_cell=!lattice.cell;
-    for (int s=0; s<lattice.atom_pos.get_size(); s++) {
-      LinkedList<MultiCluster> long_cluster_list;
-      LinkedList<int> long_cluster_i_list;
-      LinkedListIterator<MultiCluster> c(cluster_list);
-      int cluster_index=0;
-      
-      for ( ; c; c++,cluster_index++) {
-	if (c->clus.get_size()!=0) {
-            Array<MultiCluster> clusters;
-            find_equivalent_clusters(&clusters, *c,space_group.cell,space_group.point_op,space_group.trans);
-            for (int ec=0; ec<clusters.get_size(); ec++) {
-	      for (int center_atom=0; center_atom<clusters(ec).clus.get_size(); center_atom++) {
-		rVector3d lat_shift=lattice.atom_pos(s)-clusters(ec).clus(center_atom);
-		if (is_int(inv_cell*lat_shift)) {
-                  MultiCluster *to_add=new MultiCluster(clusters(ec).clus.get_size());
-                  to_add->clus(0)=clusters(ec).clus(center_atom)+lat_shift;
-		  to_add->site_type(0)=clusters(ec).site_type(center_atom);
-		  to_add->func(0)=clusters(ec).func(center_atom);
-                  int j=1;
-                  for (int i=0; i<clusters(ec).clus.get_size(); i++) {
-                    if (i!=center_atom) {
-                      to_add->clus(j)=clusters(ec).clus(i)+lat_shift;
-                      to_add->site_type(j)=clusters(ec).site_type(i);
-                      to_add->func(j)=clusters(ec).func(i);
-                      j++;
-                    }
-                  }
-                  long_cluster_list << to_add;
-                  long_cluster_i_list << new int(cluster_index);
-                }
-              }
-            }
-        }
-      }
-      nb_clusters[s]=long_cluster_list.get_size();
+    Array<Array<iVector3d> > shift_cell(site_in_cell);
+    Array<Array<int> > shift_site(site_in_cell);
+    for (int s=0; s<site_in_cell; s++) {
+      nb_clusters[s]=table.get_nb_clusters(s);
       cluster_size[s]=new int[nb_clusters[s]];
       eci[s]=new Real[nb_clusters[s]];
       which_cluster[s]=new int[nb_clusters[s]];
       site_offset[s]=new pint[nb_clusters[s]];
       spin_val_clus[s]=new ppReal[nb_clusters[s]];
-      c.init(long_cluster_list);
-      LinkedListIterator<int> c_i(long_cluster_i_list);
-      for (int ic=0; ic<nb_clusters[s]; ic++, c++, c_i++) {
-        cluster_size[s][ic]=c->clus.get_size();
+      nbr_row_len[s]=table.member_site[s].size();
+      site_offset_flat[s]=new int[nbr_row_len[s]];
+      shift_cell(s).resize(nbr_row_len[s]);
+      shift_site(s).resize(nbr_row_len[s]);
+      for (int ic=0; ic<nb_clusters[s]; ic++) {
+        int k=table.first_member[s][ic];
+        cluster_size[s][ic]=table.cluster_size[s][ic];
 	eci[s][ic]=0.;
-        which_cluster[s][ic]=*c_i;
-        site_offset[s][ic]=new int[c->clus.get_size()];
-        spin_val_clus[s][ic]=new pReal[c->clus.get_size()];
-        for (int j=0; j<c->clus.get_size(); j++) {
-          int offset_in_cell=which_atom(lattice.atom_pos,c->clus(j),inv_cell);
-          iVector3d offset_cell=to_int(inv_cell*(c->clus(j)-lattice.atom_pos(offset_in_cell)));
+        which_cluster[s][ic]=table.which_cluster[s][ic];
+        site_offset[s][ic]=site_offset_flat[s]+k;
+        spin_val_clus[s][ic]=new pReal[cluster_size[s][ic]];
+        for (int j=0; j<cluster_size[s][ic]; j++, k++) {
+          int offset_in_cell=table.member_site[s][k];
+          const iVector3d &offset_cell=table.member_cell[s][k];
           site_offset[s][ic][j]=((offset_cell(0)*total_box(1) + offset_cell(1))*total_box(2) + offset_cell(2))*site_in_cell + offset_in_cell - s;
+          shift_cell(s)(k)=offset_cell;
+          shift_site(s)(k)=offset_in_cell;
 	  spin_val_clus[s][ic][j]=new Real[nb_spin_val[offset_in_cell]];
 	  for (int l=0; l<nb_spin_val[offset_in_cell]; l++) {
-            spin_val_clus[s][ic][j][l]=_corrfunc(c->site_type(j))(c->func(j))(l);
+            spin_val_clus[s][ic][j][l]=_corrfunc(table.member_type[s][k])(table.member_func[s][k])(l);
           }
         }
       }
     }
+    nbr_table=NULL;
+    nbr_row_start=NULL;
+    if (use_index_table) {
+      nbr_row_start=new int[spin_size];
+      int table_size=0;
+      for (int s=0; s<site_in_cell; s++) {
+        table_size+=nbr_row_len[s];
+      }
+      nbr_table=new int[table_size*supercell(0)*supercell(1)*supercell(2)];
+      int k=0;
+      MultiDimIterator<iVector3d> cur_cell(supercell);
+      for ( ; cur_cell; cur_cell++) {
+        iVector3d &cell=(iVector3d &)cur_cell;
+        for (int s=0; s<site_in_cell; s++) {
+          int offset=((cell(0)*supercell(1) + cell(1))*supercell(2) + cell(2))*site_in_cell + s;
+          nbr_row_start[offset]=k;
+          for (int j=0; j<nbr_row_len[s]; j++, k++) {
+            iVector3d n;
+            for (int i=0; i<3; i++) {
+              n(i)=((cell(i)+shift_cell(s)(j)(i)) % supercell(i) + supercell(i)) % supercell(i);
+            }
+            nbr_table[k]=((n(0)*supercell(1) + n(1))*supercell(2) + n(2))*site_in_cell + shift_site(s)(j) - offset;
+          }
+        }
+      }
+    }
+    nb_touched=new int[site_in_cell];
+    touched=new pint[site_in_cell];
+    nb_touched_point=new int[site_in_cell];
+    touched_point=new pint[site_in_cell];
+    Array<int> is_touched(total_clusters);
+    for (int s=0; s<site_in_cell; s++) {
+      zero_array(&is_touched);
+      for (int ic=0; ic<nb_clusters[s]; ic++) {
+        is_touched(which_cluster[s][ic])=1;
+      }
+      nb_touched[s]=0;
+      for (int i=0; i<total_clusters; i++) {
+        nb_touched[s]+=is_touched(i);
+      }
+      touched[s]=new int[nb_touched[s]];
+      for (int i=0, k=0; i<total_clusters; i++) {
+        if (is_touched(i)) {touched[s][k++]=i;}
+      }
+      nb_touched_point[s]=0;
+      for (int i=0; i<nb_point; i++) {
+        nb_touched_point[s]+=is_touched(which_is_point[i]);
+      }
+      touched_point[s]=new int[nb_touched_point[s]];
+      for (int i=0, k=0; i<nb_point; i++) {
+        if (is_touched(which_is_point[i])) {touched_point[s][k++]=i;}
+      }
+    }
   }
 
 MultiMonteCarlo::~MultiMonteCarlo(void) {
@@ -189,20 +215,33 @@ MultiMonteCarlo::~MultiMonteCarlo(void) {
 	    delete[] spin_val_clus[s][ic][j];
         }
         delete[] spin_val_clus[s][ic];
-        delete[] site_offset[s][ic];
       }
       delete[] spin_val_clus[s];
       delete[] site_offset[s];
+      delete[] site_offset_flat[s];
       delete[] cluster_size[s];
       delete[] eci[s];
       delete[] which_cluster[s];
+      delete[] touched[s];
+      delete[] touched_point[s];
     }
     delete[] which_site;
+    delete[] is_frozen;
     delete[] spin_val_clus;
     delete[] site_offset;
+    delete[] site_offset_flat;
+    delete[] nbr_row_len;
+    if (nbr_table) {
+      delete[] nbr_table;
+      delete[] nbr_row_start;
+    }
     delete[] cluster_size;
     delete[] eci;
     delete[] which_cluster;
+    delete[] nb_touched;
+    delete[] touched;
+    delete[] nb_touched_point;
+    delete[] touched_point;
     delete[] nb_clusters;
 
     delete[] nb_spin_val;
@@ -213,6 +252,7 @@ MultiMonteCarlo::~MultiMonteCarlo(void) {
 
     delete[] spin;
     delete[] spin_orig;
+    if (flip_stamp) delete[] flip_stamp;
 }
 
 void MultiMonteCarlo::calc_delta_point_corr(Array<Real> *pcorr, int site, int type) {
@@ -344,48 +384,28 @@ void MultiMonteCarlo::find_all_allowed_flips(const Array2d<Real> &corr_constrain
 
 int MultiMonteCarlo::force_spin_flip(int *cell, int incell, int newspin) {
   int i;
-  int mcell[3],mcellscan[3],offset;
+  int mcell[3],offset;
   int oldspin;
-  Real denergy,dconc;
-  int cluster_count,site_count;
-  int **pcluster;
-  Real ***pppspin_val_clus,**ppspin_val_clus;
-  int *pwhich_cluster;
-  int *poffset,*psize;
-  Real *peci, *prho, *prho2, *prcluster_mult_per_atom;
-  Real rho;
+  Real denergy;
   for (i=0; i<3; i++) {
     mcell[i]=cell[i]+margin(i);
   }
 
   offset=((mcell[0]*total_box(1) + mcell[1])*total_box(2) + mcell[2])*site_in_cell + incell;
   oldspin=spin[offset];
-  denergy=0.;
-  for (i=total_clusters, prho=new_rho; i>0; i--, prho++) {
-    *prho=0.;
-  }
-  for (cluster_count=nb_clusters[incell], pcluster=site_offset[incell], pppspin_val_clus=spin_val_clus[incell], psize=cluster_size[incell], pwhich_cluster=which_cluster[incell], peci=eci[incell]; cluster_count>0; cluster_count--, pcluster++, pppspin_val_clus++, psize++, pwhich_cluster++, peci++) {
-    poffset=*pcluster;
-    ppspin_val_clus=*pppspin_val_clus;
-    rho=(*ppspin_val_clus)[newspin]-(*ppspin_val_clus)[oldspin];
-    poffset++;
-    ppspin_val_clus++;
-    for (site_count=(*psize)-1; site_count>0; site_count--, poffset++, ppspin_val_clus++) {
-      rho*=(*ppspin_val_clus)[spin[offset+(*poffset)]];
-    }
-    new_rho[*pwhich_cluster]+=rho;
-    denergy+=(*peci)*rho;
-  }
-  for (i=0; i<nb_point; i++) {
-    denergy-=pmu[i]*new_rho[which_is_point[i]];
-  }
+  denergy=site_flip_energy(offset,incell,newspin);
 
   cur_energy+=denergy/rspin_size;
-  for (i=0, prho=new_rho, prho2=pcur_rho, prcluster_mult_per_atom=rcluster_mult_per_atom; i<total_clusters; i++, prho++, prho2++, prcluster_mult_per_atom++) {
-    *prho2+=(*prho)/(*prcluster_mult_per_atom)/rspin_size;
-  }
+  add_flip_to_corr(incell);
+  set_spin(cell,incell,oldspin,newspin);
+  return oldspin;
+}
 
+void MultiMonteCarlo::set_spin(int *cell, int incell, int oldspin, int newspin) {
+  int i;
+  int mcell[3],mcellscan[3],offset;
   for (i=0; i<3; i++) {
+    mcell[i]=cell[i]+margin(i);
     if (mcell[i]>=supercell(i)) {mcell[i]-=supercell(i);}
   }
   for (mcellscan[0]=mcell[0]; mcellscan[0]<total_box(0); mcellscan[0]+=supercell(0)) {
@@ -398,7 +418,6 @@ int MultiMonteCarlo::force_spin_flip(int *cell, int incell, int newspin) {
   offset=((cell[0]*supercell(1) + cell[1])*supercell(2) + cell[2])*site_in_cell + incell;
   cur_disorder_param+=((newspin!=spin_orig[offset])-(oldspin!=spin_orig[offset]))/rspin_size;
   extension_update_spin_flip(cell,incell,oldspin,newspin);
-  return oldspin;
 }
 
 void MultiMonteCarlo::save_state(MultiMonteCarloState *pstate) {
@@ -456,12 +475,12 @@ void MultiMonteCarlo::multi_spin_flip(void) {
   Array<iVector3d> cells;
   Array<int> oldspin;
   do {
-    which_flip=random(allowed_flip_site.get_size());
+    which_flip=rng.random(allowed_flip_site.get_size());
     cells.resize(allowed_flip_site(which_flip).get_size());
     iVector3d center;
     if (flip_span(0)>=0) {
       for (int j=0; j<3; j++) {
-	center(j)=random(supercell(j));
+	center(j)=rng.random(supercell(j));
       }
     }
     for (int i=0; i<cells.get_size(); i++) {
@@ -469,10 +488,10 @@ void MultiMonteCarlo::multi_spin_flip(void) {
       do {
 	for (int j=0; j<3; j++) {
 	  if (flip_span(0)>=0) {
-	    cells(i)(j)=(supercell(j)+center(j)+random(2*flip_span(j)+1)-flip_span(j)) % supercell(j);
+	    cells(i)(j)=(supercell(j)+center(j)+rng.random(2*flip_span(j)+1)-flip_span(j)) % supercell(j);
 	  }
 	  else {
-	    cells(i)(j)=random(supercell(j));
+	    cells(i)(j)=rng.random(supercell(j));
 	  }
 	}
 	for (ii=0; ii<i; ii++) {
@@ -510,7 +529,7 @@ void MultiMonteCarlo::multi_spin_flip(void) {
     accept=1;
   }
   else {
-    if (uniform01()<exp(-denergy/T)) accept=1;
+    if (rng.uniform01()<exp(-denergy/T)) accept=1;
   }
   if (!accept) {
     restore_state(saved_state);
@@ -524,7 +543,7 @@ void MultiMonteCarlo::multi_spin_flip(void) {
   // cerr << ">---" << endl;
 }
 
-void MultiMonteCarlo::set_eci(const Array<Real> &new_eci) {
+void MultiMonteCarlo::copy_eci(const Array<Real> &new_eci) {
   if (which_is_empty>=0) {
     E_ref=new_eci(which_is_empty)/lattice.atom_pos.get_size();
   } else {
@@ -535,9 +554,27 @@ void MultiMonteCarlo::set_eci(const Array<Real> &new_eci) {
       eci[s][c]=new_eci(which_cluster[s][c]);
     }
   }
+}
+
+void MultiMonteCarlo::set_eci(const Array<Real> &new_eci) {
+  copy_eci(new_eci);
   calc_from_scratch();
 }
 
+void MultiMonteCarlo::change_eci(const Array<Real> &new_eci) {
+  copy_eci(new_eci);
+  // each cluster of type i contributes rho/mult_i to cur_rho(i) and rho*eci_i
+  // to the energy (the empty cluster is accounted for by E_ref);
+  cur_energy=0.;
+  for (int i=0; i<total_clusters; i++) {
+    if (i!=which_is_empty) cur_energy+=new_eci(i)*rcluster_mult_per_atom[i]*cur_rho(i);
+  }
+  for (int i=0; i<nb_point; i++) {
+    cur_energy-=mu(i)*cur_rho(which_is_point[i])*point_mult[i];
+  }
+  flip_rate_valid=0;
+}
+
 void MultiMonteCarlo::init_random(const Array<Array<Real> > &conc) {
     Array<Array<Real> > sconc;
     sconc=conc;
@@ -555,9 +592,11 @@ void MultiMonteCarlo::init_random(const Array<Array<Real> > &conc) {
     msupercell.diag(supercell);
     BoundingBox<int,3> bb(iVector3d(0,0,0),total_box-iVector3d(1,1,1));
     MultiDimIterator<iVector3d> cell(supercell);
+    Array<Real> rcell(site_in_cell);
     for ( ; cell; cell++) {
+      rng.fill_uniform01(rcell.get_buf(),site_in_cell);
       for (int offset_in_cell=0; offset_in_cell<site_in_cell; offset_in_cell++) {
-        Real r=uniform01();
+        Real r=rcell(offset_in_cell);
         int the_spin=0;
         for (; the_spin<sconc(offset_in_cell).get_size()-1; the_spin++) {
           if (r<sconc(offset_in_cell)(the_spin)) break;
@@ -599,7 +638,7 @@ void MultiMonteCarlo::init_structure(const Structure &str) {
       rMatrix3d inv_cell=!(lattice.cell);
       int s=which_atom(lattice.atom_pos,str.atom_pos(at),inv_cell);
       iVector3d cell=to_int(inv_cell*(str.atom_pos(at)-lattice.atom_pos(s)));
-      SPIN_TYPE newspin=(SPIN_TYPE)( str.atom_type(at)==-1 ? random(nb_spin_val[s]) : str.atom_type(at));
+      SPIN_TYPE newspin=(SPIN_TYPE)( str.atom_type(at)==-1 ? rng.random(nb_spin_val[s]) : str.atom_type(at));
       MultiDimIterator<iVector3d> image(iVector3d(-1,-1,-1),iVector3d(1,1,1));
       for ( ; image; image++) {
 	iVector3d image_cell=cell+msupercell*(iVector3d &)image+margin;
@@ -631,7 +670,7 @@ void MultiMonteCarlo::init_structure(const Structure &str) {
 	else {
 	  at=which_atom(str.atom_pos,rcell+lattice.atom_pos(s),inv_cell);
 	}
-	SPIN_TYPE newspin=(SPIN_TYPE)( str.atom_type(at)==-1 ? random(nb_spin_val[s]) : str.atom_type(at));
+	SPIN_TYPE newspin=(SPIN_TYPE)( str.atom_type(at)==-1 ? rng.random(nb_spin_val[s]) : str.atom_type(at));
 	MultiDimIterator<iVector3d> image(iVector3d(-1,-1,-1),iVector3d(1,1,1));
 	for ( ; image; image++) {
 	  iVector3d image_cell=(iVector3d &)cell+msupercell*(iVector3d &)image+margin;
@@ -664,10 +703,11 @@ void MultiMonteCarlo::calc_from_scratch(void) {
         iVector3d cell=cur_cell;
         int offset=((cell(0)*supercell(1) + cell(1))*supercell(2) + cell(2))*site_in_cell + s;
         cur_disorder_param+=(spin[moffset]!=spin_orig[offset]);
+        int *poffset=first_site_offset(moffset,s);
         for (int c=0; c<nb_clusters[s]; c++) {
           Real rho=1;
-          for (int i=0; i<cluster_size[s][c]; i++) {
-            rho*=spin_val_clus[s][c][i][spin[moffset+site_offset[s][c][i]]];
+          for (int i=0; i<cluster_size[s][c]; i++, poffset++) {
+            rho*=spin_val_clus[s][c][i][spin[moffset+(*poffset)]];
           }
 	  rho/=(Real)(cluster_size[s][c]);
           cur_energy+=rho*eci[s][c];
@@ -682,6 +722,7 @@ void MultiMonteCarlo::calc_from_scratch(void) {
     for (int i=0; i<nb_point; i++) {
       cur_energy-=mu(i)*cur_rho(which_is_point[i])*point_mult[i];
     }
+    flip_rate_valid=0;
   }
 
 const Array<Real> & MultiMonteCarlo::get_cur_concentration(void) {
@@ -698,66 +739,48 @@ void MultiMonteCarlo::set_T_mu(Real _T, const Array<Real> &_mu) {
     }
     mu=_mu;
     pmu=mu.get_buf();
+    flip_rate_valid=0;
 }
 
 void MultiMonteCarlo::spin_flip(void) {
+  spin_flip(extension_is_active());
+}
+
+// with_extension=0 skips the (virtual) extension calls altogether;
+void MultiMonteCarlo::spin_flip(int with_extension) {
     int i;
     int cell[3],mcell[3],mcellscan[3],incell,inactivecell,offset;
     int oldspin,newspin;
-    Real denergy,dconc;
-    int cluster_count,site_count;
-    int **pcluster;
-    Real ***pppspin_val_clus,**ppspin_val_clus;
-    int *pwhich_cluster;
-    int *poffset,*psize;
-    Real *peci, *prho, *prho2, *prcluster_mult_per_atom;
-    Real rho;
+    Real denergy;
     int accept;
     for (i=0; i<3; i++) {
-      cell[i]=random(supercell(i));
+      cell[i]=rng.random(supercell(i));
       mcell[i]=cell[i]+margin(i);
     }
     // incell=random(site_in_cell);
-    inactivecell=random(active_site_in_cell);
+    inactivecell=rng.random(active_site_in_cell);
     incell=which_site[inactivecell];
     offset=((mcell[0]*total_box(1) + mcell[1])*total_box(2) + mcell[2])*site_in_cell + incell;
     oldspin=spin[offset];
-    newspin=(oldspin+1+random(nb_spin_val[incell]-1)) % nb_spin_val[incell];
-    denergy=0.;
-    for (i=total_clusters, prho=new_rho; i>0; i--, prho++) {
-      *prho=0.;
-    }
-    for (cluster_count=nb_clusters[incell], pcluster=site_offset[incell], pppspin_val_clus=spin_val_clus[incell], psize=cluster_size[incell], pwhich_cluster=which_cluster[incell], peci=eci[incell]; cluster_count>0; cluster_count--, pcluster++, pppspin_val_clus++, psize++, pwhich_cluster++, peci++) {
-      poffset=*pcluster;
-      ppspin_val_clus=*pppspin_val_clus;
-      rho=(*ppspin_val_clus)[newspin]-(*ppspin_val_clus)[oldspin];
-      poffset++;
-      ppspin_val_clus++;
-      for (site_count=(*psize)-1; site_count>0; site_count--, poffset++, ppspin_val_clus++) {
-        rho*=(*ppspin_val_clus)[spin[offset+(*poffset)]];
-      }
-      new_rho[*pwhich_cluster]+=rho;
-      denergy+=(*peci)*rho;
-    }
-    for (i=0; i<nb_point; i++) {
-      denergy-=pmu[i]*new_rho[which_is_point[i]];
+    newspin=(oldspin+1+rng.random(nb_spin_val[incell]-1)) % nb_spin_val[incell];
+    denergy=site_flip_energy(offset,incell,newspin);
+    Real dextension_energy=0.;
+    if (with_extension) {
+      extension_save_state();
+      Real save_extension_energy=extension_get_energy();
+      extension_update_spin_flip(cell,incell,oldspin,newspin);
+      dextension_energy=(extension_get_energy()-save_extension_energy)*rspin_size;
     }
-    extension_save_state();
-    Real save_extension_energy=extension_get_energy();
-    extension_update_spin_flip(cell,incell,oldspin,newspin);
-    Real dextension_energy=(extension_get_energy()-save_extension_energy)*rspin_size;
     accept=0;
     if (denergy+dextension_energy<0) {
       accept=1;
     }
     else {
-      if (uniform01()<exp(-(denergy+dextension_energy)/T)) accept=1;
+      if (rng.uniform01()<exp(-(denergy+dextension_energy)/T)) accept=1;
     }
     if (accept) {
       cur_energy+=denergy/rspin_size;
-      for (i=0, prho=new_rho, prho2=pcur_rho, prcluster_mult_per_atom=rcluster_mult_per_atom; i<total_clusters; i++, prho++, prho2++, prcluster_mult_per_atom++) {
-         *prho2+=(*prho)/(*prcluster_mult_per_atom)/rspin_size;
-      }
+      add_flip_to_corr(incell);
 
       for (i=0; i<3; i++) {
         if (mcell[i]>=supercell(i)) {mcell[i]-=supercell(i);}
@@ -772,19 +795,124 @@ void MultiMonteCarlo::spin_flip(void) {
       offset=((cell[0]*supercell(1) + cell[1])*supercell(2) + cell[2])*site_in_cell + incell;
       cur_disorder_param+=((newspin!=spin_orig[offset])-(oldspin!=spin_orig[offset]))/rspin_size;
     }
-    if (accept) {
-      extension_forget_state();
+    if (with_extension) {
+      if (accept) {
+        extension_forget_state();
+      }
+      else {
+        extension_undo_spin_flip();
+      }
     }
-    else {
-      extension_undo_spin_flip();
+}
+
+void MultiMonteCarlo::heat_bath_flip(void) {
+  int cell[3],mcell[3],incell,offset;
+  for (int i=0; i<3; i++) {
+    cell[i]=rng.random(supercell(i));
+    mcell[i]=cell[i]+margin(i);
+  }
+  incell=which_site[rng.random(active_site_in_cell)];
+  offset=((mcell[0]*total_box(1) + mcell[1])*total_box(2) + mcell[2])*site_in_cell + incell;
+  int oldspin=spin[offset];
+  int nb_val=nb_spin_val[incell];
+
+  // new_rho temporarily holds the chemical potential of each point cluster
+  // touched by the site (and 0 for the other touched clusters), so that the
+  // mu term can be folded into the effective eci of each cluster;
+  for (int i=0; i<nb_touched[incell]; i++) {
+    new_rho[touched[incell][i]]=0.;
+  }
+  for (int i=0; i<nb_touched_point[incell]; i++) {
+    int p=touched_point[incell][i];
+    new_rho[which_is_point[p]]=pmu[p];
+  }
+
+  // one pass over the clusters containing the site: product of the functions
+  // of the other sites of each, accumulated for all species at once;
+  neighbor_prod.resize(nb_clusters[incell]);
+  species_energy.resize(nb_val);
+  species_weight.resize(nb_val);
+  zero_array(&species_energy);
+  Real *penergy=species_energy.get_buf();
+  int cluster_count,site_count;
+  Real ***pppspin_val_clus,**ppspin_val_clus;
+  int *pwhich_cluster;
+  int *poffset,*psize;
+  Real *peci,*pprod;
+  for (cluster_count=nb_clusters[incell], poffset=first_site_offset(offset,incell), pppspin_val_clus=spin_val_clus[incell], psize=cluster_size[incell], pwhich_cluster=which_cluster[incell], peci=eci[incell], pprod=neighbor_prod.get_buf(); cluster_count>0; cluster_count--, pppspin_val_clus++, psize++, pwhich_cluster++, peci++, pprod++) {
+    ppspin_val_clus=*pppspin_val_clus;
+    Real *val=*ppspin_val_clus;
+    poffset++;
+    ppspin_val_clus++;
+    Real prod=1.;
+    for (site_count=(*psize)-1; site_count>0; site_count--, poffset++, ppspin_val_clus++) {
+      prod*=(*ppspin_val_clus)[spin[offset+(*poffset)]];
+    }
+    *pprod=prod;
+    Real w=((*peci)-new_rho[*pwhich_cluster])*prod;
+    for (int v=0; v<nb_val; v++) {
+      penergy[v]+=w*val[v];
     }
+  }
+  // energy change for each species;
+  Real min_energy=0.;
+  Real old_energy=penergy[oldspin];
+  for (int v=0; v<nb_val; v++) {
+    penergy[v]-=old_energy;
+    min_energy=MIN(min_energy,penergy[v]);
+  }
+  penergy[oldspin]=0.;
+
+  // sample from exp(-denergy/T), normalized;
+  int newspin=oldspin;
+  if (T>0.) {
+    Real total=0.;
+    for (int v=0; v<nb_val; v++) {
+      species_weight(v)=exp(-(species_energy(v)-min_energy)/T);
+      total+=species_weight(v);
+    }
+    Real r=rng.uniform01()*total;
+    for (newspin=0; newspin<nb_val-1; newspin++) {
+      r-=species_weight(newspin);
+      if (r<0.) break;
+    }
+  }
+  else {
+    for (int v=0; v<nb_val; v++) {
+      if (species_energy(v)<species_energy(newspin)) newspin=v;
+    }
+  }
+  if (newspin!=oldspin) {
+    for (int i=0; i<nb_touched[incell]; i++) {
+      new_rho[touched[incell][i]]=0.;
+    }
+    for (int c=0; c<nb_clusters[incell]; c++) {
+      Real *val=spin_val_clus[incell][c][0];
+      new_rho[which_cluster[incell][c]]+=(val[newspin]-val[oldspin])*neighbor_prod(c);
+    }
+    cur_energy+=species_energy(newspin)/rspin_size;
+    add_flip_to_corr(incell);
+    set_spin(cell,incell,oldspin,newspin);
+  }
 }
 
 void MultiMonteCarlo::run(int mc_passes, int mode) {
+  if (mode==3) {
+    rejection_free_run(mc_passes);
+    return;
+  }
+  flip_rate_valid=0;
   int maxn=mc_passes*supercell(0)*supercell(1)*supercell(2)*site_in_cell;
-  if (mode==1) {
+  if (mode==4) {
+    if (extension_is_active()) ERRORQUIT("Heat-bath mode is not available with k-space ECI");
     for (int n=0; n<maxn; n++) {
-      spin_flip();
+      heat_bath_flip();
+    }
+  }
+  else if (mode==1) {
+    int with_extension=extension_is_active();
+    for (int n=0; n<maxn; n++) {
+      spin_flip(with_extension);
     }
   }
   else {
@@ -794,6 +922,172 @@ void MultiMonteCarlo::run(int mc_passes, int mode) {
   }
 }
 
+Real MultiMonteCarlo::site_flip_energy(int offset, int incell, int newspin) {
+  int oldspin=spin[offset];
+  Real denergy=0.;
+  int cluster_count,site_count;
+  Real ***pppspin_val_clus,**ppspin_val_clus;
+  int *pwhich_cluster;
+  int *poffset,*psize;
+  Real *peci;
+  Real rho;
+  int i;
+  // only the orbits containing the site can change;
+  for (i=0; i<nb_touched[incell]; i++) {
+    new_rho[touched[incell][i]]=0.;
+  }
+  for (cluster_count=nb_clusters[incell], poffset=first_site_offset(offset,incell), pppspin_val_clus=spin_val_clus[incell], psize=cluster_size[incell], pwhich_cluster=which_cluster[incell], peci=eci[incell]; cluster_count>0; cluster_count--, pppspin_val_clus++, psize++, pwhich_cluster++, peci++) {
+    ppspin_val_clus=*pppspin_val_clus;
+    rho=(*ppspin_val_clus)[newspin]-(*ppspin_val_clus)[oldspin];
+    poffset++;
+    ppspin_val_clus++;
+    for (site_count=(*psize)-1; site_count>0; site_count--, poffset++, ppspin_val_clus++) {
+      rho*=(*ppspin_val_clus)[spin[offset+(*poffset)]];
+    }
+    new_rho[*pwhich_cluster]+=rho;
+    denergy+=(*peci)*rho;
+  }
+  for (i=0; i<nb_touched_point[incell]; i++) {
+    int p=touched_point[incell][i];
+    denergy-=pmu[p]*new_rho[which_is_point[p]];
+  }
+  return denergy;
+}
+
+// adds the correlation changes left in new_rho by site_flip_energy();
+void MultiMonteCarlo::add_flip_to_corr(int incell) {
+  for (int i=0; i<nb_touched[incell]; i++) {
+    int c=touched[incell][i];
+    pcur_rho[c]+=new_rho[c]/rcluster_mult_per_atom[c]/rspin_size;
+  }
+}
+
+int MultiMonteCarlo::site_from_offset(int moffset, int *cell, int *incell) {
+  int mcell[3];
+  *incell=moffset % site_in_cell;
+  moffset/=site_in_cell;
+  for (int i=2; i>=0; i--) {
+    mcell[i]=moffset % total_box(i);
+    moffset/=total_box(i);
+  }
+  for (int i=0; i<3; i++) {
+    cell[i]=((mcell[i]-margin(i)) % supercell(i) + supercell(i)) % supercell(i);
+  }
+  return ((cell[0]*supercell(1) + cell[1])*supercell(2) + cell[2])*site_in_cell + *incell;
+}
+
+// the rate of a site is the probability that a Metropolis attempt on it
+// succeeds, averaged over the proposed new spins;
+void MultiMonteCarlo::update_flip_rate(int site) {
+  int incell=site % site_in_cell;
+  if (nb_spin_val[incell]<2 || is_frozen[incell]) {
+    flip_rate.set(site,0.);
+    return;
+  }
+  int c=site/site_in_cell;
+  int mcell[3];
+  for (int i=2; i>=0; i--) {
+    mcell[i]=c % supercell(i) + margin(i);
+    c/=supercell(i);
+  }
+  int offset=((mcell[0]*total_box(1) + mcell[1])*total_box(2) + mcell[2])*site_in_cell + incell;
+  Real rate=0.;
+  for (int newspin=0; newspin<nb_spin_val[incell]; newspin++) {
+    if (newspin==spin[offset]) continue;
+    Real denergy=site_flip_energy(offset,incell,newspin);
+    rate+=(denergy<0 ? 1. : exp(-denergy/T));
+  }
+  flip_rate.set(site,rate/(Real)(nb_spin_val[incell]-1));
+}
+
+void MultiMonteCarlo::init_flip_rates(void) {
+  int spin_size=(int)rspin_size;
+  flip_rate.init(spin_size);
+  for (int i=0; i<spin_size; i++) {
+    update_flip_rate(i);
+  }
+  if (!flip_stamp) {
+    flip_stamp=new int[spin_size];
+  }
+  for (int i=0; i<spin_size; i++) {
+    flip_stamp[i]=0;
+  }
+  cur_stamp=0;
+  flip_wait=-1.;
+  flip_rate_valid=1;
+}
+
+// n-fold way version of run(,1): flips occur at the rates of Metropolis
+// sampling and the state is sampled at whole passes, so that each configuration
+// is weighted by its residence time;
+void MultiMonteCarlo::rejection_free_run(int mc_passes) {
+  if (extension_is_active()) ERRORQUIT("Rejection-free mode is not available with k-space ECI");
+  if (!flip_rate_valid) init_flip_rates();
+  // run(,1) makes site_in_cell attempts per cell and pass, but only on active sites;
+  Real rate_per_pass=(Real)site_in_cell/(Real)active_site_in_cell;
+  Real time_left=(Real)mc_passes;
+  while (1) {
+    if (flip_wait<0.) {
+      Real total=flip_rate.get_total()*rate_per_pass;
+      Real r;
+      do {r=rng.uniform01();} while (r==0.);
+      flip_wait=(total>0. ? -log(r)/total : MAXFLOAT);
+    }
+    if (flip_wait>time_left) break;
+    time_left-=flip_wait;
+    flip_wait=-1.;
+    int site=flip_rate.find(rng.uniform01()*flip_rate.get_total());
+    int cell[3],mcell[3],incell;
+    int c=site/site_in_cell;
+    incell=site % site_in_cell;
+    for (int i=2; i>=0; i--) {
+      cell[i]=c % supercell(i);
+      mcell[i]=cell[i]+margin(i);
+      c/=supercell(i);
+    }
+    int offset=((mcell[0]*total_box(1) + mcell[1])*total_box(2) + mcell[2])*site_in_cell + incell;
+    int oldspin=spin[offset];
+    Real r=rng.uniform01()*flip_rate(site)*(Real)(nb_spin_val[incell]-1);
+    int newspin=-1;
+    for (int s=0; s<nb_spin_val[incell]; s++) {
+      if (s==oldspin) continue;
+      newspin=s;
+      Real denergy=site_flip_energy(offset,incell,s);
+      r-=(denergy<0 ? 1. : exp(-denergy/T));
+      if (r<0.) break;
+    }
+    force_spin_flip(cell,incell,newspin);
+    if (cur_stamp==MAXINT) {
+      for (int i=0; i<(int)rspin_size; i++) {flip_stamp[i]=0;}
+      cur_stamp=0;
+    }
+    cur_stamp++;
+    int *poffset=first_site_offset(offset,incell);
+    for (int j=0; j<nbr_row_len[incell]; j++, poffset++) {
+      int ncell[3],nincell;
+      int nsite=site_from_offset(offset+(*poffset),ncell,&nincell);
+      if (flip_stamp[nsite]!=cur_stamp) {
+        flip_stamp[nsite]=cur_stamp;
+        update_flip_rate(nsite);
+      }
+    }
+  }
+  flip_wait-=time_left;
+}
+
+void MultiMonteCarlo::get_species(Array<int> *pspecies) const {
+  pspecies->resize(supercell(0)*supercell(1)*supercell(2)*site_in_cell);
+  int k=0;
+  MultiDimIterator<iVector3d> cur_cell(supercell);
+  for ( ; cur_cell; cur_cell++) {
+    iVector3d m_cur_cell=(iVector3d &)cur_cell+margin;
+    for (int s=0; s<site_in_cell; s++, k++) {
+      int moffset=((m_cur_cell(0)*total_box(1) + m_cur_cell(1))*total_box(2) + m_cur_cell(2))*site_in_cell + s;
+      (*pspecies)(k)=spin[moffset];
+    }
+  }
+}
+
 void MultiMonteCarlo::view(const Array<Arrayint> &labellookup, const Array<std::string> &atom_label, ofstream &file, const rMatrix3d &axes) {
   for (int i=0; i<3; i++) {
     file << axes.get_column(i) << endl;
@@ -840,13 +1134,78 @@ void run_mc(GenericAccumulator *accum, MultiMonteCarlo *pmc, int mode) {
   }
 }
 
+MultiReplicaExchange::MultiReplicaExchange(const Array<MultiMonteCarlo *> &_replica): ReplicaExchangeBase<MultiMonteCarlo>(_replica), mu(), eci(), accum() {
+  for (int i=0; i<replica.get_size(); i++) {
+    replica(i)->set_random_stream(master_rng.split());
+  }
+}
+
+void MultiReplicaExchange::init_run(const Array<Real> &_T, const Array<Array<Real> > &_mu, const Array<Array<Real> > &_eci) {
+  if (_T.get_size()!=replica.get_size()) ERRORQUIT("MultiReplicaExchange: need one replica per temperature");
+  T=_T;
+  mu=_mu;
+  eci=_eci;
+  for (int s=0; s<replica.get_size(); s++) {
+    MultiMonteCarlo *pmc=replica(slot_replica(s));
+    pmc->set_eci(eci(s));
+    pmc->set_T_mu(T(s),mu(s));
+  }
+}
+
+void MultiReplicaExchange::run_replica(int r, int nb_pass) {
+  replica(r)->run(nb_pass,mode_cur);
+}
+
+void MultiReplicaExchange::sample_slot(int s) {
+  Array<Real> data;
+  get_replica_at(s)->get_thermo_data(&data);
+  accum(s).new_data(data);
+}
+
+// energy per site of the configuration of replica r under the ECI and
+// chemical potentials of slot s;
+Real MultiReplicaExchange::calc_enthalpy(int r, int s) {
+  MultiMonteCarlo *pmc=replica(r);
+  const Array<Real> &corr=pmc->get_cur_corr();
+  Array<Real> mult;
+  pmc->get_cluster_mult(&mult);
+  Real E=0.;
+  for (int i=0; i<corr.get_size(); i++) {
+    E+=eci(s)(i)*mult(i)*corr(i);
+  }
+  return E-inner_product(mu(s),pmc->get_cur_concentration());
+}
+
+void MultiReplicaExchange::set_conditions(int r, int s) {
+  replica(r)->change_eci(eci(s));
+  replica(r)->set_T_mu(T(s),mu(s));
+}
+
+void MultiReplicaExchange::run(Array<Array<Real> > *pmean, Array<Array<Real> > *pvar, int n_equil, int n_step, int swap_interval, int mode) {
+  mode_cur=mode;
+  accum.resize(0);
+  accum.resize(replica.get_size());
+  run_schedule(n_equil,n_step,swap_interval);
+  pmean->resize(replica.get_size());
+  pvar->resize(replica.get_size());
+  for (int s=0; s<replica.get_size(); s++) {
+    (*pmean)(s)=accum(s).get_mean();
+    (*pvar)(s)=accum(s).get_var();
+  }
+}
+
 #include "anyfft.h"
 
 KSpaceMultiMonteCarlo::KSpaceMultiMonteCarlo(const Structure &_lattice, const Array<Array<int> > &_site_type_list,
 		const iVector3d &_supercell,
 		const SpaceGroup &space_group, const LinkedList<MultiCluster> &cluster_list,
 		const Array<Array<Array<Real> > > &_corrfunc, KSpaceECI *_p_kspace_eci):
-  MultiMonteCarlo(_lattice,_site_type_list,_supercell,space_group,cluster_list,_corrfunc), flipped_spins(), ft_spin(), ft_eci(), dir_eci(), convol(), ref_x() {
+  KSpaceMultiMonteCarlo(_lattice,_site_type_list,_supercell,MCInteractionTable(_lattice,space_group,cluster_list),_corrfunc,_p_kspace_eci) {}
+
+KSpaceMultiMonteCarlo::KSpaceMultiMonteCarlo(const Structure &_lattice, const Array<Array<int> > &_site_type_list,
+		const iVector3d &_supercell, const MCInteractionTable &table,
+		const Array<Array<Array<Real> > > &_corrfunc, KSpaceECI *_p_kspace_eci):
+  MultiMonteCarlo(_lattice,_site_type_list,_supercell,table,_corrfunc), flipped_spins(), ft_spin(), ft_eci(), dir_eci(), convol(), ref_x() {
   p_kspace_eci=_p_kspace_eci;
   nsite=_lattice.atom_pos.get_size();
   size=supercell(0)*supercell(1)*supercell(2);
@@ -929,7 +1288,7 @@ void KSpaceMultiMonteCarlo::set_k_space_eci(void) {
     for (int t=0; t<=s; t++) {
       for (int ss=0; ss<dir_eci(s)(t).get_size(); ss++) {
         for (int tt=0; tt<dir_eci(s)(t)(ss).get_size(); tt++) {
-          fftnd(dir_eci(s)(t)(ss)(tt).get_buf(),3,supercell.get_buf(),-1);
+          fftnd_real_part(dir_eci(s)(t)(ss)(tt).get_buf(),3,supercell.get_buf(),-1);
 /*
 rMatrix3d id;
 id.identity();
@@ -970,7 +1329,7 @@ void KSpaceMultiMonteCarlo::extension_calc_from_scratch(void) {
 //Array<Array<Array<Complex> > > savesp(ft_spin);
   for (int s=0; s<nsite; s++) {
     for (int ss=0; ss<ft_spin(s).get_size(); ss++) {
-      fftnd(ft_spin(s)(ss).get_buf(),3,supercell.get_buf(),1);
+      fftnd_real(ft_spin(s)(ss).get_buf(),3,supercell.get_buf(),1);
 //rMatrix3d id;
 //id.identity();
 //plot_3d_surf(id,id,supercell,ft_spin(s)(ss));
@@ -1008,7 +1367,7 @@ void KSpaceMultiMonteCarlo::extension_calc_from_scratch(void) {
 //cerr << "end" << endl;
   for (int s=0; s<nsite; s++) {
     for (int ss=0; ss<convol(s).get_size(); ss++) {
-      fftnd(convol(s)(ss).get_buf(),3,supercell.get_buf(),-1);
+      fftnd_real_part(convol(s)(ss).get_buf(),3,supercell.get_buf(),-1);
     }
   }
 /*
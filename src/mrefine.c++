@@ -34,6 +34,8 @@ ClusterExpansion::ClusterExpansion(const Structure &_parent_lattice,
      predictor_labels="";
      ignore_gs=0;
      user_max_vol=32000;//largest cell possible;
+     pcache=NULL;
+     cache_context=0;
 
      // initialize lattice_only;
      int nbsite=0;
@@ -127,8 +129,13 @@ void ClusterExpansion::update_correlations(StructureInfo *str) {
   // loop through multiplets and add missing correlations;
   LinkedListIterator<LinkedListReal> corr_list(str->correlations);
 
+  // correlations found in the cache need not be computed (all processes have the same cache);
+  uint64_t str_key=(pcache ? corrcache_structure_key(*str,parent_lattice,site_type_list) : 0);
+  std::vector<std::pair<uint64_t, Real *> > computed;
   {
+      // all missing correlations of this structure are exchanged in one collective;
       MPISynchronizer<Real> sync;
+      std::vector<std::pair<Real *, const Array<MultiCluster> *> > mine;
       for (int clus_list=0; clus_list<pclusters.get_size(); clus_list++, corr_list++) {
 	  // for each multiplet, prepare to loop through clusters;
 	  LinkedListIterator<Real> corr(*corr_list);
@@ -140,13 +147,47 @@ void ClusterExpansion::update_correlations(StructureInfo *str) {
 	  // and then add the missing corr.;
 	  for ( ; idx<pclusters(clus_list)->get_current_index(); clus++, equiv_clus++, idx++) {
 	      Real *prho=new Real;
+	      (*corr_list) << prho;
+	      if (pcache) {
+		  uint64_t clus_key=hash_cluster(*clus,cache_context);
+		  if (pcache->find(prho,str_key,clus_key)) continue;
+		  computed.push_back(std::make_pair(clus_key,prho));
+	      }
 	      if (sync.is_my_job()) {
-		  *prho=calc_correlation(*str,*equiv_clus,spacegroup.cell,*pcorrfunc);
+		  mine.push_back(std::make_pair(prho,&(*equiv_clus)));
 	      }
-	      (*corr_list) << prho;
 	      sync.sync(prho);
 	  }
       }
+      // evaluate this process' share in one pass over the structure (before sync exchanges them);
+      SupercellSiteTable tab;
+      CorrelationKernel kernel;
+      int usekernel=(mine.size()>0 && tab.init(*str,spacegroup.cell));
+      if (usekernel) {
+	  kernel.init(tab);
+	  for (size_t i=0; i<mine.size() && usekernel; i++) {
+	      usekernel=kernel.add_orbit(*(mine[i].second));
+	  }
+      }
+      if (usekernel) {
+	  Array<int> site_type;
+	  get_site_types(&site_type,*str,tab);
+	  kernel.set_structure(site_type,*pcorrfunc);
+	  for (size_t i=0; i<mine.size(); i++) {
+	      *(mine[i].first)=kernel.get_correlation(i);
+	  }
+      }
+      else {
+	  for (size_t i=0; i<mine.size(); i++) {
+	      *(mine[i].first)=calc_correlation(*str,*(mine[i].second),spacegroup.cell,*pcorrfunc);
+	  }
+      }
+  }
+  if (pcache) {
+    for (size_t i=0; i<computed.size(); i++) {
+      pcache->add(str_key,computed[i].first,*(computed[i].second));
+    }
+    pcache->flush();
   }
 
   // create predictor objects, if needed;
@@ -155,6 +196,11 @@ void ClusterExpansion::update_correlations(StructureInfo *str) {
   }
 }
 
+void ClusterExpansion::set_correlation_cache(CorrelationCache *_pcache) {
+  pcache=_pcache;
+  cache_context=corrcache_context(parent_lattice,*pcorrfunc);
+}
+
 void ClusterExpansion::update_correlations(StructureInfo::Status select) {
   reset_structure();
   // for each structure that maches the select mask, update correlations.;
@@ -481,7 +527,7 @@ void ClusterExpansion::find_best_cluster_choice(CEFitInfo *pfitinfo) {
       one_array(&weight1);
     }
   }
-  MyMPI_BcastStream(&weight1);
+  MyMPI_Bcast(&weight1);
   weight=weight1;
   Array<int> best_choice; // to remember best choice;
   Array<Real> best_eci_mult; // to remember best eci (times multiplicity);
@@ -502,7 +548,7 @@ void ClusterExpansion::find_best_cluster_choice(CEFitInfo *pfitinfo) {
       LinkedList_to_Array(&best_choice,cluster_choice);
     }
   }
-  MyMPI_BcastStream(&best_choice);
+  MyMPI_Bcast(&best_choice);
 
   if (best_choice.get_size()>0) { // if user-specified cluster choice;
 #ifndef BAKER
@@ -560,6 +606,9 @@ void ClusterExpansion::find_best_cluster_choice(CEFitInfo *pfitinfo) {
       int best_gs_ok=0;
       Real best_cv=MAXFLOAT;
       int colinear;
+      // successive choices share most columns: update the factorization;
+      IncrementalCV inccv;
+      inccv.init(weight);
       do { // loop through cluster choices;
 	//if you want to print out trace information;
 	if (MyMPIobj.is_root())  cerr  << "Current cluster: " ;
@@ -571,11 +620,12 @@ void ClusterExpansion::find_best_cluster_choice(CEFitInfo *pfitinfo) {
 	calc_regression_matrices(&corr_matrix,&energy);
 	calc_predictor_energy(&predictor_energy);
 	diff(&ce_energy,energy,predictor_energy);
-	Real cv=calc_cv(corr_matrix,ce_energy,weight,1);
+	inccv.set_design(corr_matrix);
+	Real cv=inccv.get_cv(ce_energy);
 	// do regression and add back the predictor energy;
 	Array<Real> cur_eci_mult;
 	Array<Real> fitted_energy;
-	calc_ols(&cur_eci_mult,corr_matrix,ce_energy,weight,1);
+	inccv.get_fit(&cur_eci_mult,ce_energy);
 	product(&fitted_energy,corr_matrix,cur_eci_mult);
 	sum(&fitted_energy,fitted_energy,predictor_energy);
 	// check for qualitatively wrong ground states;
@@ -674,7 +724,7 @@ void ClusterExpansion::find_best_cluster_choice(CEFitInfo *pfitinfo) {
         }
       }
     }
-    MyMPI_BcastStream(&(pfitinfo->pure_energy));
+    MyMPI_Bcast(&(pfitinfo->pure_energy));
     // consider formation energies;
     Array<Array<Real> > full_conc(concentration.get_size());
     for (int i=0; i<concentration.get_size(); i++) {
@@ -40,6 +40,8 @@ int main(int argc, char *argv[]) {
   Real large_step=1e50;
   Real x_prec=0;
   const char *kspace_labels="";
+  int kspace_real_space=0;
+  const char *itable_file="";
   AskStruct options[]={
     {"","PHase Boundary " MAPS_VERSION ", by Axel van de Walle",TITLEVAL,NULL},
     {"-h","Help",BOOLVAL,&help},
@@ -68,7 +70,9 @@ int main(int argc, char *argv[]) {
     {"-sd","Seed for random number generation (default: use clock)",INTVAL,&seed},
     {"-dn","Go down in temperature",BOOLVAL,&go_down},
     {"-dx","Concentration Precision",REALVAL,&x_prec},
-    {"-ks","Specify how k space ECI are calculated (e.g. -ks=cs).",STRINGVAL,&kspace_labels}
+    {"-ks","Specify how k space ECI are calculated (e.g. -ks=cs).",STRINGVAL,&kspace_labels},
+    {"-ksr","Update the k space energy in real space after each accepted flip (instead of periodic FFTs)",BOOLVAL,&kspace_real_space},
+    {"-itf","Interaction table file: the clusters around each site are read from it if it matches lattice and clusters, otherwise found and saved to it, in the directory of each phase (default: do not use a file)",STRINGVAL,&itable_file}
   };
   if (!get_values(argc,argv,countof(options),options)) {
     display_help(countof(options),options);
@@ -107,6 +111,8 @@ int main(int argc, char *argv[]) {
   PolyInterpolatorBig<Array<Real> > teci[2];
   PolyInterpolatorBig<Array<Real> > teeci[2];
   Real e_scale[2];
+  // reused by the second phase when both share their lattice and clusters;
+  MCInteractionTable itable;
 
   for (int phase=0; phase<2; phase++) {
     auto cur_dir = std::filesystem::current_path().c_str();
@@ -216,6 +222,7 @@ int main(int argc, char *argv[]) {
     fit_sphere=find_sphere_bounding_box(lattice_only.cell*mat_simple_supercell,2.*enclosed_radius);
     for (int i=0; i<3; i++) {simple_supercell(i)*=fit_sphere(i);}
     cout << "Phase " << phase+1 << " size: " << simple_supercell << endl;
+    get_interaction_table(&itable,lattice_only,spacegroup,clusterlist,itable_file);
     if (strlen(kspace_labels)>0) {
       if (lte_prec!=0) ERRORQUIT("LTE not implemented with k-space cluster expansion.");
       if (!check_plug_in(KSpaceECI(),kspace_labels)) {
@@ -227,10 +234,12 @@ int main(int argc, char *argv[]) {
       for (; i; i++) {
 	i->static_init(lattice_only);
       }
-      mc[phase]=new KSpaceMonteCarlo(lattice_only,simple_supercell,spacegroup,clusterlist,&(multi_kspace_eci[phase]));
+      KSpaceMonteCarlo *pkmc=new KSpaceMonteCarlo(lattice_only,simple_supercell,itable,&(multi_kspace_eci[phase]));
+      pkmc->set_real_space_update(kspace_real_space);
+      mc[phase]=pkmc;
     }
     else {
-      mc[phase]=new MonteCarlo(lattice_only,simple_supercell,spacegroup,clusterlist);
+      mc[phase]=new MonteCarlo(lattice_only,simple_supercell,itable);
     }
     chdir_robust(std::filesystem::current_path().string());
   }
@@ -1,7 +1,10 @@
 #include "refine.h"
 #include "getvalue.h"
+#include <atomic>
 #include <fstream>
 #include <sstream>
+#include <thread>
+#include <vector>
 
 template <>
 GenericPlugIn<EnergyPredictor> *GenericPlugIn<EnergyPredictor>::list = NULL;
@@ -39,6 +42,9 @@ ClusterExpansion::ClusterExpansion(const Structure &_parent_lattice,
   maxc_gs_ok = MAXFLOAT;
   predictor_labels = "";
   user_max_vol = 32000; // largest cell possible;
+  nb_threads = 1;
+  pcache = NULL;
+  cache_context = 0;
 
   // initialize lattice_only;
   int nbsite = 0;
@@ -95,7 +101,67 @@ ClusterExpansion::~ClusterExpansion(void) {
   }
 }
 
-void ClusterExpansion::update_correlations(StructureInfo *str) {
+// Correlations of one structure that are still to be computed;
+class MissingCorrelations {
+public:
+  StructureInfo *pstr;
+  std::vector<Real *> pcorr;
+  std::vector<const ArrayCluster *> pclusters;
+  uint64_t str_key;                // only if a cache is used;
+  std::vector<uint64_t> clus_key; // idem;
+  MissingCorrelations(void) : pcorr(), pclusters(), clus_key() {
+    pstr = NULL;
+    str_key = 0;
+  }
+  void calc(const rMatrix3d &cell, CorrelationCache *pcache);
+};
+
+void MissingCorrelations::calc(const rMatrix3d &cell,
+                               CorrelationCache *pcache) {
+  if (pcorr.size() == 0)
+    return;
+  // correlations found in the cache need not be computed;
+  std::vector<size_t> todo;
+  if (pcache) {
+    for (size_t i = 0; i < pcorr.size(); i++) {
+      if (!pcache->find(pcorr[i], str_key, clus_key[i])) {
+        todo.push_back(i);
+      }
+    }
+  } else {
+    for (size_t i = 0; i < pcorr.size(); i++) {
+      todo.push_back(i);
+    }
+  }
+  if (todo.size() == 0)
+    return;
+  // the site -> species lookup is set up once for all new clusters;
+  SupercellSiteTable tab;
+  if (tab.init(*pstr, cell)) {
+    Array<int> site_type;
+    get_site_types(&site_type, *pstr, tab);
+    for (size_t j = 0; j < todo.size(); j++) {
+      *pcorr[todo[j]] = calc_correlation(site_type, *pclusters[todo[j]], tab);
+    }
+  } else {
+    for (size_t j = 0; j < todo.size(); j++) {
+      *pcorr[todo[j]] = calc_correlation(*pstr, *pclusters[todo[j]], cell);
+    }
+  }
+  if (pcache) {
+    for (size_t j = 0; j < todo.size(); j++) {
+      pcache->add(str_key, clus_key[todo[j]], *pcorr[todo[j]]);
+    }
+  }
+}
+
+void ClusterExpansion::list_missing_correlations(MissingCorrelations *pmissing,
+                                                 StructureInfo *str) {
+  pmissing->pstr = str;
+  if (pcache) {
+    pmissing->str_key =
+        corrcache_structure_key(*str, parent_lattice, site_type_list);
+  }
   // set structure label, if needed;
   if (strlen(str->label) == 0) {
     while (i_label_list && *i_label_list == cur_label) {
@@ -137,8 +203,18 @@ void ClusterExpansion::update_correlations(StructureInfo *str) {
     } // and then add the missing corr.;
     for (; idx < pclusters(clus_list)->get_current_index();
          clus++, equiv_clus++, idx++) {
-      (*corr_list) << new Real(
-          calc_correlation(*str, *equiv_clus, spacegroup.cell));
+      Real *prho = new Real(0.);
+      (*corr_list) << prho;
+      pmissing->pcorr.push_back(prho);
+      pmissing->pclusters.push_back(equiv_clus);
+      if (pcache) {
+        // keyed as the binary MultiCluster corrdump and mcsqs use;
+        MultiCluster mclus(clus->get_size());
+        mclus.clus = *clus;
+        zero_array(&mclus.site_type);
+        zero_array(&mclus.func);
+        pmissing->clus_key.push_back(hash_cluster(mclus, cache_context));
+      }
     }
   }
 
@@ -148,14 +224,65 @@ void ClusterExpansion::update_correlations(StructureInfo *str) {
   }
 }
 
+void ClusterExpansion::update_correlations(StructureInfo *str) {
+  MissingCorrelations missing;
+  list_missing_correlations(&missing, str);
+  missing.calc(spacegroup.cell, pcache);
+  if (pcache)
+    pcache->flush();
+}
+
 void ClusterExpansion::update_correlations(StructureInfo::Status select) {
   reset_structure();
-  // for each structure that maches the select mask, update correlations.;
+  // for each structure that maches the select mask, list missing corr.;
+  LinkedList<MissingCorrelations> missing_list;
   LinkedListIterator<StructureInfo> str(structures.get_structure_list());
   for (; str; str++) {
-    if (str->status & select)
-      update_correlations(str);
+    if (str->status & select) {
+      MissingCorrelations *pmissing = new MissingCorrelations;
+      list_missing_correlations(pmissing, str);
+      if (pmissing->pcorr.size() > 0) {
+        missing_list << pmissing;
+      } else {
+        delete pmissing;
+      }
+    }
   }
+  // and compute them, one structure at a time per thread;
+  Array<MissingCorrelations *> missing(missing_list.get_size());
+  LinkedListIterator<MissingCorrelations> m(missing_list);
+  for (int i = 0; m; m++, i++) {
+    missing(i) = m;
+  }
+  std::atomic<int> next(0);
+  auto worker = [&]() {
+    int i;
+    while ((i = next++) < missing.get_size()) {
+      missing(i)->calc(spacegroup.cell, pcache);
+    }
+  };
+  int nt = MIN(nb_threads, missing.get_size());
+  if (nt > 1) {
+    std::vector<std::thread> thread;
+    for (int t = 0; t < nt; t++) {
+      thread.push_back(std::thread(worker));
+    }
+    for (size_t t = 0; t < thread.size(); t++) {
+      thread[t].join();
+    }
+  } else {
+    worker();
+  }
+  if (pcache)
+    pcache->flush();
+}
+
+void ClusterExpansion::set_correlation_cache(CorrelationCache *_pcache) {
+  pcache = _pcache;
+  // the binary spins 2*type-1 are the trigo functions of 2 components;
+  TrigoCorrFuncTable spin;
+  spin.init(2);
+  cache_context = corrcache_context(parent_lattice, spin);
 }
 
 void ClusterExpansion::init_predictors(void) {
@@ -476,6 +603,9 @@ void ClusterExpansion::find_best_cluster_choice(CEFitInfo *pfitinfo) {
       reset_cluster_choice(); // select minimal cluster expansion;
       int best_gs_ok = 0;
       Real best_cv = MAXFLOAT;
+      // successive choices share most columns: update the factorization;
+      IncrementalCV inccv;
+      inccv.init(weight);
       do { // loop through cluster choices;
         // if you want to print out trace information;
         for (int i = 0; i < pclusters.get_size(); i++) {
@@ -486,11 +616,12 @@ void ClusterExpansion::find_best_cluster_choice(CEFitInfo *pfitinfo) {
         calc_regression_matrices(&corr_matrix, &energy);
         calc_predictor_energy(&predictor_energy);
         diff(&ce_energy, energy, predictor_energy);
-        Real cv = calc_cv(corr_matrix, ce_energy, weight, 1);
+        inccv.set_design(corr_matrix);
+        Real cv = inccv.get_cv(ce_energy);
         // do regression and add back the predictor energy;
         Array<Real> cur_eci_mult;
         Array<Real> fitted_energy;
-        calc_ols(&cur_eci_mult, corr_matrix, ce_energy, weight, 1);
+        inccv.get_fit(&cur_eci_mult, ce_energy);
         product(&fitted_energy, corr_matrix, cur_eci_mult);
         sum(&fitted_energy, fitted_energy, predictor_energy);
         // check for qualitatively wrong ground states;
@@ -0,0 +1,71 @@
+#include <fstream>
+#include <iomanip>
+#include "mctraj.h"
+#include "getvalue.h"
+#include "version.h"
+
+int main(int argc, char *argv[]) {
+  const char *trajfile="";
+  int frame=-1;
+  int all=0;
+  const char *outfile="";
+  int sigdig=6;
+  int dohelp=0;
+  AskStruct options[]={
+    {"","Convert emc2/memc2 binary TRAJectory snapshots to STRucture files, version " MAPS_VERSION,TITLEVAL,NULL},
+    {"-f","Trajectory file written with the -otr option of emc2 or memc2",STRINGVAL,&trajfile},
+    {"-fr","Index of the snapshot to write (starting at 0; default: list the snapshots and their T, mu)",INTVAL,&frame},
+    {"-a","Write all snapshots, to files named as with -opss (the part of -o before the dot is replaced by the snapshot index)",BOOLVAL,&all},
+    {"-o","Output file (default: stdout)",STRINGVAL,&outfile},
+    {"-sigdig","Number of significant digits printed",INTVAL,&sigdig},
+    {"-h","Display more help",BOOLVAL,&dohelp}
+  };
+  if (!get_values(argc,argv,countof(options),options) || dohelp || strlen(trajfile)==0) {
+    display_help(countof(options),options);
+    return 1;
+  }
+
+  TrajectoryReader traj;
+  if (!traj.open(trajfile)) ERRORQUIT("Unable to read trajectory file");
+  Array<int> species;
+  Array<Real> cond;
+  if (all) {
+    std::string pattern=outfile;
+    size_t dot=pattern.rfind('.');
+    if (dot==std::string::npos) ERRORQUIT("-a requires an output file name containing a dot (e.g. -o=snapshot.out)");
+    for (int i=0; traj.read_frame(&species,&cond); i++) {
+      std::string filename=pattern;
+      filename.replace(0,dot,std::to_string(i));
+      ofstream file(filename.c_str());
+      file << std::fixed << std::setprecision(sigdig);
+      traj.write_structure(file,species);
+    }
+  }
+  else if (frame>=0) {
+    for (int i=0; i<frame; i++) {
+      if (!traj.skip_frame(&cond)) ERRORQUIT("Trajectory has fewer snapshots than requested");
+    }
+    if (!traj.read_frame(&species,&cond)) ERRORQUIT("Trajectory has fewer snapshots than requested");
+    if (strlen(outfile)>0) {
+      ofstream file(outfile);
+      file << std::fixed << std::setprecision(sigdig);
+      traj.write_structure(file,species);
+    }
+    else {
+      cout << std::fixed << std::setprecision(sigdig);
+      traj.write_structure(cout,species);
+    }
+  }
+  else {
+    cout.setf(ios::fixed);
+    cout.precision(sigdig);
+    for (int i=0; traj.skip_frame(&cond); i++) {
+      cout << i;
+      for (int j=0; j<cond.get_size(); j++) {
+	cout << "\t" << cond(j);
+      }
+      cout << endl;
+    }
+  }
+  return 0;
+}
@@ -675,6 +675,85 @@ void find_common_simple_supercell(iVector3d *psimple_supercell,
   }
 }
 
+void smith_normal_form(iMatrix3d *pd, iMatrix3d *pu, iMatrix3d *pv,
+                       const iMatrix3d &m) {
+  iMatrix3d &d = *pd;
+  iMatrix3d &u = *pu;
+  iMatrix3d &v = *pv;
+  d = m;
+  u.identity();
+  v.identity();
+  for (int k = 0; k < 3; k++) {
+    while (1) {
+      // move the smallest nonzero element of the remaining block to (k,k);
+      int pi = -1, pj = -1;
+      for (int i = k; i < 3; i++) {
+        for (int j = k; j < 3; j++) {
+          if (d(i, j) != 0 && (pi == -1 || abs(d(i, j)) < abs(d(pi, pj)))) {
+            pi = i;
+            pj = j;
+          }
+        }
+      }
+      if (pi == -1)
+        break;
+      for (int j = 0; j < 3; j++) {
+        swap(&d(k, j), &d(pi, j));
+        swap(&u(k, j), &u(pi, j));
+      }
+      for (int i = 0; i < 3; i++) {
+        swap(&d(i, k), &d(i, pj));
+        swap(&v(i, k), &v(i, pj));
+      }
+      // reduce row and column k by the pivot; any remainder is a new, smaller
+      // pivot candidate;
+      int done = 1;
+      for (int i = k + 1; i < 3; i++) {
+        int q = d(i, k) / d(k, k);
+        for (int j = 0; j < 3; j++) {
+          d(i, j) -= q * d(k, j);
+          u(i, j) -= q * u(k, j);
+        }
+        if (d(i, k) != 0)
+          done = 0;
+      }
+      for (int j = k + 1; j < 3; j++) {
+        int q = d(k, j) / d(k, k);
+        for (int i = 0; i < 3; i++) {
+          d(i, j) -= q * d(i, k);
+          v(i, j) -= q * v(i, k);
+        }
+        if (d(k, j) != 0)
+          done = 0;
+      }
+      if (!done)
+        continue;
+      // the pivot must divide the rest of the block: if not, add the
+      // offending row to row k and start over;
+      for (int i = k + 1; i < 3 && done; i++) {
+        for (int j = k + 1; j < 3; j++) {
+          if (d(i, j) % d(k, k) != 0) {
+            for (int l = 0; l < 3; l++) {
+              d(k, l) += d(i, l);
+              u(k, l) += u(i, l);
+            }
+            done = 0;
+            break;
+          }
+        }
+      }
+      if (done)
+        break;
+    }
+    if (d(k, k) < 0) {
+      for (int j = 0; j < 3; j++) {
+        d(k, j) = -d(k, j);
+        u(k, j) = -u(k, j);
+      }
+    }
+  }
+}
+
 void strain_str(Structure *pstr, const Structure &str,
                 const rMatrix3d &strain) {
   rMatrix3d id;
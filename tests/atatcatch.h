@@ -0,0 +1,12 @@
+#ifndef __ATATCATCH_H__
+#define __ATATCATCH_H__
+
+// Catch2 v3 (fetched by cmake) and v2 (as packaged by many distributions)
+// name their headers differently;
+#if __has_include(<catch2/catch_test_macros.hpp>)
+#include <catch2/catch_test_macros.hpp>
+#else
+#include <catch2/catch.hpp>
+#endif
+
+#endif
@@ -0,0 +1,197 @@
+#include "atatcatch.h"
+#include "calccorr.h"
+#include "findsym.h"
+
+// bcc-like lattice with two sites: a ternary one at the origin and a binary
+// one at the cube center (kept apart by their atom types);
+static void make_lattice(Structure *plat, SpaceGroup *psg) {
+  plat->cell.identity();
+  plat->atom_pos.resize(2);
+  plat->atom_pos(0) = rVector3d(0., 0., 0.);
+  plat->atom_pos(1) = rVector3d(0.5, 0.5, 0.5);
+  plat->atom_type.resize(2);
+  plat->atom_type(0) = 0;
+  plat->atom_type(1) = 1;
+  psg->cell = plat->cell;
+  find_spacegroup(&psg->point_op, &psg->trans, plat->cell, plat->atom_pos,
+                  plat->atom_type);
+}
+
+static iMatrix3d make_matrix(int rows[3][3]) {
+  iMatrix3d m;
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      m(i, j) = rows[i][j];
+    }
+  }
+  return m;
+}
+
+// supercell lat.cell*m of lat filled with pseudo-random species (0-2 on the
+// ternary site, 0-1 on the binary one), atoms listed in a scrambled order;
+static void make_supercell(Structure *pstr, const Structure &lat,
+                           const iMatrix3d &m) {
+  pstr->cell = lat.cell * to_real(m);
+  LinkedList<rVector3d> pos_list;
+  LinkedList<int> type_list;
+  unsigned int seed = 12345;
+  LatticePointInCellIterator t(lat.cell, pstr->cell);
+  for (; t; t++) {
+    for (int b = 0; b < lat.atom_pos.get_size(); b++) {
+      seed = seed * 1103515245u + 12345u;
+      pos_list << new rVector3d((rVector3d)t + lat.atom_pos(b));
+      type_list << new int((seed >> 16) % (b == 0 ? 3 : 2));
+    }
+  }
+  Array<rVector3d> pos;
+  Array<int> type;
+  LinkedList_to_Array(&pos, pos_list);
+  LinkedList_to_Array(&type, type_list);
+  int n = pos.get_size();
+  pstr->atom_pos.resize(n);
+  pstr->atom_type.resize(n);
+  for (int i = 0; i < n; i++) {
+    int j = (7 * i) % n;
+    pstr->atom_pos(i) = pos(j);
+    pstr->atom_type(i) = type(j);
+  }
+}
+
+// site type (number of species minus 2) and function of each point follow
+// the site; all the equivalent clusters of each prototype form an orbit;
+static void make_orbits(Array<Array<MultiCluster>> *porbits,
+                        const SpaceGroup &sg) {
+  rVector3d o(0., 0., 0.), c(0.5, 0.5, 0.5);
+  LinkedList<MultiCluster> proto;
+  MultiCluster pt(1);
+  pt.clus(0) = o;
+  pt.site_type(0) = 1;
+  pt.func(0) = 1;
+  proto << new MultiCluster(pt);
+  MultiCluster pair(2);
+  pair.clus(0) = o;
+  pair.clus(1) = c;
+  pair.site_type(0) = 1;
+  pair.site_type(1) = 0;
+  pair.func(0) = 0;
+  pair.func(1) = 0;
+  proto << new MultiCluster(pair);
+  MultiCluster far(2);
+  far.clus(0) = o;
+  far.clus(1) = rVector3d(1., 1., 0.);
+  far.site_type(0) = 1;
+  far.site_type(1) = 1;
+  far.func(0) = 0;
+  far.func(1) = 1;
+  proto << new MultiCluster(far);
+  MultiCluster trip(3);
+  trip.clus(0) = o;
+  trip.clus(1) = c;
+  trip.clus(2) = rVector3d(1., 0., 0.);
+  trip.site_type(0) = 1;
+  trip.site_type(1) = 0;
+  trip.site_type(2) = 1;
+  trip.func(0) = 1;
+  trip.func(1) = 0;
+  trip.func(2) = 0;
+  proto << new MultiCluster(trip);
+  porbits->resize(proto.get_size());
+  LinkedListIterator<MultiCluster> i(proto);
+  for (int k = 0; i; i++, k++) {
+    find_equivalent_clusters(&(*porbits)(k), *i, sg.cell, sg.point_op,
+                             sg.trans);
+  }
+}
+
+// average over all lattice translations of the supercell, looking up every
+// point by position;
+static Real brute_force_correlation(const Structure &str,
+                                    const Array<MultiCluster> &clusters,
+                                    const rMatrix3d &cell,
+                                    const Array<Array<Array<Real>>> &corrfunc) {
+  Real accum = 0.;
+  int count = 0;
+  rMatrix3d inv_strcell = !str.cell;
+  LatticePointInCellIterator t(cell, str.cell);
+  for (; t; t++) {
+    for (int c = 0; c < clusters.get_size(); c++) {
+      Real sigma = 1.;
+      for (int at = 0; at < clusters(c).clus.get_size(); at++) {
+        int a = which_atom(str.atom_pos, t + clusters(c).clus(at), inv_strcell);
+        REQUIRE(a >= 0);
+        sigma *= corrfunc(clusters(c).site_type(at))(clusters(c).func(at))(
+            str.atom_type(a));
+      }
+      accum += sigma;
+      count++;
+    }
+  }
+  return accum / (Real)count;
+}
+
+TEST_CASE("CorrelationKernel matches the brute-force loop on a "
+          "non-diagonal supercell of a two-site lattice",
+          "[calccorr]") {
+  Structure lat;
+  SpaceGroup sg;
+  make_lattice(&lat, &sg);
+  TrigoCorrFuncTable corrfunc;
+  corrfunc.init(3);
+  Array<Array<MultiCluster>> orbits;
+  make_orbits(&orbits, sg);
+
+  // neither diagonal nor triangular, so u and d of the Smith normal form are
+  // both nontrivial;
+  int rows[3][3] = {{2, 1, 0}, {0, 2, 1}, {1, 0, 2}};
+  iMatrix3d m = make_matrix(rows);
+  Structure str;
+  make_supercell(&str, lat, m);
+  REQUIRE(str.atom_pos.get_size() == 2 * 9);
+
+  SupercellSiteTable tab;
+  REQUIRE(tab.init(str, lat.cell));
+  REQUIRE(tab.get_nb_cell() == 9);
+  REQUIRE(tab.get_nb_basis() == 2);
+  Array<int> site_type;
+  get_site_types(&site_type, str, tab);
+
+  CorrelationKernel kernel;
+  REQUIRE(kernel.init(tab, orbits));
+  REQUIRE(kernel.get_nb_orbits() == orbits.get_size());
+  kernel.set_structure(site_type, corrfunc);
+  Array<Real> corr;
+  kernel.get_correlations(&corr);
+  for (int o = 0; o < orbits.get_size(); o++) {
+    Real brute = brute_force_correlation(str, orbits(o), lat.cell, corrfunc);
+    REQUIRE(fabs(corr(o) - brute) < 1e-12);
+    REQUIRE(corr(o) ==
+            calc_correlation(site_type, orbits(o), tab, corrfunc));
+    REQUIRE(fabs(calc_correlation(str, orbits(o), lat.cell, corrfunc) -
+                 brute) < 1e-12);
+  }
+}
+
+TEST_CASE("Binary table correlations match the brute-force loop",
+          "[calccorr]") {
+  Structure lat;
+  SpaceGroup sg;
+  make_lattice(&lat, &sg);
+  int rows[3][3] = {{1, -1, 0}, {1, 1, 0}, {0, 1, 2}};
+  iMatrix3d m = make_matrix(rows);
+  Structure str;
+  make_supercell(&str, lat, m);
+  for (int i = 0; i < str.atom_type.get_size(); i++) {
+    str.atom_type(i) = MIN(str.atom_type(i), 1);
+  }
+  SupercellSiteTable tab;
+  REQUIRE(tab.init(str, lat.cell));
+  Array<int> site_type;
+  get_site_types(&site_type, str, tab);
+  Array<rVector3d> pair(2);
+  pair(0) = rVector3d(0., 0., 0.);
+  pair(1) = rVector3d(0.5, 0.5, 0.5);
+  Array<ArrayrVector3d> clusters;
+  find_equivalent_clusters(&clusters, pair, sg.cell, sg.point_op, sg.trans);
+  REQUIRE(fabs(calc_correlation(site_type, clusters, tab) -
+               calc_correlation(str, clusters, lat.cell)) < 1e-12);
+}
@@ -0,0 +1,108 @@
+#include "atatcatch.h"
+#include "calccorr.h"
+#include "corrcache.h"
+#include "findsym.h"
+#include "refine.h"
+#include <cstdio>
+
+// fcc binary lattice, as parse_lattice_file would give it;
+static void make_fcc(Structure *plat, Array<Arrayint> *psite_type_list,
+                     Array<std::string> *plabel, SpaceGroup *psg) {
+  plat->cell.set_column(0, rVector3d(0., 0.5, 0.5));
+  plat->cell.set_column(1, rVector3d(0.5, 0., 0.5));
+  plat->cell.set_column(2, rVector3d(0.5, 0.5, 0.));
+  plat->atom_pos.resize(1);
+  plat->atom_pos(0) = rVector3d(0., 0., 0.);
+  plat->atom_type.resize(1);
+  plat->atom_type(0) = 0;
+  psite_type_list->resize(1);
+  (*psite_type_list)(0).resize(2);
+  (*psite_type_list)(0)(0) = 0;
+  (*psite_type_list)(0)(1) = 1;
+  plabel->resize(2);
+  (*plabel)(0) = "A";
+  (*plabel)(1) = "B";
+  psg->cell = plat->cell;
+  find_spacegroup(&psg->point_op, &psg->trans, plat->cell, plat->atom_pos,
+                  plat->atom_type);
+}
+
+TEST_CASE("Correlations saved by corrdump are found by maps", "[corrcache]") {
+  Structure lat;
+  Array<Arrayint> site_type_list;
+  Array<std::string> label;
+  SpaceGroup sg;
+  make_fcc(&lat, &site_type_list, &label, &sg);
+  // L1_0-like ordering along a doubled lattice vector;
+  Structure str;
+  str.cell = lat.cell;
+  str.cell.set_column(0, 2. * lat.cell.get_column(0));
+  str.atom_pos.resize(2);
+  str.atom_pos(0) = rVector3d(0., 0., 0.);
+  str.atom_pos(1) = lat.cell.get_column(0);
+  str.atom_type.resize(2);
+  str.atom_type(0) = 0;
+  str.atom_type(1) = 1;
+
+  ClusterExpansion ce(lat, site_type_list, label, sg);
+  // the point correlation, keyed as corrdump does, with a value that cannot
+  // be the computed one;
+  const LinkedList<Cluster> &points = ce.get_cluster_list(0);
+  LinkedListIterator<Cluster> point(points);
+  MultiCluster mpoint(point->get_size());
+  mpoint.clus = *point;
+  zero_array(&mpoint.site_type);
+  zero_array(&mpoint.func);
+  TrigoCorrFuncTable corrfunc;
+  corrfunc.init_from_site_type_list(site_type_list);
+  const char *filename = "corrcachetest.bin";
+  remove(filename);
+  {
+    CorrelationCache corrdump_cache;
+    corrdump_cache.open(filename);
+    corrdump_cache.add(
+        corrcache_structure_key(str, lat, site_type_list),
+        hash_cluster(mpoint, corrcache_context(lat, corrfunc)), 0.375);
+    corrdump_cache.flush();
+  }
+
+  CorrelationCache maps_cache;
+  REQUIRE(maps_cache.open(filename) == 1);
+  ce.set_correlation_cache(&maps_cache);
+  StructureInfo *pstr;
+  ce.access_structure_bank().add_structure(str, &pstr);
+  ce.update_correlations(pstr);
+  LinkedListIterator<LinkedListReal> corr_list(pstr->correlations);
+  LinkedListIterator<Real> corr(*corr_list);
+  REQUIRE(*corr == 0.375);
+  // the pair correlations, not in the cache, were computed and saved;
+  CorrelationCache reread;
+  REQUIRE(reread.open(filename) > 1);
+  remove(filename);
+}
+
+TEST_CASE("Entries appended twice are compacted on open", "[corrcache]") {
+  const char *filename = "corrcachetest_dup.bin";
+  remove(filename);
+  // two codes started together compute and save the same correlations;
+  CorrelationCache first, second;
+  first.open(filename);
+  second.open(filename);
+  for (int i = 0; i < 10; i++) {
+    first.add(1, i, 0.1 * i);
+    second.add(1, i, 0.1 * i);
+  }
+  first.add(2, 0, 0.5);
+  first.flush();
+  second.flush();
+  CorrelationCache third;
+  REQUIRE(third.open(filename) == 21);
+  CorrelationCache fourth;
+  REQUIRE(fourth.open(filename) == 11);
+  Real corr;
+  REQUIRE(fourth.find(&corr, 1, 7));
+  REQUIRE(corr == 0.1 * 7);
+  REQUIRE(fourth.find(&corr, 2, 0));
+  REQUIRE(corr == 0.5);
+  remove(filename);
+}
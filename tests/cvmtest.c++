@@ -0,0 +1,126 @@
+#include <ifopt/problem.h>
+
+#include <memory>
+#include <vector>
+
+#include "CVMIpopt.h"
+#include "CVMModel.h"
+#include "atatcatch.h"
+
+using namespace ifopt;
+
+// binary pair approximation: correlations (empty, point, pair) and the
+// probabilities of the 4 configurations of a pair;
+static MatrixXd make_vmatrix(void) {
+  MatrixXd v(4, 3);
+  v << 1., 2., 1., 1., 0., -1., 1., 0., -1., 1., -2., 1.;
+  return v / 4.;
+}
+
+static VectorXd make_vector(double a, double b, double c) {
+  VectorXd x(3);
+  x << a, b, c;
+  return x;
+}
+
+static std::shared_ptr<CVMFreeEnergy> make_free_energy(void) {
+  VectorXd multconfig_kb(4);
+  multconfig_kb << 3., 3., 3., 3.;
+  auto cost = std::make_shared<CVMFreeEnergy>(
+      DEFAULT_FREEENERGY_NAME, make_vector(0., 0.01, 0.05), multconfig_kb,
+      make_vmatrix());
+  cost->setT(1000.);
+  return cost;
+}
+
+TEST_CASE("CVMFreeEnergy Hessian matches finite differences of the cost") {
+  auto cost = make_free_energy();
+  VectorXd x = make_vector(1., 0.2, 0.1);
+  CVMFreeEnergy::Hessian hess;
+  cost->FillHessian(x, hess);
+  double h = 1e-4;
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      VectorXd di = VectorXd::Unit(3, i) * h;
+      VectorXd dj = VectorXd::Unit(3, j) * h;
+      double fd = (cost->GetCost(x + di + dj) - cost->GetCost(x + di - dj) -
+		 cost->GetCost(x - di + dj) + cost->GetCost(x - di - dj)) /
+		(4. * h * h);
+      REQUIRE(fabs(hess.coeff(i, j) - fd) < 1e-5);
+    }
+  }
+}
+
+// the Hessian of the Lagrangian given to IPOPT must be the derivative of its
+// gradient, obj_factor grad f + sum_i lambda_i grad g_i;
+TEST_CASE("CVMIpoptAdapter Hessian matches finite differences of the "
+	  "gradient of the Lagrangian") {
+  typedef Ipopt::Index Index;
+  MatrixXd v = make_vmatrix();
+  VectorXd disordered = make_vector(1., 0.2, 0.04);
+  VectorXd ordered = make_vector(1., 0.2, 1.);
+  VectorXd x = make_vector(1., 0.2, 0.1);
+
+  Problem nlp;
+  auto corrs = std::make_shared<CVMCorrelations>(
+      DEFAULT_CORRELATIONS_SET_NAME, 3, 1);
+  corrs->SetVariables(x);
+  auto cost = make_free_energy();
+  auto norm = std::make_shared<CVMNormConstraints>(DEFAULT_NORM_CONST_NAME,
+						   disordered, ordered);
+  nlp.AddVariableSet(corrs);
+  nlp.AddConstraintSet(
+      std::make_shared<CVMRhoConstraints>(DEFAULT_RHO_CONST_NAME, 4, 2, v));
+  nlp.AddCostSet(cost);
+  nlp.AddConstraintSet(norm);
+  int norm_row = nlp.GetNumberOfConstraints() - 1;
+  CVMIpoptAdapter adapter(nlp, *cost, norm.get(), norm_row);
+
+  Index n, m, nnz_jac, nnz_h;
+  Ipopt::TNLP::IndexStyleEnum style;
+  REQUIRE(adapter.get_nlp_info(n, m, nnz_jac, nnz_h, style));
+  REQUIRE(n == 3);
+  REQUIRE(m == 5);
+  std::vector<Index> jac_row(nnz_jac), jac_col(nnz_jac);
+  REQUIRE(adapter.eval_jac_g(n, NULL, true, m, nnz_jac, jac_row.data(),
+			     jac_col.data(), NULL));
+  std::vector<Index> h_row(nnz_h), h_col(nnz_h);
+  REQUIRE(adapter.eval_h(n, NULL, true, 1., m, NULL, true, nnz_h,
+			 h_row.data(), h_col.data(), NULL));
+
+  double obj_factor = 0.7;
+  std::vector<double> lambda = {0.1, -0.2, 0.3, 0.4, 0.5};
+  auto lagrangian_gradient = [&](const VectorXd &y) {
+    VectorXd grad(n);
+    adapter.eval_grad_f(n, y.data(), true, grad.data());
+    grad *= obj_factor;
+    std::vector<double> jac(nnz_jac);
+    adapter.eval_jac_g(n, y.data(), true, m, nnz_jac, NULL, NULL, jac.data());
+    for (int k = 0; k < nnz_jac; k++) {
+      grad(jac_col[k]) += lambda[jac_row[k]] * jac[k];
+    }
+    return grad;
+  };
+
+  MatrixXd fd(n, n);
+  double h = 1e-6;
+  for (int j = 0; j < n; j++) {
+    VectorXd dj = VectorXd::Unit(n, j) * h;
+    fd.col(j) =
+	(lagrangian_gradient(x + dj) - lagrangian_gradient(x - dj)) / (2 * h);
+  }
+  std::vector<double> values(nnz_h);
+  REQUIRE(adapter.eval_h(n, x.data(), true, obj_factor, m, lambda.data(),
+			 true, nnz_h, NULL, NULL, values.data()));
+  MatrixXd hess = MatrixXd::Zero(n, n);
+  for (int k = 0; k < nnz_h; k++) {
+    REQUIRE(h_row[k] >= h_col[k]);
+    hess(h_row[k], h_col[k]) = values[k];
+    hess(h_col[k], h_row[k]) = values[k];
+  }
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < n; j++) {
+      REQUIRE(fabs(hess(i, j) - fd(i, j)) < 1e-5);
+    }
+  }
+}
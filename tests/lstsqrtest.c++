@@ -0,0 +1,90 @@
+#include "atatcatch.h"
+#include "lstsqr.h"
+
+// candidate columns of a design matrix over nb_row points: 1, t, t^2,
+// 2t+1 (a combination of the first two), t^3, cos(3t);
+static Real column(int which, int i, int nb_row) {
+  Real t = (Real)i / (Real)(nb_row - 1) - 0.5;
+  switch (which) {
+    case 0: return 1.;
+    case 1: return t;
+    case 2: return t * t;
+    case 3: return 2. * t + 1.;
+    case 4: return t * t * t;
+    default: return cos(3. * t);
+  }
+}
+
+static void make_design(Array2d<Real> *px, const Array<int> &which, int nb_row) {
+  px->resize(iVector2d(nb_row, which.get_size()));
+  for (int i = 0; i < nb_row; i++) {
+    for (int j = 0; j < which.get_size(); j++) {
+      (*px)(i, j) = column(which(j), i, nb_row);
+    }
+  }
+}
+
+// goes through a sequence of designs that add columns at the end, remove
+// some, and change a leading column, checking each one against calc_cv and
+// calc_ols;
+static void check_sequence(const Array<Real> &weight, int nb_row) {
+  Array<Real> y(nb_row);
+  for (int i = 0; i < nb_row; i++) {
+    Real t = (Real)i / (Real)(nb_row - 1) - 0.5;
+    y(i) = 0.3 - t + 2. * t * t + 0.1 * sin(7. * t);
+  }
+  int seq[][5] = {{0, 1, -1, -1, -1}, {0, 1, 3, -1, -1}, {0, 1, 3, 2, 4},
+                  {0, 1, -1, -1, -1}, {0, 1, 2, 5, -1}, {0, 2, 3, 1, -1}};
+  IncrementalCV inc;
+  inc.init(weight);
+  for (int s = 0; s < (int)(sizeof(seq) / sizeof(seq[0])); s++) {
+    int nb_col = 0;
+    while (nb_col < 5 && seq[s][nb_col] >= 0) nb_col++;
+    Array<int> which(nb_col);
+    for (int j = 0; j < nb_col; j++) which(j) = seq[s][j];
+    Array2d<Real> x;
+    make_design(&x, which, nb_row);
+    inc.set_design(x);
+    Real cv = calc_cv(x, y, weight, 1);
+    REQUIRE(fabs(inc.get_cv(y) - cv) < 1e-8 * MAX(1., cv));
+    Array<Real> b, b_inc;
+    calc_ols(&b, x, y, weight, 1);
+    inc.get_fit(&b_inc, y);
+    REQUIRE(b_inc.get_size() == b.get_size());
+    for (int j = 0; j < b.get_size(); j++) {
+      REQUIRE(fabs(b_inc(j) - b(j)) < 1e-8);
+    }
+  }
+}
+
+TEST_CASE("IncrementalCV matches calc_cv and calc_ols", "[lstsqr]") {
+  int nb_row = 12;
+  SECTION("without weights") { check_sequence(empty_rArray, nb_row); }
+  SECTION("with weights") {
+    Array<Real> weight(nb_row);
+    for (int i = 0; i < nb_row; i++) {
+      weight(i) = 0.5 + (Real)(i % 3);
+    }
+    check_sequence(weight, nb_row);
+  }
+}
+
+TEST_CASE("IncrementalCV gives redundant columns a zero coefficient",
+          "[lstsqr]") {
+  int nb_row = 10;
+  Array<int> which(3);
+  which(0) = 0;
+  which(1) = 1;
+  which(2) = 3;
+  Array2d<Real> x;
+  make_design(&x, which, nb_row);
+  Array<Real> y(nb_row);
+  for (int i = 0; i < nb_row; i++) y(i) = (Real)(i * i);
+  IncrementalCV inc;
+  inc.init();
+  inc.set_design(x);
+  REQUIRE(inc.get_nb_basis() == 2);
+  Array<Real> b;
+  inc.get_fit(&b, y);
+  REQUIRE(b(2) == 0.);
+}
@@ -0,0 +1,325 @@
+#include "atatcatch.h"
+#include "findsym.h"
+#include "mclib.h"
+
+// fcc binary with nearest and second nearest neighbor pairs;
+static void make_fcc(Structure *plat, SpaceGroup *psg, LinkedList<Cluster> *pclusters) {
+  plat->cell.set_column(0,rVector3d(0.,0.5,0.5));
+  plat->cell.set_column(1,rVector3d(0.5,0.,0.5));
+  plat->cell.set_column(2,rVector3d(0.5,0.5,0.));
+  plat->atom_pos.resize(1);
+  plat->atom_pos(0)=rVector3d(0.,0.,0.);
+  plat->atom_type.resize(1);
+  plat->atom_type(0)=0;
+  psg->cell=plat->cell;
+  find_spacegroup(&psg->point_op,&psg->trans,plat->cell,plat->atom_pos,plat->atom_type);
+  Cluster empty;
+  Cluster point(1);
+  point(0)=rVector3d(0.,0.,0.);
+  Cluster nn(2);
+  nn(0)=rVector3d(0.,0.,0.);
+  nn(1)=rVector3d(0.5,0.5,0.);
+  Cluster nnn(2);
+  nnn(0)=rVector3d(0.,0.,0.);
+  nnn(1)=rVector3d(1.,0.,0.);
+  (*pclusters) << new Cluster(empty) << new Cluster(point) << new Cluster(nn) << new Cluster(nnn);
+}
+
+static void make_eci(Array<Real> *peci) {
+  peci->resize(4);
+  (*peci)(0)=0.;
+  (*peci)(1)=0.01;
+  (*peci)(2)=0.1;
+  (*peci)(3)=-0.02;
+}
+
+// the running sums updated by each flip must agree with a full recalculation;
+static void check_running_sums(MonteCarlo *pmc) {
+  Array<Real> rho=pmc->get_cur_corr();
+  Real E=pmc->get_cur_energy();
+  Real x=pmc->get_cur_concentration();
+  pmc->calc_from_scratch();
+  for (int i=0; i<rho.get_size(); i++) {
+    REQUIRE(fabs(rho(i)-pmc->get_cur_corr()(i))<1e-10);
+  }
+  REQUIRE(fabs(E-pmc->get_cur_energy())<1e-10);
+  REQUIRE(fabs(x-pmc->get_cur_concentration())<1e-10);
+}
+
+class MCFixture {
+public:
+  Structure lat;
+  SpaceGroup sg;
+  LinkedList<Cluster> clusters;
+  Array<Real> eci;
+  MCFixture(void) {
+    make_fcc(&lat,&sg,&clusters);
+    make_eci(&eci);
+  }
+  MonteCarlo *make(int nb_threads, uint64_t seed) {
+    MonteCarlo *pmc=new MonteCarlo(lat,iVector3d(12,12,12),sg,clusters);
+    pmc->set_random_stream(RandomStream(seed));
+    pmc->set_eci(eci);
+    pmc->set_nb_threads(nb_threads);
+    pmc->init_random(0.);
+    return pmc;
+  }
+};
+
+// statistical averages of the concentration and of the nearest neighbor
+// correlation over nb_pass passes;
+static void average(MonteCarlo *pmc, int mode, int nb_pass, Real *px, Real *pnn) {
+  *px=0.;
+  *pnn=0.;
+  for (int n=0; n<nb_pass; n++) {
+    pmc->run(1,mode);
+    *px+=pmc->get_cur_concentration();
+    *pnn+=pmc->get_cur_corr()(2);
+  }
+  *px/=(Real)nb_pass;
+  *pnn/=(Real)nb_pass;
+}
+
+TEST_CASE("Threaded sweeps keep the running sums exact","[mclib][threads]") {
+  MCFixture f;
+  Real T_list[]={1e-30,0.05,1e30};
+  for (int mode=1; mode<=2; mode++) {
+    for (int t=0; t<3; t++) {
+      MonteCarlo *pmc=f.make(4,17);
+      REQUIRE(pmc->get_nb_threads()==4);
+      pmc->init_run(T_list[t],0.02);
+      pmc->run(10,mode);
+      check_running_sums(pmc);
+      delete pmc;
+    }
+  }
+}
+
+TEST_CASE("Threaded sweeps are reproducible for a fixed seed","[mclib][threads]") {
+  MCFixture f;
+  for (int mode=1; mode<=2; mode++) {
+    MonteCarlo *pmc1=f.make(4,123);
+    MonteCarlo *pmc2=f.make(4,123);
+    pmc1->init_run(0.1,0.);
+    pmc2->init_run(0.1,0.);
+    pmc1->run(10,mode);
+    pmc2->run(10,mode);
+    Array<int> species1,species2;
+    pmc1->get_species(&species1);
+    pmc2->get_species(&species2);
+    REQUIRE(species1.get_size()==species2.get_size());
+    int nb_diff=0;
+    for (int i=0; i<species1.get_size(); i++) {
+      if (species1(i)!=species2(i)) nb_diff++;
+    }
+    REQUIRE(nb_diff==0);
+    REQUIRE(pmc1->get_cur_energy()==pmc2->get_cur_energy());
+    delete pmc1;
+    delete pmc2;
+  }
+}
+
+// the worker threads live for all the passes of a run, which must give the
+// same configuration as running the passes one at a time;
+TEST_CASE("One threaded run of many passes equals many runs of one pass","[mclib][threads]") {
+  MCFixture f;
+  for (int mode=1; mode<=2; mode++) {
+    MonteCarlo *pmc1=f.make(4,321);
+    MonteCarlo *pmc2=f.make(4,321);
+    pmc1->init_run(0.1,0.01);
+    pmc2->init_run(0.1,0.01);
+    pmc1->run(10,mode);
+    for (int n=0; n<10; n++) {
+      pmc2->run(1,mode);
+    }
+    Array<int> species1,species2;
+    pmc1->get_species(&species1);
+    pmc2->get_species(&species2);
+    int nb_diff=0;
+    for (int i=0; i<species1.get_size(); i++) {
+      if (species1(i)!=species2(i)) nb_diff++;
+    }
+    REQUIRE(nb_diff==0);
+    REQUIRE(pmc1->get_cur_energy()==pmc2->get_cur_energy());
+    check_running_sums(pmc1);
+    delete pmc1;
+    delete pmc2;
+  }
+}
+
+TEST_CASE("Threaded and serial sweeps agree at T=0","[mclib][threads]") {
+  MCFixture f;
+  // a large chemical potential makes the pure phase the only ground state;
+  Real E[2],x[2];
+  for (int th=0; th<2; th++) {
+    MonteCarlo *pmc=f.make(th==0 ? 1 : 4,5);
+    pmc->init_run(1e-30,2.);
+    pmc->run(20,1);
+    check_running_sums(pmc);
+    E[th]=pmc->get_cur_energy();
+    x[th]=pmc->get_cur_concentration();
+    delete pmc;
+  }
+  REQUIRE(fabs(x[0]-1.)<1e-12);
+  REQUIRE(fabs(x[1]-1.)<1e-12);
+  REQUIRE(fabs(E[0]-E[1])<1e-10);
+  // canonical exchanges at T=0 never raise the energy;
+  for (int th=0; th<2; th++) {
+    MonteCarlo *pmc=f.make(th==0 ? 1 : 4,7);
+    pmc->init_run(1e-30,0.);
+    Real E0=pmc->get_cur_energy();
+    Real x0=pmc->get_cur_concentration();
+    pmc->run(10,2);
+    REQUIRE(pmc->get_cur_energy()<=E0+1e-12);
+    REQUIRE(fabs(pmc->get_cur_concentration()-x0)<1e-12);
+    delete pmc;
+  }
+}
+
+TEST_CASE("Threaded and serial sweeps agree at infinite T","[mclib][threads]") {
+  MCFixture f;
+  // every flip is accepted: configurations are random whatever the ECI, so
+  // correlations (and, in grand canonical mode, the concentration) average to
+  // zero within the statistical error, about 0.002 here;
+  for (int mode=1; mode<=2; mode++) {
+    for (int th=0; th<2; th++) {
+      MonteCarlo *pmc=f.make(th==0 ? 1 : 4,11);
+      Real x0=pmc->get_cur_concentration();
+      pmc->init_run(1e30,0.);
+      pmc->run(5,mode);
+      Real x,nn;
+      average(pmc,mode,200,&x,&nn);
+      check_running_sums(pmc);
+      REQUIRE(fabs(nn)<0.02);
+      if (mode==1) {
+        REQUIRE(fabs(x)<0.02);
+      }
+      else {
+        REQUIRE(fabs(x-x0)<1e-12);
+      }
+      delete pmc;
+    }
+  }
+}
+
+TEST_CASE("Changing the ECI without a rescan gives the same energy","[mclib][replica]") {
+  MCFixture f;
+  MonteCarlo *pmc=f.make(1,3);
+  pmc->init_run(0.1,0.3);
+  pmc->run(5,1);
+  Array<Real> eci2(4);
+  eci2(0)=0.5;
+  eci2(1)=-0.03;
+  eci2(2)=0.07;
+  eci2(3)=0.01;
+  pmc->change_eci(eci2);
+  // the same conditions as a replica exchange would set;
+  pmc->init_run(0.2,-0.1);
+  check_running_sums(pmc);
+  pmc->run(5,1);
+  check_running_sums(pmc);
+  delete pmc;
+}
+
+TEST_CASE("Replica exchange keeps the running sums exact","[mclib][replica]") {
+  MCFixture f;
+  Array<MonteCarlo *> replica(3);
+  Array<Real> T(3),mu(3);
+  Array<Array<Real> > eci(3);
+  for (int i=0; i<3; i++) {
+    replica(i)=f.make(1,40+i);
+    T(i)=0.05*(Real)(i+1);
+    mu(i)=0.1*(Real)i;
+    eci(i)=f.eci;
+    eci(i)(2)*=1.+0.1*(Real)i;
+  }
+  ReplicaExchange pt(replica);
+  pt.set_nb_threads(3);
+  pt.init_run(T,mu,eci);
+  Array<MCOutputData> data;
+  pt.run(&data,20,20,2,1);
+  REQUIRE(data.get_size()==3);
+  int nb_swap=0;
+  for (int i=0; i<2; i++) {
+    REQUIRE(pt.get_swap_rate(i)>=0.);
+    if (pt.get_swap_rate(i)>0.) nb_swap++;
+  }
+  REQUIRE(nb_swap>0);
+  // each slot keeps its conditions, whichever replica occupies it;
+  for (int s=0; s<3; s++) {
+    MonteCarlo *pmc=pt.get_replica_at(s);
+    REQUIRE(pmc->get_T()==T(s));
+    REQUIRE(data(s).T==T(s));
+    check_running_sums(pmc);
+  }
+  for (int i=0; i<3; i++) {delete replica(i);}
+}
+
+// smooth, concentration-independent k space interaction;
+class GaussianKSpaceECI : public KSpaceECI {
+public:
+  void get_k_space_eci(Array2d<Complex> *p_keci, const rVector3d &k, Real x) {
+    p_keci->resize(iVector2d(1,1));
+    (*p_keci)(0,0)=Complex(0.05*exp(-norm2(k)),0.);
+  }
+};
+
+TEST_CASE("Real space and FFT updates of the k space energy agree","[mclib][kspace]") {
+  MCFixture f;
+  GaussianKSpaceECI keci;
+  Real E[2];
+  Array<int> species[2];
+  for (int rs=0; rs<2; rs++) {
+    KSpaceMonteCarlo *pmc=new KSpaceMonteCarlo(f.lat,iVector3d(8,8,8),f.sg,f.clusters,&keci);
+    pmc->set_real_space_update(rs);
+    pmc->set_random_stream(RandomStream(77));
+    pmc->set_eci(f.eci);
+    pmc->init_random(0.2);
+    pmc->init_run(0.1,0.);
+    pmc->run(10,2);
+    E[rs]=pmc->get_cur_energy();
+    pmc->get_species(&species[rs]);
+    check_running_sums(pmc);
+    delete pmc;
+  }
+  int nb_diff=0;
+  for (int i=0; i<species[0].get_size(); i++) {
+    if (species[0](i)!=species[1](i)) nb_diff++;
+  }
+  REQUIRE(nb_diff==0);
+  REQUIRE(fabs(E[0]-E[1])<1e-10);
+}
+
+TEST_CASE("Inconsistent interaction tables are rejected","[mcitable]") {
+  Structure lat;
+  SpaceGroup sg;
+  LinkedList<Cluster> clusters;
+  make_fcc(&lat,&sg,&clusters);
+  MCInteractionTable table(lat,sg,clusters);
+  const char *filename="mclibtest_table.bin";
+  MCInteractionTable read_back;
+  REQUIRE(table.write(filename));
+  REQUIRE(read_back.read(filename,table.key));
+  REQUIRE(read_back.which_cluster==table.which_cluster);
+  REQUIRE(read_back.member_site==table.member_site);
+
+  MCInteractionTable bad=table;
+  bad.which_cluster[0][0]=bad.total_clusters;
+  REQUIRE(bad.write(filename));
+  REQUIRE(!read_back.read(filename,table.key));
+  bad=table;
+  bad.member_site[0].back()=bad.nb_site;
+  REQUIRE(bad.write(filename));
+  REQUIRE(!read_back.read(filename,table.key));
+  bad=table;
+  bad.first_member[0].pop_back();
+  REQUIRE(bad.write(filename));
+  REQUIRE(!read_back.read(filename,table.key));
+  bad=table;
+  bad.mult_per_atom.pop_back();
+  REQUIRE(bad.write(filename));
+  REQUIRE(!read_back.read(filename,table.key));
+  // a rejected file leaves the table as it was;
+  REQUIRE(read_back.which_cluster==table.which_cluster);
+  remove(filename);
+}
@@ -0,0 +1,284 @@
+#include "atatcatch.h"
+#include "findsym.h"
+#include "calccorr.h"
+#include "mctraj.h"
+#include "mmclib.h"
+#include <sstream>
+#include <unistd.h>
+
+static MultiCluster make_cluster(int n, const rVector3d *pos, const int *func) {
+  MultiCluster c(n);
+  for (int i=0; i<n; i++) {
+    c.clus(i)=pos[i];
+    c.site_type(i)=1; // ternary sites;
+    c.func(i)=func[i];
+  }
+  return c;
+}
+
+// simple cubic lattice with two inequivalent ternary sites (CsCl positions),
+// point and pair clusters;
+class MMCFixture {
+public:
+  Structure lat;
+  Array<Array<int> > site_type_list;
+  SpaceGroup sg;
+  LinkedList<MultiCluster> clusters;
+  TrigoCorrFuncTable corrfunc;
+  Array<Real> eci;
+  int nb_point;
+  MMCFixture(void) {
+    lat.cell.identity();
+    lat.atom_pos.resize(2);
+    lat.atom_pos(0)=rVector3d(0.,0.,0.);
+    lat.atom_pos(1)=rVector3d(0.5,0.5,0.5);
+    lat.atom_type.resize(2);
+    lat.atom_type(0)=0;
+    lat.atom_type(1)=1;
+    site_type_list.resize(2);
+    for (int t=0; t<2; t++) {
+      site_type_list(t).resize(3);
+      for (int i=0; i<3; i++) {site_type_list(t)(i)=3*t+i;}
+    }
+    corrfunc.init_from_site_type_list(site_type_list);
+    sg.cell=lat.cell;
+    find_spacegroup(&sg.point_op,&sg.trans,lat.cell,lat.atom_pos,lat.atom_type);
+    int f00[]={0,0};
+    int f1[]={1};
+    clusters << new MultiCluster(0);
+    nb_point=0;
+    for (int s=0; s<2; s++) {
+      clusters << new MultiCluster(make_cluster(1,&lat.atom_pos(s),f00));
+      clusters << new MultiCluster(make_cluster(1,&lat.atom_pos(s),f1));
+      nb_point+=2;
+    }
+    rVector3d nn[]={lat.atom_pos(0),lat.atom_pos(1)};
+    clusters << new MultiCluster(make_cluster(2,nn,f00));
+    rVector3d nnn[]={rVector3d(0.,0.,0.),rVector3d(1.,0.,0.)};
+    clusters << new MultiCluster(make_cluster(2,nnn,f00));
+    eci.resize(clusters.get_size());
+    Real e[]={0.,0.02,-0.01,0.03,0.01,0.08,-0.03};
+    for (int i=0; i<eci.get_size(); i++) {eci(i)=e[i];}
+  }
+  // the constructor reads frozensite.in from the current directory;
+  MultiMonteCarlo *make(const char *frozen) {
+    char dir[]="/tmp/mmclibtestXXXXXX";
+    REQUIRE(mkdtemp(dir)!=NULL);
+    char cwd[1024];
+    REQUIRE(getcwd(cwd,sizeof(cwd))!=NULL);
+    REQUIRE(chdir(dir)==0);
+    if (frozen) {
+      ofstream file("frozensite.in");
+      file << frozen << endl;
+    }
+    MultiMonteCarlo *pmc=new MultiMonteCarlo(lat,site_type_list,iVector3d(6,6,6),sg,clusters,corrfunc);
+    if (frozen) unlink("frozensite.in");
+    REQUIRE(chdir(cwd)==0);
+    rmdir(dir);
+    // the same initial (and hence frozen) configuration in every run;
+    pmc->set_random_stream(RandomStream(31));
+    pmc->set_eci(eci);
+    Array<Array<Real> > conc(2);
+    for (int s=0; s<2; s++) {
+      conc(s).resize(3);
+      for (int i=0; i<3; i++) {conc(s)(i)=1./3.;}
+    }
+    pmc->init_random(conc);
+    Array<Real> mu(nb_point);
+    zero_array(&mu);
+    pmc->set_T_mu(0.1,mu);
+    return pmc;
+  }
+};
+
+// average correlations of the nearest neighbor pair and of a point cluster
+// over nb_pass passes;
+static void average(MultiMonteCarlo *pmc, int mode, int nb_pass, Real *pnn, Real *ppoint) {
+  *pnn=0.;
+  *ppoint=0.;
+  for (int n=0; n<nb_pass; n++) {
+    pmc->run(1,mode);
+    *pnn+=pmc->get_cur_corr()(5);
+    *ppoint+=pmc->get_cur_corr()(1);
+  }
+  *pnn/=(Real)nb_pass;
+  *ppoint/=(Real)nb_pass;
+}
+
+TEST_CASE("Rejection-free runs never flip frozen sites","[mmclib][rejectionfree]") {
+  MMCFixture f;
+  MultiMonteCarlo *pmc=f.make("1");
+  Array<int> before,after;
+  pmc->get_species(&before);
+  pmc->run(20,3);
+  pmc->get_species(&after);
+  int nb_active_changed=0;
+  // sites alternate between site 0 (active) and site 1 (frozen);
+  for (int k=0; k<before.get_size(); k++) {
+    if (k%2==1) {
+      REQUIRE(before(k)==after(k));
+    }
+    else if (before(k)!=after(k)) {
+      nb_active_changed++;
+    }
+  }
+  REQUIRE(nb_active_changed>0);
+  Array<Real> rho=pmc->get_cur_corr();
+  pmc->calc_from_scratch();
+  for (int i=0; i<rho.get_size(); i++) {
+    REQUIRE(fabs(rho(i)-pmc->get_cur_corr()(i))<1e-10);
+  }
+  delete pmc;
+}
+
+TEST_CASE("Rejection-free and Metropolis averages agree with frozen sites","[mmclib][rejectionfree]") {
+  MMCFixture f;
+  Real nn[2],point[2];
+  for (int m=0; m<2; m++) {
+    MultiMonteCarlo *pmc=f.make("1");
+    int mode=(m==0 ? 1 : 3);
+    pmc->run(50,mode);
+    average(pmc,mode,400,&nn[m],&point[m]);
+    delete pmc;
+  }
+  REQUIRE(fabs(nn[0]-nn[1])<0.02);
+  REQUIRE(fabs(point[0]-point[1])<0.02);
+}
+
+// the running sums must agree with a full recalculation;
+static void check_running_sums(MultiMonteCarlo *pmc) {
+  Array<Real> rho=pmc->get_cur_corr();
+  Real E=pmc->get_cur_energy();
+  pmc->calc_from_scratch();
+  for (int i=0; i<rho.get_size(); i++) {
+    REQUIRE(fabs(rho(i)-pmc->get_cur_corr()(i))<1e-10);
+  }
+  REQUIRE(fabs(E-pmc->get_cur_energy())<1e-10);
+}
+
+TEST_CASE("Replica exchange keeps the running sums exact","[mmclib][replica]") {
+  MMCFixture f;
+  Array<MultiMonteCarlo *> replica(3);
+  Array<Real> T(3);
+  Array<Array<Real> > mu(3),eci(3);
+  for (int i=0; i<3; i++) {
+    replica(i)=f.make(NULL);
+    T(i)=0.05*(Real)(i+1);
+    mu(i).resize(f.nb_point);
+    for (int j=0; j<f.nb_point; j++) {mu(i)(j)=0.01*(Real)(i-j);}
+    eci(i)=f.eci;
+    eci(i)(5)*=1.+0.1*(Real)i;
+  }
+  MultiReplicaExchange pt(replica);
+  pt.set_nb_threads(3);
+  pt.init_run(T,mu,eci);
+  Array<Array<Real> > mean,var;
+  pt.run(&mean,&var,20,20,2,1);
+  REQUIRE(mean.get_size()==3);
+  int nb_swap=0;
+  for (int i=0; i<2; i++) {
+    if (pt.get_swap_rate(i)>0.) nb_swap++;
+  }
+  REQUIRE(nb_swap>0);
+  // each slot keeps its conditions, whichever replica occupies it;
+  for (int s=0; s<3; s++) {
+    MultiMonteCarlo *pmc=pt.get_replica_at(s);
+    REQUIRE(pmc->get_T()==T(s));
+    REQUIRE(pmc->get_mu()(1)==mu(s)(1));
+    check_running_sums(pmc);
+  }
+  for (int i=0; i<3; i++) {delete replica(i);}
+}
+
+static void read_file(std::string *ps, const char *filename) {
+  ifstream file(filename);
+  std::stringstream buf;
+  buf << file.rdbuf();
+  *ps=buf.str();
+}
+
+TEST_CASE("Trajectory frames read back as written and as view() shows them","[mmclib][mctraj]") {
+  MMCFixture f;
+  MultiMonteCarlo *pmc=f.make(NULL);
+  Array<std::string> label(6);
+  const char *names[]={"Al","Cu","Ni","O","F","Vac"};
+  for (int i=0; i<6; i++) {label(i)=names[i];}
+  rMatrix3d axes;
+  axes.identity();
+  axes=2.*axes;
+  char trajname[]="/tmp/mmclibtestXXXXXX";
+  int fd=mkstemp(trajname);
+  REQUIRE(fd>=0);
+  close(fd);
+  TrajectoryWriter writer;
+  REQUIRE(writer.open(trajname,pmc->get_lattice(),f.site_type_list,label,axes,pmc->get_supercell()));
+  int nb_frame=3;
+  Array<Array<int> > species(nb_frame);
+  Array<Array<Real> > cond(nb_frame);
+  for (int n=0; n<nb_frame; n++) {
+    pmc->run(2,1);
+    pmc->get_species(&species(n));
+    cond(n).resize(2);
+    cond(n)(0)=0.1*(Real)(n+1);
+    cond(n)(1)=-0.01*(Real)n;
+    writer.write_frame(species(n),cond(n));
+  }
+  writer.close();
+
+  TrajectoryReader reader;
+  REQUIRE(reader.open(trajname));
+  REQUIRE(reader.get_nb_sites()==species(0).get_size());
+  REQUIRE(reader.supercell==pmc->get_supercell());
+  REQUIRE(reader.labellookup.get_size()==f.site_type_list.get_size());
+  // ternary sites need 2 bits; some site must use the third species;
+  int max_sp=0;
+  for (int n=0; n<nb_frame; n++) {
+    Array<int> sp;
+    Array<Real> c;
+    if (n==1) {
+      REQUIRE(reader.skip_frame(&c));
+      REQUIRE(c.get_size()==2);
+      REQUIRE(c(0)==cond(n)(0));
+      continue;
+    }
+    REQUIRE(reader.read_frame(&sp,&c));
+    REQUIRE(c.get_size()==2);
+    REQUIRE(c(0)==cond(n)(0));
+    REQUIRE(c(1)==cond(n)(1));
+    int nb_diff=0;
+    for (int i=0; i<sp.get_size(); i++) {
+      if (sp(i)!=species(n)(i)) nb_diff++;
+      max_sp=MAX(max_sp,sp(i));
+    }
+    REQUIRE(nb_diff==0);
+  }
+  REQUIRE(max_sp==2);
+  Array<int> sp;
+  Array<Real> c;
+  REQUIRE(!reader.read_frame(&sp,&c));
+
+  // the last frame is the current state of the simulation;
+  char viewname[]="/tmp/mmclibtestXXXXXX";
+  char strname[]="/tmp/mmclibtestXXXXXX";
+  fd=mkstemp(viewname);
+  close(fd);
+  fd=mkstemp(strname);
+  close(fd);
+  {
+    ofstream file(viewname);
+    pmc->view(f.site_type_list,label,file,axes);
+  }
+  {
+    ofstream file(strname);
+    reader.write_structure(file,species(nb_frame-1));
+  }
+  std::string viewed,written;
+  read_file(&viewed,viewname);
+  read_file(&written,strname);
+  REQUIRE(viewed.size()>0);
+  REQUIRE(viewed==written);
+  unlink(trajname);
+  unlink(viewname);
+  unlink(strname);
+  delete pmc;
+}